@@ -0,0 +1,37 @@
+#ifndef DriverFormat_h
+#define DriverFormat_h
+
+#include <cstdint>
+
+// The formats MacaroniAudioDriver offers. Kept apart from the driver, and free of DriverKit, like
+// LoopbackEngine. Both streams are always float32 stereo and always run at the device's rate.
+constexpr double kSupportedSampleRates[] = {44100.0, 48000.0, 88200.0, 96000.0, 192000.0};
+constexpr uint32_t kSupportedSampleRateCount = sizeof(kSupportedSampleRates) / sizeof(kSupportedSampleRates[0]);
+constexpr double kDefaultSampleRate = 48000.0;
+
+inline bool IsSupportedSampleRate(double sampleRate)
+{
+    for (double supportedRate : kSupportedSampleRates) {
+        if (supportedRate == sampleRate) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// The length of the IO buffers, which is also the zero time stamp period: 512 frames up to
+// 48 kHz, doubling with the sample rate past that. A period stays no shorter than at 48 kHz, so
+// recording at the higher rates moves the data in fewer, larger transfers.
+inline uint32_t BufferFramesForSampleRate(double sampleRate)
+{
+    uint32_t frames = 512;
+
+    while (frames * 48000.0 < 512 * sampleRate) {
+        frames *= 2;
+    }
+
+    return frames;
+}
+
+#endif /* DriverFormat_h */
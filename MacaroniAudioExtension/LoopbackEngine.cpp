@@ -0,0 +1,185 @@
+#include "LoopbackEngine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LOOPBACK_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LOOPBACK_SSE 1
+#endif
+
+// Keep the compiler from turning the scalar ramp into something the vector path doesn't do
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+void ScaleSamples(const float* in, float* out, uint32_t count, float gain)
+{
+    uint32_t i = 0;
+
+#if LOOPBACK_NEON
+    float32x4_t gains = vdupq_n_f32(gain);
+
+    for (; i + 8 <= count; i += 8) {
+        vst1q_f32(out + i, vmulq_f32(vld1q_f32(in + i), gains));
+        vst1q_f32(out + i + 4, vmulq_f32(vld1q_f32(in + i + 4), gains));
+    }
+
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(out + i, vmulq_f32(vld1q_f32(in + i), gains));
+    }
+#elif LOOPBACK_SSE
+    __m128 gains = _mm_set1_ps(gain);
+
+    for (; i + 8 <= count; i += 8) {
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), gains));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_loadu_ps(in + i + 4), gains));
+    }
+
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), gains));
+    }
+#endif
+
+    for (; i < count; i++) {
+        out[i] = in[i] * gain;
+    }
+}
+
+#ifdef __clang__
+#pragma mark LoopbackEngine
+#endif
+
+void LoopbackEngine::Reset(uint32_t channels)
+{
+    mChannels = std::min(channels, kMaxChannels);
+    mStartFrame = 0;
+    mEndFrame = 0;
+    mAppliedGain = mTargetGain.load(std::memory_order_relaxed);
+    memset(mHistory, 0, sizeof(mHistory));
+}
+
+float LoopbackEngine::GainForDecibels(float decibels)
+{
+    return powf(10.0f, decibels / 20.0f);
+}
+
+void LoopbackEngine::WriteOutput(const float* ioBuffer, uint32_t ioBufferFrames, uint64_t sampleTime, uint32_t frames)
+{
+    frames = std::min(frames, ioBufferFrames);
+    uint64_t endFrame = sampleTime + frames;
+
+    if (mStartFrame == mEndFrame || sampleTime < mStartFrame || sampleTime >= mEndFrame + kHistoryFrames) {
+        // Nothing we have lines up with these frames any more, so start over from them
+        mStartFrame = sampleTime;
+        mEndFrame = sampleTime;
+    } else if (sampleTime > mEndFrame) {
+        // Skipped frames read back as silence
+        for (uint64_t frame = mEndFrame; frame < sampleTime;) {
+            uint32_t historyOffset = uint32_t(frame % kHistoryFrames);
+            uint32_t chunk = uint32_t(std::min(sampleTime - frame, uint64_t(kHistoryFrames - historyOffset)));
+            memset(&mHistory[historyOffset * mChannels], 0, chunk * mChannels * sizeof(float));
+            frame += chunk;
+        }
+    }
+
+    for (uint32_t done = 0; done < frames;) {
+        uint64_t frame = sampleTime + done;
+        uint32_t ioOffset = uint32_t(frame % ioBufferFrames);
+        uint32_t historyOffset = uint32_t(frame % kHistoryFrames);
+        uint32_t chunk = std::min({frames - done, ioBufferFrames - ioOffset, kHistoryFrames - historyOffset});
+
+        memcpy(&mHistory[historyOffset * mChannels],
+               &ioBuffer[ioOffset * mChannels],
+               chunk * mChannels * sizeof(float));
+        done += chunk;
+    }
+
+    mEndFrame = std::max(mEndFrame, endFrame);
+
+    if (mEndFrame - mStartFrame > kHistoryFrames) {
+        mStartFrame = mEndFrame - kHistoryFrames;
+    }
+}
+
+void LoopbackEngine::ReadInput(float* ioBuffer, uint32_t ioBufferFrames, uint64_t sampleTime, uint32_t frames)
+{
+    frames = std::min(frames, ioBufferFrames);
+
+    // Ramp from the gain the last cycle ended on, rather than jumping, to avoid zipper noise
+    float startGain = mAppliedGain;
+    float targetGain = mTargetGain.load(std::memory_order_relaxed);
+    float gainStep = (frames > 0) ? (targetGain - startGain) / frames : 0.0f;
+    mAppliedGain = targetGain;
+
+    for (uint32_t done = 0; done < frames;) {
+        uint64_t frame = sampleTime + done;
+        uint32_t ioOffset = uint32_t(frame % ioBufferFrames);
+        uint32_t historyOffset = uint32_t(frame % kHistoryFrames);
+        uint32_t chunk = std::min({frames - done, ioBufferFrames - ioOffset, kHistoryFrames - historyOffset});
+        float* out = &ioBuffer[ioOffset * mChannels];
+        bool available = (frame >= mStartFrame && frame < mEndFrame);
+
+        if (frame < mStartFrame) {
+            chunk = uint32_t(std::min(uint64_t(chunk), mStartFrame - frame));
+        } else if (available) {
+            chunk = uint32_t(std::min(uint64_t(chunk), mEndFrame - frame));
+        }
+
+        if (!available) {
+            memset(out, 0, chunk * mChannels * sizeof(float));
+        } else if (gainStep == 0.0f) {
+            ScaleSamples(&mHistory[historyOffset * mChannels], out, chunk * mChannels, targetGain);
+        } else {
+            const float* in = &mHistory[historyOffset * mChannels];
+
+            for (uint32_t i = 0; i < chunk; i++) {
+                float gain = startGain + (done + i) * gainStep;
+
+                for (uint32_t channel = 0; channel < mChannels; channel++) {
+                    out[i * mChannels + channel] = in[i * mChannels + channel] * gain;
+                }
+            }
+        }
+
+        done += chunk;
+    }
+}
+
+#ifdef __clang__
+#pragma mark ZeroTimestampClock
+#endif
+
+void ZeroTimestampClock::Start(uint64_t hostTime, double hostTicksPerFrame, uint32_t periodFrames)
+{
+    mAnchorHostTime = hostTime;
+    mHostTicksPerFrame = hostTicksPerFrame;
+    mPeriodFrames = periodFrames;
+    mPeriods = 0;
+}
+
+uint64_t ZeroTimestampClock::NextHostTime() const
+{
+    return mAnchorHostTime + uint64_t(double((mPeriods + 1) * mPeriodFrames) * mHostTicksPerFrame);
+}
+
+bool ZeroTimestampClock::Update(uint64_t hostNow, uint64_t& outSampleTime, uint64_t& outHostTime)
+{
+    if (hostNow < NextHostTime()) {
+        return false;
+    }
+
+    // If the timer fired late, skip straight to the latest time stamp that's due rather than
+    // publishing a run of stale ones
+    while (hostNow >= NextHostTime()) {
+        mPeriods++;
+    }
+
+    outSampleTime = mPeriods * mPeriodFrames;
+    outHostTime = mAnchorHostTime + uint64_t(double(outSampleTime) * mHostTicksPerFrame);
+    return true;
+}
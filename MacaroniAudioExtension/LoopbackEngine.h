@@ -0,0 +1,76 @@
+#ifndef LoopbackEngine_h
+#define LoopbackEngine_h
+
+#include <atomic>
+#include <cstdint>
+
+// The part of MacaroniAudioDriver's IO path that doesn't need DriverKit, so that it can be built and
+// exercised anywhere.
+//
+// The HAL hands the device one IO buffer per stream, used as a ring of ioBufferFrames frames: the
+// frame for sample time t lives at t % ioBufferFrames. Those rings are only as long as the zero
+// time stamp period, and the HAL reads the input well behind where it writes the output, so the
+// output is copied into a longer history of its own, stored by sample time, and the input is
+// filled from that history at its own sample times. Each frame of the input is then the frame
+// that was written for the same sample time on the output.
+//
+// WriteOutput and ReadInput must be called from the device's IO thread only. SetGain may be called
+// from any thread.
+class LoopbackEngine
+{
+public:
+    static constexpr uint32_t kMaxChannels = 8;
+    static constexpr uint32_t kHistoryFrames = 16384;
+
+    // Forgets the history. Not safe while IO is running.
+    void Reset(uint32_t channels);
+
+    // The gain applied to the loopback, taken up from the next cycle on and ramped to over its
+    // course. Muting is a gain of 0.
+    void SetGain(float gain) { mTargetGain.store(gain, std::memory_order_relaxed); }
+    static float GainForDecibels(float decibels);
+
+    // Copies the frames the HAL just wrote to the output IO buffer into the history
+    void WriteOutput(const float* ioBuffer, uint32_t ioBufferFrames, uint64_t sampleTime, uint32_t frames);
+
+    // Fills the input IO buffer with the history at sampleTime, gain applied. Frames that were
+    // never written, or have already fallen out of the history, are silence.
+    void ReadInput(float* ioBuffer, uint32_t ioBufferFrames, uint64_t sampleTime, uint32_t frames);
+
+private:
+    uint32_t mChannels;
+    // The frames of the history that are valid, by sample time
+    uint64_t mStartFrame;
+    uint64_t mEndFrame;
+    std::atomic<float> mTargetGain;
+    // The gain the last cycle ended on, which the next one ramps from
+    float mAppliedGain;
+    float mHistory[kHistoryFrames * kMaxChannels];
+};
+
+// Turns the host clock into the device's zero time stamps: one every periodFrames frames, at the
+// host time that many frames take at the nominal sample rate.
+class ZeroTimestampClock
+{
+public:
+    void Start(uint64_t hostTime, double hostTicksPerFrame, uint32_t periodFrames);
+
+    // If hostNow has reached the next time stamp, moves on to it, and returns true along with
+    // the time stamp to publish.
+    bool Update(uint64_t hostNow, uint64_t& outSampleTime, uint64_t& outHostTime);
+
+    // When the next time stamp is due, for arming the timer
+    uint64_t NextHostTime() const;
+
+private:
+    uint64_t mAnchorHostTime;
+    double mHostTicksPerFrame;
+    uint32_t mPeriodFrames;
+    uint64_t mPeriods;
+};
+
+// Writes in[i] * gain to out[i] for count samples. Vectorized with NEON or SSE2 where available,
+// with a single rounded multiply per sample, so every path gives the same results.
+void ScaleSamples(const float* in, float* out, uint32_t count, float gain);
+
+#endif /* LoopbackEngine_h */
@@ -3,13 +3,16 @@
 #include <DriverKit/OSCollections.h>
 
 #include "MacaroniAudioDriver.h"
+#include "DriverFormat.h"
+#include "LoopbackEngine.h"
 
 // Constants
-constexpr uint32_t kSampleRate = 48000;
 constexpr uint32_t kNumChannels = 2;
 constexpr uint32_t kBitsPerChannel = 32;
 constexpr uint32_t kBytesPerFrame = (kBitsPerChannel / 8) * kNumChannels;
-constexpr uint32_t kBufferFrames = 512;
+
+// The configuration change action for a new sample rate, with the rate as an OSNumber
+constexpr uint64_t kSampleRateChangeAction = 1;
 
 // Object IDs
 constexpr IOUserAudioObjectID kDeviceObjectID = 1;
@@ -27,12 +30,101 @@ struct MacaroniAudioDriver_IVars
     OSSharedPtr<IOUserAudioBooleanControl> muteControl;
     OSSharedPtr<IOBufferMemoryDescriptor> inputBuffer;
     OSSharedPtr<IOBufferMemoryDescriptor> outputBuffer;
-
+    OSSharedPtr<IOMemoryMap> inputMap;
+    OSSharedPtr<IOMemoryMap> outputMap;
+    // The mapped IO buffers, which hold bufferFrames frames each
+    float* inputFrames;
+    float* outputFrames;
+    OSSharedPtr<IODispatchQueue> workQueue;
+    OSSharedPtr<IOTimerDispatchSource> ztsTimer;
+    OSSharedPtr<OSAction> ztsTimerAction;
+
+    ZeroTimestampClock ztsClock;
+    LoopbackEngine loopback;
+
+    // Only changed from PerformDeviceConfigurationChange, while IO is stopped
+    double sampleRate;
+    uint32_t bufferFrames;
+
+    // Linear gain, picked up from the volume control every cycle
     float volumeLevel;
     bool isMuted;
     bool isRunning;
 };
 
+static IOUserAudioStreamBasicDescription StreamFormatForSampleRate(double sampleRate)
+{
+    IOUserAudioStreamBasicDescription format = {};
+    format.mSampleRate = sampleRate;
+    format.mFormatID = kIOUserAudioFormatLinearPCM;
+    format.mFormatFlags = kIOUserAudioFormatFlagIsFloat | kIOUserAudioFormatFlagIsPacked;
+    format.mBytesPerPacket = kBytesPerFrame;
+    format.mFramesPerPacket = 1;
+    format.mBytesPerFrame = kBytesPerFrame;
+    format.mChannelsPerFrame = kNumChannels;
+    format.mBitsPerChannel = kBitsPerChannel;
+    return format;
+}
+
+// Gives both streams new IO buffers of ivars->bufferFrames frames and maps them for the IO handler.
+// The old buffers are only let go of once the new ones are in place. Not safe while IO is running.
+static kern_return_t CreateIOBuffers(MacaroniAudioDriver_IVars* ivars)
+{
+    kern_return_t ret;
+    uint32_t bufferSize = ivars->bufferFrames * kBytesPerFrame;
+    OSSharedPtr<IOBufferMemoryDescriptor> outputBuffer;
+    OSSharedPtr<IOBufferMemoryDescriptor> inputBuffer;
+    OSSharedPtr<IOMemoryMap> outputMap;
+    OSSharedPtr<IOMemoryMap> inputMap;
+
+    ret = IOBufferMemoryDescriptor::Create(kIOMemoryDirectionInOut,
+                                           bufferSize,
+                                           0,
+                                           outputBuffer.attach());
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+
+    ret = IOBufferMemoryDescriptor::Create(kIOMemoryDirectionInOut,
+                                           bufferSize,
+                                           0,
+                                           inputBuffer.attach());
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+
+    // Map the buffers so the IO handler can get at the samples
+    ret = outputBuffer->CreateMapping(0, 0, 0, 0, 0, outputMap.attach());
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+
+    ret = inputBuffer->CreateMapping(0, 0, 0, 0, 0, inputMap.attach());
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+
+    // Set buffers on streams
+    ret = ivars->outputStream->SetIOMemoryDescriptor(outputBuffer.get());
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+
+    ret = ivars->inputStream->SetIOMemoryDescriptor(inputBuffer.get());
+    if (ret != kIOReturnSuccess) {
+        ivars->outputStream->SetIOMemoryDescriptor(ivars->outputBuffer.get());
+        return ret;
+    }
+
+    ivars->outputBuffer = outputBuffer;
+    ivars->inputBuffer = inputBuffer;
+    ivars->outputMap = outputMap;
+    ivars->inputMap = inputMap;
+    ivars->outputFrames = reinterpret_cast<float*>(outputMap->GetAddress());
+    ivars->inputFrames = reinterpret_cast<float*>(inputMap->GetAddress());
+    return kIOReturnSuccess;
+}
+
 bool MacaroniAudioDriver::init()
 {
     if (!super::init()) {
@@ -47,6 +139,10 @@ bool MacaroniAudioDriver::init()
     ivars->volumeLevel = 1.0f;
     ivars->isMuted = false;
     ivars->isRunning = false;
+    ivars->sampleRate = kDefaultSampleRate;
+    ivars->bufferFrames = BufferFramesForSampleRate(ivars->sampleRate);
+    ivars->loopback.SetGain(ivars->volumeLevel);
+    ivars->loopback.Reset(kNumChannels);
 
     return true;
 }
@@ -61,6 +157,11 @@ void MacaroniAudioDriver::free()
         ivars->muteControl.reset();
         ivars->inputBuffer.reset();
         ivars->outputBuffer.reset();
+        ivars->inputMap.reset();
+        ivars->outputMap.reset();
+        ivars->ztsTimer.reset();
+        ivars->ztsTimerAction.reset();
+        ivars->workQueue.reset();
         IOSafeDeleteNULL(ivars, MacaroniAudioDriver_IVars, 1);
     }
     super::free();
@@ -92,19 +193,16 @@ kern_return_t MacaroniAudioDriver::Start(IOService* provider)
     ivars->audioDevice->SetManufacturer(manufacturer.get());
     ivars->audioDevice->SetCanBeDefault(true);
     ivars->audioDevice->SetCanBeDefaultForSystemSounds(true);
-    ivars->audioDevice->SetSampleRate(kSampleRate);
-    ivars->audioDevice->SetZeroTimeStampPeriod(kBufferFrames);
-
-    // Create stream format
-    IOUserAudioStreamBasicDescription format = {};
-    format.mSampleRate = kSampleRate;
-    format.mFormatID = kIOUserAudioFormatLinearPCM;
-    format.mFormatFlags = kIOUserAudioFormatFlagIsFloat | kIOUserAudioFormatFlagIsPacked;
-    format.mBytesPerPacket = kBytesPerFrame;
-    format.mFramesPerPacket = 1;
-    format.mBytesPerFrame = kBytesPerFrame;
-    format.mChannelsPerFrame = kNumChannels;
-    format.mBitsPerChannel = kBitsPerChannel;
+    ivars->audioDevice->SetAvailableSampleRates(kSupportedSampleRates, kSupportedSampleRateCount);
+    ivars->audioDevice->SetSampleRate(ivars->sampleRate);
+    ivars->audioDevice->SetZeroTimeStampPeriod(ivars->bufferFrames);
+
+    // Create stream formats: the one sample format we do, at every supported sample rate
+    IOUserAudioStreamBasicDescription formats[kSupportedSampleRateCount];
+    for (uint32_t i = 0; i < kSupportedSampleRateCount; i++) {
+        formats[i] = StreamFormatForSampleRate(kSupportedSampleRates[i]);
+    }
+    IOUserAudioStreamBasicDescription format = StreamFormatForSampleRate(ivars->sampleRate);
 
     // Create output stream (audio from apps)
     ivars->outputStream = OSSharedPtr(IOUserAudioStream::Create(this,
@@ -117,7 +215,7 @@ kern_return_t MacaroniAudioDriver::Start(IOService* provider)
 
     OSSharedPtr<OSString> outputStreamName = OSSharedPtr(OSString::withCString("Macaroni Output"), OSNoRetain);
     ivars->outputStream->SetName(outputStreamName.get());
-    ivars->outputStream->SetAvailableStreamFormats(&format, 1);
+    ivars->outputStream->SetAvailableStreamFormats(formats, kSupportedSampleRateCount);
     ivars->outputStream->SetCurrentStreamFormat(&format);
 
     // Create input stream (for loopback to capture processed audio)
@@ -131,7 +229,7 @@ kern_return_t MacaroniAudioDriver::Start(IOService* provider)
 
     OSSharedPtr<OSString> inputStreamName = OSSharedPtr(OSString::withCString("Macaroni Input"), OSNoRetain);
     ivars->inputStream->SetName(inputStreamName.get());
-    ivars->inputStream->SetAvailableStreamFormats(&format, 1);
+    ivars->inputStream->SetAvailableStreamFormats(formats, kSupportedSampleRateCount);
     ivars->inputStream->SetCurrentStreamFormat(&format);
 
     // Create volume control
@@ -186,30 +284,57 @@ kern_return_t MacaroniAudioDriver::Start(IOService* provider)
     }
 
     // Create IO buffers
-    uint32_t bufferSize = kBufferFrames * kBytesPerFrame;
-    ret = IOBufferMemoryDescriptor::Create(kIOMemoryDirectionInOut,
-                                           bufferSize,
-                                           0,
-                                           ivars->outputBuffer.attach());
+    ret = CreateIOBuffers(ivars);
     if (ret != kIOReturnSuccess) {
         return ret;
     }
 
-    ret = IOBufferMemoryDescriptor::Create(kIOMemoryDirectionInOut,
-                                           bufferSize,
-                                           0,
-                                           ivars->inputBuffer.attach());
+    // The output stream loops back to the input stream. The HAL calls the handler on the device's
+    // IO thread, once it has written the output for a cycle and before it reads the input. The
+    // buffers are only replaced while IO is stopped, so they're looked up afresh every cycle.
+
+    ret = ivars->audioDevice->SetIOOperationHandler(^kern_return_t(IOUserAudioObjectID in_device,
+                                                                   IOUserAudioIOOperation in_io_operation,
+                                                                   uint32_t in_io_buffer_frame_size,
+                                                                   uint64_t in_sample_time,
+                                                                   uint64_t in_host_time) {
+        switch (in_io_operation) {
+            case IOUserAudioIOOperationWriteEnd:
+                ivars->loopback.WriteOutput(
+                    ivars->outputFrames, ivars->bufferFrames, in_sample_time, in_io_buffer_frame_size);
+                break;
+
+            case IOUserAudioIOOperationBeginRead:
+                ivars->volumeLevel = LoopbackEngine::GainForDecibels(ivars->volumeControl->GetDecibelValue());
+                ivars->isMuted = ivars->muteControl->GetControlValue();
+                ivars->loopback.SetGain(ivars->isMuted ? 0.0f : ivars->volumeLevel);
+                ivars->loopback.ReadInput(
+                    ivars->inputFrames, ivars->bufferFrames, in_sample_time, in_io_buffer_frame_size);
+                break;
+
+            default:
+                break;
+        }
+
+        return kIOReturnSuccess;
+    });
     if (ret != kIOReturnSuccess) {
         return ret;
     }
 
-    // Set buffers on streams
-    ret = ivars->outputStream->SetIOMemoryDescriptor(ivars->outputBuffer.get());
+    // Zero time stamps come from a timer on the driver's work queue
+    ivars->workQueue = GetWorkQueue();
+    ret = IOTimerDispatchSource::Create(ivars->workQueue.get(), ivars->ztsTimer.attach());
     if (ret != kIOReturnSuccess) {
         return ret;
     }
 
-    ret = ivars->inputStream->SetIOMemoryDescriptor(ivars->inputBuffer.get());
+    ret = CreateActionZtsTimerOccurred(sizeof(void*), ivars->ztsTimerAction.attach());
+    if (ret != kIOReturnSuccess) {
+        return ret;
+    }
+
+    ret = ivars->ztsTimer->SetHandler(ivars->ztsTimerAction.get());
     if (ret != kIOReturnSuccess) {
         return ret;
     }
@@ -226,6 +351,10 @@ kern_return_t MacaroniAudioDriver::Start(IOService* provider)
 
 kern_return_t MacaroniAudioDriver::Stop(IOService* provider)
 {
+    if (ivars->ztsTimer) {
+        ivars->ztsTimer->SetEnable(false);
+    }
+
     if (ivars->audioDevice) {
         ivars->audioDevice->StopIO(IOUserAudioStartStopFlags::None);
         RemoveObject(ivars->audioDevice.get());
@@ -241,7 +370,20 @@ kern_return_t MacaroniAudioDriver::NewUserClient(uint32_t type, IOUserClient** u
 kern_return_t MacaroniAudioDriver::StartDevice(IOUserAudioObjectID in_object_id,
                                                 IOUserAudioStartStopFlags in_flags)
 {
+    // The sample time starts over from 0 on every start, so the loopback's history has to as well
+    ivars->loopback.Reset(kNumChannels);
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    double hostTicksPerFrame = (1000000000.0 * timebase.denom / timebase.numer) / ivars->sampleRate;
+    uint64_t startHostTime = mach_absolute_time();
+
+    ivars->ztsClock.Start(startHostTime, hostTicksPerFrame, ivars->bufferFrames);
+    ivars->audioDevice->UpdateCurrentZeroTimestamp(0, startHostTime);
     ivars->isRunning = true;
+
+    ivars->ztsTimer->WakeAtTime(kIOTimerClockMachAbsoluteTime, ivars->ztsClock.NextHostTime(), 0);
+    ivars->ztsTimer->SetEnable(true);
     return kIOReturnSuccess;
 }
 
@@ -249,6 +391,7 @@ kern_return_t MacaroniAudioDriver::StopDevice(IOUserAudioObjectID in_object_id,
                                                IOUserAudioStartStopFlags in_flags)
 {
     ivars->isRunning = false;
+    ivars->ztsTimer->SetEnable(false);
     return kIOReturnSuccess;
 }
 
@@ -256,6 +399,37 @@ kern_return_t MacaroniAudioDriver::PerformDeviceConfigurationChange(IOUserAudioO
                                                                      uint64_t in_change_action,
                                                                      OSObject* in_change_info)
 {
+    if (in_change_action != kSampleRateChangeAction) {
+        return kIOReturnSuccess;
+    }
+
+    OSNumber* rate = OSDynamicCast(OSNumber, in_change_info);
+    if (rate == nullptr || !IsSupportedSampleRate(double(rate->unsigned64BitValue()))) {
+        return kIOReturnBadArgument;
+    }
+
+    // IO is stopped while this runs, so the IO buffers can be replaced out from under the IO
+    // handler. The zero time stamp period always matches the buffers, and the time stamps start
+    // over at the new rate on the next StartDevice.
+    double oldSampleRate = ivars->sampleRate;
+    uint32_t oldBufferFrames = ivars->bufferFrames;
+    ivars->sampleRate = double(rate->unsigned64BitValue());
+    ivars->bufferFrames = BufferFramesForSampleRate(ivars->sampleRate);
+
+    if (ivars->bufferFrames != oldBufferFrames) {
+        kern_return_t ret = CreateIOBuffers(ivars);
+        if (ret != kIOReturnSuccess) {
+            ivars->sampleRate = oldSampleRate;
+            ivars->bufferFrames = oldBufferFrames;
+            return ret;
+        }
+    }
+
+    IOUserAudioStreamBasicDescription format = StreamFormatForSampleRate(ivars->sampleRate);
+    ivars->audioDevice->SetSampleRate(ivars->sampleRate);
+    ivars->audioDevice->SetZeroTimeStampPeriod(ivars->bufferFrames);
+    ivars->outputStream->SetCurrentStreamFormat(&format);
+    ivars->inputStream->SetCurrentStreamFormat(&format);
     return kIOReturnSuccess;
 }
 
@@ -271,7 +445,35 @@ kern_return_t MacaroniAudioDriver::HandleChangedStreamFormat(IOUserAudioObjectID
                                                               const IOUserAudioStreamBasicDescription* in_old_format,
                                                               const IOUserAudioStreamBasicDescription* in_new_format)
 {
-    return kIOReturnSuccess;
+    if (in_new_format == nullptr || !IsSupportedSampleRate(in_new_format->mSampleRate)) {
+        return kIOReturnUnsupported;
+    }
+
+    if (in_new_format->mSampleRate == ivars->sampleRate) {
+        return kIOReturnSuccess;
+    }
+
+    // Both streams and the device change rate together, and the IO buffers may need to grow, none
+    // of which can happen while IO is running, so it's left to PerformDeviceConfigurationChange
+    uint64_t newSampleRate = uint64_t(in_new_format->mSampleRate);
+    OSSharedPtr<OSNumber> rate = OSSharedPtr(OSNumber::withNumber(newSampleRate, 64), OSNoRetain);
+    return ivars->audioDevice->RequestDeviceConfigurationChange(kSampleRateChangeAction, rate.get());
+}
+
+void MacaroniAudioDriver::ZtsTimerOccurred_Impl(OSAction* action, uint64_t time)
+{
+    if (!ivars->isRunning) {
+        return;
+    }
+
+    uint64_t sampleTime;
+    uint64_t hostTime;
+
+    if (ivars->ztsClock.Update(mach_absolute_time(), sampleTime, hostTime)) {
+        ivars->audioDevice->UpdateCurrentZeroTimestamp(sampleTime, hostTime);
+    }
+
+    ivars->ztsTimer->WakeAtTime(kIOTimerClockMachAbsoluteTime, ivars->ztsClock.NextHostTime(), 0);
 }
 
 IMPL_KERNEL_MAIN()
@@ -0,0 +1,235 @@
+#include "AdaptiveResampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "AudioMixKernels.h"
+
+// The filter's passband edge, as a fraction of the lower of the two sample rates, and the Kaiser
+// window's beta. With kBaseTaps taps for every multiple of downsampling, this gives a transition
+// band of roughly 3 kHz at 44.1 kHz, just above 18 kHz, and about 70 dB of stopband attenuation.
+#define kResamplerCutoff 0.45
+#define kResamplerKaiserBeta 7.0
+
+// How many frames it takes the drift controller's smoothed fill level to settle, and its gains. A
+// fill level error of 100 frames makes the proportional term move the ratio by 250 ppm, and the
+// integral term takes over from it within about a minute.
+#define kDriftSmoothingFrames 16384.0
+#define kDriftProportionalGain 2.5e-6
+#define kDriftIntegralGain 1e-12
+
+static Float64 BesselI0(Float64 x) {
+    Float64 sum = 1.0;
+    Float64 term = 1.0;
+
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+
+    return sum;
+}
+
+#ifdef __clang__
+#pragma mark AdaptiveResampler
+#endif
+
+AdaptiveResampler::AdaptiveResampler(UInt32 channels, UInt32 maxOutputFrames, Float64 maxRatio)
+    : mChannels(channels), mMaxOutputFrames(maxOutputFrames), mMaxRatio(maxRatio) {
+    mHistoryCapacity = kMaxTaps + UInt32(ceil(maxOutputFrames * maxRatio)) + 2;
+    mHistory.assign(mChannels * mHistoryCapacity, 0.0f);
+    SetNominalRatio(1.0);
+}
+
+void AdaptiveResampler::SetNominalRatio(Float64 ratio) {
+    mNominalRatio = ratio;
+
+    // Past four times the taps the filter would get expensive, so beyond that the transition band
+    // is allowed to widen instead
+    Float64 downsampling = std::max(ratio, 1.0);
+    mTaps = kBaseTaps * std::min(UInt32(ceil(downsampling)), kMaxTaps / kBaseTaps);
+    mLeadingFrames = mTaps / 2 - 1;
+    mFrameFilter.assign(mTaps, 0.0f);
+    BuildFilter(kResamplerCutoff / downsampling, kResamplerKaiserBeta);
+    Reset();
+}
+
+void AdaptiveResampler::BuildFilter(Float64 cutoff, Float64 beta) {
+    mFilter.assign((kPhases + 1) * mTaps, 0.0f);
+    const Float64 halfWidth = mTaps / 2;
+    const Float64 windowScale = 1.0 / BesselI0(beta);
+
+    for (UInt32 phase = 0; phase <= kPhases; phase++) {
+        Float64 fraction = Float64(phase) / kPhases;
+        Float32 *row = &mFilter[phase * mTaps];
+        Float64 sum = 0.0;
+
+        for (UInt32 tap = 0; tap < mTaps; tap++) {
+            // The distance of this tap's input frame from the output frame's position
+            Float64 distance = (Float64(tap) - mLeadingFrames) - fraction;
+            Float64 x = 2.0 * cutoff * distance;
+            Float64 sinc = (fabs(x) < 1e-9) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            Float64 windowPosition = distance / halfWidth;
+            Float64 window = 0.0;
+
+            if (fabs(windowPosition) <= 1.0) {
+                window = BesselI0(beta * sqrt(1.0 - windowPosition * windowPosition)) * windowScale;
+            }
+
+            Float64 coefficient = 2.0 * cutoff * sinc * window;
+            row[tap] = Float32(coefficient);
+            sum += coefficient;
+        }
+
+        // Normalize every phase to unity gain at DC so that interpolating between them doesn't
+        // modulate the level
+        for (UInt32 tap = 0; tap < mTaps; tap++) {
+            row[tap] = Float32(row[tap] / sum);
+        }
+    }
+}
+
+void AdaptiveResampler::Reset() {
+    std::fill(mHistory.begin(), mHistory.end(), 0.0f);
+    mHistoryFrames = mLeadingFrames;
+    mSilentFrames = mHistoryFrames;
+    mPosition = mLeadingFrames;
+}
+
+UInt32 AdaptiveResampler::InputFramesNeeded(UInt32 outputFrames, Float64 ratio) const {
+    if (outputFrames == 0) {
+        return 0;
+    }
+
+    ratio = std::min(ratio, mMaxRatio);
+    Float64 lastPosition = mPosition + (outputFrames - 1) * ratio;
+    SInt64 requiredFrames = SInt64(floor(lastPosition)) + (mTaps - mLeadingFrames);
+
+    return (requiredFrames > SInt64(mHistoryFrames)) ? UInt32(requiredFrames - mHistoryFrames) : 0;
+}
+
+void AdaptiveResampler::PushInput(const Float32 *input, UInt32 frames) {
+    frames = std::min(frames, mHistoryCapacity - mHistoryFrames);
+
+    for (UInt32 channel = 0; channel < mChannels; channel++) {
+        Float32 *history = History(channel) + mHistoryFrames;
+        const Float32 *in = input + channel;
+
+        for (UInt32 frame = 0; frame < frames; frame++) {
+            history[frame] = *in;
+            in += mChannels;
+        }
+    }
+
+    mHistoryFrames += frames;
+
+    if (frames > 0) {
+        mSilentFrames = 0;
+    }
+}
+
+void AdaptiveResampler::PushSilence(UInt32 frames) {
+    frames = std::min(frames, mHistoryCapacity - mHistoryFrames);
+
+    for (UInt32 channel = 0; channel < mChannels; channel++) {
+        memset(History(channel) + mHistoryFrames, 0, frames * sizeof(Float32));
+    }
+
+    mHistoryFrames += frames;
+    mSilentFrames += frames;
+}
+
+void AdaptiveResampler::Process(Float32 *output, UInt32 outputFrames, Float64 ratio) {
+    ratio = std::min(ratio, mMaxRatio);
+    outputFrames = std::min(outputFrames, mMaxOutputFrames);
+
+    for (UInt32 frame = 0; frame < outputFrames; frame++) {
+        Float64 position = mPosition + frame * ratio;
+        Float64 index = floor(position);
+        Float64 phasePosition = (position - index) * kPhases;
+        UInt32 phase = std::min(UInt32(phasePosition), kPhases - 1);
+        Float32 phaseFraction = Float32(phasePosition - phase);
+        SInt64 firstFrame = SInt64(index) - mLeadingFrames;
+
+        // Shouldn't happen as long as the caller pushed enough input, but never read outside of
+        // the history
+        if (firstFrame < 0 || firstFrame + mTaps > mHistoryFrames) {
+            memset(output + frame * mChannels, 0, mChannels * sizeof(Float32));
+            continue;
+        }
+
+        const Float32 *filter = &mFilter[phase * mTaps];
+        const Float32 *nextFilter = filter + mTaps;
+
+        for (UInt32 tap = 0; tap < mTaps; tap++) {
+            mFrameFilter[tap] = filter[tap] + phaseFraction * (nextFilter[tap] - filter[tap]);
+        }
+
+        for (UInt32 channel = 0; channel < mChannels; channel++) {
+            output[frame * mChannels + channel] = DotProduct(mFrameFilter.data(), History(channel) + firstFrame, mTaps);
+        }
+    }
+
+    Advance(outputFrames, ratio);
+}
+
+void AdaptiveResampler::Skip(UInt32 outputFrames, Float64 ratio) {
+    Advance(std::min(outputFrames, mMaxOutputFrames), std::min(ratio, mMaxRatio));
+}
+
+void AdaptiveResampler::Advance(UInt32 outputFrames, Float64 ratio) {
+    mPosition += outputFrames * ratio;
+
+    // Drop the input frames that no later output frame can reach any more
+    SInt64 framesToDrop = std::min(SInt64(floor(mPosition)) - SInt64(mLeadingFrames), SInt64(mHistoryFrames));
+
+    // Moving silence down over silence wouldn't change anything
+    if (framesToDrop > 0) {
+        for (UInt32 channel = 0; channel < mChannels && !IsSilent(); channel++) {
+            Float32 *history = History(channel);
+            memmove(history, history + framesToDrop, (mHistoryFrames - framesToDrop) * sizeof(Float32));
+        }
+
+        mHistoryFrames -= UInt32(framesToDrop);
+        mSilentFrames = std::min(mSilentFrames, mHistoryFrames);
+        mPosition -= framesToDrop;
+    }
+}
+
+#ifdef __clang__
+#pragma mark DriftController
+#endif
+
+DriftController::DriftController(Float64 maxDeviation) : mMaxDeviation(maxDeviation) {
+    Reset(0);
+}
+
+void DriftController::Reset(Float64 targetFill) {
+    mTargetFill = targetFill;
+    mSmoothedFill = targetFill;
+    mIntegral = 0.0;
+    mRatio = 1.0;
+}
+
+Float64 DriftController::Update(Float64 fill, UInt32 cycleFrames) {
+    Float64 smoothing = cycleFrames / (cycleFrames + kDriftSmoothingFrames);
+    mSmoothedFill += (fill - mSmoothedFill) * smoothing;
+
+    // More frames buffered than we want means we're consuming them too slowly, so the ratio of
+    // input frames per output frame goes up
+    Float64 error = mSmoothedFill - mTargetFill;
+
+    // Keep the integral term from winding up past what the ratio could ever use
+    Float64 integralLimit = mMaxDeviation / kDriftIntegralGain;
+    mIntegral = std::clamp(mIntegral + error * cycleFrames, -integralLimit, integralLimit);
+
+    Float64 deviation = kDriftProportionalGain * error + kDriftIntegralGain * mIntegral;
+    mRatio = 1.0 + std::clamp(deviation, -mMaxDeviation, mMaxDeviation);
+
+    return mRatio;
+}
@@ -0,0 +1,110 @@
+#ifndef __AdaptiveResampler_h__
+#define __AdaptiveResampler_h__
+
+#include "PortableTypes.h"
+#include <vector>
+
+// An asynchronous sample rate converter for interleaved float audio, whose conversion ratio can
+// change from one call to the next. It converts between the proxy device's sample rate and the
+// rate of the device it's playing to, and soaks up the clock drift between the two.
+//
+// Every output frame is interpolated from the input frames around its position with a Kaiser
+// windowed sinc filter. The filter is tabulated at kPhases fractional positions and linearly
+// interpolated between them. Input is kept in a planar history so that the filter for each channel
+// is a plain dot product.
+//
+// Everything apart from the constructor and SetNominalRatio is safe to call from a real-time
+// thread.
+class AdaptiveResampler {
+  public:
+    static const UInt32 kBaseTaps = 64;
+    static const UInt32 kMaxTaps = kBaseTaps * 4;
+    static const UInt32 kPhases = 256;
+
+    // The resampler can produce up to maxOutputFrames frames per call to Process, at ratios (input
+    // frames per output frame) of up to maxRatio.
+    AdaptiveResampler(UInt32 channels, UInt32 maxOutputFrames, Float64 maxRatio);
+
+    // Sets the ratio the resampler will be run at, give or take drift, and designs the filter for
+    // it: when downsampling, the cutoff has to come down to the output's Nyquist frequency, and the
+    // filter gets longer to keep the transition band just as narrow. Allocates, and resets the
+    // resampler.
+    void SetNominalRatio(Float64 ratio);
+    Float64 NominalRatio() const { return mNominalRatio; }
+
+    // Forgets all buffered input, so that the next input frame pushed becomes the next output frame
+    void Reset();
+
+    // How many more input frames need to be pushed before outputFrames frames can be produced at
+    // the given ratio
+    UInt32 InputFramesNeeded(UInt32 outputFrames, Float64 ratio) const;
+
+    void PushInput(const Float32 *input, UInt32 frames);
+    void PushSilence(UInt32 frames);
+
+    // Produces outputFrames interleaved frames, advancing through the input by ratio input frames
+    // per output frame. InputFramesNeeded frames must have been pushed first.
+    void Process(Float32 *output, UInt32 outputFrames, Float64 ratio);
+
+    // Whether all the input the resampler has buffered is silence, pushed by PushSilence, so that
+    // whatever it produces next would be too. The caller can then call Skip instead of Process,
+    // which moves through the input exactly as Process would without computing any output.
+    bool IsSilent() const { return mSilentFrames >= mHistoryFrames; }
+    void Skip(UInt32 outputFrames, Float64 ratio);
+
+    UInt32 Channels() const { return mChannels; }
+    UInt32 MaxOutputFrames() const { return mMaxOutputFrames; }
+
+    // How many input frames past the position of an output frame the filter needs, and so the
+    // delay it adds
+    UInt32 Latency() const { return mTaps - mLeadingFrames; }
+
+  private:
+    void BuildFilter(Float64 cutoff, Float64 beta);
+    void Advance(UInt32 outputFrames, Float64 ratio);
+    Float32 *History(UInt32 channel) { return &mHistory[channel * mHistoryCapacity]; }
+
+    UInt32 mChannels;
+    UInt32 mMaxOutputFrames;
+    Float64 mMaxRatio;
+    Float64 mNominalRatio;
+    UInt32 mTaps;
+    UInt32 mLeadingFrames;
+    UInt32 mHistoryCapacity;
+    std::vector<Float32> mHistory;
+    UInt32 mHistoryFrames;
+    // How many of the frames at the end of the history are silence
+    UInt32 mSilentFrames;
+    // The position of the next output frame, in input frames from the start of the history
+    Float64 mPosition;
+    // (kPhases + 1) rows of mTaps coefficients
+    std::vector<Float32> mFilter;
+    std::vector<Float32> mFrameFilter;
+};
+
+// A PI controller that picks the resampling ratio which keeps the ring buffer's fill level at its
+// target. The fill level jumps around by up to a buffer's worth of frames every cycle, so it's
+// smoothed first, and the ratio is kept within maxDeviation of 1.
+class DriftController {
+  public:
+    DriftController(Float64 maxDeviation = 0.002);
+
+    void Reset(Float64 targetFill);
+
+    // Takes the fill level at the start of a cycle of cycleFrames frames and returns the ratio to
+    // resample that cycle at
+    Float64 Update(Float64 fill, UInt32 cycleFrames);
+
+    Float64 TargetFill() const { return mTargetFill; }
+    Float64 SmoothedFill() const { return mSmoothedFill; }
+    Float64 Ratio() const { return mRatio; }
+
+  private:
+    Float64 mMaxDeviation;
+    Float64 mTargetFill;
+    Float64 mSmoothedFill;
+    Float64 mIntegral;
+    Float64 mRatio;
+};
+
+#endif // __AdaptiveResampler_h__
@@ -1,5 +1,8 @@
 #include "AudioDevice.h"
 
+#include <algorithm>
+#include <cstddef>
+
 #include "ProxyAudioDevice.h"
 #include "debugHelpers.h"
 #include "CFTypeHelpers.h"
@@ -9,6 +12,8 @@ AudioDevice::AudioDevice(AudioObjectID inId, bool inIsOutput) {
     isOutput = inIsOutput;
     safetyOffset = 0;
     bufferFrameSize = 0;
+    latency = 0;
+    channelCount = 0;
     procId = nullptr;
     isStarted = false;
 
@@ -58,6 +63,38 @@ OSStatus AudioDevice::updateStreamInfo() {
         return err;
     }
 
+    // Not every device reports its latency, so like the streams' below it counts as none if it
+    // can't be read, rather than making the device unusable
+    if (getIntegerPropertyData(latency,
+                               kAudioDevicePropertyLatency,
+                               isOutput ? kAudioObjectPropertyScopeOutput : kAudioObjectPropertyScopeInput,
+                               kAudioObjectPropertyElementMaster) != noErr) {
+        syslog(LOG_WARNING, "ProxyAudio: failed to get latency of device %u, assuming 0", id);
+        latency = 0;
+    }
+
+    // Streams can add latency of their own on top of the device's. Not every device reports it,
+    // so it's fine for this part to fail.
+    AudioObjectPropertyAddress streamsAddress = {kAudioDevicePropertyStreams,
+                                                 isOutput ? kAudioObjectPropertyScopeOutput
+                                                          : kAudioObjectPropertyScopeInput,
+                                                 kAudioObjectPropertyElementMaster};
+    AudioObjectID stream = kAudioObjectUnknown;
+    UInt32 size = sizeof(AudioObjectID);
+
+    if (AudioObjectGetPropertyData(id, &streamsAddress, 0, NULL, &size, &stream) == noErr && size > 0) {
+        AudioObjectPropertyAddress streamLatencyAddress = {
+            kAudioStreamPropertyLatency, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster};
+        UInt32 streamLatency = 0;
+        size = sizeof(UInt32);
+
+        if (AudioObjectGetPropertyData(stream, &streamLatencyAddress, 0, NULL, &size, &streamLatency) == noErr) {
+            latency += streamLatency;
+        }
+    }
+
+    updateChannelInfo();
+
     err = getDoublePropertyData(sampleRate,
                                 kAudioDevicePropertyNominalSampleRate,
                                 kAudioObjectPropertyScopeGlobal,
@@ -71,6 +108,41 @@ OSStatus AudioDevice::updateStreamInfo() {
     return noErr;
 }
 
+// Not every device describes its channels, so none of this is fatal
+void AudioDevice::updateChannelInfo() {
+    AudioObjectPropertyScope scope = isOutput ? kAudioObjectPropertyScopeOutput : kAudioObjectPropertyScopeInput;
+    UInt32 size = 0;
+
+    channelCount = channelCountForDevice(id, scope);
+    channelLabels.clear();
+
+    // Only layouts given as a list of channel descriptions are understood here. Anything given as
+    // a layout tag or bitmap is left for the caller to assume the standard channel order for.
+    AudioObjectPropertyAddress layoutAddress = {
+        kAudioDevicePropertyPreferredChannelLayout, scope, kAudioObjectPropertyElementMaster};
+
+    if (AudioObjectGetPropertyDataSize(id, &layoutAddress, 0, NULL, &size) != noErr
+        || size < offsetof(AudioChannelLayout, mChannelDescriptions)) {
+        return;
+    }
+
+    std::vector<Byte> layoutData(size);
+    AudioChannelLayout *layout = (AudioChannelLayout *)layoutData.data();
+
+    if (AudioObjectGetPropertyData(id, &layoutAddress, 0, NULL, &size, layout) != noErr
+        || layout->mChannelLayoutTag != kAudioChannelLayoutTag_UseChannelDescriptions) {
+        return;
+    }
+
+    UInt32 descriptions = std::min<UInt32>(layout->mNumberChannelDescriptions,
+                                           (size - offsetof(AudioChannelLayout, mChannelDescriptions))
+                                               / sizeof(AudioChannelDescription));
+
+    for (UInt32 index = 0; index < descriptions; index++) {
+        channelLabels.push_back(layout->mChannelDescriptions[index].mChannelLabel);
+    }
+}
+
 void AudioDevice::addPropertyListener(AudioObjectPropertySelector selector,
                                       AudioObjectPropertyScope scope,
                                       AudioObjectPropertyElement element,
@@ -257,32 +329,25 @@ std::vector<AudioObjectID> AudioDevice::allAudioDevices() {
     return devices;
 }
 
-std::vector<AudioObjectID> AudioDevice::devicesWithOutputCapabilitiesThatAreNotProxyAudioDevice() {
-    std::vector<AudioObjectID> devices = allAudioDevices();
-    std::vector<AudioObjectID> result;
-
-    for (AudioObjectID device : devices) {
-        UInt32 values[2];
-        AudioObjectPropertyAddress propertyAddress = {kAudioDevicePropertyPreferredChannelsForStereo,
-                                                      kAudioObjectPropertyScopeOutput,
-                                                      kAudioObjectPropertyElementMaster};
-        UInt32 size = sizeof(values);
-        OSStatus error = AudioObjectGetPropertyData(device, &propertyAddress, 0, NULL, &size, values);
-
-        if (error != noErr || values[0] == values[1]) {
-            continue;
+// The total number of channels across all of the device's streams in the given scope
+UInt32 AudioDevice::channelCountForDevice(AudioObjectID device, AudioObjectPropertyScope scope) {
+    AudioObjectPropertyAddress configurationAddress = {
+        kAudioDevicePropertyStreamConfiguration, scope, kAudioObjectPropertyElementMaster};
+    UInt32 size = 0;
+    UInt32 channelCount = 0;
+
+    if (AudioObjectGetPropertyDataSize(device, &configurationAddress, 0, NULL, &size) == noErr && size > 0) {
+        std::vector<Byte> configuration(size);
+        AudioBufferList *bufferList = (AudioBufferList *)configuration.data();
+
+        if (AudioObjectGetPropertyData(device, &configurationAddress, 0, NULL, &size, bufferList) == noErr) {
+            for (UInt32 bufferIndex = 0; bufferIndex < bufferList->mNumberBuffers; bufferIndex++) {
+                channelCount += bufferList->mBuffers[bufferIndex].mNumberChannels;
+            }
         }
-
-        CFStringSmartRef uid = AudioDevice::copyDeviceUID(device);
-
-        if (!uid || CFStringCompare(uid, CFSTR(kDevice_UID), 0) == kCFCompareEqualTo) {
-            continue;
-        }
-
-        result.push_back(device);
     }
 
-    return result;
+    return channelCount;
 }
 
 AudioObjectID AudioDevice::defaultOutputDevice() {
@@ -30,7 +30,7 @@ class AudioDevice {
     void start();
     void stop();
     static std::vector<AudioObjectID> allAudioDevices();
-    static std::vector<AudioObjectID> devicesWithOutputCapabilitiesThatAreNotProxyAudioDevice();
+    static UInt32 channelCountForDevice(AudioObjectID device, AudioObjectPropertyScope scope);
     static AudioObjectID defaultOutputDevice();
     static CFStringRef copyDeviceUID(AudioObjectID device);
     static CFStringRef copyObjectName(AudioObjectID device);
@@ -44,12 +44,19 @@ class AudioDevice {
     bool isOutput;
     UInt32 safetyOffset;
     UInt32 bufferFrameSize;
+    // The device's presentation latency plus that of its first stream in this direction
+    UInt32 latency;
+    // The total number of channels across all of the device's streams in this direction, and the
+    // label of each of them, if the device says. Either can be empty when the device doesn't.
+    UInt32 channelCount;
+    std::vector<AudioChannelLabel> channelLabels;
     Float64 sampleRate;
     AudioDeviceIOProcID procId;
     bool isStarted;
 
   protected:
     void initialize();
+    void updateChannelInfo();
 };
 
 #endif
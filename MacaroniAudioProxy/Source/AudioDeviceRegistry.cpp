@@ -0,0 +1,43 @@
+#include "AudioDeviceRegistry.h"
+
+#include "AudioDevice.h"
+
+std::vector<AudioObjectID> CoreAudioDeviceSystem::DeviceIDs() {
+    return AudioDevice::allAudioDevices();
+}
+
+CFStringRef CoreAudioDeviceSystem::CopyUID(AudioObjectID deviceID) {
+    return AudioDevice::copyDeviceUID(deviceID);
+}
+
+CFStringRef CoreAudioDeviceSystem::CopyName(AudioObjectID deviceID) {
+    return AudioDevice::copyObjectName(deviceID);
+}
+
+UInt32 CoreAudioDeviceSystem::TransportType(AudioObjectID deviceID) {
+    AudioObjectPropertyAddress transportTypeAddress = {
+        kAudioDevicePropertyTransportType, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster};
+    UInt32 transportType = kAudioDeviceTransportTypeUnknown;
+    UInt32 size = sizeof(transportType);
+
+    if (AudioObjectGetPropertyData(deviceID, &transportTypeAddress, 0, NULL, &size, &transportType) != noErr) {
+        transportType = kAudioDeviceTransportTypeUnknown;
+    }
+
+    return transportType;
+}
+
+UInt32 CoreAudioDeviceSystem::OutputChannelCount(AudioObjectID deviceID) {
+    return AudioDevice::channelCountForDevice(deviceID, kAudioObjectPropertyScopeOutput);
+}
+
+bool CoreAudioDeviceSystem::HasStereoOutput(AudioObjectID deviceID) {
+    UInt32 stereoChannels[2];
+    AudioObjectPropertyAddress stereoChannelsAddress = {kAudioDevicePropertyPreferredChannelsForStereo,
+                                                        kAudioObjectPropertyScopeOutput,
+                                                        kAudioObjectPropertyElementMaster};
+    UInt32 size = sizeof(stereoChannels);
+
+    return AudioObjectGetPropertyData(deviceID, &stereoChannelsAddress, 0, NULL, &size, stereoChannels) == noErr
+           && stereoChannels[0] != stereoChannels[1];
+}
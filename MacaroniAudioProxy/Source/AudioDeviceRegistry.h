@@ -0,0 +1,41 @@
+#ifndef __AudioDeviceRegistry_h__
+#define __AudioDeviceRegistry_h__
+
+#include <CoreAudio/CoreAudio.h>
+#include <CoreServices/CoreServices.h>
+#include <vector>
+
+#include "CAMutex.h"
+#include "DeviceRegistry.h"
+
+// The HAL's devices, for DeviceRegistry
+struct CoreAudioDeviceSystem {
+    typedef AudioObjectID ObjectID;
+    typedef CFStringRef String;
+
+    static constexpr AudioObjectID kUnknownDevice = kAudioObjectUnknown;
+
+    struct Mutex : CAMutex {
+        Mutex() : CAMutex("AudioDeviceRegistry") {}
+    };
+    typedef CAMutex::Locker Locker;
+
+    static std::vector<AudioObjectID> DeviceIDs();
+    static CFStringRef CopyUID(AudioObjectID deviceID);
+    static CFStringRef CopyName(AudioObjectID deviceID);
+    static UInt32 TransportType(AudioObjectID deviceID);
+    static UInt32 OutputChannelCount(AudioObjectID deviceID);
+    static bool HasStereoOutput(AudioObjectID deviceID);
+
+    static void Retain(CFStringRef string) { CFRetain(string); }
+    static void Release(CFStringRef string) { CFRelease(string); }
+    static size_t Hash(CFStringRef string) { return CFHash(string); }
+    static bool Equal(CFStringRef string1, CFStringRef string2) { return CFEqual(string1, string2); }
+    static void GetCString(CFStringRef string, char *buffer, size_t size) {
+        CFStringGetCString(string, buffer, size, kCFStringEncodingUTF8);
+    }
+};
+
+typedef DeviceRegistry<CoreAudioDeviceSystem> AudioDeviceRegistry;
+
+#endif // __AudioDeviceRegistry_h__
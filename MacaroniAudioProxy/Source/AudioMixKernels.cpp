@@ -0,0 +1,587 @@
+#include "AudioMixKernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AUDIO_MIX_NEON 1
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#define AUDIO_MIX_SSE 1
+#endif
+
+// The vector paths compute every sample as a rounded multiply followed by a rounded add. Keep the
+// compiler from fusing the scalar code into FMAs so that both paths give bit-identical results.
+#ifdef __clang__
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+#ifdef __clang__
+#pragma mark Vector Primitives
+#endif
+
+#if AUDIO_MIX_NEON
+
+typedef float32x4_t Vec4;
+typedef float32x2_t Vec2;
+
+static inline Vec4 Load4(const Float32 *p) { return vld1q_f32(p); }
+static inline void Store4(Float32 *p, Vec4 v) { vst1q_f32(p, v); }
+static inline Vec4 MulAdd4(Vec4 out, Vec4 in, Vec4 gain) { return vaddq_f32(out, vmulq_f32(in, gain)); }
+static inline Vec2 Load2(const Float32 *p) { return vld1_f32(p); }
+static inline void Store2(Float32 *p, Vec2 v) { vst1_f32(p, v); }
+static inline Vec2 MulAdd2(Vec2 out, Vec2 in, Vec2 gain) { return vadd_f32(out, vmul_f32(in, gain)); }
+static inline Vec4 Splat4(Float32 value) { return vdupq_n_f32(value); }
+static inline Vec2 Splat2(Float32 value) { return vdup_n_f32(value); }
+// Two pairs of samples from anywhere, low pair first, for stereo frames in a wider layout
+static inline Vec4 Load2x2(const Float32 *low, const Float32 *high) {
+    return vcombine_f32(vld1_f32(low), vld1_f32(high));
+}
+static inline void Store2x2(Float32 *low, Float32 *high, Vec4 v) {
+    vst1_f32(low, vget_low_f32(v));
+    vst1_f32(high, vget_high_f32(v));
+}
+// {low, low, high, high}
+static inline Vec4 Pair4(Float32 low, Float32 high) { return vcombine_f32(vdup_n_f32(low), vdup_n_f32(high)); }
+
+// Whether all 16 samples are zero, of either sign. Shifting left by one drops the sign bits.
+static inline bool IsZero16(const Float32 *p) {
+    const uint32_t *bits = (const uint32_t *)p;
+    uint32x4_t any = vorrq_u32(vorrq_u32(vld1q_u32(bits), vld1q_u32(bits + 4)),
+                               vorrq_u32(vld1q_u32(bits + 8), vld1q_u32(bits + 12)));
+    return vmaxvq_u32(vshlq_n_u32(any, 1)) == 0;
+}
+
+#elif AUDIO_MIX_SSE
+
+typedef __m128 Vec4;
+typedef __m128 Vec2;
+
+static inline Vec4 Load4(const Float32 *p) { return _mm_loadu_ps(p); }
+static inline void Store4(Float32 *p, Vec4 v) { _mm_storeu_ps(p, v); }
+static inline Vec4 MulAdd4(Vec4 out, Vec4 in, Vec4 gain) { return _mm_add_ps(out, _mm_mul_ps(in, gain)); }
+static inline Vec2 Load2(const Float32 *p) { return _mm_castpd_ps(_mm_load_sd((const double *)p)); }
+static inline void Store2(Float32 *p, Vec2 v) { _mm_store_sd((double *)p, _mm_castps_pd(v)); }
+static inline Vec2 MulAdd2(Vec2 out, Vec2 in, Vec2 gain) { return MulAdd4(out, in, gain); }
+static inline Vec4 Splat4(Float32 value) { return _mm_set1_ps(value); }
+static inline Vec2 Splat2(Float32 value) { return _mm_set1_ps(value); }
+// Two pairs of samples from anywhere, low pair first, for stereo frames in a wider layout
+static inline Vec4 Load2x2(const Float32 *low, const Float32 *high) {
+    return _mm_loadh_pi(Load2(low), (const __m64 *)high);
+}
+static inline void Store2x2(Float32 *low, Float32 *high, Vec4 v) {
+    _mm_storel_pi((__m64 *)low, v);
+    _mm_storeh_pi((__m64 *)high, v);
+}
+// {low, low, high, high}
+static inline Vec4 Pair4(Float32 low, Float32 high) { return _mm_setr_ps(low, low, high, high); }
+
+#if defined(__AVX__)
+typedef __m256 Vec8;
+
+static inline Vec8 Load8(const Float32 *p) { return _mm256_loadu_ps(p); }
+static inline void Store8(Float32 *p, Vec8 v) { _mm256_storeu_ps(p, v); }
+static inline Vec8 MulAdd8(Vec8 out, Vec8 in, Vec8 gain) { return _mm256_add_ps(out, _mm256_mul_ps(in, gain)); }
+
+static inline bool IsZero16(const Float32 *p) {
+    __m256 any = _mm256_or_ps(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 8));
+    return _mm256_testz_si256(_mm256_castps_si256(any), _mm256_set1_epi32(0x7FFFFFFF));
+}
+#else
+// Whether all 16 samples are zero, of either sign. Shifting left by one drops the sign bits.
+static inline bool IsZero16(const Float32 *p) {
+    const __m128i *bits = (const __m128i *)p;
+    __m128i any = _mm_or_si128(_mm_or_si128(_mm_loadu_si128(bits), _mm_loadu_si128(bits + 1)),
+                               _mm_or_si128(_mm_loadu_si128(bits + 2), _mm_loadu_si128(bits + 3)));
+    __m128i zero = _mm_cmpeq_epi32(_mm_slli_epi32(any, 1), _mm_setzero_si128());
+    return _mm_movemask_epi8(zero) == 0xFFFF;
+}
+#endif
+
+#endif
+
+#ifdef __clang__
+#pragma mark Scalar Reference
+#endif
+
+void MixInterleavedWithGainScalar(const Float32 *in,
+                                  UInt32 inChannels,
+                                  Float32 *out,
+                                  UInt32 outChannels,
+                                  UInt32 frames,
+                                  const Float32 *gains) {
+    UInt32 channels = std::min(inChannels, outChannels);
+
+    for (UInt32 channel = 0; channel < channels; channel++) {
+        const Float32 *inSample = in + channel;
+        Float32 *outSample = out + channel;
+        Float32 gain = gains[channel];
+
+        for (UInt32 frame = 0; frame < frames; frame++) {
+            Float32 scaled = *inSample * gain;
+            *outSample = *outSample + scaled;
+            inSample += inChannels;
+            outSample += outChannels;
+        }
+    }
+}
+
+void MixInterleavedWithGainRampScalar(const Float32 *in,
+                                      UInt32 inChannels,
+                                      Float32 *out,
+                                      UInt32 outChannels,
+                                      UInt32 frames,
+                                      const Float32 *startGains,
+                                      const Float32 *gainSteps) {
+    UInt32 channels = std::min(inChannels, outChannels);
+
+    for (UInt32 channel = 0; channel < channels; channel++) {
+        const Float32 *inSample = in + channel;
+        Float32 *outSample = out + channel;
+
+        for (UInt32 frame = 0; frame < frames; frame++) {
+            Float32 ramp = Float32(frame) * gainSteps[channel];
+            Float32 gain = startGains[channel] + ramp;
+            Float32 scaled = *inSample * gain;
+            *outSample = *outSample + scaled;
+            inSample += inChannels;
+            outSample += outChannels;
+        }
+    }
+}
+
+// The per input channel gains for one frame, shared by both matrix implementations
+static inline void ScaleFrame(const Float32 *in,
+                              UInt32 inChannels,
+                              UInt32 frame,
+                              const Float32 *startGains,
+                              const Float32 *gainSteps,
+                              Float32 *scaled) {
+    for (UInt32 channel = 0; channel < inChannels; channel++) {
+        Float32 gain = startGains[channel];
+
+        if (gainSteps) {
+            Float32 ramp = Float32(frame) * gainSteps[channel];
+            gain = gain + ramp;
+        }
+
+        scaled[channel] = in[channel] * gain;
+    }
+}
+
+void MixInterleavedWithMatrixScalar(const Float32 *in,
+                                    UInt32 inChannels,
+                                    Float32 *out,
+                                    UInt32 outChannels,
+                                    UInt32 frames,
+                                    const Float32 *matrix,
+                                    UInt32 matrixStride,
+                                    const Float32 *startGains,
+                                    const Float32 *gainSteps) {
+    Float32 scaled[kAudioMixKernelsMaxChannels];
+
+    for (UInt32 frame = 0; frame < frames; frame++) {
+        ScaleFrame(in, inChannels, frame, startGains, gainSteps, scaled);
+
+        for (UInt32 inChannel = 0; inChannel < inChannels; inChannel++) {
+            const Float32 *column = matrix + inChannel * matrixStride;
+
+            for (UInt32 outChannel = 0; outChannel < outChannels; outChannel++) {
+                Float32 routed = scaled[inChannel] * column[outChannel];
+                out[outChannel] = out[outChannel] + routed;
+            }
+        }
+
+        in += inChannels;
+        out += outChannels;
+    }
+}
+
+Float32 DotProductScalar(const Float32 *a, const Float32 *b, UInt32 count) {
+    Float32 sums[4] = {0, 0, 0, 0};
+    UInt32 i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        for (UInt32 lane = 0; lane < 4; lane++) {
+            Float32 product = a[i + lane] * b[i + lane];
+            sums[lane] = sums[lane] + product;
+        }
+    }
+
+    Float32 sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+
+    for (; i < count; i++) {
+        Float32 product = a[i] * b[i];
+        sum = sum + product;
+    }
+
+    return sum;
+}
+
+// The sample's bits without its sign, so that -0 counts as silence too. Comparing the samples with
+// zero instead would count denormals as silence whenever the thread flushes them to zero.
+static inline UInt32 MagnitudeBits(Float32 sample) {
+    UInt32 bits;
+    memcpy(&bits, &sample, sizeof(bits));
+    return bits & 0x7FFFFFFF;
+}
+
+bool IsSilentScalar(const Float32 *samples, UInt32 count) {
+    for (UInt32 i = 0; i < count; i++) {
+        if (MagnitudeBits(samples[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#ifdef __clang__
+#pragma mark Vector Implementation
+#endif
+
+#if AUDIO_MIX_NEON || AUDIO_MIX_SSE
+
+#if defined(__AVX__)
+#define kMixVectorLanes 8
+#else
+#define kMixVectorLanes 4
+#endif
+
+// Input and output have the same layout, so the samples can be treated as one contiguous stream.
+// The gains repeat every lcm(channels, lanes) samples, which is how many we process per pass.
+static bool MixContiguous(const Float32 *in, Float32 *out, UInt32 channels, UInt32 frames, const Float32 *gains) {
+    const UInt32 period = std::lcm(channels, UInt32(kMixVectorLanes));
+
+    if (period > kAudioMixKernelsMaxChannels * 2) {
+        return false;
+    }
+
+    Float32 gainPattern[kAudioMixKernelsMaxChannels * 2];
+
+    for (UInt32 i = 0; i < period; i++) {
+        gainPattern[i] = gains[i % channels];
+    }
+
+    const UInt32 samples = frames * channels;
+    UInt32 sample = 0;
+
+    for (; sample + period <= samples; sample += period) {
+        for (UInt32 lane = 0; lane < period; lane += kMixVectorLanes) {
+#if defined(__AVX__)
+            Store8(out + sample + lane,
+                   MulAdd8(Load8(out + sample + lane), Load8(in + sample + lane), Load8(gainPattern + lane)));
+#else
+            Store4(out + sample + lane,
+                   MulAdd4(Load4(out + sample + lane), Load4(in + sample + lane), Load4(gainPattern + lane)));
+#endif
+        }
+    }
+
+    for (; sample < samples; sample++) {
+        Float32 scaled = in[sample] * gainPattern[sample % period];
+        out[sample] = out[sample] + scaled;
+    }
+
+    return true;
+}
+
+// Stereo into a multichannel device, or the front pair of a multichannel input into a stereo one.
+// Mixing one frame at a time would leave half of every vector empty, so the two shared channels of
+// two frames are gathered into one.
+static void MixPairs(const Float32 *in,
+                     UInt32 inChannels,
+                     Float32 *out,
+                     UInt32 outChannels,
+                     UInt32 frames,
+                     const Float32 *gains) {
+    const Vec4 gain = Load2x2(gains, gains);
+    UInt32 frame = 0;
+
+    for (; frame + 2 <= frames; frame += 2) {
+        Vec4 mixed = MulAdd4(Load2x2(out, out + outChannels), Load2x2(in, in + inChannels), gain);
+        Store2x2(out, out + outChannels, mixed);
+        in += 2 * inChannels;
+        out += 2 * outChannels;
+    }
+
+    if (frame < frames) {
+        Store2(out, MulAdd2(Load2(out), Load2(in), Load2(gains)));
+    }
+}
+
+// Other different layouts: each frame's shared channels are mixed in chunks of four, then two,
+// then one.
+static void MixStrided(const Float32 *in,
+                       UInt32 inChannels,
+                       Float32 *out,
+                       UInt32 outChannels,
+                       UInt32 frames,
+                       const Float32 *gains) {
+    const UInt32 channels = std::min(inChannels, outChannels);
+
+    for (UInt32 frame = 0; frame < frames; frame++) {
+        UInt32 channel = 0;
+
+        for (; channel + 4 <= channels; channel += 4) {
+            Store4(out + channel, MulAdd4(Load4(out + channel), Load4(in + channel), Load4(gains + channel)));
+        }
+
+        for (; channel + 2 <= channels; channel += 2) {
+            Store2(out + channel, MulAdd2(Load2(out + channel), Load2(in + channel), Load2(gains + channel)));
+        }
+
+        for (; channel < channels; channel++) {
+            Float32 scaled = in[channel] * gains[channel];
+            out[channel] = out[channel] + scaled;
+        }
+
+        in += inChannels;
+        out += outChannels;
+    }
+}
+
+void MixInterleavedWithGain(const Float32 *in,
+                            UInt32 inChannels,
+                            Float32 *out,
+                            UInt32 outChannels,
+                            UInt32 frames,
+                            const Float32 *gains) {
+    if (inChannels == outChannels && MixContiguous(in, out, inChannels, frames, gains)) {
+        return;
+    }
+
+    const UInt32 channels = std::min(inChannels, outChannels);
+
+    if (channels == 2) {
+        MixPairs(in, inChannels, out, outChannels, frames, gains);
+    } else if (channels > 2) {
+        MixStrided(in, inChannels, out, outChannels, frames, gains);
+    } else {
+        MixInterleavedWithGainScalar(in, inChannels, out, outChannels, frames, gains);
+    }
+}
+
+// Stereo is mixed two frames to a vector like MixPairs does, and everything else one frame at a time
+void MixInterleavedWithGainRamp(const Float32 *in,
+                                UInt32 inChannels,
+                                Float32 *out,
+                                UInt32 outChannels,
+                                UInt32 frames,
+                                const Float32 *startGains,
+                                const Float32 *gainSteps) {
+    const UInt32 channels = std::min(inChannels, outChannels);
+
+    if (channels < 2) {
+        MixInterleavedWithGainRampScalar(in, inChannels, out, outChannels, frames, startGains, gainSteps);
+        return;
+    }
+
+    UInt32 frame = 0;
+
+    if (channels == 2) {
+        const Vec4 start = Load2x2(startGains, startGains);
+        const Vec4 step = Load2x2(gainSteps, gainSteps);
+
+        // The frame numbers are converted each time rather than counted up in floats, which would
+        // stop matching Float32(frame) past 2^24
+        for (; frame + 2 <= frames; frame += 2) {
+            Vec4 gains = MulAdd4(start, Pair4(Float32(frame), Float32(frame + 1)), step);
+            Vec4 mixed = MulAdd4(Load2x2(out, out + outChannels), Load2x2(in, in + inChannels), gains);
+            Store2x2(out, out + outChannels, mixed);
+            in += 2 * inChannels;
+            out += 2 * outChannels;
+        }
+    }
+
+    for (; frame < frames; frame++) {
+        const Float32 frameIndex = Float32(frame);
+        UInt32 channel = 0;
+
+        for (; channel + 4 <= channels; channel += 4) {
+            Vec4 gains = MulAdd4(Load4(startGains + channel), Splat4(frameIndex), Load4(gainSteps + channel));
+            Store4(out + channel, MulAdd4(Load4(out + channel), Load4(in + channel), gains));
+        }
+
+        for (; channel + 2 <= channels; channel += 2) {
+            Vec2 gains = MulAdd2(Load2(startGains + channel), Splat2(frameIndex), Load2(gainSteps + channel));
+            Store2(out + channel, MulAdd2(Load2(out + channel), Load2(in + channel), gains));
+        }
+
+        for (; channel < channels; channel++) {
+            Float32 ramp = frameIndex * gainSteps[channel];
+            Float32 gain = startGains[channel] + ramp;
+            Float32 scaled = in[channel] * gain;
+            out[channel] = out[channel] + scaled;
+        }
+
+        in += inChannels;
+        out += outChannels;
+    }
+}
+
+// Downmixing to stereo fills a vector with the output of two frames and adds up every input
+// channel's share of it in a register. Otherwise every input sample is spread across the output
+// frame four, then two, then one channel at a time.
+void MixInterleavedWithMatrix(const Float32 *in,
+                              UInt32 inChannels,
+                              Float32 *out,
+                              UInt32 outChannels,
+                              UInt32 frames,
+                              const Float32 *matrix,
+                              UInt32 matrixStride,
+                              const Float32 *startGains,
+                              const Float32 *gainSteps) {
+    Float32 scaled[kAudioMixKernelsMaxChannels];
+    UInt32 frame = 0;
+
+    if (outChannels == 2) {
+        Float32 nextScaled[kAudioMixKernelsMaxChannels];
+        Vec4 columns[kAudioMixKernelsMaxChannels];
+
+        for (UInt32 inChannel = 0; inChannel < inChannels; inChannel++) {
+            const Float32 *column = matrix + inChannel * matrixStride;
+            columns[inChannel] = Load2x2(column, column);
+        }
+
+        for (; frame + 2 <= frames; frame += 2) {
+            ScaleFrame(in, inChannels, frame, startGains, gainSteps, scaled);
+            ScaleFrame(in + inChannels, inChannels, frame + 1, startGains, gainSteps, nextScaled);
+            Vec4 sum = Load4(out);
+
+            // In the same order as the scalar version adds them
+            for (UInt32 inChannel = 0; inChannel < inChannels; inChannel++) {
+                sum = MulAdd4(sum, Pair4(scaled[inChannel], nextScaled[inChannel]), columns[inChannel]);
+            }
+
+            Store4(out, sum);
+            in += 2 * inChannels;
+            out += 4;
+        }
+    }
+
+    for (; frame < frames; frame++) {
+        ScaleFrame(in, inChannels, frame, startGains, gainSteps, scaled);
+
+        for (UInt32 inChannel = 0; inChannel < inChannels; inChannel++) {
+            const Float32 *column = matrix + inChannel * matrixStride;
+            const Vec4 sample4 = Splat4(scaled[inChannel]);
+            const Vec2 sample2 = Splat2(scaled[inChannel]);
+            UInt32 channel = 0;
+
+            for (; channel + 4 <= outChannels; channel += 4) {
+                Store4(out + channel, MulAdd4(Load4(out + channel), sample4, Load4(column + channel)));
+            }
+
+            for (; channel + 2 <= outChannels; channel += 2) {
+                Store2(out + channel, MulAdd2(Load2(out + channel), sample2, Load2(column + channel)));
+            }
+
+            for (; channel < outChannels; channel++) {
+                Float32 routed = scaled[inChannel] * column[channel];
+                out[channel] = out[channel] + routed;
+            }
+        }
+
+        in += inChannels;
+        out += outChannels;
+    }
+}
+
+Float32 DotProduct(const Float32 *a, const Float32 *b, UInt32 count) {
+    Vec4 sums = Splat4(0);
+    UInt32 i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        sums = MulAdd4(sums, Load4(a + i), Load4(b + i));
+    }
+
+    Float32 lanes[4];
+    Store4(lanes, sums);
+    Float32 sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    for (; i < count; i++) {
+        Float32 product = a[i] * b[i];
+        sum = sum + product;
+    }
+
+    return sum;
+}
+
+bool IsSilent(const Float32 *samples, UInt32 count) {
+    UInt32 i = 0;
+
+    // Sixteen samples at a time, so that a buffer with sound in it is usually given away by its
+    // first few samples
+    for (; i + 16 <= count; i += 16) {
+        if (!IsZero16(samples + i)) {
+            return false;
+        }
+    }
+
+    for (; i < count; i++) {
+        if (MagnitudeBits(samples[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#else
+
+void MixInterleavedWithGain(const Float32 *in,
+                            UInt32 inChannels,
+                            Float32 *out,
+                            UInt32 outChannels,
+                            UInt32 frames,
+                            const Float32 *gains) {
+    MixInterleavedWithGainScalar(in, inChannels, out, outChannels, frames, gains);
+}
+
+void MixInterleavedWithGainRamp(const Float32 *in,
+                                UInt32 inChannels,
+                                Float32 *out,
+                                UInt32 outChannels,
+                                UInt32 frames,
+                                const Float32 *startGains,
+                                const Float32 *gainSteps) {
+    MixInterleavedWithGainRampScalar(in, inChannels, out, outChannels, frames, startGains, gainSteps);
+}
+
+void MixInterleavedWithMatrix(const Float32 *in,
+                              UInt32 inChannels,
+                              Float32 *out,
+                              UInt32 outChannels,
+                              UInt32 frames,
+                              const Float32 *matrix,
+                              UInt32 matrixStride,
+                              const Float32 *startGains,
+                              const Float32 *gainSteps) {
+    MixInterleavedWithMatrixScalar(
+        in, inChannels, out, outChannels, frames, matrix, matrixStride, startGains, gainSteps);
+}
+
+Float32 DotProduct(const Float32 *a, const Float32 *b, UInt32 count) {
+    return DotProductScalar(a, b, count);
+}
+
+bool IsSilent(const Float32 *samples, UInt32 count) {
+    return IsSilentScalar(samples, count);
+}
+
+#endif
+
+const char *AudioMixKernelsImplementationName() {
+#if AUDIO_MIX_NEON
+    return "NEON";
+#elif AUDIO_MIX_SSE && defined(__AVX__)
+    return "AVX";
+#elif AUDIO_MIX_SSE
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,93 @@
+#ifndef __AudioMixKernels_h__
+#define __AudioMixKernels_h__
+
+#include "PortableTypes.h"
+
+// Kernels for mixing interleaved float audio into an interleaved output buffer with a gain per
+// channel. For every frame f and every channel c below min(inChannels, outChannels):
+//
+//     out[f * outChannels + c] += in[f * inChannels + c] * gains[c]
+//
+// The vector implementation is picked at compile time (NEON on Apple Silicon, AVX or SSE2 on
+// Intel) and always produces results bit-identical to the scalar reference: every sample is a
+// single rounded multiply followed by a single rounded add, never a fused multiply-add.
+
+#define kAudioMixKernelsMaxChannels 32
+
+// The scalar reference implementation
+void MixInterleavedWithGainScalar(const Float32 *in,
+                                  UInt32 inChannels,
+                                  Float32 *out,
+                                  UInt32 outChannels,
+                                  UInt32 frames,
+                                  const Float32 *gains);
+
+// The vectorized implementation, falling back to the scalar one for layouts it doesn't cover
+void MixInterleavedWithGain(const Float32 *in,
+                            UInt32 inChannels,
+                            Float32 *out,
+                            UInt32 outChannels,
+                            UInt32 frames,
+                            const Float32 *gains);
+
+// Like MixInterleavedWithGain, but with the gain of every channel changing linearly over the
+// buffer, which avoids zipper noise when the volume moves. Frame f uses the gain
+//
+//     startGains[c] + f * gainSteps[c]
+void MixInterleavedWithGainRampScalar(const Float32 *in,
+                                      UInt32 inChannels,
+                                      Float32 *out,
+                                      UInt32 outChannels,
+                                      UInt32 frames,
+                                      const Float32 *startGains,
+                                      const Float32 *gainSteps);
+void MixInterleavedWithGainRamp(const Float32 *in,
+                                UInt32 inChannels,
+                                Float32 *out,
+                                UInt32 outChannels,
+                                UInt32 frames,
+                                const Float32 *startGains,
+                                const Float32 *gainSteps);
+
+// Mixes every input channel into any number of output channels, for when the input and output
+// have different channel layouts. Input channel i goes into output channel o scaled by the routing
+// gain matrix[i * matrixStride + o], on top of the gain ramp above (pass NULL gainSteps for
+// constant gains). For every frame f, every input channel i in order, and every output channel o:
+//
+//     scaled = in[f * inChannels + i] * (startGains[i] + f * gainSteps[i])
+//     out[f * outChannels + o] += scaled * matrix[i * matrixStride + o]
+//
+// inChannels can't be more than kAudioMixKernelsMaxChannels.
+void MixInterleavedWithMatrixScalar(const Float32 *in,
+                                    UInt32 inChannels,
+                                    Float32 *out,
+                                    UInt32 outChannels,
+                                    UInt32 frames,
+                                    const Float32 *matrix,
+                                    UInt32 matrixStride,
+                                    const Float32 *startGains,
+                                    const Float32 *gainSteps);
+void MixInterleavedWithMatrix(const Float32 *in,
+                              UInt32 inChannels,
+                              Float32 *out,
+                              UInt32 outChannels,
+                              UInt32 frames,
+                              const Float32 *matrix,
+                              UInt32 matrixStride,
+                              const Float32 *startGains,
+                              const Float32 *gainSteps);
+
+// The dot product of two arrays, as used by the resampler's filter. Both versions accumulate four
+// interleaved partial sums and add them up in the same order, so they give identical results.
+Float32 DotProductScalar(const Float32 *a, const Float32 *b, UInt32 count);
+Float32 DotProduct(const Float32 *a, const Float32 *b, UInt32 count);
+
+// Whether every one of the samples is zero, either +0 or -0, for finding the spans of audio that
+// are digital silence. NaNs and denormals don't count as silence.
+bool IsSilentScalar(const Float32 *samples, UInt32 count);
+bool IsSilent(const Float32 *samples, UInt32 count);
+
+// The name of the instruction set MixInterleavedWithGain was built for, for logging
+const char *AudioMixKernelsImplementationName();
+
+#endif // __AudioMixKernels_h__
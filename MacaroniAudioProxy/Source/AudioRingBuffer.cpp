@@ -1,132 +1,516 @@
 #include "AudioRingBuffer.h"
 
-AudioRingBuffer::AudioRingBuffer(UInt32 bytesPerFrame, UInt32 capacityFrames) : mBuffer(NULL) {
-    Allocate(bytesPerFrame, capacityFrames);
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <numeric>
+#include <sys/syslog.h>
+
+#if __APPLE__
+#include <mach/mach.h>
+#include <mach/mach_vm.h>
+#elif __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+AudioRingBuffer::AudioRingBuffer(UInt32 bytesPerFrame, UInt32 capacityFrames, AllocationMode mode)
+    : mBuffer(NULL),
+      mMirrored(false),
+      mStartFrame(0),
+      mEndFrame(0),
+      mEpoch(0),
+      mClearPending(false),
+      mSilentBlockCount(0) {
+    Allocate(bytesPerFrame, capacityFrames, mode);
 }
 
 AudioRingBuffer::~AudioRingBuffer() {
-    if (mBuffer)
-        free(mBuffer);
+    Deallocate();
 }
 
-void AudioRingBuffer::Allocate(UInt32 bytesPerFrame, UInt32 capacityFrames) {
-    if (mBuffer)
-        free(mBuffer);
+void AudioRingBuffer::Allocate(UInt32 bytesPerFrame, UInt32 capacityFrames, AllocationMode mode) {
+    // Not safe to call while either IO thread is using the buffer
+    Deallocate();
 
     mBytesPerFrame = bytesPerFrame;
     mCapacityFrames = capacityFrames;
     mCapacityBytes = bytesPerFrame * capacityFrames;
-    mBuffer = (Byte *)malloc(mCapacityBytes);
-    Clear();
+
+    if (mode == AllocationMode::mirrored && !AllocateMirrored()) {
+        syslog(LOG_WARNING, "ProxyAudio: couldn't map mirrored ring buffer, falling back to heap allocation");
+    }
+
+    if (!mBuffer) {
+        mBuffer = (Byte *)malloc(mCapacityBytes);
+        memset(mBuffer, 0, mCapacityBytes);
+    }
+
+    mSilentBlockCount = mCapacityFrames / kSilenceBlockFrames + 2;
+    mSilentBlocks.reset(new std::atomic<SInt64>[mSilentBlockCount]);
+
+    for (UInt32 block = 0; block < mSilentBlockCount; block++) {
+        mSilentBlocks[block].store(kNotSilent, std::memory_order_relaxed);
+    }
+
+    mClearPending.store(false, std::memory_order_relaxed);
+    BeginRewrite();
+    Reset();
+    IdleReaders();
+    EndRewrite();
+}
+
+bool AudioRingBuffer::AllocateMirrored() {
+#if __APPLE__
+    UInt32 pageSize = UInt32(vm_page_size);
+#elif __linux__
+    UInt32 pageSize = UInt32(sysconf(_SC_PAGESIZE));
+#else
+    return false;
+#endif
+
+    // Round the capacity up so that it is both a whole number of frames and a whole number of
+    // pages, otherwise the second mapping wouldn't line up with the first.
+    UInt32 framesPerStep = pageSize / std::gcd(pageSize, mBytesPerFrame);
+    UInt32 capacityFrames = ((mCapacityFrames + framesPerStep - 1) / framesPerStep) * framesPerStep;
+    UInt32 capacityBytes = capacityFrames * mBytesPerFrame;
+
+#if __APPLE__
+    mach_vm_address_t address = 0;
+    kern_return_t err = mach_vm_allocate(mach_task_self(), &address, mach_vm_size_t(capacityBytes) * 2, VM_FLAGS_ANYWHERE);
+
+    if (err != KERN_SUCCESS) {
+        return false;
+    }
+
+    // Replace the second half of the reservation with a second view of the first half's pages
+    mach_vm_address_t mirrorAddress = address + capacityBytes;
+    vm_prot_t currentProtection, maxProtection;
+    err = mach_vm_remap(mach_task_self(),
+                        &mirrorAddress,
+                        capacityBytes,
+                        0,
+                        VM_FLAGS_FIXED | VM_FLAGS_OVERWRITE,
+                        mach_task_self(),
+                        address,
+                        FALSE,
+                        &currentProtection,
+                        &maxProtection,
+                        VM_INHERIT_DEFAULT);
+
+    if (err != KERN_SUCCESS || mirrorAddress != address + capacityBytes) {
+        mach_vm_deallocate(mach_task_self(), address, mach_vm_size_t(capacityBytes) * 2);
+        return false;
+    }
+
+    mBuffer = (Byte *)address;
+#elif __linux__
+    int fd = memfd_create("AudioRingBuffer", 0);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    if (ftruncate(fd, capacityBytes) != 0) {
+        close(fd);
+        return false;
+    }
+
+    void *address = mmap(NULL, size_t(capacityBytes) * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool mapped = (address != MAP_FAILED);
+
+    mapped = mapped
+             && mmap(address, capacityBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED
+             && mmap((Byte *)address + capacityBytes,
+                     capacityBytes,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED,
+                     fd,
+                     0)
+                    != MAP_FAILED;
+    close(fd);
+
+    if (!mapped) {
+        if (address != MAP_FAILED) {
+            munmap(address, size_t(capacityBytes) * 2);
+        }
+        return false;
+    }
+
+    mBuffer = (Byte *)address;
+#endif
+
+    // Freshly mapped pages are already zeroed
+    mCapacityFrames = capacityFrames;
+    mCapacityBytes = capacityBytes;
+    mMirrored = true;
+    return true;
+}
+
+void AudioRingBuffer::Deallocate() {
+    if (!mBuffer)
+        return;
+
+    if (mMirrored) {
+#if __APPLE__
+        mach_vm_deallocate(mach_task_self(), mach_vm_address_t(mBuffer), mach_vm_size_t(mCapacityBytes) * 2);
+#elif __linux__
+        munmap(mBuffer, size_t(mCapacityBytes) * 2);
+#endif
+    } else {
+        free(mBuffer);
+    }
+
+    mBuffer = NULL;
+    mMirrored = false;
 }
 
 void AudioRingBuffer::Clear() {
-    memset(mBuffer, 0, mCapacityBytes);
-    mStartOffset = 0;
-    mStartFrame = 0;
-    mEndFrame = 0;
+    // The memory belongs to the writer, so we only flag the clear here and let the next Store do
+    // the actual work. Fetch honors the flag straight away.
+    mClearPending.store(true, std::memory_order_release);
+}
+
+void AudioRingBuffer::Reset() {
+    mEndFrame.store(0, std::memory_order_relaxed);
+    mStartFrame.store(0, std::memory_order_relaxed);
+    // The tags don't need clearing, since any frames stored from now on update the tags of their
+    // blocks the same way they would have in an empty buffer
+    mSilentRunStart = mSilentRunEnd = 0;
+}
+
+void AudioRingBuffer::BeginRewrite() {
+    // Odd epochs tell the reader that the window is being changed underneath it
+    mEpoch.store(mEpoch.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void AudioRingBuffer::EndRewrite() {
+    mEpoch.store(mEpoch.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void AudioRingBuffer::CopyIn(SInt64 frameNumber, const Byte *data, UInt32 nFrames) {
+    UInt32 offset0 = FrameOffset(frameNumber);
+    UInt32 nBytes = nFrames * mBytesPerFrame;
+
+    if (mMirrored || offset0 + nBytes <= mCapacityBytes)
+        memcpy(mBuffer + offset0, data, nBytes);
+    else {
+        UInt32 firstBytes = mCapacityBytes - offset0;
+        memcpy(mBuffer + offset0, data, firstBytes);
+        memcpy(mBuffer, data + firstBytes, nBytes - firstBytes);
+    }
+}
+
+void AudioRingBuffer::ZeroRange(SInt64 startFrame, SInt64 endFrame) {
+    if (endFrame - startFrame >= mCapacityFrames) {
+        memset(mBuffer, 0, mCapacityBytes);
+        return;
+    }
+
+    UInt32 offset0 = FrameOffset(startFrame);
+    UInt32 nBytes = UInt32(endFrame - startFrame) * mBytesPerFrame;
+
+    if (mMirrored || offset0 + nBytes <= mCapacityBytes)
+        memset(mBuffer + offset0, 0, nBytes);
+    else {
+        UInt32 firstBytes = mCapacityBytes - offset0;
+        memset(mBuffer + offset0, 0, firstBytes);
+        memset(mBuffer, 0, nBytes - firstBytes);
+    }
+}
+
+void AudioRingBuffer::UpdateSilentBlocks(SInt64 startFrame, SInt64 endFrame, bool silent) {
+    // Frames that aren't silent untag their blocks before they're copied in, and silent ones only
+    // tag the blocks that nothing but the current run of silence has been stored in since. Either
+    // way, a reader can only see the new frames once mEndFrame is published after them, or through
+    // a change of epoch if they rewrite published frames.
+    if (!silent) {
+        mSilentRunStart = mSilentRunEnd = 0;
+
+        for (SInt64 block = SilenceBlockStart(startFrame); block < endFrame; block += kSilenceBlockFrames) {
+            SilentBlockTag(block).store(kNotSilent, std::memory_order_relaxed);
+        }
+
+        return;
+    }
+
+    if (startFrame < mSilentRunStart || startFrame > mSilentRunEnd) {
+        mSilentRunStart = mSilentRunEnd = startFrame;
+    }
+
+    mSilentRunEnd = std::max(mSilentRunEnd, endFrame);
+    SInt64 block = SilenceBlockStart(startFrame);
+
+    if (block < mSilentRunStart) {
+        block += kSilenceBlockFrames;
+    }
+
+    for (; block < endFrame && block + kSilenceBlockFrames <= mSilentRunEnd; block += kSilenceBlockFrames) {
+        SilentBlockTag(block).store(block, std::memory_order_release);
+    }
 }
 
-bool AudioRingBuffer::Store(const Byte *data, UInt32 nFrames, SInt64 startFrame) {
+bool AudioRingBuffer::Store(const Byte *data, UInt32 nFrames, SInt64 startFrame, bool silent) {
     if (nFrames > mCapacityFrames)
         return false;
 
-    // $$$ we have an unaddressed critical region here
-    // reading and writing could well be in separate threads
-
+    bool clear = mClearPending.exchange(false, std::memory_order_acquire);
     SInt64 endFrame = startFrame + nFrames;
-    if (startFrame >= mEndFrame + mCapacityFrames)
+    SInt64 bufferStart = mStartFrame.load(std::memory_order_relaxed);
+    SInt64 bufferEnd = mEndFrame.load(std::memory_order_relaxed);
+
+    if (bufferStart != bufferEnd && startFrame >= bufferEnd + mCapacityFrames)
         // writing more than one buffer ahead -- fine but that means that everything we have is now too far in the past
-        Clear();
+        clear = true;
 
-    if (mStartFrame == 0) {
+    // Overwriting frames that are already published (rather than ones that are falling off the
+    // start of the window) can't be described by moving the window bounds, so the reader gets told
+    // through the epoch instead.
+    bool rewriting = clear || (bufferStart != bufferEnd && startFrame < bufferEnd);
+
+    if (rewriting)
+        BeginRewrite();
+
+    if (clear) {
+        Reset();
+        bufferStart = bufferEnd = 0;
+    }
+
+    UpdateSilentBlocks(startFrame, endFrame, silent);
+
+    if (bufferStart == bufferEnd) {
         // empty buffer
-        mStartOffset = 0;
-        mStartFrame = startFrame;
-        mEndFrame = endFrame;
-        memcpy(mBuffer, data, nFrames * mBytesPerFrame);
+        mStartFrame.store(startFrame, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        CopyIn(startFrame, data, nFrames);
+        mEndFrame.store(endFrame, std::memory_order_release);
     } else {
-        UInt32 offset0, offset1, nBytes;
-        if (endFrame > mEndFrame) {
+        if (endFrame > bufferEnd) {
             // advancing (as will be usual with sequential stores)
 
-            if (startFrame > mEndFrame) {
-                // we are skipping some samples, so zero the range we are skipping
-                offset0 = FrameOffset(mEndFrame);
-                offset1 = FrameOffset(startFrame);
-                if (offset0 < offset1)
-                    memset(mBuffer + offset0, 0, offset1 - offset0);
-                else {
-                    nBytes = mCapacityBytes - offset0;
-                    memset(mBuffer + offset0, 0, nBytes);
-                    memset(mBuffer, 0, offset1);
-                }
-            }
-            mEndFrame = endFrame;
-
-            // except for the case of not having wrapped yet, we will normally
-            // have to advance the start
-            SInt64 newStart = mEndFrame - mCapacityFrames;
-            if (newStart > mStartFrame) {
-                mStartOffset = (UInt32)(mStartOffset + ((UInt64)newStart - mStartFrame) * mBytesPerFrame) % mCapacityBytes;
-                mStartFrame = newStart;
+            // except for the case of not having wrapped yet, we will normally have to advance the
+            // start, and the reader has to hear about that before we touch the frames it is losing
+            SInt64 newStart = endFrame - mCapacityFrames;
+            if (newStart > bufferStart) {
+                CountDroppedFrames(bufferStart, newStart);
+                bufferStart = newStart;
+                mStartFrame.store(bufferStart, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
             }
+
+            if (startFrame > bufferEnd)
+                // we are skipping some samples, so zero the range we are skipping
+                ZeroRange(bufferEnd, startFrame);
         }
-        // now everything is lined up and we can just write the new data
-        offset0 = FrameOffset(startFrame);
-        offset1 = FrameOffset(endFrame);
-        if (offset0 < offset1)
-            memcpy(mBuffer + offset0, data, offset1 - offset0);
-        else {
-            nBytes = mCapacityBytes - offset0;
-            memcpy(mBuffer + offset0, data, nBytes);
-            memcpy(mBuffer, data + nBytes, offset1);
+
+        // now everything is lined up and we can just write the new data, skipping anything that
+        // has already fallen out of the window
+        if (startFrame < bufferStart) {
+            UInt32 skippedFrames = UInt32(std::min(bufferStart - startFrame, SInt64(nFrames)));
+            data += skippedFrames * mBytesPerFrame;
+            nFrames -= skippedFrames;
+            startFrame += skippedFrames;
         }
+
+        CopyIn(startFrame, data, nFrames);
+
+        if (endFrame > bufferEnd)
+            mEndFrame.store(endFrame, std::memory_order_release);
     }
 
+    if (rewriting)
+        EndRewrite();
+
     return true;
 }
 
-bool AudioRingBuffer::Fetch(Byte *data, UInt32 nFrames, SInt64 startFrame) {
+UInt32 AudioRingBuffer::UnreadFramesDroppedByStore(UInt32 nFrames, SInt64 startFrame) const {
+    SInt64 bufferStart = mStartFrame.load(std::memory_order_relaxed);
+    SInt64 bufferEnd = mEndFrame.load(std::memory_order_relaxed);
+    SInt64 newStart = startFrame + nFrames - mCapacityFrames;
+
+    if (bufferStart == bufferEnd || newStart <= bufferStart)
+        return 0;
+
+    // Frames the slowest reader hasn't read but which have already been dropped don't count
+    SInt64 firstUnread = std::max(SlowestReaderFrame(), bufferStart);
+    return (newStart > firstUnread) ? UInt32(std::min(newStart, bufferEnd) - firstUnread) : 0;
+}
+
+bool AudioRingBuffer::BeginRead(SInt64 startFrame, UInt32 nFrames, ReadSpans &spans) const {
     SInt64 endFrame = startFrame + nFrames;
 
-    if (endFrame < mStartFrame || startFrame >= mEndFrame) {
-        memset(data, 0, mBytesPerFrame * nFrames);
+    spans = ReadSpans();
+    spans.epoch = mEpoch.load(std::memory_order_acquire);
+    SInt64 bufferEnd = mEndFrame.load(std::memory_order_acquire);
+    SInt64 bufferStart = mStartFrame.load(std::memory_order_acquire);
+
+    if ((spans.epoch & 1) || mClearPending.load(std::memory_order_acquire) || bufferStart >= bufferEnd
+        || endFrame <= bufferStart || startFrame >= bufferEnd) {
+        spans.leadingZeroFrames = nFrames;
         return true;
     }
 
     bool bufferOverrun = false;
 
-    if (startFrame < mStartFrame) {
-        UInt64 bytes = (mStartFrame - startFrame) * mBytesPerFrame;
-        memset(data, 0, bytes);
-        startFrame = mStartFrame;
-        data += bytes;
+    if (startFrame < bufferStart) {
+        spans.leadingZeroFrames = UInt32(bufferStart - startFrame);
+        startFrame = bufferStart;
         bufferOverrun = true;
     }
 
-    if (endFrame > mEndFrame) {
-        UInt64 bytes = (endFrame - mEndFrame) * mBytesPerFrame;
-        UInt64 offset = (mEndFrame - startFrame) * mBytesPerFrame;
-        memset(data + offset, 0, bytes);
-        endFrame = mEndFrame;
+    if (endFrame > bufferEnd) {
+        spans.trailingZeroFrames = UInt32(endFrame - bufferEnd);
+        endFrame = bufferEnd;
         bufferOverrun = true;
     }
 
-    if (startFrame == endFrame) {
+    UInt32 offset0 = FrameOffset(startFrame);
+    UInt32 frames = UInt32(endFrame - startFrame);
+    UInt32 framesToBufferEnd = (mCapacityBytes - offset0) / mBytesPerFrame;
+
+    spans.firstFrame = startFrame;
+    spans.data[0] = mBuffer + offset0;
+
+    if (mMirrored || frames <= framesToBufferEnd) {
+        spans.frames[0] = frames;
+    } else {
+        spans.frames[0] = framesToBufferEnd;
+        spans.data[1] = mBuffer;
+        spans.frames[1] = frames - framesToBufferEnd;
+    }
+
+    return bufferOverrun;
+}
+
+bool AudioRingBuffer::EndRead(const ReadSpans &spans) const {
+    if (spans.frames[0] == 0) {
         return true;
     }
 
-    UInt32 offset0 = FrameOffset(startFrame);
-    UInt32 offset1 = FrameOffset(endFrame);
+    // Make sure the writer didn't reclaim any of the frames while they were being read. If it did,
+    // they may be torn.
+    std::atomic_thread_fence(std::memory_order_acquire);
 
-    if (offset0 < offset1)
-        memcpy(data, mBuffer + offset0, offset1 - offset0);
-    else {
-        UInt32 nBytes = mCapacityBytes - offset0;
-        memcpy(data, mBuffer + offset0, nBytes);
-        memcpy(data + nBytes, mBuffer, offset1);
+    return mEpoch.load(std::memory_order_relaxed) == spans.epoch
+           && mStartFrame.load(std::memory_order_relaxed) <= spans.firstFrame;
+}
+
+bool AudioRingBuffer::SpansAreSilent(const ReadSpans &spans) const {
+    SInt64 endFrame = spans.firstFrame + spans.frames[0] + spans.frames[1];
+
+    for (SInt64 block = SilenceBlockStart(spans.firstFrame); block < endFrame; block += kSilenceBlockFrames) {
+        if (SilentBlockTag(block).load(std::memory_order_acquire) != block) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool AudioRingBuffer::Fetch(Byte *data, UInt32 nFrames, SInt64 startFrame) {
+    ReadSpans spans;
+    bool bufferOverrun = BeginRead(startFrame, nFrames, spans);
+    Byte *out = data;
+
+    if (SpansAreSilent(spans)) {
+        memset(data, 0, nFrames * mBytesPerFrame);
+    } else {
+        memset(out, 0, spans.leadingZeroFrames * mBytesPerFrame);
+        out += spans.leadingZeroFrames * mBytesPerFrame;
+
+        for (int i = 0; i < 2 && spans.frames[i] > 0; i++) {
+            memcpy(out, spans.data[i], spans.frames[i] * mBytesPerFrame);
+            out += spans.frames[i] * mBytesPerFrame;
+        }
+
+        memset(out, 0, spans.trailingZeroFrames * mBytesPerFrame);
+    }
+
+    if (!EndRead(spans)) {
+        // torn samples are replaced with silence
+        memset(data, 0, nFrames * mBytesPerFrame);
+        return true;
     }
 
     return bufferOverrun;
 }
+
+#ifdef __clang__
+#pragma mark Readers
+#endif
+
+int AudioRingBuffer::AddReader() {
+    for (int reader = 0; reader < kMaxReaders; reader++) {
+        bool registered = false;
+
+        if (mReaders[reader].registered.compare_exchange_strong(registered, true, std::memory_order_acq_rel)) {
+            // The cursor of a free slot is always idle, so the writer won't count anything against
+            // it before the reader starts
+            mReaders[reader].overrunFrames.store(0, std::memory_order_relaxed);
+            return reader;
+        }
+    }
+
+    return -1;
+}
+
+void AudioRingBuffer::RemoveReader(int reader) {
+    if (reader < 0 || reader >= kMaxReaders)
+        return;
+
+    mReaders[reader].frame.store(kReaderIdle, std::memory_order_release);
+    mReaders[reader].registered.store(false, std::memory_order_release);
+}
+
+void AudioRingBuffer::IdleReaders() {
+    for (Reader &reader : mReaders) {
+        reader.frame.store(kReaderIdle, std::memory_order_relaxed);
+        reader.overrunFrames.store(0, std::memory_order_relaxed);
+    }
+}
+
+void AudioRingBuffer::SetReaderFrame(int reader, SInt64 frameNumber) {
+    if (reader < 0 || reader >= kMaxReaders)
+        return;
+
+    mReaders[reader].frame.store(frameNumber, std::memory_order_release);
+}
+
+UInt64 AudioRingBuffer::TakeReaderOverrunFrames(int reader) {
+    if (reader < 0 || reader >= kMaxReaders)
+        return 0;
+
+    return mReaders[reader].overrunFrames.exchange(0, std::memory_order_acquire);
+}
+
+SInt64 AudioRingBuffer::ReaderFrame(int reader) const {
+    if (reader < 0 || reader >= kMaxReaders)
+        return kReaderIdle;
+
+    return mReaders[reader].frame.load(std::memory_order_acquire);
+}
+
+SInt64 AudioRingBuffer::SlowestReaderFrame() const {
+    SInt64 slowest = kReaderIdle;
+
+    for (const Reader &reader : mReaders) {
+        slowest = std::min(slowest, reader.frame.load(std::memory_order_acquire));
+    }
+
+    return slowest;
+}
+
+void AudioRingBuffer::CountDroppedFrames(SInt64 oldStartFrame, SInt64 newStartFrame) {
+    // Only the frames between the old and new start are being dropped now. Whatever a reader
+    // missed before the old start was counted by an earlier store.
+    for (Reader &reader : mReaders) {
+        SInt64 cursor = reader.frame.load(std::memory_order_acquire);
+
+        if (cursor < newStartFrame) {
+            SInt64 dropped = newStartFrame - std::max(cursor, oldStartFrame);
+            reader.overrunFrames.fetch_add(UInt64(dropped), std::memory_order_release);
+        }
+    }
+}
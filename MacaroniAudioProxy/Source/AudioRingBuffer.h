@@ -1,30 +1,177 @@
 #ifndef __AudioRingBuffer_h__
 #define __AudioRingBuffer_h__
 
-#include <CoreServices/CoreServices.h>
+#include "PortableTypes.h"
+#include <atomic>
+#include <memory>
 
 // used for now to cache a couple of seconds (?) of input and access it for audio thruing
+//
+// The buffer is safe for exactly one thread calling Store (the HAL's IO thread) and one thread
+// calling Fetch (the proxied device's IO thread) at the same time, without either of them taking a
+// lock. The valid window of frames is published through the atomic mStartFrame / mEndFrame pair:
+// the writer moves mStartFrame forward *before* overwriting old frames and moves mEndFrame forward
+// only *after* the new frames have been copied in. The reader copies out of the window it observed
+// and then re-checks mStartFrame, treating any frames the writer may have reclaimed in the meantime
+// as an overrun rather than handing back torn samples.
+//
+// Any number of reader threads can read the buffer at the same time, since reading never changes
+// the buffer. To find out about overruns without racing to the window bounds, a reader can also
+// register a cursor, the frame number it will read next. Whenever the writer moves mStartFrame past
+// frames a registered reader hadn't got to yet, it adds them to that reader's overrun count, and
+// the cursor of the slowest reader tells the writer how far it can go without losing unread frames.
+//
+// The writer can also say that what it's storing is digital silence. The buffer keeps track of
+// which blocks of kSilenceBlockFrames frames hold nothing else, and readers can ask whether a range
+// they're reading is all silence instead of looking at every sample, so that when nothing is being
+// played the readers don't have to do anything with it.
 class AudioRingBuffer {
   public:
-    AudioRingBuffer(UInt32 bytesPerFrame, UInt32 capacityFrames);
+    // In mirrored mode the buffer's pages are mapped twice, back to back, so that any run of up to
+    // mCapacityFrames frames starting anywhere in the first copy is contiguous in memory and never
+    // has to be split at the wrap-around point. The capacity is rounded up to a whole number of
+    // pages for this. If the mapping can't be set up, the buffer falls back to a heap allocation.
+    enum class AllocationMode { heap, mirrored };
+
+    AudioRingBuffer(UInt32 bytesPerFrame, UInt32 capacityFrames, AllocationMode mode = AllocationMode::heap);
     ~AudioRingBuffer();
 
-    void Allocate(UInt32 bytesPerFrame, UInt32 capacityFrames);
+    void Allocate(UInt32 bytesPerFrame, UInt32 capacityFrames, AllocationMode mode = AllocationMode::heap);
+    bool IsMirrored() const { return mMirrored; }
+
+    // May be called from any thread. The buffer reads as empty immediately, and the memory itself
+    // is reset by the writer on its next call to Store.
     void Clear();
-    bool Store(const Byte *data, UInt32 nFrames, SInt64 frameNumber);
+
+    // Writer thread only. silent says that every sample in data is zero, which the caller has
+    // usually found out anyway. Passing false for silent data is always safe.
+    bool Store(const Byte *data, UInt32 nFrames, SInt64 frameNumber, bool silent = false);
+
+    // Reader thread only. Returns true if any of the requested frames were unavailable and had to
+    // be zero-filled.
     bool Fetch(Byte *data, UInt32 nFrames, SInt64 frameNumber);
 
-    UInt32 FrameOffset(SInt64 frameNumber) {
-        return (mStartOffset + UInt32(frameNumber - mStartFrame) * mBytesPerFrame) % mCapacityBytes;
-    }
+    // A view of nFrames frames of the buffer, in order: leadingZeroFrames of silence, up to two
+    // regions pointing straight into the buffer (the second one is only used when the range wraps
+    // and the buffer isn't mirrored), and then trailingZeroFrames of silence.
+    struct ReadSpans {
+        UInt32 leadingZeroFrames = 0;
+        const Byte *data[2] = {NULL, NULL};
+        UInt32 frames[2] = {0, 0};
+        UInt32 trailingZeroFrames = 0;
+
+        SInt64 firstFrame = 0;
+        UInt32 epoch = 0;
+    };
+
+    // Zero-copy alternative to Fetch for the reader thread. BeginRead fills in the spans and
+    // returns true if any frames were unavailable, just like Fetch. Once the caller is done reading
+    // the spans it must call EndRead, which returns false if the writer reclaimed any of those
+    // frames in the meantime, meaning that what was read may be torn.
+    bool BeginRead(SInt64 frameNumber, UInt32 nFrames, ReadSpans &spans) const;
+    bool EndRead(const ReadSpans &spans) const;
+
+    // Reader thread only, between BeginRead and EndRead. Whether the frames the spans point to are
+    // known to be silent, in which case the caller can treat the whole read as silence. It can say
+    // that silent frames aren't, for instance when only part of a block was stored as silence, but
+    // never the other way around. If EndRead then returns false, the answer doesn't count either.
+    bool SpansAreSilent(const ReadSpans &spans) const;
+
+    static const UInt32 kSilenceBlockFrames = 64;
+
+    // Cursors don't hold anything up: the writer never waits for a reader, it only keeps count of
+    // what each one missed. AddReader and RemoveReader may be called from any thread, and return
+    // and take a reader index. AddReader returns -1 if all kMaxReaders slots are taken.
+    static const int kMaxReaders = 8;
+    // The cursor of a reader that isn't reading at the moment, which never falls behind
+    static const SInt64 kReaderIdle = INT64_MAX;
+
+    int AddReader();
+    void RemoveReader(int reader);
+
+    // That reader's thread only. Moves its cursor to the next frame it will read, or to
+    // kReaderIdle, and collects the number of frames the writer dropped before the reader got to
+    // them since the last call.
+    void SetReaderFrame(int reader, SInt64 frameNumber);
+    UInt64 TakeReaderOverrunFrames(int reader);
+
+    // Any thread. Where that reader's cursor is, or kReaderIdle if it isn't reading.
+    SInt64 ReaderFrame(int reader) const;
+    // The cursor of the slowest registered reader, or kReaderIdle if none of them is reading
+    SInt64 SlowestReaderFrame() const;
+
+    // Writer thread only. How many frames no reader has read yet would be dropped from the start of
+    // the window if nFrames frames were stored at frameNumber.
+    UInt32 UnreadFramesDroppedByStore(UInt32 nFrames, SInt64 frameNumber) const;
+
+    SInt64 StartFrame() const { return mStartFrame.load(std::memory_order_acquire); }
+    SInt64 EndFrame() const { return mEndFrame.load(std::memory_order_acquire); }
 
     UInt32 mBytesPerFrame;
     UInt32 mCapacityFrames;
     UInt32 mCapacityBytes;
     Byte *mBuffer;
-    UInt32 mStartOffset;
-    SInt64 mStartFrame;
-    SInt64 mEndFrame;
+
+  private:
+    bool AllocateMirrored();
+    void Deallocate();
+    void Reset();
+    void BeginRewrite();
+    void EndRewrite();
+
+    // Frames map to a fixed position in the buffer based only on their frame number, so the reader
+    // never needs any writer state beyond the window bounds to locate them.
+    UInt32 FrameOffset(SInt64 frameNumber) const {
+        SInt64 index = frameNumber % SInt64(mCapacityFrames);
+        return UInt32((index < 0) ? index + mCapacityFrames : index) * mBytesPerFrame;
+    }
+
+    void CopyIn(SInt64 frameNumber, const Byte *data, UInt32 nFrames);
+    void CountDroppedFrames(SInt64 oldStartFrame, SInt64 newStartFrame);
+    void IdleReaders();
+    void ZeroRange(SInt64 startFrame, SInt64 endFrame);
+    void UpdateSilentBlocks(SInt64 startFrame, SInt64 endFrame, bool silent);
+
+    // The first frame of the block frameNumber is in, rounding down for negative frame numbers too
+    static SInt64 SilenceBlockStart(SInt64 frameNumber) {
+        SInt64 block = frameNumber / SInt64(kSilenceBlockFrames);
+        return ((frameNumber % SInt64(kSilenceBlockFrames) < 0) ? block - 1 : block) * kSilenceBlockFrames;
+    }
+
+    std::atomic<SInt64> &SilentBlockTag(SInt64 blockStart) const {
+        SInt64 index = (blockStart / SInt64(kSilenceBlockFrames)) % SInt64(mSilentBlockCount);
+        return mSilentBlocks[(index < 0) ? index + mSilentBlockCount : index];
+    }
+
+    bool mMirrored;
+    std::atomic<SInt64> mStartFrame;
+    std::atomic<SInt64> mEndFrame;
+    // Bumped to an odd value by the writer while it overwrites frames that may still be inside the
+    // published window (a reset, or a store that rewrites already published frames), and back to
+    // an even value once it's done.
+    std::atomic<UInt32> mEpoch;
+    std::atomic_bool mClearPending;
+
+    // Kept on separate cache lines, since every one of them is written by a different thread
+    struct alignas(64) Reader {
+        std::atomic_bool registered = {false};
+        std::atomic<SInt64> frame = {kReaderIdle};
+        std::atomic<UInt64> overrunFrames = {0};
+    };
+    Reader mReaders[kMaxReaders];
+
+    // A tag per block, holding the block's first frame number while the whole block is known to be
+    // silent and kNotSilent otherwise. Keying the tags by frame number rather than by position in
+    // the buffer means a tag left over from an older block in the same slot never matches. There
+    // are enough of them that the blocks sharing a slot are always more than the capacity apart.
+    static const SInt64 kNotSilent = INT64_MIN;
+    std::unique_ptr<std::atomic<SInt64>[]> mSilentBlocks;
+    UInt32 mSilentBlockCount;
+    // Writer thread only. The range of frames the latest run of silent stores covered, which is
+    // empty when the latest store wasn't silent. Blocks are only tagged once they're entirely
+    // inside it.
+    SInt64 mSilentRunStart;
+    SInt64 mSilentRunEnd;
 };
 
 #endif // __AudioRingBuffer_h__
@@ -0,0 +1,118 @@
+#include "ChannelMatrix.h"
+
+#include <algorithm>
+#include <cmath>
+
+AudioChannelLabel ProxyChannelLabel(UInt32 channel) {
+    static const AudioChannelLabel labels[] = {kAudioChannelLabel_Left,
+                                               kAudioChannelLabel_Right,
+                                               kAudioChannelLabel_Center,
+                                               kAudioChannelLabel_LFEScreen,
+                                               kAudioChannelLabel_LeftSurround,
+                                               kAudioChannelLabel_RightSurround,
+                                               kAudioChannelLabel_RearSurroundLeft,
+                                               kAudioChannelLabel_RearSurroundRight};
+
+    return (channel < sizeof(labels) / sizeof(labels[0])) ? labels[channel] : kAudioChannelLabel_Unknown;
+}
+
+bool MakeChannelMatrix(UInt32 inputChannels,
+                       UInt32 outputChannels,
+                       const std::vector<AudioChannelLabel> &deviceLabels,
+                       std::vector<Float32> &outMatrix) {
+    std::vector<AudioChannelLabel> outputLabels = deviceLabels;
+
+    auto hasLabel = [&](AudioChannelLabel label) {
+        return std::find(outputLabels.begin(), outputLabels.end(), label) != outputLabels.end();
+    };
+
+    // A device that doesn't describe its channels in a way we understand is assumed to use the
+    // standard order
+    if (outputLabels.size() != outputChannels
+        || (!hasLabel(kAudioChannelLabel_Left) && !hasLabel(kAudioChannelLabel_Mono))) {
+        outputLabels.clear();
+
+        for (UInt32 channel = 0; channel < outputChannels; channel++) {
+            outputLabels.push_back(outputChannels == 1 ? kAudioChannelLabel_Mono : ProxyChannelLabel(channel));
+        }
+    }
+
+    auto findOutputChannel = [&](AudioChannelLabel label) -> SInt32 {
+        auto found = std::find(outputLabels.begin(), outputLabels.end(), label);
+        return (found == outputLabels.end()) ? -1 : SInt32(found - outputLabels.begin());
+    };
+
+    outMatrix.assign(inputChannels * outputChannels, 0.0f);
+
+    for (UInt32 inputChannel = 0; inputChannel < inputChannels; inputChannel++) {
+        Float32 *row = &outMatrix[inputChannel * outputChannels];
+        AudioChannelLabel label = ProxyChannelLabel(inputChannel);
+        SInt32 exact = findOutputChannel(label);
+        SInt32 left = findOutputChannel(kAudioChannelLabel_Left);
+        SInt32 right = findOutputChannel(kAudioChannelLabel_Right);
+        SInt32 mono = findOutputChannel(kAudioChannelLabel_Mono);
+
+        if (exact >= 0) {
+            row[exact] = 1.0f;
+            continue;
+        }
+
+        // The output device doesn't have this channel, so fold it down
+        switch (label) {
+            case kAudioChannelLabel_Left:
+            case kAudioChannelLabel_Right:
+                if (mono >= 0) {
+                    row[mono] = 0.5f;
+                }
+                break;
+
+            case kAudioChannelLabel_Center:
+                if (left >= 0 && right >= 0) {
+                    row[left] = M_SQRT1_2;
+                    row[right] = M_SQRT1_2;
+                } else if (mono >= 0) {
+                    row[mono] = M_SQRT1_2;
+                }
+                break;
+
+            case kAudioChannelLabel_LeftSurround:
+            case kAudioChannelLabel_RightSurround:
+            case kAudioChannelLabel_RearSurroundLeft:
+            case kAudioChannelLabel_RearSurroundRight: {
+                bool isLeft =
+                    (label == kAudioChannelLabel_LeftSurround || label == kAudioChannelLabel_RearSurroundLeft);
+                SInt32 otherSurround = findOutputChannel(
+                    (label == kAudioChannelLabel_LeftSurround)    ? kAudioChannelLabel_RearSurroundLeft
+                    : (label == kAudioChannelLabel_RightSurround) ? kAudioChannelLabel_RearSurroundRight
+                    : (label == kAudioChannelLabel_RearSurroundLeft) ? kAudioChannelLabel_LeftSurround
+                                                                     : kAudioChannelLabel_RightSurround);
+                SInt32 front = isLeft ? left : right;
+
+                if (otherSurround >= 0) {
+                    row[otherSurround] = 1.0f;
+                } else if (front >= 0) {
+                    row[front] = M_SQRT1_2;
+                } else if (mono >= 0) {
+                    row[mono] = 0.5f;
+                }
+            } break;
+
+            default:
+                // There's nowhere sensible to put the LFE channel without bass management, so
+                // it's dropped, like most downmixes do
+                break;
+        }
+    }
+
+    for (UInt32 inputChannel = 0; inputChannel < inputChannels; inputChannel++) {
+        for (UInt32 outputChannel = 0; outputChannel < outputChannels; outputChannel++) {
+            Float32 expected = (inputChannel == outputChannel) ? 1.0f : 0.0f;
+
+            if (outMatrix[inputChannel * outputChannels + outputChannel] != expected) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
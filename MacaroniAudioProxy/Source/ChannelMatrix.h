@@ -0,0 +1,47 @@
+#ifndef __ChannelMatrix_h__
+#define __ChannelMatrix_h__
+
+#include "PortableTypes.h"
+#include <vector>
+
+#if __APPLE__
+#include <CoreAudio/CoreAudioTypes.h>
+#else
+// The Core Audio channel labels used here, with the same values
+typedef UInt32 AudioChannelLabel;
+enum : AudioChannelLabel {
+    kAudioChannelLabel_Unknown = 0xFFFFFFFF,
+    kAudioChannelLabel_Left = 1,
+    kAudioChannelLabel_Right = 2,
+    kAudioChannelLabel_Center = 3,
+    kAudioChannelLabel_LFEScreen = 4,
+    kAudioChannelLabel_LeftSurround = 5,
+    kAudioChannelLabel_RightSurround = 6,
+    kAudioChannelLabel_RearSurroundLeft = 33,
+    kAudioChannelLabel_RearSurroundRight = 34,
+    kAudioChannelLabel_Mono = 42,
+};
+#endif
+
+// How the proxy device's channels are routed onto the channels of a device it plays to.
+
+// The label of each of the proxy device's channels, in the order of the standard 5.1 and 7.1
+// layouts, which the stereo and 5.1 layouts are just the start of. kAudioChannelLabel_Unknown past
+// the last of them.
+AudioChannelLabel ProxyChannelLabel(UInt32 channel);
+
+// Fills outMatrix with the gains for MixInterleavedWithMatrix from inputChannels of the proxy
+// device's channels into an output device's outputChannels, the gain from channel i into its
+// channel o being at [i * outputChannels + o]. Each of our channels goes to the output device's
+// channel with the same label, or failing that is folded down into the nearest channels it does
+// have. outputLabels are the output device's labels for its channels; if they don't say which is
+// which, it's assumed to use the standard order.
+//
+// Returns whether the matrix routes every channel straight through to the channel in the same
+// position, so that a plain mix can be used instead.
+bool MakeChannelMatrix(UInt32 inputChannels,
+                       UInt32 outputChannels,
+                       const std::vector<AudioChannelLabel> &outputLabels,
+                       std::vector<Float32> &outMatrix);
+
+#endif // __ChannelMatrix_h__
@@ -0,0 +1,247 @@
+#ifndef __DeviceRegistry_h__
+#define __DeviceRegistry_h__
+
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+#include "PortableTypes.h"
+#include "debugHelpers.h"
+
+// What's known about each of the system's audio devices, so that finding one by its UID doesn't
+// mean asking every device for its UID in turn. Update is called whenever the HAL's device list
+// changes, and only asks the HAL about the devices that have been added since it was last called.
+// The lookups in between are hash lookups that make no HAL calls at all.
+//
+// A device's UID never changes, but the rest of what's recorded about it is only read when it's
+// added, so it's only meant for choosing between devices and for logging.
+//
+// System is where the devices come from, which is the HAL in the driver (see AudioDeviceRegistry.h)
+// and a simulated one in the tests. It provides:
+//
+//   ObjectID, String           the types of device IDs and of UIDs and names
+//   kUnknownDevice             the ID that means no device
+//   Mutex, Locker              a lock, and a scoped holder of it
+//   DeviceIDs()                the IDs of the devices, in the system's order
+//   CopyUID(id)                a device's UID, or NULL if it can't be read; the caller owns it
+//   CopyName(id)               a device's name, or NULL; the caller owns it
+//   TransportType(id), OutputChannelCount(id), HasStereoOutput(id)
+//   Retain(string), Release(string), Hash(string), Equal(string1, string2)
+//   GetCString(string, buffer, size)   for logging
+template <class System>
+class DeviceRegistry {
+  public:
+    typedef typename System::ObjectID ObjectID;
+    typedef typename System::String String;
+
+    struct Device {
+        String uid;
+        String name;
+        UInt32 transportType;
+        UInt32 outputChannelCount;
+        // Whether the device has a preferred pair of output channels for stereo
+        bool hasStereoOutput;
+    };
+
+    ~DeviceRegistry() {
+        for (auto &entry : mDevices) {
+            ReleaseDevice(entry.second);
+        }
+    }
+
+    // Brings the registry in line with the HAL's device list, and returns whether any devices were
+    // added to it or removed from it. That includes a device that couldn't be read by an earlier
+    // update and now can.
+    bool Update();
+    // Whether the last update left out any devices because they couldn't be read
+    bool HasUnreadableDevices() {
+        typename System::Locker locker(mMutex);
+        return !mUnreadableDeviceIDs.empty();
+    }
+
+    // kUnknownDevice if there's no such device
+    ObjectID DeviceForUID(String uid);
+    // The caller owns the returned UID, which is NULL if there's no such device
+    String CopyUIDForDevice(ObjectID device);
+    // The first device in the HAL's order that has stereo output, other than the one with the given
+    // UID. kUnknownDevice if there isn't one.
+    ObjectID FirstStereoOutputDeviceExcept(String uid);
+
+  private:
+    struct UIDHash {
+        size_t operator()(String uid) const { return System::Hash(uid); }
+    };
+    struct UIDEqual {
+        bool operator()(String uid1, String uid2) const { return System::Equal(uid1, uid2); }
+    };
+
+    static bool ReadDevice(ObjectID deviceID, Device &device);
+    static void ReleaseDevice(Device &device);
+
+    typename System::Mutex mMutex;
+    // In the order the HAL lists them
+    std::vector<ObjectID> mDeviceIDs;
+    // The devices in the HAL's list that the last update couldn't read
+    std::vector<ObjectID> mUnreadableDeviceIDs;
+    std::unordered_map<ObjectID, Device> mDevices;
+    // The keys are the UIDs owned by the entries in mDevices
+    std::unordered_map<String, ObjectID, UIDHash, UIDEqual> mDeviceIDsByUID;
+};
+
+template <class System>
+bool DeviceRegistry<System>::Update() {
+    std::vector<ObjectID> deviceIDs = System::DeviceIDs();
+    std::vector<ObjectID> addedIDs;
+
+    {
+        typename System::Locker locker(mMutex);
+
+        for (ObjectID deviceID : deviceIDs) {
+            if (mDevices.find(deviceID) == mDevices.end()) {
+                addedIDs.push_back(deviceID);
+            }
+        }
+    }
+
+    // The new devices are read without holding the lock, since the HAL can take a while to answer
+    // and the lookups shouldn't have to wait for it. A device that can't be read, because it's
+    // going away again for instance, is left out and tried again by the next update.
+    std::vector<std::pair<ObjectID, Device>> addedDevices;
+    std::vector<ObjectID> unreadableIDs;
+
+    for (ObjectID deviceID : addedIDs) {
+        Device device;
+
+        if (ReadDevice(deviceID, device)) {
+            addedDevices.push_back(std::make_pair(deviceID, device));
+        } else {
+            DebugMsg("ProxyAudio: AudioDeviceRegistry could not read device %u", (unsigned)deviceID);
+            unreadableIDs.push_back(deviceID);
+        }
+    }
+
+    typename System::Locker locker(mMutex);
+    bool changed = false;
+    mUnreadableDeviceIDs = unreadableIDs;
+
+    for (auto it = mDevices.begin(); it != mDevices.end();) {
+        if (std::find(deviceIDs.begin(), deviceIDs.end(), it->first) != deviceIDs.end()) {
+            ++it;
+            continue;
+        }
+
+        DebugMsg("ProxyAudio: AudioDeviceRegistry removed device %u", (unsigned)it->first);
+        mDeviceIDsByUID.erase(it->second.uid);
+        ReleaseDevice(it->second);
+        it = mDevices.erase(it);
+        changed = true;
+    }
+
+    for (auto &added : addedDevices) {
+        // Another update may have added it in the meantime
+        if (!mDevices.emplace(added.first, added.second).second) {
+            ReleaseDevice(added.second);
+            continue;
+        }
+
+        char name[128] = "";
+
+        if (added.second.name) {
+            System::GetCString(added.second.name, name, sizeof(name));
+        }
+
+        DebugMsg("ProxyAudio: AudioDeviceRegistry added device %u \"%s\", transport '%c%c%c%c', %u output channels",
+                 (unsigned)added.first,
+                 name,
+                 (added.second.transportType >> 24) & 0xFF,
+                 (added.second.transportType >> 16) & 0xFF,
+                 (added.second.transportType >> 8) & 0xFF,
+                 added.second.transportType & 0xFF,
+                 added.second.outputChannelCount);
+        mDeviceIDsByUID[added.second.uid] = added.first;
+        changed = true;
+    }
+
+    // Keep the HAL's order, leaving out any device that couldn't be read
+    mDeviceIDs.clear();
+
+    for (ObjectID deviceID : deviceIDs) {
+        if (mDevices.find(deviceID) != mDevices.end()) {
+            mDeviceIDs.push_back(deviceID);
+        }
+    }
+
+    return changed;
+}
+
+template <class System>
+typename DeviceRegistry<System>::ObjectID DeviceRegistry<System>::DeviceForUID(String uid) {
+    if (!uid) {
+        return System::kUnknownDevice;
+    }
+
+    typename System::Locker locker(mMutex);
+    auto found = mDeviceIDsByUID.find(uid);
+
+    return (found != mDeviceIDsByUID.end()) ? found->second : System::kUnknownDevice;
+}
+
+template <class System>
+typename DeviceRegistry<System>::String DeviceRegistry<System>::CopyUIDForDevice(ObjectID device) {
+    typename System::Locker locker(mMutex);
+    auto found = mDevices.find(device);
+
+    if (found == mDevices.end()) {
+        return NULL;
+    }
+
+    System::Retain(found->second.uid);
+    return found->second.uid;
+}
+
+template <class System>
+typename DeviceRegistry<System>::ObjectID DeviceRegistry<System>::FirstStereoOutputDeviceExcept(String uid) {
+    typename System::Locker locker(mMutex);
+
+    for (ObjectID deviceID : mDeviceIDs) {
+        const Device &device = mDevices[deviceID];
+
+        if (device.hasStereoOutput && !(uid && System::Equal(device.uid, uid))) {
+            return deviceID;
+        }
+    }
+
+    return System::kUnknownDevice;
+}
+
+template <class System>
+bool DeviceRegistry<System>::ReadDevice(ObjectID deviceID, Device &device) {
+    device.uid = System::CopyUID(deviceID);
+
+    if (!device.uid) {
+        return false;
+    }
+
+    device.name = System::CopyName(deviceID);
+    device.transportType = System::TransportType(deviceID);
+    device.outputChannelCount = System::OutputChannelCount(deviceID);
+    device.hasStereoOutput = System::HasStereoOutput(deviceID);
+
+    return true;
+}
+
+template <class System>
+void DeviceRegistry<System>::ReleaseDevice(Device &device) {
+    if (device.uid) {
+        System::Release(device.uid);
+        device.uid = NULL;
+    }
+
+    if (device.name) {
+        System::Release(device.name);
+        device.name = NULL;
+    }
+}
+
+#endif // __DeviceRegistry_h__
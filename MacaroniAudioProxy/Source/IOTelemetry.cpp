@@ -0,0 +1,182 @@
+#include "IOTelemetry.h"
+
+#include <algorithm>
+#include <cmath>
+
+void IOTelemetry::RecordOutputCycle(SInt64 fill,
+                                    bool overrun,
+                                    bool underrun,
+                                    UInt32 zeroFilledFrames,
+                                    UInt32 skippedFrames,
+                                    UInt64 durationNanos) {
+    Add(mOutput.cycles, 1);
+    Add(mOutput.overruns, overrun ? 1 : 0);
+    Add(mOutput.underruns, underrun ? 1 : 0);
+    Add(mOutput.zeroFilledFrames, zeroFilledFrames);
+    Add(mOutput.skippedFrames, skippedFrames);
+    Add(mOutput.fillHistogram[FillBucket(fill)], 1);
+    Add(mOutput.durationHistogram[DurationBucket(durationNanos)], 1);
+
+    UInt64 maxDuration = mOutput.maxDurationNanos.load(std::memory_order_relaxed);
+
+    while (durationNanos > maxDuration
+           && !mOutput.maxDurationNanos.compare_exchange_weak(maxDuration, durationNanos, std::memory_order_relaxed)) {
+    }
+}
+
+void IOTelemetry::RecordOutputRestart(bool warm, UInt64 latencyNanos) {
+    Add(mRestarts.restarts[warm], 1);
+    mRestarts.lastLatencyNanos[warm].store(latencyNanos, std::memory_order_relaxed);
+
+    UInt64 maxLatency = mRestarts.maxLatencyNanos[warm].load(std::memory_order_relaxed);
+
+    while (latencyNanos > maxLatency
+           && !mRestarts.maxLatencyNanos[warm].compare_exchange_weak(
+               maxLatency, latencyNanos, std::memory_order_relaxed)) {
+    }
+}
+
+UInt32 IOTelemetry::FillBucket(SInt64 fill) {
+    if (fill < 1) {
+        return 0;
+    }
+
+    // The number of bits it takes to hold the fill level
+    UInt32 bits = 64 - __builtin_clzll(UInt64(fill));
+    return std::min(bits, kFillBuckets - 1);
+}
+
+UInt32 IOTelemetry::DurationBucket(UInt64 nanos) {
+    if (nanos < 4) {
+        return UInt32(nanos);
+    }
+
+    // Four buckets per power of two, picked by the two bits after the highest set one
+    UInt32 highestBit = 63 - __builtin_clzll(nanos);
+    UInt32 bucket = 4 * (highestBit - 1) + UInt32((nanos >> (highestBit - 2)) & 3);
+    return std::min(bucket, kDurationBuckets - 1);
+}
+
+UInt64 IOTelemetry::DurationBucketUpperBound(UInt32 bucket) {
+    if (bucket < 4) {
+        return bucket + 1;
+    }
+
+    UInt32 highestBit = bucket / 4 + 1;
+    return UInt64(5 + bucket % 4) << (highestBit - 2);
+}
+
+UInt64 IOTelemetry::DurationPercentile(const UInt64 *counts, UInt64 total, Float64 percentile) {
+    UInt64 rank = std::max(UInt64(1), UInt64(ceil(total * percentile)));
+    UInt64 seen = 0;
+
+    for (UInt32 bucket = 0; bucket < kDurationBuckets; bucket++) {
+        seen += counts[bucket];
+
+        if (seen >= rank) {
+            return DurationBucketUpperBound(bucket);
+        }
+    }
+
+    return 0;
+}
+
+#if __APPLE__
+static void SetNumber(CFMutableDictionaryRef dictionary, CFStringRef key, CFNumberType type, const void *value) {
+    CFNumberRef number = CFNumberCreate(NULL, type, value);
+
+    if (number) {
+        CFDictionarySetValue(dictionary, key, number);
+        CFRelease(number);
+    }
+}
+
+static void SetCount(CFMutableDictionaryRef dictionary, CFStringRef key, const std::atomic<UInt64> &counter) {
+    SInt64 value = SInt64(counter.load(std::memory_order_relaxed));
+    SetNumber(dictionary, key, kCFNumberSInt64Type, &value);
+}
+
+CFDictionaryRef IOTelemetry::CopySnapshot() const {
+    CFMutableDictionaryRef snapshot =
+        CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+
+    if (!snapshot) {
+        return NULL;
+    }
+
+    SetCount(snapshot, CFSTR("inputCycles"), mInput.cycles);
+    SetCount(snapshot, CFSTR("silentInputCycles"), mInput.silentCycles);
+    SetCount(snapshot, CFSTR("loopbackCycles"), mInput.loopbackCycles);
+    SetCount(snapshot, CFSTR("loopbackUnderruns"), mInput.loopbackUnderruns);
+    SetCount(snapshot, CFSTR("outputCycles"), mOutput.cycles);
+    SetCount(snapshot, CFSTR("overruns"), mOutput.overruns);
+    SetCount(snapshot, CFSTR("underruns"), mOutput.underruns);
+    SetCount(snapshot, CFSTR("zeroFilledFrames"), mOutput.zeroFilledFrames);
+    SetCount(snapshot, CFSTR("skippedSilentFrames"), mOutput.skippedFrames);
+    SetCount(snapshot, CFSTR("resyncs"), mOutput.resyncs);
+
+    Float64 driftRatio = mDriftRatio.load(std::memory_order_relaxed);
+    SetNumber(snapshot, CFSTR("driftRatio"), kCFNumberFloat64Type, &driftRatio);
+
+    SetCount(snapshot, CFSTR("coldRestarts"), mRestarts.restarts[false]);
+    SetCount(snapshot, CFSTR("warmRestarts"), mRestarts.restarts[true]);
+
+    for (int warm = 0; warm < 2; warm++) {
+        if (mRestarts.restarts[warm].load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+
+        Float64 last = mRestarts.lastLatencyNanos[warm].load(std::memory_order_relaxed) / 1000.0;
+        Float64 max = mRestarts.maxLatencyNanos[warm].load(std::memory_order_relaxed) / 1000.0;
+        SetNumber(snapshot,
+                  warm ? CFSTR("warmRestartMicrosecondsLast") : CFSTR("coldRestartMicrosecondsLast"),
+                  kCFNumberFloat64Type,
+                  &last);
+        SetNumber(snapshot,
+                  warm ? CFSTR("warmRestartMicrosecondsMax") : CFSTR("coldRestartMicrosecondsMax"),
+                  kCFNumberFloat64Type,
+                  &max);
+    }
+
+    CFMutableArrayRef fillHistogram = CFArrayCreateMutable(NULL, kFillBuckets, &kCFTypeArrayCallBacks);
+
+    if (fillHistogram) {
+        for (UInt32 bucket = 0; bucket < kFillBuckets; bucket++) {
+            SInt64 count = SInt64(mOutput.fillHistogram[bucket].load(std::memory_order_relaxed));
+            CFNumberRef number = CFNumberCreate(NULL, kCFNumberSInt64Type, &count);
+
+            if (number) {
+                CFArrayAppendValue(fillHistogram, number);
+                CFRelease(number);
+            }
+        }
+
+        CFDictionarySetValue(snapshot, CFSTR("fillHistogram"), fillHistogram);
+        CFRelease(fillHistogram);
+    }
+
+    // The histogram keeps changing while we read it, so the percentiles are worked out from one
+    // copy of it
+    UInt64 durationCounts[kDurationBuckets];
+    UInt64 durationTotal = 0;
+
+    for (UInt32 bucket = 0; bucket < kDurationBuckets; bucket++) {
+        durationCounts[bucket] = mOutput.durationHistogram[bucket].load(std::memory_order_relaxed);
+        durationTotal += durationCounts[bucket];
+    }
+
+    if (durationTotal > 0) {
+        UInt64 maxDuration = mOutput.maxDurationNanos.load(std::memory_order_relaxed);
+        Float64 p50 = std::min(DurationPercentile(durationCounts, durationTotal, 0.5), maxDuration) / 1000.0;
+        Float64 p90 = std::min(DurationPercentile(durationCounts, durationTotal, 0.9), maxDuration) / 1000.0;
+        Float64 p99 = std::min(DurationPercentile(durationCounts, durationTotal, 0.99), maxDuration) / 1000.0;
+        Float64 max = maxDuration / 1000.0;
+        SetNumber(snapshot, CFSTR("ioProcMicrosecondsP50"), kCFNumberFloat64Type, &p50);
+        SetNumber(snapshot, CFSTR("ioProcMicrosecondsP90"), kCFNumberFloat64Type, &p90);
+        SetNumber(snapshot, CFSTR("ioProcMicrosecondsP99"), kCFNumberFloat64Type, &p99);
+        SetNumber(snapshot, CFSTR("ioProcMicrosecondsMax"), kCFNumberFloat64Type, &max);
+    }
+
+    return snapshot;
+}
+#endif
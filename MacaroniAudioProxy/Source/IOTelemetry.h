@@ -0,0 +1,101 @@
+#ifndef __IOTelemetry_h__
+#define __IOTelemetry_h__
+
+#include "PortableTypes.h"
+#if __APPLE__
+#include <CoreFoundation/CoreFoundation.h>
+#endif
+#include <atomic>
+
+// Counters and histograms that the IO paths update on every cycle, for finding out why audio
+// glitched without a debug build. Recording only ever does relaxed atomic adds and stores, so it's
+// safe from any number of real-time threads at once, and cheap enough to leave on all the time.
+// CopySnapshot collects everything into a property list on the control side.
+//
+// The fill level histogram counts output cycles by how far the read position was behind the proxy
+// device's clock: bucket 0 is for less than one frame, and bucket i for [2^(i-1), 2^i) frames. The
+// IO proc durations are kept in buckets a quarter of an octave wide, so the percentiles worked out
+// from them are accurate to within about 20%.
+class IOTelemetry {
+  public:
+    static const UInt32 kFillBuckets = 20;
+    static const UInt32 kDurationBuckets = 112;
+
+    // From DoIOOperation. A silent cycle is one whose mix was nothing but digital silence.
+    void RecordInputCycle(bool silent) {
+        Add(mInput.cycles, 1);
+        Add(mInput.silentCycles, silent ? 1 : 0);
+    }
+    void RecordLoopbackCycle(bool zeroFilled) {
+        Add(mInput.loopbackCycles, 1);
+        Add(mInput.loopbackUnderruns, zeroFilled ? 1 : 0);
+    }
+
+    // From the output IO procs. zeroFilledFrames counts the frames that had to be played as silence
+    // because they had either already been dropped from the ring buffer or not been written yet.
+    // skippedFrames counts the frames that were left out of resampling and mixing because there
+    // was nothing but silence to play.
+    void RecordOutputCycle(SInt64 fill,
+                           bool overrun,
+                           bool underrun,
+                           UInt32 zeroFilledFrames,
+                           UInt32 skippedFrames,
+                           UInt64 durationNanos);
+    void RecordResync() { Add(mOutput.resyncs, 1); }
+    // The primary output's resampling ratio relative to its nominal one, which is how far its
+    // clock is drifting from ours
+    void SetDriftRatio(Float64 ratio) { mDriftRatio.store(ratio, std::memory_order_relaxed); }
+    // From an output IO proc's first cycle after it was started playing again, with how long it
+    // took from then until that cycle's first frame is presented. Warm restarts are from standby,
+    // with the device still running; cold ones had to start the device.
+    void RecordOutputRestart(bool warm, UInt64 latencyNanos);
+
+#if __APPLE__
+    // A dictionary of everything recorded so far. The caller owns it.
+    CFDictionaryRef CopySnapshot() const;
+#endif
+
+  private:
+    static void Add(std::atomic<UInt64> &counter, UInt64 amount) {
+        if (amount > 0) {
+            counter.fetch_add(amount, std::memory_order_relaxed);
+        }
+    }
+
+    static UInt32 FillBucket(SInt64 fill);
+    static UInt32 DurationBucket(UInt64 nanos);
+    static UInt64 DurationBucketUpperBound(UInt32 bucket);
+    static UInt64 DurationPercentile(const UInt64 *counts, UInt64 total, Float64 percentile);
+
+    // The input and output sides are written by different threads, so they're kept apart
+    struct alignas(64) InputCounters {
+        std::atomic<UInt64> cycles = {0};
+        std::atomic<UInt64> silentCycles = {0};
+        std::atomic<UInt64> loopbackCycles = {0};
+        std::atomic<UInt64> loopbackUnderruns = {0};
+    };
+    struct alignas(64) OutputCounters {
+        std::atomic<UInt64> cycles = {0};
+        std::atomic<UInt64> overruns = {0};
+        std::atomic<UInt64> underruns = {0};
+        std::atomic<UInt64> zeroFilledFrames = {0};
+        std::atomic<UInt64> skippedFrames = {0};
+        std::atomic<UInt64> resyncs = {0};
+        std::atomic<UInt64> maxDurationNanos = {0};
+        std::atomic<UInt64> fillHistogram[kFillBuckets] = {};
+        std::atomic<UInt64> durationHistogram[kDurationBuckets] = {};
+    };
+    // Indexed by whether the restart was warm
+    struct alignas(64) RestartCounters {
+        std::atomic<UInt64> restarts[2] = {};
+        std::atomic<UInt64> lastLatencyNanos[2] = {};
+        std::atomic<UInt64> maxLatencyNanos[2] = {};
+    };
+
+    InputCounters mInput;
+    OutputCounters mOutput;
+    RestartCounters mRestarts;
+    std::atomic<Float64> mDriftRatio = {1.0};
+};
+
+#endif // __IOTelemetry_h__
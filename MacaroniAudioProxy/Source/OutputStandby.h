@@ -0,0 +1,40 @@
+#ifndef __OutputStandby_h__
+#define __OutputStandby_h__
+
+#include "PortableTypes.h"
+#include <algorithm>
+
+// How long ProxyAudioDevice keeps an output device running in standby once there's nothing to play,
+// and where a device that's starting up again starts reading.
+//
+// Stopping a device and starting it again is slow and can clip the next sound, while keeping it
+// running costs power, so the standby period adapts to how the machine is being used. Whenever a
+// device that standby stopped is needed again, the period doubles if that was sooner than the
+// period itself, since a longer standby would have kept it running, and otherwise halves, between
+// kMinSeconds and kMaxSeconds.
+//
+// See Tests/OutputStandbyTests.cpp for how that plays out.
+class OutputStandby {
+  public:
+    static constexpr Float64 kMinSeconds = 30;
+    static constexpr Float64 kMaxSeconds = 480;
+    // How far back an output device that's starting up again can go to pick up audio it would
+    // otherwise skip. It has to stay under ProxyAudioDevice's kDevice_DriftResyncFrames, or the
+    // extra fill level would trigger a resync straight away.
+    static constexpr SInt64 kPreRollFrames = 4096;
+
+    // The standby period after a device that standby stopped is needed again stoppedSeconds later
+    static Float64 NextStandbySeconds(Float64 standbySeconds, Float64 stoppedSeconds) {
+        return (stoppedSeconds < standbySeconds) ? std::min(standbySeconds * 2, kMaxSeconds)
+                                                 : std::max(standbySeconds / 2, kMinSeconds);
+    }
+
+    // Where a device that's starting up again at readFrame reads from instead: up to kPreRollFrames
+    // back, but no further than the ring buffer still holds (bufferStartFrame), and never back over
+    // what it has already played (playedFrame)
+    static SInt64 PreRollFrame(SInt64 readFrame, SInt64 bufferStartFrame, SInt64 playedFrame) {
+        return std::min(readFrame, std::max({readFrame - kPreRollFrames, bufferStartFrame, playedFrame}));
+    }
+};
+
+#endif // __OutputStandby_h__
@@ -0,0 +1,26 @@
+#ifndef __PortableTypes_h__
+#define __PortableTypes_h__
+
+// The MacTypes.h names for fixed-size integers and floats, which are all that the buffer and DSP
+// code needs from the system headers. They're defined from <cstdint> elsewhere, so that code can be
+// built and tested on its own on any platform, see Tests/Makefile.
+#if __APPLE__
+#include <MacTypes.h>
+#else
+#include <cstdint>
+
+typedef uint8_t UInt8;
+typedef int8_t SInt8;
+typedef uint16_t UInt16;
+typedef int16_t SInt16;
+typedef uint32_t UInt32;
+typedef int32_t SInt32;
+typedef uint64_t UInt64;
+typedef int64_t SInt64;
+typedef float Float32;
+typedef double Float64;
+typedef UInt8 Byte;
+typedef SInt32 OSStatus;
+#endif
+
+#endif // __PortableTypes_h__
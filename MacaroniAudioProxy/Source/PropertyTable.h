@@ -0,0 +1,78 @@
+#ifndef __PropertyTable_h__
+#define __PropertyTable_h__
+
+#include <CoreAudio/AudioServerPlugIn.h>
+#include <cstddef>
+
+// What there is to know about one of an object's properties without looking at the object's state
+struct PropertyInfo {
+    // For properties whose data size depends on the object's state, and has to be worked out by the
+    // object's GetPropertyDataSize
+    static const UInt32 kVariableSize = 0xFFFFFFFF;
+
+    AudioObjectPropertySelector selector;
+    bool settable;
+    // The property only exists in the input and output scopes
+    bool scoped;
+    UInt32 dataSize;
+
+    bool HasScope(AudioObjectPropertyScope scope) const {
+        return !scoped || scope == kAudioObjectPropertyScopeInput || scope == kAudioObjectPropertyScopeOutput;
+    }
+};
+
+// All the properties of one kind of object, so that HasProperty, IsPropertySettable and
+// GetPropertyDataSize are answered from the same list instead of each having a switch of its own.
+// The properties can be listed in any order: the table is sorted by selector when it's built, which
+// happens at compile time, and looking one up is a binary search.
+template <size_t N>
+class PropertyTable {
+  public:
+    constexpr PropertyTable(const PropertyInfo (&properties)[N]) : mProperties() {
+        for (size_t index = 0; index < N; index++) {
+            PropertyInfo property = properties[index];
+            size_t position = index;
+
+            for (; position > 0 && mProperties[position - 1].selector > property.selector; position--) {
+                mProperties[position] = mProperties[position - 1];
+            }
+
+            mProperties[position] = property;
+        }
+    }
+
+    // For a static_assert on each table, since a selector that's listed twice would make which of
+    // its entries is found depend on the order they were listed in
+    constexpr bool HasUniqueSelectors() const {
+        for (size_t index = 1; index < N; index++) {
+            if (mProperties[index - 1].selector == mProperties[index].selector) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // NULL if the object doesn't have the property
+    const PropertyInfo *Find(AudioObjectPropertySelector selector) const {
+        size_t low = 0;
+        size_t high = N;
+
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+
+            if (mProperties[middle].selector < selector) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        return (low < N && mProperties[low].selector == selector) ? &mProperties[low] : NULL;
+    }
+
+  private:
+    PropertyInfo mProperties[N];
+};
+
+#endif // __PropertyTable_h__
@@ -4,10 +4,14 @@
 #include <string>
 #include <dispatch/dispatch.h>
 #include <mach/mach_time.h>
+#include <CoreAudio/HostTime.h>
 
 #include "AudioDevice.h"
+#include "AudioMixKernels.h"
 #include "AudioRingBuffer.h"
 #include "CFTypeHelpers.h"
+#include "ChannelMatrix.h"
+#include "PropertyTable.h"
 #include "debugHelpers.h"
 #include "utilities.h"
 
@@ -562,14 +566,34 @@ OSStatus ProxyAudioDevice::Initialize(AudioServerPlugInDriverRef inDriver, Audio
     audioOutputQueue = dispatch_queue_create("net.briankendall.ProxyAudioDevice.audioOutputQueue", priorityAttribute);
     
     inputMonitoringTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, audioOutputQueue);
-    dispatch_source_set_timer(inputMonitoringTimer, dispatch_walltime(NULL, 0), 500ull * NSEC_PER_MSEC, 20ull * NSEC_PER_MSEC);
+    dispatch_source_set_timer(inputMonitoringTimer, dispatch_walltime(NULL, 0), DISPATCH_TIME_FOREVER, 20ull * NSEC_PER_MSEC);
     dispatch_source_set_event_handler(inputMonitoringTimer, ^{ monitorUserActivity(); });
     dispatch_resume(inputMonitoringTimer);
+
+    // Messages logged from the IO threads are only queued, so pass them on to syslog from here. This
+    // also makes sure the shared log is constructed here rather than on the first IO thread to log.
+    // The timer is left suspended until there are IO threads, see updateLogDrainTimerNoLock.
+    RealtimeLog::Shared();
+    logDrainTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, audioOutputQueue);
+    dispatch_source_set_timer(logDrainTimer, dispatch_walltime(NULL, 0), 100ull * NSEC_PER_MSEC, 20ull * NSEC_PER_MSEC);
+    dispatch_source_set_event_handler(logDrainTimer, ^{ RealtimeLog::Shared().Drain(); });
     
     deviceName = copyDeviceNameFromStorage();
     outputDeviceUID = copyOutputDeviceUIDFromStorage();
     outputDeviceBufferFrameSize = retrieveOutputDeviceBufferFrameSizeFromStorage();
     outputDeviceActiveCondition = retrieveOutputDeviceActiveConditionFromStorage();
+    additionalOutputDevicesList = copyAdditionalOutputDevicesFromStorage();
+    latencyMode = retrieveLatencyModeFromStorage();
+    silenceStandbySeconds = retrieveSilenceStandbySecondsFromStorage();
+    channelLayout = retrieveChannelLayoutFromStorage();
+    gDevice_ChannelsPerFrame = channelCountForLayout(channelLayout);
+
+    //    apply the latency mode's settings up front. The latency we report stays at 0 until we know
+    //    what output device we're playing to.
+    gDevice_RingBufferFrames = kDevice_LatencyModeSettings[int(latencyMode)].ringBufferFrames;
+    gDevice_CushionFrames = kDevice_LatencyModeSettings[int(latencyMode)].cushionFrames;
+    gDevice_SafetyOffset = kDevice_LatencyModeSettings[int(latencyMode)].safetyOffset;
+    outputStandbySeconds = OutputStandby::kMinSeconds;
 
     //    calculate the host ticks per frame
     struct mach_timebase_info theTimeBaseInfo;
@@ -578,8 +602,20 @@ OSStatus ProxyAudioDevice::Initialize(AudioServerPlugInDriverRef inDriver, Audio
     theHostClockFrequency *= 1000000000.0;
     gDevice_HostTicksPerFrame = theHostClockFrequency / gDevice_SampleRate;
 
-    inputBuffer = new AudioRingBuffer(gDevice_BytesPerFrameInChannel * gDevice_ChannelsPerFrame, 88200);
-    workBuffer = new Byte[gDevice_BytesPerFrameInChannel * gDevice_ChannelsPerFrame * kDevice_RingBufferSize * 2];
+    {
+        CAMutex::Locker locker(stateMutex);
+        publishControlStateNoLock();
+    }
+
+    inputBuffer = new AudioRingBuffer(gDevice_BytesPerFrameInChannel * gDevice_ChannelsPerFrame,
+                                      gDevice_RingBufferFrames,
+                                      AudioRingBuffer::AllocationMode::mirrored);
+    primaryOutput = new OutputTarget();
+    primaryOutput->owner = this;
+    primaryOutput->steersClock = true;
+    primaryOutput->ringReader = inputBuffer->AddReader();
+    createOutputResamplerNoLock(*primaryOutput);
+    DebugMsg("ProxyAudio: using %s mix kernels", AudioMixKernelsImplementationName());
 
     initializeOutputDevice();
 
@@ -697,9 +733,12 @@ OSStatus ProxyAudioDevice::PerformDeviceConfigurationChange(AudioServerPlugInDri
     //    means that the only notifications that would need to be sent here would be for either
     //    custom properties the HAL doesn't know about or for controls.
     //
-    //    For the device implemented by this driver, only sample rate changes go through this process
-    //    as it is the only state that can be changed for the device that isn't a control. For this
-    //    change, the new sample rate is passed in the inChangeAction argument.
+    //    For the device implemented by this driver, sample rate changes go through this process, with
+    //    the new sample rate passed in the inChangeAction argument, as do changes to the safety
+    //    offset and ring buffer size, with kDevice_LatencyConfigurationChange passed instead, and
+    //    changes to the channel layout, with kDevice_ChannelLayoutConfigurationChange, or both bits
+    //    at once. kDevice_LatencyConfigurationChange is also how the latency we report changes when
+    //    the primary output's device does, see publishLatencyNoLock.
 
 #pragma unused(inChangeInfo)
 
@@ -719,6 +758,20 @@ OSStatus ProxyAudioDevice::PerformDeviceConfigurationChange(AudioServerPlugInDri
                    theAnswer = kAudioHardwareBadObjectError,
                    Done,
                    "ProxyAudio_PerformDeviceConfigurationChange: bad device ID");
+
+    if ((inChangeAction & ~kDevice_ConfigurationChangeMask) == 0) {
+        //    Anything asked for since the request was made is folded into it
+        UInt64 theChanges;
+        {
+            CAMutex::Locker locker(stateMutex);
+            theChanges = pendingConfigurationChanges;
+            pendingConfigurationChanges = 0;
+        }
+
+        applyConfigurationChanges(theChanges);
+        goto Done;
+    }
+
     FailWithAction(!contains(gDevice_SampleRates, (Float64)inChangeAction),
                    theAnswer = kAudioHardwareBadObjectError,
                    Done,
@@ -737,6 +790,8 @@ OSStatus ProxyAudioDevice::PerformDeviceConfigurationChange(AudioServerPlugInDri
         theHostClockFrequency = (Float64)theTimeBaseInfo.denom / theTimeBaseInfo.numer;
         theHostClockFrequency *= 1000000000.0;
         gDevice_HostTicksPerFrame = theHostClockFrequency / gDevice_SampleRate;
+
+        publishControlStateNoLock();
     }
 
     DebugMsg("ProxyAudio: finished PerformDeviceConfigurationChange, will match sample rate");
@@ -752,13 +807,14 @@ OSStatus ProxyAudioDevice::AbortDeviceConfigurationChange(AudioServerPlugInDrive
                                                           void *inChangeInfo) {
     //    This method is called to tell the driver that a request for a config change has been denied.
     //    This provides the driver an opportunity to clean up any state associated with the request.
-    //    For this driver, an aborted config change requires no action. So we just check the arguments
-    //    and return
+    //    For this driver, that's forgetting the changes that were folded into it, so the next one
+    //    makes a new request.
 
-#pragma unused(inChangeAction, inChangeInfo)
+#pragma unused(inChangeInfo)
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    UInt64 theChanges = 0;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -770,9 +826,27 @@ OSStatus ProxyAudioDevice::AbortDeviceConfigurationChange(AudioServerPlugInDrive
                    Done,
                    "ProxyAudio_PerformDeviceConfigurationChange: bad device ID");
 
-    syslog(LOG_ERR,
-           "ProxyAudio error: was not able to change the sample rate of Proxy Audio Device to %llu",
-           inChangeAction);
+    //    inChangeAction is the new sample rate, unless it's our own kinds of change
+    if ((inChangeAction & ~kDevice_ConfigurationChangeMask) != 0) {
+        syslog(LOG_ERR,
+               "ProxyAudio error: was not able to change the sample rate of Proxy Audio Device to %llu",
+               inChangeAction);
+        goto Done;
+    }
+
+    {
+        CAMutex::Locker locker(stateMutex);
+        theChanges = pendingConfigurationChanges;
+        pendingConfigurationChanges = 0;
+    }
+
+    if (theChanges & kDevice_LatencyConfigurationChange) {
+        syslog(LOG_ERR, "ProxyAudio error: was not able to change the latency mode of Proxy Audio Device");
+    }
+
+    if (theChanges & kDevice_ChannelLayoutConfigurationChange) {
+        syslog(LOG_ERR, "ProxyAudio error: was not able to change the channel layout of Proxy Audio Device");
+    }
 
 Done:
     return theAnswer;
@@ -810,11 +884,18 @@ Boolean ProxyAudioDevice::HasProperty(AudioServerPlugInDriverRef inDriver,
             break;
 
         case kObjectID_Stream_Output:
+        case kObjectID_Stream_Input:
             theAnswer = HasStreamProperty(inDriver, inObjectID, inClientProcessID, inAddress);
             break;
 
         case kObjectID_Volume_Output_L:
         case kObjectID_Volume_Output_R:
+        case kObjectID_Volume_Output_C:
+        case kObjectID_Volume_Output_LFE:
+        case kObjectID_Volume_Output_Ls:
+        case kObjectID_Volume_Output_Rs:
+        case kObjectID_Volume_Output_Lrs:
+        case kObjectID_Volume_Output_Rrs:
         case kObjectID_Mute_Output_Master:
         case kObjectID_DataSource_Output_Master:
             theAnswer = HasControlProperty(inDriver, inObjectID, inClientProcessID, inAddress);
@@ -865,11 +946,18 @@ OSStatus ProxyAudioDevice::IsPropertySettable(AudioServerPlugInDriverRef inDrive
             break;
 
         case kObjectID_Stream_Output:
+        case kObjectID_Stream_Input:
             theAnswer = IsStreamPropertySettable(inDriver, inObjectID, inClientProcessID, inAddress, outIsSettable);
             break;
 
         case kObjectID_Volume_Output_L:
         case kObjectID_Volume_Output_R:
+        case kObjectID_Volume_Output_C:
+        case kObjectID_Volume_Output_LFE:
+        case kObjectID_Volume_Output_Ls:
+        case kObjectID_Volume_Output_Rs:
+        case kObjectID_Volume_Output_Lrs:
+        case kObjectID_Volume_Output_Rrs:
         case kObjectID_Mute_Output_Master:
         case kObjectID_DataSource_Output_Master:
             theAnswer = IsControlPropertySettable(inDriver, inObjectID, inClientProcessID, inAddress, outIsSettable);
@@ -928,12 +1016,19 @@ OSStatus ProxyAudioDevice::GetPropertyDataSize(AudioServerPlugInDriverRef inDriv
             break;
 
         case kObjectID_Stream_Output:
+        case kObjectID_Stream_Input:
             theAnswer = GetStreamPropertyDataSize(
                 inDriver, inObjectID, inClientProcessID, inAddress, inQualifierDataSize, inQualifierData, outDataSize);
             break;
 
         case kObjectID_Volume_Output_L:
         case kObjectID_Volume_Output_R:
+        case kObjectID_Volume_Output_C:
+        case kObjectID_Volume_Output_LFE:
+        case kObjectID_Volume_Output_Ls:
+        case kObjectID_Volume_Output_Rs:
+        case kObjectID_Volume_Output_Lrs:
+        case kObjectID_Volume_Output_Rrs:
         case kObjectID_Mute_Output_Master:
         case kObjectID_DataSource_Output_Master:
             theAnswer = GetControlPropertyDataSize(
@@ -1020,6 +1115,7 @@ OSStatus ProxyAudioDevice::GetPropertyData(AudioServerPlugInDriverRef inDriver,
             break;
 
         case kObjectID_Stream_Output:
+        case kObjectID_Stream_Input:
             theAnswer = GetStreamPropertyData(inDriver,
                                               inObjectID,
                                               inClientProcessID,
@@ -1033,6 +1129,12 @@ OSStatus ProxyAudioDevice::GetPropertyData(AudioServerPlugInDriverRef inDriver,
 
         case kObjectID_Volume_Output_L:
         case kObjectID_Volume_Output_R:
+        case kObjectID_Volume_Output_C:
+        case kObjectID_Volume_Output_LFE:
+        case kObjectID_Volume_Output_Ls:
+        case kObjectID_Volume_Output_Rs:
+        case kObjectID_Volume_Output_Lrs:
+        case kObjectID_Volume_Output_Rrs:
         case kObjectID_Mute_Output_Master:
         case kObjectID_DataSource_Output_Master:
             theAnswer = GetControlPropertyData(inDriver,
@@ -1120,6 +1222,7 @@ OSStatus ProxyAudioDevice::SetPropertyData(AudioServerPlugInDriverRef inDriver,
             break;
 
         case kObjectID_Stream_Output:
+        case kObjectID_Stream_Input:
             theAnswer = SetStreamPropertyData(inDriver,
                                               inObjectID,
                                               inClientProcessID,
@@ -1134,6 +1237,12 @@ OSStatus ProxyAudioDevice::SetPropertyData(AudioServerPlugInDriverRef inDriver,
 
         case kObjectID_Volume_Output_L:
         case kObjectID_Volume_Output_R:
+        case kObjectID_Volume_Output_C:
+        case kObjectID_Volume_Output_LFE:
+        case kObjectID_Volume_Output_Ls:
+        case kObjectID_Volume_Output_Rs:
+        case kObjectID_Volume_Output_Lrs:
+        case kObjectID_Volume_Output_Rrs:
         case kObjectID_Mute_Output_Master:
         case kObjectID_DataSource_Output_Master:
             theAnswer = SetControlPropertyData(inDriver,
@@ -1164,6 +1273,23 @@ Done:
 
 #pragma mark PlugIn Property Operations
 
+//    Each entry is the selector, whether the property is settable, whether it only exists in the
+//    input and output scopes, and the size of its data
+static constexpr PropertyInfo kPlugInPropertyList[] = {
+    {kAudioObjectPropertyBaseClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyOwner, false, false, sizeof(AudioObjectID)},
+    {kAudioObjectPropertyManufacturer, false, false, sizeof(CFStringRef)},
+    {kAudioObjectPropertyOwnedObjects, false, false, PropertyInfo::kVariableSize},
+    {kAudioPlugInPropertyBoxList, false, false, sizeof(AudioClassID)},
+    {kAudioPlugInPropertyTranslateUIDToBox, false, false, sizeof(AudioObjectID)},
+    {kAudioPlugInPropertyDeviceList, false, false, PropertyInfo::kVariableSize},
+    {kAudioPlugInPropertyTranslateUIDToDevice, false, false, sizeof(AudioObjectID)},
+    {kAudioPlugInPropertyResourceBundle, false, false, sizeof(CFStringRef)},
+};
+static constexpr PropertyTable kPlugInProperties(kPlugInPropertyList);
+static_assert(kPlugInProperties.HasUniqueSelectors(), "a plug-in property is listed twice");
+
 Boolean ProxyAudioDevice::HasPlugInProperty(AudioServerPlugInDriverRef inDriver,
                                             AudioObjectID inObjectID,
                                             pid_t inClientProcessID,
@@ -1174,6 +1300,7 @@ Boolean ProxyAudioDevice::HasPlugInProperty(AudioServerPlugInDriverRef inDriver,
 
     //    declare the local variables
     Boolean theAnswer = false;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailIf(inDriver != gAudioServerPlugInDriverRef, Done, "HasPlugInProperty: bad driver reference");
@@ -1183,20 +1310,8 @@ Boolean ProxyAudioDevice::HasPlugInProperty(AudioServerPlugInDriverRef inDriver,
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetPlugInPropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-        case kAudioObjectPropertyClass:
-        case kAudioObjectPropertyOwner:
-        case kAudioObjectPropertyManufacturer:
-        case kAudioObjectPropertyOwnedObjects:
-        case kAudioPlugInPropertyBoxList:
-        case kAudioPlugInPropertyTranslateUIDToBox:
-        case kAudioPlugInPropertyDeviceList:
-        case kAudioPlugInPropertyTranslateUIDToDevice:
-        case kAudioPlugInPropertyResourceBundle:
-            theAnswer = true;
-            break;
-    };
+    theProperty = kPlugInProperties.Find(inAddress->mSelector);
+    theAnswer = (theProperty != NULL) && theProperty->HasScope(inAddress->mScope);
 
 Done:
     return theAnswer;
@@ -1214,6 +1329,7 @@ OSStatus ProxyAudioDevice::IsPlugInPropertySettable(AudioServerPlugInDriverRef i
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -1236,24 +1352,13 @@ OSStatus ProxyAudioDevice::IsPlugInPropertySettable(AudioServerPlugInDriverRef i
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetPlugInPropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-        case kAudioObjectPropertyClass:
-        case kAudioObjectPropertyOwner:
-        case kAudioObjectPropertyManufacturer:
-        case kAudioObjectPropertyOwnedObjects:
-        case kAudioPlugInPropertyBoxList:
-        case kAudioPlugInPropertyTranslateUIDToBox:
-        case kAudioPlugInPropertyDeviceList:
-        case kAudioPlugInPropertyTranslateUIDToDevice:
-        case kAudioPlugInPropertyResourceBundle:
-            *outIsSettable = false;
-            break;
+    theProperty = kPlugInProperties.Find(inAddress->mSelector);
 
-        default:
-            theAnswer = kAudioHardwareUnknownPropertyError;
-            break;
-    };
+    if (theProperty == NULL) {
+        theAnswer = kAudioHardwareUnknownPropertyError;
+    } else {
+        *outIsSettable = theProperty->settable;
+    }
 
 Done:
     return theAnswer;
@@ -1272,6 +1377,7 @@ OSStatus ProxyAudioDevice::GetPlugInPropertyDataSize(AudioServerPlugInDriverRef
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -1294,59 +1400,36 @@ OSStatus ProxyAudioDevice::GetPlugInPropertyDataSize(AudioServerPlugInDriverRef
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetPlugInPropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-            *outDataSize = sizeof(AudioClassID);
-            break;
-
-        case kAudioObjectPropertyClass:
-            *outDataSize = sizeof(AudioClassID);
-            break;
-
-        case kAudioObjectPropertyOwner:
-            *outDataSize = sizeof(AudioObjectID);
-            break;
-
-        case kAudioObjectPropertyManufacturer:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioObjectPropertyOwnedObjects:
-            if (gBox_Acquired) {
-                *outDataSize = 2 * sizeof(AudioClassID);
-            } else {
-                *outDataSize = sizeof(AudioClassID);
-            }
-            break;
-
-        case kAudioPlugInPropertyBoxList:
-            *outDataSize = sizeof(AudioClassID);
-            break;
-
-        case kAudioPlugInPropertyTranslateUIDToBox:
-            *outDataSize = sizeof(AudioObjectID);
-            break;
-
-        case kAudioPlugInPropertyDeviceList:
-            if (gBox_Acquired) {
-                *outDataSize = sizeof(AudioClassID);
-            } else {
-                *outDataSize = 0;
-            }
-            break;
+    theProperty = kPlugInProperties.Find(inAddress->mSelector);
 
-        case kAudioPlugInPropertyTranslateUIDToDevice:
-            *outDataSize = sizeof(AudioObjectID);
-            break;
+    if (theProperty == NULL) {
+        theAnswer = kAudioHardwareUnknownPropertyError;
+    } else if (theProperty->dataSize != PropertyInfo::kVariableSize) {
+        *outDataSize = theProperty->dataSize;
+    } else {
+        //    The properties whose size depends on the state of the plug-in
+        switch (inAddress->mSelector) {
+            case kAudioObjectPropertyOwnedObjects:
+                if (gBox_Acquired) {
+                    *outDataSize = 2 * sizeof(AudioClassID);
+                } else {
+                    *outDataSize = sizeof(AudioClassID);
+                }
+                break;
 
-        case kAudioPlugInPropertyResourceBundle:
-            *outDataSize = sizeof(CFStringRef);
-            break;
+            case kAudioPlugInPropertyDeviceList:
+                if (gBox_Acquired) {
+                    *outDataSize = sizeof(AudioClassID);
+                } else {
+                    *outDataSize = 0;
+                }
+                break;
 
-        default:
-            theAnswer = kAudioHardwareUnknownPropertyError;
-            break;
-    };
+            default:
+                theAnswer = kAudioHardwareUnknownPropertyError;
+                break;
+        };
+    }
 
 Done:
     return theAnswer;
@@ -1491,8 +1574,9 @@ OSStatus ProxyAudioDevice::GetPlugInPropertyData(AudioServerPlugInDriverRef inDr
                            Done,
                            "GetPlugInPropertyData: not enough space for the return value of "
                            "kAudioPlugInPropertyTranslateUIDToBox");
+            //    The qualifier is the CFStringRef itself, so it has to be exactly that size
             FailWithAction(
-                inQualifierDataSize == sizeof(CFStringRef),
+                inQualifierDataSize != sizeof(CFStringRef),
                 theAnswer = kAudioHardwareBadPropertySizeError,
                 Done,
                 "GetPlugInPropertyData: the qualifier is the wrong size for kAudioPlugInPropertyTranslateUIDToBox");
@@ -1541,8 +1625,9 @@ OSStatus ProxyAudioDevice::GetPlugInPropertyData(AudioServerPlugInDriverRef inDr
                            Done,
                            "GetPlugInPropertyData: not enough space for the return value of "
                            "kAudioPlugInPropertyTranslateUIDToDevice");
+            //    The qualifier is the CFStringRef itself, as for kAudioPlugInPropertyTranslateUIDToBox
             FailWithAction(
-                inQualifierDataSize == sizeof(CFStringRef),
+                inQualifierDataSize != sizeof(CFStringRef),
                 theAnswer = kAudioHardwareBadPropertySizeError,
                 Done,
                 "GetPlugInPropertyData: the qualifier is the wrong size for kAudioPlugInPropertyTranslateUIDToDevice");
@@ -1634,6 +1719,30 @@ Done:
 
 #pragma mark Box Property Operations
 
+static constexpr PropertyInfo kBoxPropertyList[] = {
+    {kAudioObjectPropertyBaseClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyOwner, false, false, sizeof(AudioObjectID)},
+    {kAudioObjectPropertyName, true, false, sizeof(CFStringRef)},
+    {kAudioObjectPropertyModelName, false, false, sizeof(CFStringRef)},
+    {kAudioObjectPropertyManufacturer, false, false, sizeof(CFStringRef)},
+    {kAudioObjectPropertyOwnedObjects, false, false, 0},
+    {kAudioObjectPropertyIdentify, true, false, sizeof(UInt32)},
+    {kAudioObjectPropertySerialNumber, false, false, sizeof(CFStringRef)},
+    {kAudioObjectPropertyFirmwareVersion, false, false, sizeof(CFStringRef)},
+    {kAudioBoxPropertyBoxUID, false, false, sizeof(CFStringRef)},
+    {kAudioBoxPropertyTransportType, false, false, sizeof(UInt32)},
+    {kAudioBoxPropertyHasAudio, false, false, sizeof(UInt32)},
+    {kAudioBoxPropertyHasVideo, false, false, sizeof(UInt32)},
+    {kAudioBoxPropertyHasMIDI, false, false, sizeof(UInt32)},
+    {kAudioBoxPropertyIsProtected, false, false, sizeof(UInt32)},
+    {kAudioBoxPropertyAcquired, true, false, sizeof(UInt32)},
+    {kAudioBoxPropertyAcquisitionFailed, false, false, sizeof(UInt32)},
+    {kAudioBoxPropertyDeviceList, false, false, PropertyInfo::kVariableSize},
+};
+static constexpr PropertyTable kBoxProperties(kBoxPropertyList);
+static_assert(kBoxProperties.HasUniqueSelectors(), "a box property is listed twice");
+
 Boolean ProxyAudioDevice::HasBoxProperty(AudioServerPlugInDriverRef inDriver,
                                          AudioObjectID inObjectID,
                                          pid_t inClientProcessID,
@@ -1644,6 +1753,7 @@ Boolean ProxyAudioDevice::HasBoxProperty(AudioServerPlugInDriverRef inDriver,
 
     //    declare the local variables
     Boolean theAnswer = false;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailIf(inDriver != gAudioServerPlugInDriverRef, Done, "HasBoxProperty: bad driver reference");
@@ -1653,29 +1763,8 @@ Boolean ProxyAudioDevice::HasBoxProperty(AudioServerPlugInDriverRef inDriver,
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetBoxPropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-        case kAudioObjectPropertyClass:
-        case kAudioObjectPropertyOwner:
-        case kAudioObjectPropertyName:
-        case kAudioObjectPropertyModelName:
-        case kAudioObjectPropertyManufacturer:
-        case kAudioObjectPropertyOwnedObjects:
-        case kAudioObjectPropertyIdentify:
-        case kAudioObjectPropertySerialNumber:
-        case kAudioObjectPropertyFirmwareVersion:
-        case kAudioBoxPropertyBoxUID:
-        case kAudioBoxPropertyTransportType:
-        case kAudioBoxPropertyHasAudio:
-        case kAudioBoxPropertyHasVideo:
-        case kAudioBoxPropertyHasMIDI:
-        case kAudioBoxPropertyIsProtected:
-        case kAudioBoxPropertyAcquired:
-        case kAudioBoxPropertyAcquisitionFailed:
-        case kAudioBoxPropertyDeviceList:
-            theAnswer = true;
-            break;
-    };
+    theProperty = kBoxProperties.Find(inAddress->mSelector);
+    theAnswer = (theProperty != NULL) && theProperty->HasScope(inAddress->mScope);
 
 Done:
     return theAnswer;
@@ -1693,6 +1782,7 @@ OSStatus ProxyAudioDevice::IsBoxPropertySettable(AudioServerPlugInDriverRef inDr
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -1713,36 +1803,13 @@ OSStatus ProxyAudioDevice::IsBoxPropertySettable(AudioServerPlugInDriverRef inDr
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetBoxPropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-        case kAudioObjectPropertyClass:
-        case kAudioObjectPropertyOwner:
-        case kAudioObjectPropertyModelName:
-        case kAudioObjectPropertyManufacturer:
-        case kAudioObjectPropertyOwnedObjects:
-        case kAudioObjectPropertySerialNumber:
-        case kAudioObjectPropertyFirmwareVersion:
-        case kAudioBoxPropertyBoxUID:
-        case kAudioBoxPropertyTransportType:
-        case kAudioBoxPropertyHasAudio:
-        case kAudioBoxPropertyHasVideo:
-        case kAudioBoxPropertyHasMIDI:
-        case kAudioBoxPropertyIsProtected:
-        case kAudioBoxPropertyAcquisitionFailed:
-        case kAudioBoxPropertyDeviceList:
-            *outIsSettable = false;
-            break;
-
-        case kAudioObjectPropertyName:
-        case kAudioObjectPropertyIdentify:
-        case kAudioBoxPropertyAcquired:
-            *outIsSettable = true;
-            break;
+    theProperty = kBoxProperties.Find(inAddress->mSelector);
 
-        default:
-            theAnswer = kAudioHardwareUnknownPropertyError;
-            break;
-    };
+    if (theProperty == NULL) {
+        theAnswer = kAudioHardwareUnknownPropertyError;
+    } else {
+        *outIsSettable = theProperty->settable;
+    }
 
 Done:
     return theAnswer;
@@ -1761,6 +1828,7 @@ OSStatus ProxyAudioDevice::GetBoxPropertyDataSize(AudioServerPlugInDriverRef inD
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -1781,88 +1849,25 @@ OSStatus ProxyAudioDevice::GetBoxPropertyDataSize(AudioServerPlugInDriverRef inD
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetBoxPropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-            *outDataSize = sizeof(AudioClassID);
-            break;
-
-        case kAudioObjectPropertyClass:
-            *outDataSize = sizeof(AudioClassID);
-            break;
-
-        case kAudioObjectPropertyOwner:
-            *outDataSize = sizeof(AudioObjectID);
-            break;
-
-        case kAudioObjectPropertyName:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioObjectPropertyModelName:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioObjectPropertyManufacturer:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioObjectPropertyOwnedObjects:
-            *outDataSize = 0;
-            break;
-
-        case kAudioObjectPropertyIdentify:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioObjectPropertySerialNumber:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioObjectPropertyFirmwareVersion:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioBoxPropertyBoxUID:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioBoxPropertyTransportType:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioBoxPropertyHasAudio:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioBoxPropertyHasVideo:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioBoxPropertyHasMIDI:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioBoxPropertyIsProtected:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioBoxPropertyAcquired:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioBoxPropertyAcquisitionFailed:
-            *outDataSize = sizeof(UInt32);
-            break;
+    theProperty = kBoxProperties.Find(inAddress->mSelector);
 
-        case kAudioBoxPropertyDeviceList: {
-            CAMutex::Locker locker(stateMutex);
-            *outDataSize = gBox_Acquired ? sizeof(AudioObjectID) : 0;
-        } break;
+    if (theProperty == NULL) {
+        theAnswer = kAudioHardwareUnknownPropertyError;
+    } else if (theProperty->dataSize != PropertyInfo::kVariableSize) {
+        *outDataSize = theProperty->dataSize;
+    } else {
+        //    The properties whose size depends on the state of the box
+        switch (inAddress->mSelector) {
+            case kAudioBoxPropertyDeviceList: {
+                CAMutex::Locker locker(stateMutex);
+                *outDataSize = gBox_Acquired ? sizeof(AudioObjectID) : 0;
+            } break;
 
-        default:
-            theAnswer = kAudioHardwareUnknownPropertyError;
-            break;
-    };
+            default:
+                theAnswer = kAudioHardwareUnknownPropertyError;
+                break;
+        };
+    }
 
 Done:
     return theAnswer;
@@ -1877,7 +1882,7 @@ OSStatus ProxyAudioDevice::GetBoxPropertyData(AudioServerPlugInDriverRef inDrive
                                               UInt32 inDataSize,
                                               UInt32 *outDataSize,
                                               void *outData) {
-#pragma unused(inQualifierDataSize, inQualifierData)
+#pragma unused(inClientProcessID, inQualifierDataSize, inQualifierData)
 
     //    declare the local variables
     OSStatus theAnswer = 0;
@@ -1948,19 +1953,10 @@ OSStatus ProxyAudioDevice::GetBoxPropertyData(AudioServerPlugInDriverRef inDrive
                            Done,
                            "GetBoxPropertyData: not enough space for the return value of "
                            "kAudioObjectPropertyManufacturer for the box");
-
-            // See the comment in the switch case for 'kAudioObjectPropertyIdentify' in SetBoxPropertyData to get a
-            // description of the crazy hackery that is going on here.
-
-            if (inClientProcessID == configuratorPid && nextConfigurationToRead != ConfigType::none) {
-                DebugMsg("ProxyAudio: returning config data type %d instead of box name", nextConfigurationToRead);
-                *((CFStringRef *)outData) = copyConfigurationValue(nextConfigurationToRead);
-                
-            } else {
+            {
                 CAMutex::Locker locker(stateMutex);
                 *((CFStringRef *)outData) = CFStringCreateCopy(NULL, boxName);
             }
-
             *outDataSize = sizeof(CFStringRef);
             break;
 
@@ -2200,33 +2196,17 @@ OSStatus ProxyAudioDevice::SetBoxPropertyData(AudioServerPlugInDriverRef inDrive
                                Done,
                                "SetBoxPropertyData: bad value for kAudioObjectPropertyName");
 
-                // See the comment in the switch case for 'kAudioObjectPropertyIdentify' to get a description of the
-                // crazy hackery that is going on here.
-                
-                if (inClientProcessID == configuratorPid) {
-                    DebugMsg("ProxyAudio: setting box name from configurator process, performing configuration action "
-                             "instead!");
-                    CFStringSmartRef value = nullptr;
-                    ConfigType action = ConfigType::none;
-                    parseConfigurationString(*newValue, action, value);
-
-                    if (action != ConfigType::none && value) {
-                        setConfigurationValue(action, value);
-                    }
-                } else {
-                    CAMutex::Locker locker(stateMutex);
+                CAMutex::Locker locker(stateMutex);
 
-                    if (boxName != NULL) {
-                        CFRelease(boxName);
-                    }
-
-                    boxName = CFStringCreateCopy(NULL, *newValue);
-                    *outNumberPropertiesChanged = 1;
-                    outChangedAddresses[0].mSelector = kAudioObjectPropertyName;
-                    outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
-                    outChangedAddresses[0].mElement = kAudioObjectPropertyElementMaster;
-                }
+                if (boxName != NULL) {
+                    CFRelease(boxName);
+                }
 
+                boxName = CFStringCreateCopy(NULL, *newValue);
+                *outNumberPropertiesChanged = 1;
+                outChangedAddresses[0].mSelector = kAudioObjectPropertyName;
+                outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
+                outChangedAddresses[0].mElement = kAudioObjectPropertyElementMaster;
             }
             break;
 
@@ -2235,49 +2215,8 @@ OSStatus ProxyAudioDevice::SetBoxPropertyData(AudioServerPlugInDriverRef inDrive
                            theAnswer = kAudioHardwareBadPropertySizeError,
                            Done,
                            "SetBoxPropertyData: wrong size for the data for kAudioObjectPropertyIdentify");
-            {
-                SInt32 signedValue = *((SInt32 *)inData);
-
-                // To handle reading and setting configurations for the driver, we're using a rather ridiculous hack.
-                // However Apple makes it very, very difficult for a client process to configure the driver in any way.
-                // From the research I did, it seems to require at minimum using a LaunchDaemon to relay messages from a
-                // client process, which seemed like such a tedious and annoying thing to set up.
-
-                // So here's the alternative method: we use a few of the properties of the box device in ways they
-                // weren't intended to be used:
-
-                // First, if a process sets the "identify" property of the box device to its pid, then that pid will
-                // become the designated 'configurator' pid. The driver will then respond differently to read and write
-                // actions taken by the process for certain key properties on the box device.
-
-                // If the configurator process writes a negative value to the box device's identify property, then that
-                // sets the current setting (with the absolute value of what was written to the identify property
-                // corresponding to the ConfigType enum). The current setting is what will be returned if that same
-                // process reads the box device's name property. In the case of integer settings (such as the output
-                // device's buffer frame length) then it is converted to a string before being returned.
-
-                // Lastly, the configurator process can write out new values to the driver's settings again using the
-                // box's name property. When it sets it to a value in the form "settingName=value" then it will parse
-                // that string and adjust the specified setting accordingly.
-
-                // The identify and name properties of the box are used for this because they are a few of the only
-                // settings that can be written to at all, and aren't of particular importance to the operation of the
-                // driver.
-
-                if (signedValue != 0 && signedValue != 1) {
-                    if (signedValue < 0) {
-                        nextConfigurationToRead = ConfigType(-signedValue);
-                        DebugMsg("ProxyAudio: received signal, will return data on next call to box name: %d",
-                                 nextConfigurationToRead);
-                    } else {
-                        configuratorPid = signedValue;
-                        DebugMsg("ProxyAudio: received signal, configurator pid is: %d",
-                                 configuratorPid);
-                    }
-                    
-                }
-            }
-
+            //    There's no hardware to flash, so there's nothing to do. The driver is configured
+            //    through the device's custom properties instead.
             theAnswer = noErr;
             break;
 
@@ -2328,6 +2267,75 @@ Done:
 
 #pragma mark Device Property Operations
 
+static constexpr PropertyInfo kDevicePropertyList[] = {
+    {kAudioObjectPropertyBaseClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyOwner, false, false, sizeof(AudioObjectID)},
+    {kAudioObjectPropertyName, false, false, sizeof(CFStringRef)},
+    {kAudioObjectPropertyManufacturer, false, false, sizeof(CFStringRef)},
+    {kAudioObjectPropertyOwnedObjects, false, false, PropertyInfo::kVariableSize},
+    {kAudioDevicePropertyDeviceUID, false, false, sizeof(CFStringRef)},
+    {kAudioDevicePropertyModelUID, false, false, sizeof(CFStringRef)},
+    {kAudioDevicePropertyTransportType, false, false, sizeof(UInt32)},
+    {kAudioDevicePropertyRelatedDevices, false, false, sizeof(AudioObjectID)},
+    {kAudioDevicePropertyClockDomain, false, false, sizeof(UInt32)},
+    {kAudioDevicePropertyDeviceIsAlive, false, false, sizeof(AudioClassID)},
+    {kAudioDevicePropertyDeviceIsRunning, false, false, sizeof(UInt32)},
+    {kAudioDevicePropertyDeviceCanBeDefaultDevice, false, true, sizeof(UInt32)},
+    {kAudioDevicePropertyDeviceCanBeDefaultSystemDevice, false, true, sizeof(UInt32)},
+    {kAudioDevicePropertyLatency, false, true, sizeof(UInt32)},
+    {kAudioDevicePropertyStreams, false, false, PropertyInfo::kVariableSize},
+    {kAudioObjectPropertyControlList, false, false, PropertyInfo::kVariableSize},
+    {kAudioDevicePropertySafetyOffset, false, true, sizeof(UInt32)},
+    {kAudioDevicePropertyNominalSampleRate, true, false, sizeof(Float64)},
+    {kAudioDevicePropertyAvailableNominalSampleRates, false, false, PropertyInfo::kVariableSize},
+    {kAudioDevicePropertyIsHidden, false, false, sizeof(UInt32)},
+    {kAudioDevicePropertyPreferredChannelsForStereo, false, true, 2 * sizeof(UInt32)},
+    {kAudioDevicePropertyPreferredChannelLayout, false, true, PropertyInfo::kVariableSize},
+    {kAudioDevicePropertyZeroTimeStampPeriod, false, false, sizeof(UInt32)},
+    {kAudioDevicePropertyIcon, false, false, sizeof(CFURLRef)},
+    {kAudioObjectPropertyCustomPropertyInfoList, false, false, PropertyInfo::kVariableSize},
+    {kProxyAudioDevicePropertyOutputDeviceUID, true, false, sizeof(CFStringRef)},
+    {kProxyAudioDevicePropertyOutputDeviceBufferFrameSize, true, false, sizeof(CFPropertyListRef)},
+    {kProxyAudioDevicePropertyOutputDeviceActiveCondition, true, false, sizeof(CFPropertyListRef)},
+    {kProxyAudioDevicePropertyConfiguration, true, false, sizeof(CFPropertyListRef)},
+    {kProxyAudioDevicePropertyTelemetry, false, false, sizeof(CFPropertyListRef)},
+};
+static constexpr PropertyTable kDeviceProperties(kDevicePropertyList);
+static_assert(kDeviceProperties.HasUniqueSelectors(), "a device property is listed twice");
+
+const AudioServerPlugInCustomPropertyInfo ProxyAudioDevice::kDevice_CustomProperties[] = {
+    {kProxyAudioDevicePropertyOutputDeviceUID,
+     kAudioServerPlugInCustomPropertyDataTypeCFString,
+     kAudioServerPlugInCustomPropertyDataTypeNone},
+    {kProxyAudioDevicePropertyOutputDeviceBufferFrameSize,
+     kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+     kAudioServerPlugInCustomPropertyDataTypeNone},
+    {kProxyAudioDevicePropertyOutputDeviceActiveCondition,
+     kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+     kAudioServerPlugInCustomPropertyDataTypeNone},
+    {kProxyAudioDevicePropertyConfiguration,
+     kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+     kAudioServerPlugInCustomPropertyDataTypeNone},
+    {kProxyAudioDevicePropertyTelemetry,
+     kAudioServerPlugInCustomPropertyDataTypeCFPropertyList,
+     kAudioServerPlugInCustomPropertyDataTypeNone},
+};
+
+// Only for the custom properties that hold a single setting
+ProxyAudioDevice::ConfigType ProxyAudioDevice::configTypeForProperty(AudioObjectPropertySelector selector) {
+    switch (selector) {
+        case kProxyAudioDevicePropertyOutputDeviceBufferFrameSize:
+            return ConfigType::outputDeviceBufferFrameSize;
+
+        case kProxyAudioDevicePropertyOutputDeviceActiveCondition:
+            return ConfigType::deviceActiveCondition;
+
+        default:
+            return ConfigType::outputDevice;
+    }
+}
+
 Boolean ProxyAudioDevice::HasDeviceProperty(AudioServerPlugInDriverRef inDriver,
                                             AudioObjectID inObjectID,
                                             pid_t inClientProcessID,
@@ -2338,6 +2346,7 @@ Boolean ProxyAudioDevice::HasDeviceProperty(AudioServerPlugInDriverRef inDriver,
 
     //    declare the local variables
     Boolean theAnswer = false;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailIf(inDriver != gAudioServerPlugInDriverRef, Done, "HasDeviceProperty: bad driver reference");
@@ -2347,40 +2356,8 @@ Boolean ProxyAudioDevice::HasDeviceProperty(AudioServerPlugInDriverRef inDriver,
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetDevicePropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-        case kAudioObjectPropertyClass:
-        case kAudioObjectPropertyOwner:
-        case kAudioObjectPropertyName:
-        case kAudioObjectPropertyManufacturer:
-        case kAudioObjectPropertyOwnedObjects:
-        case kAudioDevicePropertyDeviceUID:
-        case kAudioDevicePropertyModelUID:
-        case kAudioDevicePropertyTransportType:
-        case kAudioDevicePropertyRelatedDevices:
-        case kAudioDevicePropertyClockDomain:
-        case kAudioDevicePropertyDeviceIsAlive:
-        case kAudioDevicePropertyDeviceIsRunning:
-        case kAudioObjectPropertyControlList:
-        case kAudioDevicePropertyNominalSampleRate:
-        case kAudioDevicePropertyAvailableNominalSampleRates:
-        case kAudioDevicePropertyIsHidden:
-        case kAudioDevicePropertyZeroTimeStampPeriod:
-        case kAudioDevicePropertyIcon:
-        case kAudioDevicePropertyStreams:
-            theAnswer = true;
-            break;
-
-        case kAudioDevicePropertyDeviceCanBeDefaultDevice:
-        case kAudioDevicePropertyDeviceCanBeDefaultSystemDevice:
-        case kAudioDevicePropertyLatency:
-        case kAudioDevicePropertySafetyOffset:
-        case kAudioDevicePropertyPreferredChannelsForStereo:
-        case kAudioDevicePropertyPreferredChannelLayout:
-            theAnswer = (inAddress->mScope == kAudioObjectPropertyScopeInput)
-                        || (inAddress->mScope == kAudioObjectPropertyScopeOutput);
-            break;
-    };
+    theProperty = kDeviceProperties.Find(inAddress->mSelector);
+    theAnswer = (theProperty != NULL) && theProperty->HasScope(inAddress->mScope);
 
 Done:
     return theAnswer;
@@ -2398,6 +2375,7 @@ OSStatus ProxyAudioDevice::IsDevicePropertySettable(AudioServerPlugInDriverRef i
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -2420,43 +2398,13 @@ OSStatus ProxyAudioDevice::IsDevicePropertySettable(AudioServerPlugInDriverRef i
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetDevicePropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-        case kAudioObjectPropertyClass:
-        case kAudioObjectPropertyOwner:
-        case kAudioObjectPropertyName:
-        case kAudioObjectPropertyManufacturer:
-        case kAudioObjectPropertyOwnedObjects:
-        case kAudioDevicePropertyDeviceUID:
-        case kAudioDevicePropertyModelUID:
-        case kAudioDevicePropertyTransportType:
-        case kAudioDevicePropertyRelatedDevices:
-        case kAudioDevicePropertyClockDomain:
-        case kAudioDevicePropertyDeviceIsAlive:
-        case kAudioDevicePropertyDeviceIsRunning:
-        case kAudioDevicePropertyDeviceCanBeDefaultDevice:
-        case kAudioDevicePropertyDeviceCanBeDefaultSystemDevice:
-        case kAudioDevicePropertyLatency:
-        case kAudioDevicePropertyStreams:
-        case kAudioObjectPropertyControlList:
-        case kAudioDevicePropertySafetyOffset:
-        case kAudioDevicePropertyAvailableNominalSampleRates:
-        case kAudioDevicePropertyIsHidden:
-        case kAudioDevicePropertyPreferredChannelsForStereo:
-        case kAudioDevicePropertyPreferredChannelLayout:
-        case kAudioDevicePropertyZeroTimeStampPeriod:
-        case kAudioDevicePropertyIcon:
-            *outIsSettable = false;
-            break;
-
-        case kAudioDevicePropertyNominalSampleRate:
-            *outIsSettable = true;
-            break;
+    theProperty = kDeviceProperties.Find(inAddress->mSelector);
 
-        default:
-            theAnswer = kAudioHardwareUnknownPropertyError;
-            break;
-    };
+    if (theProperty == NULL) {
+        theAnswer = kAudioHardwareUnknownPropertyError;
+    } else {
+        *outIsSettable = theProperty->settable;
+    }
 
 Done:
     return theAnswer;
@@ -2475,6 +2423,7 @@ OSStatus ProxyAudioDevice::GetDevicePropertyDataSize(AudioServerPlugInDriverRef
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -2497,140 +2446,70 @@ OSStatus ProxyAudioDevice::GetDevicePropertyDataSize(AudioServerPlugInDriverRef
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetDevicePropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-            *outDataSize = sizeof(AudioClassID);
-            break;
-
-        case kAudioObjectPropertyClass:
-            *outDataSize = sizeof(AudioClassID);
-            break;
-
-        case kAudioObjectPropertyOwner:
-            *outDataSize = sizeof(AudioObjectID);
-            break;
-
-        case kAudioObjectPropertyName:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioObjectPropertyManufacturer:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioObjectPropertyOwnedObjects:
-            switch (inAddress->mScope) {
-                case kAudioObjectPropertyScopeGlobal:
-                    *outDataSize = 8 * sizeof(AudioObjectID);
-                    break;
-
-                case kAudioObjectPropertyScopeInput:
-                    *outDataSize = 4 * sizeof(AudioObjectID);
-                    break;
-
-                case kAudioObjectPropertyScopeOutput:
-                    *outDataSize = 4 * sizeof(AudioObjectID);
-                    break;
-            };
-            break;
-
-        case kAudioDevicePropertyDeviceUID:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioDevicePropertyModelUID:
-            *outDataSize = sizeof(CFStringRef);
-            break;
-
-        case kAudioDevicePropertyTransportType:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyRelatedDevices:
-            *outDataSize = sizeof(AudioObjectID);
-            break;
-
-        case kAudioDevicePropertyClockDomain:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyDeviceIsAlive:
-            *outDataSize = sizeof(AudioClassID);
-            break;
-
-        case kAudioDevicePropertyDeviceIsRunning:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyDeviceCanBeDefaultDevice:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyDeviceCanBeDefaultSystemDevice:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyLatency:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyStreams:
-            switch (inAddress->mScope) {
-                case kAudioObjectPropertyScopeGlobal:
-                    *outDataSize = 2 * sizeof(AudioObjectID);
-                    break;
-
-                case kAudioObjectPropertyScopeInput:
-                    *outDataSize = 1 * sizeof(AudioObjectID);
-                    break;
-
-                case kAudioObjectPropertyScopeOutput:
-                    *outDataSize = 1 * sizeof(AudioObjectID);
-                    break;
-            };
-            break;
-
-        case kAudioObjectPropertyControlList:
-            *outDataSize = 6 * sizeof(AudioObjectID);
-            break;
-
-        case kAudioDevicePropertySafetyOffset:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyNominalSampleRate:
-            *outDataSize = sizeof(Float64);
-            break;
-
-        case kAudioDevicePropertyAvailableNominalSampleRates:
-            *outDataSize = (UInt32)gDevice_SampleRates.size() * sizeof(AudioValueRange);
-            break;
-
-        case kAudioDevicePropertyIsHidden:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyPreferredChannelsForStereo:
-            *outDataSize = 2 * sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyPreferredChannelLayout:
-            *outDataSize = offsetof(AudioChannelLayout, mChannelDescriptions)
-                           + (gDevice_ChannelsPerFrame * sizeof(AudioChannelDescription));
-            break;
-
-        case kAudioDevicePropertyZeroTimeStampPeriod:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioDevicePropertyIcon:
-            *outDataSize = sizeof(CFURLRef);
-            break;
+    theProperty = kDeviceProperties.Find(inAddress->mSelector);
 
-        default:
-            theAnswer = kAudioHardwareUnknownPropertyError;
-            break;
-    };
+    if (theProperty == NULL) {
+        theAnswer = kAudioHardwareUnknownPropertyError;
+    } else if (theProperty->dataSize != PropertyInfo::kVariableSize) {
+        *outDataSize = theProperty->dataSize;
+    } else {
+        //    The properties whose size depends on the state of the device
+        switch (inAddress->mSelector) {
+            case kAudioObjectPropertyOwnedObjects:
+                switch (inAddress->mScope) {
+                    case kAudioObjectPropertyScopeGlobal:
+                        *outDataSize = (2 + deviceControlCount()) * sizeof(AudioObjectID);
+                        break;
+
+                    case kAudioObjectPropertyScopeInput:
+                        *outDataSize = 1 * sizeof(AudioObjectID);
+                        break;
+
+                    case kAudioObjectPropertyScopeOutput:
+                        *outDataSize = (1 + deviceControlCount()) * sizeof(AudioObjectID);
+                        break;
+                };
+                break;
+
+            case kAudioDevicePropertyStreams:
+                switch (inAddress->mScope) {
+                    case kAudioObjectPropertyScopeGlobal:
+                        *outDataSize = 2 * sizeof(AudioObjectID);
+                        break;
+
+                    case kAudioObjectPropertyScopeInput:
+                        *outDataSize = 1 * sizeof(AudioObjectID);
+                        break;
+
+                    case kAudioObjectPropertyScopeOutput:
+                        *outDataSize = 1 * sizeof(AudioObjectID);
+                        break;
+                };
+                break;
+
+            case kAudioObjectPropertyControlList:
+                *outDataSize = deviceControlCount() * sizeof(AudioObjectID);
+                break;
+
+            case kAudioDevicePropertyAvailableNominalSampleRates:
+                *outDataSize = (UInt32)gDevice_SampleRates.size() * sizeof(AudioValueRange);
+                break;
+
+            case kAudioDevicePropertyPreferredChannelLayout: {
+                CAMutex::Locker locker(stateMutex);
+                *outDataSize = offsetof(AudioChannelLayout, mChannelDescriptions)
+                               + (gDevice_ChannelsPerFrame * sizeof(AudioChannelDescription));
+            } break;
+
+            case kAudioObjectPropertyCustomPropertyInfoList:
+                *outDataSize = kDevice_CustomPropertyCount * sizeof(AudioServerPlugInCustomPropertyInfo);
+                break;
+
+            default:
+                theAnswer = kAudioHardwareUnknownPropertyError;
+                break;
+        };
+    }
 
 Done:
     return theAnswer;
@@ -2739,34 +2618,46 @@ OSStatus ProxyAudioDevice::GetDevicePropertyData(AudioServerPlugInDriverRef inDr
             //    case, only that number of items will be returned
             theNumberItemsToFetch = inDataSize / sizeof(AudioObjectID);
 
-            //    The device owns its streams and controls. Note that what is returned here
-            //    depends on the scope requested.
+            //    The device owns its two streams and its controls, all of which are on the output
+            //    side. Note that what is returned here depends on the scope requested.
             switch (inAddress->mScope) {
                 case kAudioObjectPropertyScopeGlobal:
-                    //    global scope means return all objects
-                    if (theNumberItemsToFetch > 4) {
-                        theNumberItemsToFetch = 4;
+                    //    global scope means return all objects, the streams first
+                    if (theNumberItemsToFetch > 2 + deviceControlCount()) {
+                        theNumberItemsToFetch = 2 + deviceControlCount();
                     }
 
-                    //    fill out the list with as many objects as requested, which is everything
                     for (theItemIndex = 0; theItemIndex < theNumberItemsToFetch; ++theItemIndex) {
-                        ((AudioObjectID *)outData)[theItemIndex] = kObjectID_Stream_Output + theItemIndex;
+                        if (theItemIndex == 0) {
+                            ((AudioObjectID *)outData)[theItemIndex] = kObjectID_Stream_Output;
+                        } else if (theItemIndex == 1) {
+                            ((AudioObjectID *)outData)[theItemIndex] = kObjectID_Stream_Input;
+                        } else {
+                            ((AudioObjectID *)outData)[theItemIndex] = deviceControlAtIndex(theItemIndex - 2);
+                        }
                     }
                     break;
 
-                case kAudioObjectPropertyScopeInput:
-                    theNumberItemsToFetch = 0;
-                    break;
-
                 case kAudioObjectPropertyScopeOutput:
-                    //    output scope means just the objects on the output side
-                    if (theNumberItemsToFetch > 4) {
-                        theNumberItemsToFetch = 4;
+                    //    output scope means just the objects on the output side, stream first
+                    if (theNumberItemsToFetch > 1 + deviceControlCount()) {
+                        theNumberItemsToFetch = 1 + deviceControlCount();
                     }
 
-                    //    fill out the list with the right objects
                     for (theItemIndex = 0; theItemIndex < theNumberItemsToFetch; ++theItemIndex) {
-                        ((AudioObjectID *)outData)[theItemIndex] = kObjectID_Stream_Output + theItemIndex;
+                        ((AudioObjectID *)outData)[theItemIndex] =
+                            (theItemIndex == 0) ? kObjectID_Stream_Output : deviceControlAtIndex(theItemIndex - 1);
+                    }
+                    break;
+
+                case kAudioObjectPropertyScopeInput:
+                    //    input scope means just the loopback stream
+                    if (theNumberItemsToFetch > 1) {
+                        theNumberItemsToFetch = 1;
+                    }
+
+                    if (theNumberItemsToFetch > 0) {
+                        ((AudioObjectID *)outData)[0] = kObjectID_Stream_Input;
                     }
                     break;
             };
@@ -2915,14 +2806,20 @@ OSStatus ProxyAudioDevice::GetDevicePropertyData(AudioServerPlugInDriverRef inDr
             break;
 
         case kAudioDevicePropertyLatency:
-            //    This property returns the presentation latency of the device. For this,
-            //    device, the value is 0 due to the fact that it always vends silence.
+            //    This property returns the presentation latency of the device. For this device,
+            //    that's how long it takes a frame to make it out of the device we're playing to
+            //    after the time it was written for, as calculated by calculateLatencyNoLock().
+            //    The loopback input hands back every frame at the same time it was written for,
+            //    so it has none.
             FailWithAction(inDataSize < sizeof(UInt32),
                            theAnswer = kAudioHardwareBadPropertySizeError,
                            Done,
                            "GetDevicePropertyData: not enough space for the return value of "
                            "kAudioDevicePropertyLatency for the device");
-            *((UInt32 *)outData) = 0;
+            {
+                CAMutex::Locker locker(stateMutex);
+                *((UInt32 *)outData) = (inAddress->mScope == kAudioObjectPropertyScopeInput) ? 0 : gDevice_Latency;
+            }
             *outDataSize = sizeof(UInt32);
             break;
 
@@ -2936,21 +2833,28 @@ OSStatus ProxyAudioDevice::GetDevicePropertyData(AudioServerPlugInDriverRef inDr
             switch (inAddress->mScope) {
                 case kAudioObjectPropertyScopeGlobal:
                     //    global scope means return all streams
-                    if (theNumberItemsToFetch > 1) {
-                        theNumberItemsToFetch = 1;
+                    if (theNumberItemsToFetch > 2) {
+                        theNumberItemsToFetch = 2;
                     }
 
                     //    fill out the list with as many objects as requested
                     if (theNumberItemsToFetch > 0) {
                         ((AudioObjectID *)outData)[0] = kObjectID_Stream_Output;
                     }
-                    // if (theNumberItemsToFetch > 1) {
-                    //    ((AudioObjectID *)outData)[1] = kObjectID_Stream_Output;
-                    //}
+                    if (theNumberItemsToFetch > 1) {
+                        ((AudioObjectID *)outData)[1] = kObjectID_Stream_Input;
+                    }
                     break;
 
                 case kAudioObjectPropertyScopeInput:
-                    theNumberItemsToFetch = 0;
+                    //    input scope means just the loopback stream
+                    if (theNumberItemsToFetch > 1) {
+                        theNumberItemsToFetch = 1;
+                    }
+
+                    if (theNumberItemsToFetch > 0) {
+                        ((AudioObjectID *)outData)[0] = kObjectID_Stream_Input;
+                    }
                     break;
 
                 case kAudioObjectPropertyScopeOutput:
@@ -2975,13 +2879,13 @@ OSStatus ProxyAudioDevice::GetDevicePropertyData(AudioServerPlugInDriverRef inDr
             //    number is allowed to be smaller than the actual size of the list. In such
             //    case, only that number of items will be returned
             theNumberItemsToFetch = inDataSize / sizeof(AudioObjectID);
-            if (theNumberItemsToFetch > 4) {
-                theNumberItemsToFetch = 4;
+            if (theNumberItemsToFetch > deviceControlCount()) {
+                theNumberItemsToFetch = deviceControlCount();
             }
 
             //    fill out the list with as many objects as requested, which is everything
             for (theItemIndex = 0; theItemIndex < theNumberItemsToFetch; ++theItemIndex) {
-                ((AudioObjectID *)outData)[theItemIndex] = kObjectID_Volume_Output_L + theItemIndex;
+                ((AudioObjectID *)outData)[theItemIndex] = deviceControlAtIndex(theItemIndex);
             }
 
             //    report how much we wrote
@@ -2990,13 +2894,16 @@ OSStatus ProxyAudioDevice::GetDevicePropertyData(AudioServerPlugInDriverRef inDr
 
         case kAudioDevicePropertySafetyOffset:
             //    This property returns the how close to now the HAL can read and write. For
-            //    this, device, the value is 0 due to the fact that it always vends silence.
+            //    this device, it depends on the latency mode.
             FailWithAction(inDataSize < sizeof(UInt32),
                            theAnswer = kAudioHardwareBadPropertySizeError,
                            Done,
                            "GetDevicePropertyData: not enough space for the return value of "
                            "kAudioDevicePropertySafetyOffset for the device");
-            *((UInt32 *)outData) = gDevice_SafetyOffset;
+            {
+                CAMutex::Locker locker(stateMutex);
+                *((UInt32 *)outData) = gDevice_SafetyOffset;
+            }
             *outDataSize = sizeof(UInt32);
             break;
 
@@ -3060,11 +2967,12 @@ OSStatus ProxyAudioDevice::GetDevicePropertyData(AudioServerPlugInDriverRef inDr
 
         case kAudioDevicePropertyPreferredChannelLayout:
             //    This property returns the default AudioChannelLayout to use for the device
-            //    by default. For this device, we return a stereo ACL.
+            //    by default. For this device, that's the channel layout it's configured for.
             {
+                CAMutex::Locker locker(stateMutex);
                 //    calcualte how big the
-                UInt32 theACLSize =
-                    offsetof(AudioChannelLayout, mChannelDescriptions) + (2 * sizeof(AudioChannelDescription));
+                UInt32 theACLSize = offsetof(AudioChannelLayout, mChannelDescriptions)
+                                    + (gDevice_ChannelsPerFrame * sizeof(AudioChannelDescription));
                 FailWithAction(inDataSize < theACLSize,
                                theAnswer = kAudioHardwareBadPropertySizeError,
                                Done,
@@ -3075,7 +2983,7 @@ OSStatus ProxyAudioDevice::GetDevicePropertyData(AudioServerPlugInDriverRef inDr
                 ((AudioChannelLayout *)outData)->mNumberChannelDescriptions = gDevice_ChannelsPerFrame;
                 for (theItemIndex = 0; theItemIndex < gDevice_ChannelsPerFrame; ++theItemIndex) {
                     ((AudioChannelLayout *)outData)->mChannelDescriptions[theItemIndex].mChannelLabel =
-                        kAudioChannelLabel_Left + theItemIndex;
+                        ProxyChannelLabel(theItemIndex);
                     ((AudioChannelLayout *)outData)->mChannelDescriptions[theItemIndex].mChannelFlags = 0;
                     ((AudioChannelLayout *)outData)->mChannelDescriptions[theItemIndex].mCoordinates[0] = 0;
                     ((AudioChannelLayout *)outData)->mChannelDescriptions[theItemIndex].mCoordinates[1] = 0;
@@ -3118,26 +3026,88 @@ OSStatus ProxyAudioDevice::GetDevicePropertyData(AudioServerPlugInDriverRef inDr
             *outDataSize = sizeof(CFURLRef);
         } break;
 
-        default:
-            theAnswer = kAudioHardwareUnknownPropertyError;
-            break;
-    };
+        case kAudioObjectPropertyCustomPropertyInfoList:
+            //    This lists the device's custom properties, so that the HAL knows how to pass their
+            //    data between processes.
+            theNumberItemsToFetch = inDataSize / sizeof(AudioServerPlugInCustomPropertyInfo);
 
-Done:
-    return theAnswer;
-}
+            if (theNumberItemsToFetch > kDevice_CustomPropertyCount) {
+                theNumberItemsToFetch = kDevice_CustomPropertyCount;
+            }
 
-OSStatus ProxyAudioDevice::SetDevicePropertyData(AudioServerPlugInDriverRef inDriver,
-                                                 AudioObjectID inObjectID,
-                                                 pid_t inClientProcessID,
-                                                 const AudioObjectPropertyAddress *inAddress,
-                                                 UInt32 inQualifierDataSize,
-                                                 const void *inQualifierData,
-                                                 UInt32 inDataSize,
-                                                 const void *inData,
-                                                 UInt32 *outNumberPropertiesChanged,
-                                                 AudioObjectPropertyAddress outChangedAddresses[2]) {
-#pragma unused(inClientProcessID, inQualifierDataSize, inQualifierData)
+            for (theItemIndex = 0; theItemIndex < theNumberItemsToFetch; theItemIndex++) {
+                ((AudioServerPlugInCustomPropertyInfo *)outData)[theItemIndex] = kDevice_CustomProperties[theItemIndex];
+            }
+
+            *outDataSize = theNumberItemsToFetch * sizeof(AudioServerPlugInCustomPropertyInfo);
+            break;
+
+        case kProxyAudioDevicePropertyOutputDeviceUID:
+        case kProxyAudioDevicePropertyOutputDeviceBufferFrameSize:
+        case kProxyAudioDevicePropertyOutputDeviceActiveCondition:
+            //    The settings that have a property of their own. The caller is responsible for
+            //    releasing the value.
+            FailWithAction(inDataSize < sizeof(CFPropertyListRef),
+                           theAnswer = kAudioHardwareBadPropertySizeError,
+                           Done,
+                           "GetDevicePropertyData: not enough space for the return value of a configuration "
+                           "property for the device");
+            *((CFPropertyListRef *)outData) = copyConfigurationValue(configTypeForProperty(inAddress->mSelector));
+            *outDataSize = sizeof(CFPropertyListRef);
+            break;
+
+        case kProxyAudioDevicePropertyConfiguration: {
+            //    All of the settings, in one dictionary. The caller is responsible for releasing it.
+            FailWithAction(inDataSize < sizeof(CFPropertyListRef),
+                           theAnswer = kAudioHardwareBadPropertySizeError,
+                           Done,
+                           "GetDevicePropertyData: not enough space for the return value of "
+                           "kProxyAudioDevicePropertyConfiguration for the device");
+            CFDictionaryRef theConfiguration = copyConfiguration();
+            FailWithAction(theConfiguration == NULL,
+                           theAnswer = kAudioHardwareUnspecifiedError,
+                           Done,
+                           "GetDevicePropertyData: could not create the configuration dictionary");
+            *((CFPropertyListRef *)outData) = theConfiguration;
+            *outDataSize = sizeof(CFPropertyListRef);
+        } break;
+
+        case kProxyAudioDevicePropertyTelemetry: {
+            //    A snapshot of the IO telemetry. The caller is responsible for releasing it.
+            FailWithAction(inDataSize < sizeof(CFPropertyListRef),
+                           theAnswer = kAudioHardwareBadPropertySizeError,
+                           Done,
+                           "GetDevicePropertyData: not enough space for the return value of "
+                           "kProxyAudioDevicePropertyTelemetry for the device");
+            CFDictionaryRef theSnapshot = telemetry.CopySnapshot();
+            FailWithAction(theSnapshot == NULL,
+                           theAnswer = kAudioHardwareUnspecifiedError,
+                           Done,
+                           "GetDevicePropertyData: could not create the telemetry snapshot");
+            *((CFPropertyListRef *)outData) = theSnapshot;
+            *outDataSize = sizeof(CFPropertyListRef);
+        } break;
+
+        default:
+            theAnswer = kAudioHardwareUnknownPropertyError;
+            break;
+    };
+
+Done:
+    return theAnswer;
+}
+
+OSStatus ProxyAudioDevice::SetDevicePropertyData(AudioServerPlugInDriverRef inDriver,
+                                                 AudioObjectID inObjectID,
+                                                 pid_t inClientProcessID,
+                                                 const AudioObjectPropertyAddress *inAddress,
+                                                 UInt32 inQualifierDataSize,
+                                                 const void *inQualifierData,
+                                                 UInt32 inDataSize,
+                                                 const void *inData,
+                                                 UInt32 *outNumberPropertiesChanged,
+                                                 AudioObjectPropertyAddress outChangedAddresses[2]) {
+#pragma unused(inClientProcessID, inQualifierDataSize, inQualifierData)
 
     //    declare the local variables
     OSStatus theAnswer = 0;
@@ -3202,6 +3172,41 @@ OSStatus ProxyAudioDevice::SetDevicePropertyData(AudioServerPlugInDriverRef inDr
             }
             break;
 
+        case kProxyAudioDevicePropertyOutputDeviceUID:
+        case kProxyAudioDevicePropertyOutputDeviceBufferFrameSize:
+        case kProxyAudioDevicePropertyOutputDeviceActiveCondition: {
+            FailWithAction(inDataSize != sizeof(CFPropertyListRef),
+                           theAnswer = kAudioHardwareBadPropertySizeError,
+                           Done,
+                           "SetDevicePropertyData: wrong size for the data for a configuration property");
+            ConfigType theType = configTypeForProperty(inAddress->mSelector);
+            CFPropertyListRef theValue = *((const CFPropertyListRef *)inData);
+            CAMutex::Locker locker(configurationMutex);
+            FailWithAction(!isValidConfigurationValue(theType, theValue),
+                           theAnswer = kAudioHardwareIllegalOperationError,
+                           Done,
+                           "SetDevicePropertyData: bad value for a configuration property");
+            setConfigurationValue(theType, theValue);
+            notifyConfigurationChanged();
+        } break;
+
+        case kProxyAudioDevicePropertyConfiguration: {
+            FailWithAction(inDataSize != sizeof(CFPropertyListRef),
+                           theAnswer = kAudioHardwareBadPropertySizeError,
+                           Done,
+                           "SetDevicePropertyData: wrong size for the data for kProxyAudioDevicePropertyConfiguration");
+            CFPropertyListRef theValue = *((const CFPropertyListRef *)inData);
+            FailWithAction((theValue == NULL || CFGetTypeID(theValue) != CFDictionaryGetTypeID()),
+                           theAnswer = kAudioHardwareIllegalOperationError,
+                           Done,
+                           "SetDevicePropertyData: bad value for kProxyAudioDevicePropertyConfiguration");
+            FailWithAction(!setConfiguration(CFDictionaryRef(theValue)),
+                           theAnswer = kAudioHardwareIllegalOperationError,
+                           Done,
+                           "SetDevicePropertyData: bad setting in kProxyAudioDevicePropertyConfiguration");
+            notifyConfigurationChanged();
+        } break;
+
         default:
             theAnswer = kAudioHardwareUnknownPropertyError;
             break;
@@ -3213,6 +3218,24 @@ Done:
 
 #pragma mark Stream Property Operations
 
+static constexpr PropertyInfo kStreamPropertyList[] = {
+    {kAudioObjectPropertyBaseClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyOwner, false, false, sizeof(AudioObjectID)},
+    {kAudioObjectPropertyOwnedObjects, false, false, 0},
+    {kAudioStreamPropertyIsActive, true, false, sizeof(UInt32)},
+    {kAudioStreamPropertyDirection, false, false, sizeof(UInt32)},
+    {kAudioStreamPropertyTerminalType, false, false, sizeof(UInt32)},
+    {kAudioStreamPropertyStartingChannel, false, false, sizeof(UInt32)},
+    {kAudioStreamPropertyLatency, false, false, sizeof(UInt32)},
+    {kAudioStreamPropertyVirtualFormat, true, false, sizeof(AudioStreamBasicDescription)},
+    {kAudioStreamPropertyPhysicalFormat, true, false, sizeof(AudioStreamBasicDescription)},
+    {kAudioStreamPropertyAvailableVirtualFormats, false, false, PropertyInfo::kVariableSize},
+    {kAudioStreamPropertyAvailablePhysicalFormats, false, false, PropertyInfo::kVariableSize},
+};
+static constexpr PropertyTable kStreamProperties(kStreamPropertyList);
+static_assert(kStreamProperties.HasUniqueSelectors(), "a stream property is listed twice");
+
 Boolean ProxyAudioDevice::HasStreamProperty(AudioServerPlugInDriverRef inDriver,
                                             AudioObjectID inObjectID,
                                             pid_t inClientProcessID,
@@ -3223,32 +3246,20 @@ Boolean ProxyAudioDevice::HasStreamProperty(AudioServerPlugInDriverRef inDriver,
 
     //    declare the local variables
     Boolean theAnswer = false;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailIf(inDriver != gAudioServerPlugInDriverRef, Done, "HasStreamProperty: bad driver reference");
     FailIf(inAddress == NULL, Done, "HasStreamProperty: no address");
-    FailIf((inObjectID != kObjectID_Stream_Output), Done, "HasStreamProperty: not a stream object");
+    FailIf((inObjectID != kObjectID_Stream_Output && inObjectID != kObjectID_Stream_Input),
+           Done,
+           "HasStreamProperty: not a stream object");
 
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetStreamPropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-        case kAudioObjectPropertyClass:
-        case kAudioObjectPropertyOwner:
-        case kAudioObjectPropertyOwnedObjects:
-        case kAudioStreamPropertyIsActive:
-        case kAudioStreamPropertyDirection:
-        case kAudioStreamPropertyTerminalType:
-        case kAudioStreamPropertyStartingChannel:
-        case kAudioStreamPropertyLatency:
-        case kAudioStreamPropertyVirtualFormat:
-        case kAudioStreamPropertyPhysicalFormat:
-        case kAudioStreamPropertyAvailableVirtualFormats:
-        case kAudioStreamPropertyAvailablePhysicalFormats:
-            theAnswer = true;
-            break;
-    };
+    theProperty = kStreamProperties.Find(inAddress->mSelector);
+    theAnswer = (theProperty != NULL) && theProperty->HasScope(inAddress->mScope);
 
 Done:
     return theAnswer;
@@ -3266,6 +3277,7 @@ OSStatus ProxyAudioDevice::IsStreamPropertySettable(AudioServerPlugInDriverRef i
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -3280,7 +3292,7 @@ OSStatus ProxyAudioDevice::IsStreamPropertySettable(AudioServerPlugInDriverRef i
                    theAnswer = kAudioHardwareIllegalOperationError,
                    Done,
                    "IsStreamPropertySettable: no place to put the return value");
-    FailWithAction((inObjectID != kObjectID_Stream_Output),
+    FailWithAction((inObjectID != kObjectID_Stream_Output && inObjectID != kObjectID_Stream_Input),
                    theAnswer = kAudioHardwareBadObjectError,
                    Done,
                    "IsStreamPropertySettable: not a stream object");
@@ -3288,30 +3300,13 @@ OSStatus ProxyAudioDevice::IsStreamPropertySettable(AudioServerPlugInDriverRef i
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetStreamPropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-        case kAudioObjectPropertyClass:
-        case kAudioObjectPropertyOwner:
-        case kAudioObjectPropertyOwnedObjects:
-        case kAudioStreamPropertyDirection:
-        case kAudioStreamPropertyTerminalType:
-        case kAudioStreamPropertyStartingChannel:
-        case kAudioStreamPropertyLatency:
-        case kAudioStreamPropertyAvailableVirtualFormats:
-        case kAudioStreamPropertyAvailablePhysicalFormats:
-            *outIsSettable = false;
-            break;
-
-        case kAudioStreamPropertyIsActive:
-        case kAudioStreamPropertyVirtualFormat:
-        case kAudioStreamPropertyPhysicalFormat:
-            *outIsSettable = true;
-            break;
+    theProperty = kStreamProperties.Find(inAddress->mSelector);
 
-        default:
-            theAnswer = kAudioHardwareUnknownPropertyError;
-            break;
-    };
+    if (theProperty == NULL) {
+        theAnswer = kAudioHardwareUnknownPropertyError;
+    } else {
+        *outIsSettable = theProperty->settable;
+    }
 
 Done:
     return theAnswer;
@@ -3330,6 +3325,7 @@ OSStatus ProxyAudioDevice::GetStreamPropertyDataSize(AudioServerPlugInDriverRef
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -3344,7 +3340,7 @@ OSStatus ProxyAudioDevice::GetStreamPropertyDataSize(AudioServerPlugInDriverRef
                    theAnswer = kAudioHardwareIllegalOperationError,
                    Done,
                    "GetStreamPropertyDataSize: no place to put the return value");
-    FailWithAction((inObjectID != kObjectID_Stream_Output),
+    FailWithAction((inObjectID != kObjectID_Stream_Output && inObjectID != kObjectID_Stream_Input),
                    theAnswer = kAudioHardwareBadObjectError,
                    Done,
                    "GetStreamPropertyDataSize: not a stream object");
@@ -3352,57 +3348,26 @@ OSStatus ProxyAudioDevice::GetStreamPropertyDataSize(AudioServerPlugInDriverRef
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetStreamPropertyData() method.
-    switch (inAddress->mSelector) {
-        case kAudioObjectPropertyBaseClass:
-            *outDataSize = sizeof(AudioClassID);
-            break;
-
-        case kAudioObjectPropertyClass:
-            *outDataSize = sizeof(AudioClassID);
-            break;
-
-        case kAudioObjectPropertyOwner:
-            *outDataSize = sizeof(AudioObjectID);
-            break;
-
-        case kAudioObjectPropertyOwnedObjects:
-            *outDataSize = 0 * sizeof(AudioObjectID);
-            break;
-
-        case kAudioStreamPropertyIsActive:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioStreamPropertyDirection:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioStreamPropertyTerminalType:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioStreamPropertyStartingChannel:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioStreamPropertyLatency:
-            *outDataSize = sizeof(UInt32);
-            break;
-
-        case kAudioStreamPropertyVirtualFormat:
-        case kAudioStreamPropertyPhysicalFormat:
-            *outDataSize = sizeof(AudioStreamBasicDescription);
-            break;
+    theProperty = kStreamProperties.Find(inAddress->mSelector);
 
-        case kAudioStreamPropertyAvailableVirtualFormats:
-        case kAudioStreamPropertyAvailablePhysicalFormats:
-            *outDataSize = (UInt32)(gDevice_SampleRates.size() * sizeof(AudioStreamRangedDescription));
-            break;
-
-        default:
-            theAnswer = kAudioHardwareUnknownPropertyError;
-            break;
-    };
+    if (theProperty == NULL) {
+        theAnswer = kAudioHardwareUnknownPropertyError;
+    } else if (theProperty->dataSize != PropertyInfo::kVariableSize) {
+        *outDataSize = theProperty->dataSize;
+    } else {
+        //    The properties whose size depends on the state of the device
+        switch (inAddress->mSelector) {
+            case kAudioStreamPropertyAvailableVirtualFormats:
+            case kAudioStreamPropertyAvailablePhysicalFormats:
+                *outDataSize = (UInt32)(gDevice_SampleRates.size() * kDevice_ChannelLayoutCount
+                                        * sizeof(AudioStreamRangedDescription));
+                break;
+
+            default:
+                theAnswer = kAudioHardwareUnknownPropertyError;
+                break;
+        };
+    }
 
 Done:
     return theAnswer;
@@ -3438,7 +3403,7 @@ OSStatus ProxyAudioDevice::GetStreamPropertyData(AudioServerPlugInDriverRef inDr
                    theAnswer = kAudioHardwareIllegalOperationError,
                    Done,
                    "GetStreamPropertyData: no place to put the return value");
-    FailWithAction((inObjectID != kObjectID_Stream_Output),
+    FailWithAction((inObjectID != kObjectID_Stream_Output && inObjectID != kObjectID_Stream_Input),
                    theAnswer = kAudioHardwareBadObjectError,
                    Done,
                    "GetStreamPropertyData: not a stream object");
@@ -3498,7 +3463,8 @@ OSStatus ProxyAudioDevice::GetStreamPropertyData(AudioServerPlugInDriverRef inDr
                            "kAudioStreamPropertyIsActive for the stream");
             {
                 CAMutex::Locker locker(stateMutex);
-                *((UInt32 *)outData) = gStream_Output_IsActive;
+                *((UInt32 *)outData) =
+                    (inObjectID == kObjectID_Stream_Input) ? gStream_Input_IsActive : gStream_Output_IsActive;
             }
             *outDataSize = sizeof(UInt32);
             break;
@@ -3510,20 +3476,22 @@ OSStatus ProxyAudioDevice::GetStreamPropertyData(AudioServerPlugInDriverRef inDr
                            Done,
                            "GetStreamPropertyData: not enough space for the return value of "
                            "kAudioStreamPropertyDirection for the stream");
-            *((UInt32 *)outData) = 0;
+            *((UInt32 *)outData) = (inObjectID == kObjectID_Stream_Input) ? 1 : 0;
             *outDataSize = sizeof(UInt32);
             break;
 
         case kAudioStreamPropertyTerminalType:
             //    This returns a value that indicates what is at the other end of the stream
             //    such as a speaker or headphones, or a microphone. Values for this property
-            //    are defined in <CoreAudio/AudioHardwareBase.h>
+            //    are defined in <CoreAudio/AudioHardwareBase.h>. The loopback input comes from
+            //    our own output rather than a microphone, much like a line input would.
             FailWithAction(inDataSize < sizeof(UInt32),
                            theAnswer = kAudioHardwareBadPropertySizeError,
                            Done,
                            "GetStreamPropertyData: not enough space for the return value of "
                            "kAudioStreamPropertyTerminalType for the stream");
-            *((UInt32 *)outData) = kAudioStreamTerminalTypeSpeaker;
+            *((UInt32 *)outData) =
+                (inObjectID == kObjectID_Stream_Input) ? kAudioStreamTerminalTypeLine : kAudioStreamTerminalTypeSpeaker;
             *outDataSize = sizeof(UInt32);
             break;
 
@@ -3584,29 +3552,31 @@ OSStatus ProxyAudioDevice::GetStreamPropertyData(AudioServerPlugInDriverRef inDr
         case kAudioStreamPropertyAvailableVirtualFormats:
         case kAudioStreamPropertyAvailablePhysicalFormats:
             //    This returns an array of AudioStreamRangedDescriptions that describe what
-            //    formats are supported.
+            //    formats are supported: every sample rate in every channel layout.
 
             //    Calculate the number of items that have been requested. Note that this
             //    number is allowed to be smaller than the actual size of the list. In such
             //    case, only that number of items will be returned
-            theNumberItemsToFetch =
-                (UInt32)std::min(inDataSize / sizeof(AudioStreamRangedDescription), gDevice_SampleRates.size());
+            theNumberItemsToFetch = (UInt32)std::min(inDataSize / sizeof(AudioStreamRangedDescription),
+                                                     gDevice_SampleRates.size() * kDevice_ChannelLayoutCount);
 
             for (unsigned int i = 0; i < theNumberItemsToFetch; ++i) {
-                ((AudioStreamRangedDescription *)outData)[i].mFormat.mSampleRate = gDevice_SampleRates[i];
+                Float64 theSampleRate = gDevice_SampleRates[i % gDevice_SampleRates.size()];
+                UInt32 theChannels = channelCountForLayout(ChannelLayout(i / gDevice_SampleRates.size()));
+                ((AudioStreamRangedDescription *)outData)[i].mFormat.mSampleRate = theSampleRate;
                 ((AudioStreamRangedDescription *)outData)[i].mFormat.mFormatID = kAudioFormatLinearPCM;
                 ((AudioStreamRangedDescription *)outData)[i].mFormat.mFormatFlags =
                     kAudioFormatFlagIsFloat | kAudioFormatFlagsNativeEndian | kAudioFormatFlagIsPacked;
                 ((AudioStreamRangedDescription *)outData)[i].mFormat.mBytesPerPacket =
-                    gDevice_BytesPerFrameInChannel * gDevice_ChannelsPerFrame;
+                    gDevice_BytesPerFrameInChannel * theChannels;
                 ((AudioStreamRangedDescription *)outData)[i].mFormat.mFramesPerPacket = 1;
                 ((AudioStreamRangedDescription *)outData)[i].mFormat.mBytesPerFrame =
-                    gDevice_BytesPerFrameInChannel * gDevice_ChannelsPerFrame;
-                ((AudioStreamRangedDescription *)outData)[i].mFormat.mChannelsPerFrame = gDevice_ChannelsPerFrame;
+                    gDevice_BytesPerFrameInChannel * theChannels;
+                ((AudioStreamRangedDescription *)outData)[i].mFormat.mChannelsPerFrame = theChannels;
                 ((AudioStreamRangedDescription *)outData)[i].mFormat.mBitsPerChannel =
                     gDevice_BytesPerFrameInChannel * 8;
-                ((AudioStreamRangedDescription *)outData)[i].mSampleRateRange.mMinimum = gDevice_SampleRates[i];
-                ((AudioStreamRangedDescription *)outData)[i].mSampleRateRange.mMaximum = gDevice_SampleRates[i];
+                ((AudioStreamRangedDescription *)outData)[i].mSampleRateRange.mMinimum = theSampleRate;
+                ((AudioStreamRangedDescription *)outData)[i].mSampleRateRange.mMaximum = theSampleRate;
             }
 
             //    report how much we wrote
@@ -3637,6 +3607,8 @@ OSStatus ProxyAudioDevice::SetStreamPropertyData(AudioServerPlugInDriverRef inDr
     //    declare the local variables
     OSStatus theAnswer = 0;
     Float64 theOldSampleRate;
+    UInt32 theOldChannelCount;
+    UInt32 theNewChannelCount;
     UInt64 theNewSampleRate;
 
     //    check the arguments
@@ -3654,7 +3626,7 @@ OSStatus ProxyAudioDevice::SetStreamPropertyData(AudioServerPlugInDriverRef inDr
                    theAnswer = kAudioHardwareIllegalOperationError,
                    Done,
                    "SetStreamPropertyData: no place to return the properties that changed");
-    FailWithAction((inObjectID != kObjectID_Stream_Output),
+    FailWithAction((inObjectID != kObjectID_Stream_Output && inObjectID != kObjectID_Stream_Input),
                    theAnswer = kAudioHardwareBadObjectError,
                    Done,
                    "SetStreamPropertyData: not a stream object");
@@ -3675,8 +3647,10 @@ OSStatus ProxyAudioDevice::SetStreamPropertyData(AudioServerPlugInDriverRef inDr
                            "SetStreamPropertyData: wrong size for the data for kAudioDevicePropertyNominalSampleRate");
             {
                 CAMutex::Locker locker(stateMutex);
-                if (gStream_Output_IsActive != (*((const UInt32 *)inData) != 0)) {
-                    gStream_Output_IsActive = *((const UInt32 *)inData) != 0;
+                bool &theIsActive = (inObjectID == kObjectID_Stream_Input) ? gStream_Input_IsActive
+                                                                           : gStream_Output_IsActive;
+                if (theIsActive != (*((const UInt32 *)inData) != 0)) {
+                    theIsActive = *((const UInt32 *)inData) != 0;
                     *outNumberPropertiesChanged = 1;
                     outChangedAddresses[0].mSelector = kAudioStreamPropertyIsActive;
                     outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
@@ -3689,12 +3663,13 @@ OSStatus ProxyAudioDevice::SetStreamPropertyData(AudioServerPlugInDriverRef inDr
         case kAudioStreamPropertyPhysicalFormat:
             //    Changing the stream format needs to be handled via the
             //    RequestConfigChange/PerformConfigChange machinery. Note that because this
-            //    device only supports 2 channel 32 bit float data, the only thing that can
-            //    change is the sample rate.
+            //    device only supports 32 bit float data, the only things that can change are
+            //    the sample rate and the number of channels, which picks the channel layout.
             FailWithAction(inDataSize != sizeof(AudioStreamBasicDescription),
                            theAnswer = kAudioHardwareBadPropertySizeError,
                            Done,
                            "SetStreamPropertyData: wrong size for the data for kAudioStreamPropertyPhysicalFormat");
+            theNewChannelCount = ((const AudioStreamBasicDescription *)inData)->mChannelsPerFrame;
             FailWithAction(((const AudioStreamBasicDescription *)inData)->mFormatID != kAudioFormatLinearPCM,
                            theAnswer = kAudioDeviceUnsupportedFormatError,
                            Done,
@@ -3706,7 +3681,7 @@ OSStatus ProxyAudioDevice::SetStreamPropertyData(AudioServerPlugInDriverRef inDr
                            "SetStreamPropertyData: unsupported format flags for kAudioStreamPropertyPhysicalFormat");
             FailWithAction(
                 ((const AudioStreamBasicDescription *)inData)->mBytesPerPacket
-                    != (gDevice_BytesPerFrameInChannel * gDevice_ChannelsPerFrame),
+                    != (gDevice_BytesPerFrameInChannel * theNewChannelCount),
                 theAnswer = kAudioDeviceUnsupportedFormatError,
                 Done,
                 "SetStreamPropertyData: unsupported bytes per packet for kAudioStreamPropertyPhysicalFormat");
@@ -3716,12 +3691,14 @@ OSStatus ProxyAudioDevice::SetStreamPropertyData(AudioServerPlugInDriverRef inDr
                 Done,
                 "SetStreamPropertyData: unsupported frames per packet for kAudioStreamPropertyPhysicalFormat");
             FailWithAction(((const AudioStreamBasicDescription *)inData)->mBytesPerFrame
-                               != (gDevice_BytesPerFrameInChannel * gDevice_ChannelsPerFrame),
+                               != (gDevice_BytesPerFrameInChannel * theNewChannelCount),
                            theAnswer = kAudioDeviceUnsupportedFormatError,
                            Done,
                            "SetStreamPropertyData: unsupported bytes per frame for kAudioStreamPropertyPhysicalFormat");
             FailWithAction(
-                ((const AudioStreamBasicDescription *)inData)->mChannelsPerFrame != gDevice_ChannelsPerFrame,
+                theNewChannelCount != channelCountForLayout(ChannelLayout::stereo)
+                    && theNewChannelCount != channelCountForLayout(ChannelLayout::surround51)
+                    && theNewChannelCount != channelCountForLayout(ChannelLayout::surround71),
                 theAnswer = kAudioDeviceUnsupportedFormatError,
                 Done,
                 "SetStreamPropertyData: unsupported channels per frame for kAudioStreamPropertyPhysicalFormat");
@@ -3735,11 +3712,28 @@ OSStatus ProxyAudioDevice::SetStreamPropertyData(AudioServerPlugInDriverRef inDr
                            Done,
                            "SetStreamPropertyData: unsupported sample rate for kAudioStreamPropertyPhysicalFormat");
 
-            //    If we made it this far, the requested format is something we support, so make sure the sample rate is
-            //    actually different
+            //    If we made it this far, the requested format is something we support, so switch to the channel
+            //    layout with that many channels, if that's different, and make sure the sample rate is actually
+            //    different
             {
                 CAMutex::Locker locker(stateMutex);
                 theOldSampleRate = gDevice_SampleRate;
+                theOldChannelCount = gDevice_ChannelsPerFrame;
+            }
+            if (theNewChannelCount != theOldChannelCount) {
+                switch (theNewChannelCount) {
+                    case 6:
+                        setChannelLayout(ChannelLayout::surround51);
+                        break;
+
+                    case 8:
+                        setChannelLayout(ChannelLayout::surround71);
+                        break;
+
+                    default:
+                        setChannelLayout(ChannelLayout::stereo);
+                        break;
+                }
             }
             if (((const AudioStreamBasicDescription *)inData)->mSampleRate != theOldSampleRate) {
                 //    we dispatch this so that the change can happen asynchronously
@@ -3763,6 +3757,115 @@ Done:
 
 #pragma mark Control Property Operations
 
+static constexpr PropertyInfo kVolumeControlPropertyList[] = {
+    {kAudioObjectPropertyBaseClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyOwner, false, false, sizeof(AudioObjectID)},
+    {kAudioObjectPropertyOwnedObjects, false, false, 0},
+    {kAudioControlPropertyScope, false, false, sizeof(AudioObjectPropertyScope)},
+    {kAudioControlPropertyElement, false, false, sizeof(AudioObjectPropertyElement)},
+    {kAudioLevelControlPropertyScalarValue, true, false, sizeof(Float32)},
+    {kAudioLevelControlPropertyDecibelValue, true, false, sizeof(Float32)},
+    {kAudioLevelControlPropertyDecibelRange, false, false, sizeof(AudioValueRange)},
+    {kAudioLevelControlPropertyConvertScalarToDecibels, false, false, sizeof(Float32)},
+    {kAudioLevelControlPropertyConvertDecibelsToScalar, false, false, sizeof(Float32)},
+};
+static constexpr PropertyTable kVolumeControlProperties(kVolumeControlPropertyList);
+static_assert(kVolumeControlProperties.HasUniqueSelectors(), "a volume control property is listed twice");
+
+static constexpr PropertyInfo kMuteControlPropertyList[] = {
+    {kAudioObjectPropertyBaseClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyOwner, false, false, sizeof(AudioObjectID)},
+    {kAudioObjectPropertyOwnedObjects, false, false, 0},
+    {kAudioControlPropertyScope, false, false, sizeof(AudioObjectPropertyScope)},
+    {kAudioControlPropertyElement, false, false, sizeof(AudioObjectPropertyElement)},
+    {kAudioBooleanControlPropertyValue, true, false, sizeof(UInt32)},
+};
+static constexpr PropertyTable kMuteControlProperties(kMuteControlPropertyList);
+static_assert(kMuteControlProperties.HasUniqueSelectors(), "a mute control property is listed twice");
+
+static constexpr PropertyInfo kDataSourceControlPropertyList[] = {
+    {kAudioObjectPropertyBaseClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyClass, false, false, sizeof(AudioClassID)},
+    {kAudioObjectPropertyOwner, false, false, sizeof(AudioObjectID)},
+    {kAudioObjectPropertyOwnedObjects, false, false, 0},
+    {kAudioControlPropertyScope, false, false, sizeof(AudioObjectPropertyScope)},
+    {kAudioControlPropertyElement, false, false, sizeof(AudioObjectPropertyElement)},
+};
+static constexpr PropertyTable kDataSourceControlProperties(kDataSourceControlPropertyList);
+static_assert(kDataSourceControlProperties.HasUniqueSelectors(), "a data source control property is listed twice");
+
+//    Each kind of control has a table of its own
+static const PropertyInfo *findControlProperty(AudioObjectID inObjectID, AudioObjectPropertySelector inSelector) {
+    switch (inObjectID) {
+        case kObjectID_Volume_Output_L:
+        case kObjectID_Volume_Output_R:
+        case kObjectID_Volume_Output_C:
+        case kObjectID_Volume_Output_LFE:
+        case kObjectID_Volume_Output_Ls:
+        case kObjectID_Volume_Output_Rs:
+        case kObjectID_Volume_Output_Lrs:
+        case kObjectID_Volume_Output_Rrs:
+            return kVolumeControlProperties.Find(inSelector);
+
+        case kObjectID_Mute_Output_Master:
+            return kMuteControlProperties.Find(inSelector);
+
+        case kObjectID_DataSource_Output_Master:
+            return kDataSourceControlProperties.Find(inSelector);
+
+        default:
+            return NULL;
+    }
+}
+
+//    The entries of the table the given object's properties are looked up in, in the order they're
+//    listed. Nothing here uses this; it's for checking the tables against the property methods, see
+//    Tests/PropertyTableTests.cpp.
+template <size_t N>
+static const PropertyInfo *propertyListEntries(const PropertyInfo (&list)[N], UInt32 &outCount) {
+    outCount = N;
+    return list;
+}
+
+const PropertyInfo *ProxyAudioDevice::propertyList(AudioObjectID objectID, UInt32 &outCount) {
+    switch (objectID) {
+        case kObjectID_PlugIn:
+            return propertyListEntries(kPlugInPropertyList, outCount);
+
+        case kObjectID_Box:
+            return propertyListEntries(kBoxPropertyList, outCount);
+
+        case kObjectID_Device:
+            return propertyListEntries(kDevicePropertyList, outCount);
+
+        case kObjectID_Stream_Output:
+        case kObjectID_Stream_Input:
+            return propertyListEntries(kStreamPropertyList, outCount);
+
+        case kObjectID_Volume_Output_L:
+        case kObjectID_Volume_Output_R:
+        case kObjectID_Volume_Output_C:
+        case kObjectID_Volume_Output_LFE:
+        case kObjectID_Volume_Output_Ls:
+        case kObjectID_Volume_Output_Rs:
+        case kObjectID_Volume_Output_Lrs:
+        case kObjectID_Volume_Output_Rrs:
+            return propertyListEntries(kVolumeControlPropertyList, outCount);
+
+        case kObjectID_Mute_Output_Master:
+            return propertyListEntries(kMuteControlPropertyList, outCount);
+
+        case kObjectID_DataSource_Output_Master:
+            return propertyListEntries(kDataSourceControlPropertyList, outCount);
+
+        default:
+            outCount = 0;
+            return NULL;
+    }
+}
+
 Boolean ProxyAudioDevice::HasControlProperty(AudioServerPlugInDriverRef inDriver,
                                              AudioObjectID inObjectID,
                                              pid_t inClientProcessID,
@@ -3773,61 +3876,23 @@ Boolean ProxyAudioDevice::HasControlProperty(AudioServerPlugInDriverRef inDriver
 
     //    declare the local variables
     Boolean theAnswer = false;
+    const PropertyInfo *theProperty = NULL;
+
+    //    The controls are hidden from the HAL, and so from every client, by having no properties,
+    //    and always have been. The rest of this is what it would answer otherwise, which is kept in
+    //    step with the control property table so that showing them is a one line change.
     return false;
+
     //    check the arguments
     FailIf(inDriver != gAudioServerPlugInDriverRef, Done, "HasControlProperty: bad driver reference");
     FailIf(inAddress == NULL, Done, "HasControlProperty: no address");
+    FailIf(!isControlPresent(inObjectID), Done, "HasControlProperty: no such control");
 
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetControlPropertyData() method.
-    switch (inObjectID) {
-        case kObjectID_Volume_Output_R:
-        case kObjectID_Volume_Output_L:
-            switch (inAddress->mSelector) {
-                case kAudioObjectPropertyBaseClass:
-                case kAudioObjectPropertyClass:
-                case kAudioObjectPropertyOwner:
-                case kAudioObjectPropertyOwnedObjects:
-                case kAudioControlPropertyScope:
-                case kAudioControlPropertyElement:
-                case kAudioLevelControlPropertyScalarValue:
-                case kAudioLevelControlPropertyDecibelValue:
-                case kAudioLevelControlPropertyDecibelRange:
-                case kAudioLevelControlPropertyConvertScalarToDecibels:
-                case kAudioLevelControlPropertyConvertDecibelsToScalar:
-                    theAnswer = true;
-                    break;
-            };
-            break;
-
-        case kObjectID_Mute_Output_Master:
-            switch (inAddress->mSelector) {
-                case kAudioObjectPropertyBaseClass:
-                case kAudioObjectPropertyClass:
-                case kAudioObjectPropertyOwner:
-                case kAudioObjectPropertyOwnedObjects:
-                case kAudioControlPropertyScope:
-                case kAudioControlPropertyElement:
-                case kAudioBooleanControlPropertyValue:
-                    theAnswer = true;
-                    break;
-            };
-            break;
-
-        case kObjectID_DataSource_Output_Master:
-            switch (inAddress->mSelector) {
-                case kAudioObjectPropertyBaseClass:
-                case kAudioObjectPropertyClass:
-                case kAudioObjectPropertyOwner:
-                case kAudioObjectPropertyOwnedObjects:
-                case kAudioControlPropertyScope:
-                case kAudioControlPropertyElement:
-                    theAnswer = true;
-                    break;
-            };
-            break;
-    };
+    theProperty = findControlProperty(inObjectID, inAddress->mSelector);
+    theAnswer = (theProperty != NULL) && theProperty->HasScope(inAddress->mScope);
 
 Done:
     return theAnswer;
@@ -3845,6 +3910,7 @@ OSStatus ProxyAudioDevice::IsControlPropertySettable(AudioServerPlugInDriverRef
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -3855,6 +3921,10 @@ OSStatus ProxyAudioDevice::IsControlPropertySettable(AudioServerPlugInDriverRef
                    theAnswer = kAudioHardwareIllegalOperationError,
                    Done,
                    "IsControlPropertySettable: no address");
+    FailWithAction(!isControlPresent(inObjectID),
+                   theAnswer = kAudioHardwareBadObjectError,
+                   Done,
+                   "IsControlPropertySettable: no such control");
     FailWithAction(outIsSettable == NULL,
                    theAnswer = kAudioHardwareIllegalOperationError,
                    Done,
@@ -3863,75 +3933,13 @@ OSStatus ProxyAudioDevice::IsControlPropertySettable(AudioServerPlugInDriverRef
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetControlPropertyData() method.
-    switch (inObjectID) {
-        case kObjectID_Volume_Output_L:
-        case kObjectID_Volume_Output_R:
-            switch (inAddress->mSelector) {
-                case kAudioObjectPropertyBaseClass:
-                case kAudioObjectPropertyClass:
-                case kAudioObjectPropertyOwner:
-                case kAudioObjectPropertyOwnedObjects:
-                case kAudioControlPropertyScope:
-                case kAudioControlPropertyElement:
-                case kAudioLevelControlPropertyDecibelRange:
-                case kAudioLevelControlPropertyConvertScalarToDecibels:
-                case kAudioLevelControlPropertyConvertDecibelsToScalar:
-                    *outIsSettable = false;
-                    break;
+    theProperty = findControlProperty(inObjectID, inAddress->mSelector);
 
-                case kAudioLevelControlPropertyScalarValue:
-                case kAudioLevelControlPropertyDecibelValue:
-                    *outIsSettable = true;
-                    break;
-
-                default:
-                    theAnswer = kAudioHardwareUnknownPropertyError;
-                    break;
-            };
-            break;
-
-        case kObjectID_Mute_Output_Master:
-            switch (inAddress->mSelector) {
-                case kAudioObjectPropertyBaseClass:
-                case kAudioObjectPropertyClass:
-                case kAudioObjectPropertyOwner:
-                case kAudioObjectPropertyOwnedObjects:
-                case kAudioControlPropertyScope:
-                case kAudioControlPropertyElement:
-                    *outIsSettable = false;
-                    break;
-
-                case kAudioBooleanControlPropertyValue:
-                    *outIsSettable = true;
-                    break;
-
-                default:
-                    theAnswer = kAudioHardwareUnknownPropertyError;
-                    break;
-            };
-            break;
-
-        case kObjectID_DataSource_Output_Master:
-            switch (inAddress->mSelector) {
-                case kAudioObjectPropertyBaseClass:
-                case kAudioObjectPropertyClass:
-                case kAudioObjectPropertyOwner:
-                case kAudioObjectPropertyOwnedObjects:
-                case kAudioControlPropertyScope:
-                case kAudioControlPropertyElement:
-                    *outIsSettable = false;
-                    break;
-
-                default:
-                    theAnswer = kAudioHardwareUnknownPropertyError;
-                    break;
-            };
-            break;
-
-        default:
-            theAnswer = kAudioHardwareBadObjectError;
-            break;
-    };
+    if (theProperty == NULL) {
+        theAnswer = kAudioHardwareUnknownPropertyError;
+    } else {
+        *outIsSettable = theProperty->settable;
+    }
 
 Done:
     return theAnswer;
@@ -3950,6 +3958,7 @@ OSStatus ProxyAudioDevice::GetControlPropertyDataSize(AudioServerPlugInDriverRef
 
     //    declare the local variables
     OSStatus theAnswer = 0;
+    const PropertyInfo *theProperty = NULL;
 
     //    check the arguments
     FailWithAction(inDriver != gAudioServerPlugInDriverRef,
@@ -3960,6 +3969,10 @@ OSStatus ProxyAudioDevice::GetControlPropertyDataSize(AudioServerPlugInDriverRef
                    theAnswer = kAudioHardwareIllegalOperationError,
                    Done,
                    "GetControlPropertyDataSize: no address");
+    FailWithAction(!isControlPresent(inObjectID),
+                   theAnswer = kAudioHardwareBadObjectError,
+                   Done,
+                   "GetControlPropertyDataSize: no such control");
     FailWithAction(outDataSize == NULL,
                    theAnswer = kAudioHardwareIllegalOperationError,
                    Done,
@@ -3968,132 +3981,14 @@ OSStatus ProxyAudioDevice::GetControlPropertyDataSize(AudioServerPlugInDriverRef
     //    Note that for each object, this driver implements all the required properties plus a few
     //    extras that are useful but not required. There is more detailed commentary about each
     //    property in the GetControlPropertyData() method.
-    switch (inObjectID) {
-        case kObjectID_Volume_Output_L:
-        case kObjectID_Volume_Output_R:
-            switch (inAddress->mSelector) {
-                case kAudioObjectPropertyBaseClass:
-                    *outDataSize = sizeof(AudioClassID);
-                    break;
-
-                case kAudioObjectPropertyClass:
-                    *outDataSize = sizeof(AudioClassID);
-                    break;
-
-                case kAudioObjectPropertyOwner:
-                    *outDataSize = sizeof(AudioObjectID);
-                    break;
-
-                case kAudioObjectPropertyOwnedObjects:
-                    *outDataSize = 0 * sizeof(AudioObjectID);
-                    break;
-
-                case kAudioControlPropertyScope:
-                    *outDataSize = sizeof(AudioObjectPropertyScope);
-                    break;
-
-                case kAudioControlPropertyElement:
-                    *outDataSize = sizeof(AudioObjectPropertyElement);
-                    break;
-
-                case kAudioLevelControlPropertyScalarValue:
-                    *outDataSize = sizeof(Float32);
-                    break;
-
-                case kAudioLevelControlPropertyDecibelValue:
-                    *outDataSize = sizeof(Float32);
-                    break;
-
-                case kAudioLevelControlPropertyDecibelRange:
-                    *outDataSize = sizeof(AudioValueRange);
-                    break;
-
-                case kAudioLevelControlPropertyConvertScalarToDecibels:
-                    *outDataSize = sizeof(Float32);
-                    break;
-
-                case kAudioLevelControlPropertyConvertDecibelsToScalar:
-                    *outDataSize = sizeof(Float32);
-                    break;
-
-                default:
-                    theAnswer = kAudioHardwareUnknownPropertyError;
-                    break;
-            };
-            break;
-
-        case kObjectID_Mute_Output_Master:
-            switch (inAddress->mSelector) {
-                case kAudioObjectPropertyBaseClass:
-                    *outDataSize = sizeof(AudioClassID);
-                    break;
-
-                case kAudioObjectPropertyClass:
-                    *outDataSize = sizeof(AudioClassID);
-                    break;
-
-                case kAudioObjectPropertyOwner:
-                    *outDataSize = sizeof(AudioObjectID);
-                    break;
-
-                case kAudioObjectPropertyOwnedObjects:
-                    *outDataSize = 0 * sizeof(AudioObjectID);
-                    break;
-
-                case kAudioControlPropertyScope:
-                    *outDataSize = sizeof(AudioObjectPropertyScope);
-                    break;
-
-                case kAudioControlPropertyElement:
-                    *outDataSize = sizeof(AudioObjectPropertyElement);
-                    break;
-
-                case kAudioBooleanControlPropertyValue:
-                    *outDataSize = sizeof(UInt32);
-                    break;
-
-                default:
-                    theAnswer = kAudioHardwareUnknownPropertyError;
-                    break;
-            };
-            break;
-
-        case kObjectID_DataSource_Output_Master:
-            switch (inAddress->mSelector) {
-                case kAudioObjectPropertyBaseClass:
-                    *outDataSize = sizeof(AudioClassID);
-                    break;
-
-                case kAudioObjectPropertyClass:
-                    *outDataSize = sizeof(AudioClassID);
-                    break;
-
-                case kAudioObjectPropertyOwner:
-                    *outDataSize = sizeof(AudioObjectID);
-                    break;
-
-                case kAudioObjectPropertyOwnedObjects:
-                    *outDataSize = 0 * sizeof(AudioObjectID);
-                    break;
-
-                case kAudioControlPropertyScope:
-                    *outDataSize = sizeof(AudioObjectPropertyScope);
-                    break;
-
-                case kAudioControlPropertyElement:
-                    *outDataSize = sizeof(AudioObjectPropertyElement);
-                    break;
-
-                default:
-                    theAnswer = kAudioHardwareUnknownPropertyError;
-                    break;
-            };
-            break;
+    theProperty = findControlProperty(inObjectID, inAddress->mSelector);
 
-        default:
-            theAnswer = kAudioHardwareBadObjectError;
-            break;
-    };
+    if (theProperty == NULL) {
+        theAnswer = kAudioHardwareUnknownPropertyError;
+    } else {
+        //    None of the controls have properties whose size depends on their state
+        *outDataSize = theProperty->dataSize;
+    }
 
 Done:
     return theAnswer;
@@ -4122,6 +4017,10 @@ OSStatus ProxyAudioDevice::GetControlPropertyData(AudioServerPlugInDriverRef inD
                    "GetControlPropertyData: bad driver reference");
     FailWithAction(
         inAddress == NULL, theAnswer = kAudioHardwareIllegalOperationError, Done, "GetControlPropertyData: no address");
+    FailWithAction(!isControlPresent(inObjectID),
+                   theAnswer = kAudioHardwareBadObjectError,
+                   Done,
+                   "GetControlPropertyData: no such control");
     FailWithAction(outDataSize == NULL,
                    theAnswer = kAudioHardwareIllegalOperationError,
                    Done,
@@ -4139,6 +4038,12 @@ OSStatus ProxyAudioDevice::GetControlPropertyData(AudioServerPlugInDriverRef inD
     switch (inObjectID) {
         case kObjectID_Volume_Output_L:
         case kObjectID_Volume_Output_R:
+        case kObjectID_Volume_Output_C:
+        case kObjectID_Volume_Output_LFE:
+        case kObjectID_Volume_Output_Ls:
+        case kObjectID_Volume_Output_Rs:
+        case kObjectID_Volume_Output_Lrs:
+        case kObjectID_Volume_Output_Rrs:
             switch (inAddress->mSelector) {
                 case kAudioObjectPropertyBaseClass:
                     //    The base class for kAudioVolumeControlClassID is kAudioLevelControlClassID
@@ -4196,7 +4101,7 @@ OSStatus ProxyAudioDevice::GetControlPropertyData(AudioServerPlugInDriverRef inD
                                    Done,
                                    "GetControlPropertyData: not enough space for the return value of "
                                    "kAudioControlPropertyElement for the volume control");
-                    *((AudioObjectPropertyElement *)outData) = (inObjectID == kObjectID_Volume_Output_L) ? 1 : 2;
+                    *((AudioObjectPropertyElement *)outData) = volumeControlChannel(inObjectID) + 1;
                     *outDataSize = sizeof(AudioObjectPropertyElement);
                     break;
 
@@ -4210,11 +4115,7 @@ OSStatus ProxyAudioDevice::GetControlPropertyData(AudioServerPlugInDriverRef inD
                                    "kAudioLevelControlPropertyScalarValue for the volume control");
                     {
                         CAMutex::Locker locker(stateMutex);
-                        if (inObjectID == kObjectID_Volume_Output_L) {
-                            *((Float32 *)outData) = gVolume_Output_L_Value;
-                        } else {
-                            *((Float32 *)outData) = gVolume_Output_R_Value;
-                        }
+                        *((Float32 *)outData) = gVolume_Output_Values[volumeControlChannel(inObjectID)];
                     }
                     *outDataSize = sizeof(Float32);
                     break;
@@ -4229,11 +4130,7 @@ OSStatus ProxyAudioDevice::GetControlPropertyData(AudioServerPlugInDriverRef inD
                                    "kAudioLevelControlPropertyDecibelValue for the volume control");
                     {
                         CAMutex::Locker locker(stateMutex);
-                        if (inObjectID == kObjectID_Volume_Output_L) {
-                            *((Float32 *)outData) = gVolume_Output_L_Value;
-                        } else {
-                            *((Float32 *)outData) = gVolume_Output_R_Value;
-                        }
+                        *((Float32 *)outData) = gVolume_Output_Values[volumeControlChannel(inObjectID)];
                     }
 
                     //    Note that we square the scalar value before converting to dB so as to
@@ -4498,6 +4395,10 @@ OSStatus ProxyAudioDevice::SetControlPropertyData(AudioServerPlugInDriverRef inD
                    "SetControlPropertyData: bad driver reference");
     FailWithAction(
         inAddress == NULL, theAnswer = kAudioHardwareIllegalOperationError, Done, "SetControlPropertyData: no address");
+    FailWithAction(!isControlPresent(inObjectID),
+                   theAnswer = kAudioHardwareBadObjectError,
+                   Done,
+                   "SetControlPropertyData: no such control");
     FailWithAction(outNumberPropertiesChanged == NULL,
                    theAnswer = kAudioHardwareIllegalOperationError,
                    Done,
@@ -4516,6 +4417,12 @@ OSStatus ProxyAudioDevice::SetControlPropertyData(AudioServerPlugInDriverRef inD
     switch (inObjectID) {
         case kObjectID_Volume_Output_L:
         case kObjectID_Volume_Output_R:
+        case kObjectID_Volume_Output_C:
+        case kObjectID_Volume_Output_LFE:
+        case kObjectID_Volume_Output_Ls:
+        case kObjectID_Volume_Output_Rs:
+        case kObjectID_Volume_Output_Lrs:
+        case kObjectID_Volume_Output_Rrs:
             switch (inAddress->mSelector) {
                 case kAudioLevelControlPropertyScalarValue:
                     //    For the scalar volume, we clamp the new value to [0, 1]. Note that if this
@@ -4533,28 +4440,17 @@ OSStatus ProxyAudioDevice::SetControlPropertyData(AudioServerPlugInDriverRef inD
                     }
                     {
                         CAMutex::Locker locker(stateMutex);
-                        if (inObjectID == kObjectID_Volume_Output_L) {
-                            if (gVolume_Output_L_Value != theNewVolume) {
-                                gVolume_Output_L_Value = theNewVolume;
-                                *outNumberPropertiesChanged = 2;
-                                outChangedAddresses[0].mSelector = kAudioLevelControlPropertyScalarValue;
-                                outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
-                                outChangedAddresses[0].mElement = 1;
-                                outChangedAddresses[1].mSelector = kAudioLevelControlPropertyDecibelValue;
-                                outChangedAddresses[1].mScope = kAudioObjectPropertyScopeGlobal;
-                                outChangedAddresses[1].mElement = 1;
-                            }
-                        } else {
-                            if (gVolume_Output_R_Value != theNewVolume) {
-                                gVolume_Output_R_Value = theNewVolume;
-                                *outNumberPropertiesChanged = 2;
-                                outChangedAddresses[0].mSelector = kAudioLevelControlPropertyScalarValue;
-                                outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
-                                outChangedAddresses[0].mElement = 2;
-                                outChangedAddresses[1].mSelector = kAudioLevelControlPropertyDecibelValue;
-                                outChangedAddresses[1].mScope = kAudioObjectPropertyScopeGlobal;
-                                outChangedAddresses[1].mElement = 2;
-                            }
+                        UInt32 theChannel = volumeControlChannel(inObjectID);
+                        if (gVolume_Output_Values[theChannel] != theNewVolume) {
+                            gVolume_Output_Values[theChannel] = theNewVolume;
+                            publishControlStateNoLock();
+                            *outNumberPropertiesChanged = 2;
+                            outChangedAddresses[0].mSelector = kAudioLevelControlPropertyScalarValue;
+                            outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
+                            outChangedAddresses[0].mElement = theChannel + 1;
+                            outChangedAddresses[1].mSelector = kAudioLevelControlPropertyDecibelValue;
+                            outChangedAddresses[1].mScope = kAudioObjectPropertyScopeGlobal;
+                            outChangedAddresses[1].mElement = theChannel + 1;
                         }
                     }
                     break;
@@ -4581,28 +4477,17 @@ OSStatus ProxyAudioDevice::SetControlPropertyData(AudioServerPlugInDriverRef inD
                     theNewVolume = sqrtf(theNewVolume);
                     {
                         CAMutex::Locker locker(stateMutex);
-                        if (inObjectID == kObjectID_Volume_Output_L) {
-                            if (gVolume_Output_L_Value != theNewVolume) {
-                                gVolume_Output_L_Value = theNewVolume;
-                                *outNumberPropertiesChanged = 2;
-                                outChangedAddresses[0].mSelector = kAudioLevelControlPropertyScalarValue;
-                                outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
-                                outChangedAddresses[0].mElement = 1;
-                                outChangedAddresses[1].mSelector = kAudioLevelControlPropertyDecibelValue;
-                                outChangedAddresses[1].mScope = kAudioObjectPropertyScopeGlobal;
-                                outChangedAddresses[1].mElement = 1;
-                            }
-                        } else {
-                            if (gVolume_Output_R_Value != theNewVolume) {
-                                gVolume_Output_R_Value = theNewVolume;
-                                *outNumberPropertiesChanged = 2;
-                                outChangedAddresses[0].mSelector = kAudioLevelControlPropertyScalarValue;
-                                outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
-                                outChangedAddresses[0].mElement = 2;
-                                outChangedAddresses[1].mSelector = kAudioLevelControlPropertyDecibelValue;
-                                outChangedAddresses[1].mScope = kAudioObjectPropertyScopeGlobal;
-                                outChangedAddresses[1].mElement = 2;
-                            }
+                        UInt32 theChannel = volumeControlChannel(inObjectID);
+                        if (gVolume_Output_Values[theChannel] != theNewVolume) {
+                            gVolume_Output_Values[theChannel] = theNewVolume;
+                            publishControlStateNoLock();
+                            *outNumberPropertiesChanged = 2;
+                            outChangedAddresses[0].mSelector = kAudioLevelControlPropertyScalarValue;
+                            outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
+                            outChangedAddresses[0].mElement = theChannel + 1;
+                            outChangedAddresses[1].mSelector = kAudioLevelControlPropertyDecibelValue;
+                            outChangedAddresses[1].mScope = kAudioObjectPropertyScopeGlobal;
+                            outChangedAddresses[1].mElement = theChannel + 1;
                         }
                     }
                     break;
@@ -4625,6 +4510,7 @@ OSStatus ProxyAudioDevice::SetControlPropertyData(AudioServerPlugInDriverRef inD
                         CAMutex::Locker locker(stateMutex);
                         if (gMute_Output_Mute != (*((const UInt32 *)inData) != 0)) {
                             gMute_Output_Mute = *((const UInt32 *)inData) != 0;
+                            publishControlStateNoLock();
                             *outNumberPropertiesChanged = 1;
                             outChangedAddresses[0].mSelector = kAudioBooleanControlPropertyValue;
                             outChangedAddresses[0].mScope = kAudioObjectPropertyScopeGlobal;
@@ -4656,41 +4542,30 @@ Done:
 
 AudioDevice ProxyAudioDevice::findTargetOutputAudioDevice() {
     DebugMsg("ProxyAudio: findTargetOutputAudioDevice");
-    std::vector<AudioObjectID> devices = AudioDevice::allAudioDevices();
     CFStringSmartRef currentOutputDeviceUID;
-    
+
     {
         CAMutex::Locker locker(&stateMutex);
-        
+
         if (!outputDeviceUID) {
             DebugMsg("ProxyAudio: findTargetOutputAudioDevice finished, output device UID is null");
             return AudioDevice();
         }
-        
+
         currentOutputDeviceUID = CFStringCreateCopy(NULL, outputDeviceUID);
     }
-    
-    DebugMsg("ProxyAudio: findTargetOutputAudioDevice target UID: %s", CFStringToStdString(currentOutputDeviceUID).c_str());
-    
-    for (AudioObjectID device : devices) {
-        AudioObjectPropertyAddress propertyAddress = {
-            kAudioDevicePropertyDeviceUID, kAudioObjectPropertyScopeOutput, kAudioObjectPropertyElementMaster};
-
-        CFStringSmartRef uid;
-        UInt32 size = sizeof(CFStringRef);
-        OSStatus err = AudioObjectGetPropertyData(device, &propertyAddress, 0, NULL, &size, &uid);
-
-        if (err == noErr && uid) {
-            if (CFStringCompare(uid, currentOutputDeviceUID, 0) == kCFCompareEqualTo) {
-                DebugMsg("ProxyAudio: findTargetOutputAudioDevice finished, found output device");
-                return AudioDevice(device);
-            }
-        }
+
+    DebugMsg("ProxyAudio: findTargetOutputAudioDevice target UID: %s",
+             CFStringToStdString(currentOutputDeviceUID).c_str());
+    AudioObjectID device = deviceRegistry.DeviceForUID(currentOutputDeviceUID);
+
+    if (device == kAudioObjectUnknown) {
+        DebugMsg("ProxyAudio: findTargetOutputAudioDevice finished, did not find output device");
+        return AudioDevice();
     }
 
-    DebugMsg("ProxyAudio: findTargetOutputAudioDevice finished, not not find output device");
-    
-    return AudioDevice();
+    DebugMsg("ProxyAudio: findTargetOutputAudioDevice finished, found output device");
+    return AudioDevice(device);
 }
 
 int ProxyAudioDevice::outputDeviceAliveListenerStatic(AudioObjectID inObjectID,
@@ -4707,24 +4582,27 @@ int ProxyAudioDevice::outputDeviceAliveListenerStatic(AudioObjectID inObjectID,
 int ProxyAudioDevice::outputDeviceAliveListener(AudioObjectID inObjectID,
                                                 UInt32 inNumberAddresses,
                                                 const AudioObjectPropertyAddress *inAddresses) {
-#pragma unused(inObjectID)
 #pragma unused(inNumberAddresses)
 #pragma unused(inAddresses)
 
     DebugMsg("ProxyAudio: outputDeviceAliveListener");
-    {
-        CAMutex::Locker locker(outputDeviceMutex);
-        UInt32 alive = 0;
-        OSStatus err = outputDevice.getIntegerPropertyData(
-            alive, kAudioDevicePropertyDeviceIsAlive, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster);
+    CAMutex::Locker locker(outputDeviceMutex);
+    OutputTarget *target = outputTargetForDeviceNoLock(inObjectID);
 
-        if (err == noErr && alive == 1) {
-            return noErr;
-        }
+    if (!target) {
+        return noErr;
+    }
+
+    UInt32 alive = 0;
+    OSStatus err = target->device.getIntegerPropertyData(
+        alive, kAudioDevicePropertyDeviceIsAlive, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster);
+
+    if (err == noErr && alive == 1) {
+        return noErr;
     }
 
     DebugMsg("ProxyAudio: outputDeviceAliveListener output device no longer alive");
-    deinitializeOutputDevice();
+    deinitializeOutputDeviceNoLock(*target);
 
     return noErr;
 }
@@ -4744,11 +4622,15 @@ int ProxyAudioDevice::outputDeviceSampleRateListenerStatic(AudioObjectID inObjec
 int ProxyAudioDevice::outputDeviceSampleRateListener(AudioObjectID inObjectID,
                                                      UInt32 inNumberAddresses,
                                                      const AudioObjectPropertyAddress *inAddresses) {
-#pragma unused(inObjectID)
 #pragma unused(inNumberAddresses)
 #pragma unused(inAddresses)
     DebugMsg("ProxyAudio: outputDeviceSampleRateListener, will match sample rate");
-    matchOutputDeviceSampleRate();
+    CAMutex::Locker locker(outputDeviceMutex);
+    OutputTarget *target = outputTargetForDeviceNoLock(inObjectID);
+
+    if (target) {
+        matchOutputDeviceSampleRateNoLock(*target);
+    }
 
     return noErr;
 }
@@ -4771,26 +4653,43 @@ int ProxyAudioDevice::devicesListenerProc(AudioObjectID inObjectID,
 #pragma unused(inNumberAddresses)
 #pragma unused(inAddresses)
     DebugMsg("ProxyAudio: devicesListenerProc current devices changed");
-    setupTargetOutputDevice();
+    updateDeviceRegistry(0);
     return noErr;
 }
 
-void ProxyAudioDevice::updateOutputDeviceStartedState() {
-    static bool userIsActivePrevious = false;
-    
-    if (!outputDevice.isValid()) {
+// Brings deviceRegistry in line with the HAL's device list, and sets up the outputs again if any
+// devices came or went. A device that's only just appeared can fail to answer for a moment, and the
+// HAL won't say when it's ready since the list doesn't change again, so while any device couldn't
+// be read the update is tried again a few times, waiting twice as long each time.
+void ProxyAudioDevice::updateDeviceRegistry(UInt32 retry) {
+    bool changed = deviceRegistry.Update();
+
+    if (deviceRegistry.HasUnreadableDevices() && retry < kDeviceRegistryMaxRetries) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (250ull << retry) * NSEC_PER_MSEC),
+                       AudioOutputDispatchQueue(),
+                       ^() {
+                           updateDeviceRegistry(retry + 1);
+                       });
+    }
+
+    if (!changed) {
+        DebugMsg("ProxyAudio: updateDeviceRegistry no devices were added or removed");
         return;
     }
 
-    bool shouldStart = false;
+    setupTargetOutputDevice();
+    setupAdditionalOutputTargets();
+}
 
-    if (!outputDeviceReady) {
-        shouldStart = false;
+// Must be called with outputDeviceMutex held
+void ProxyAudioDevice::updateOutputDeviceStartedState() {
+    static bool userIsActivePrevious = false;
+    bool shouldPlay = false;
 
-    } else if (outputDeviceActiveCondition == ActiveCondition::userActive) {
-        // We consider the user to be active if they have done anything in the last 30 seconds:
-        bool userIsActive = (getUserIdleTimeInterval() < 30);
-        shouldStart = (inputIOIsActive || userIsActive);
+    if (outputDeviceActiveCondition == ActiveCondition::userActive) {
+        userIdleTime = getUserIdleTimeInterval();
+        bool userIsActive = (userIdleTime < UserActivitySchedule::kUserIdleThreshold);
+        shouldPlay = (inputIOIsActive || userIsActive);
 
         if (userIsActive && !userIsActivePrevious) {
             DebugMsg("ProxyAudio: detected user is now active");
@@ -4801,38 +4700,135 @@ void ProxyAudioDevice::updateOutputDeviceStartedState() {
         userIsActivePrevious = userIsActive;
 
     } else if (outputDeviceActiveCondition == ActiveCondition::proxiedDeviceActive) {
-        shouldStart = inputIOIsActive;
+        shouldPlay = inputIOIsActive;
 
     } else {
-        shouldStart = true;
+        shouldPlay = true;
+    }
+
+    // Once the mix has been digital silence for silenceStandbySeconds there's nothing to play
+    // whatever the condition says. The output devices only ever go into standby for it though, not
+    // all the way to being stopped: their IO procs bring them straight back out of it when there's
+    // sound again, while starting a stopped device would have to wait for the next check.
+    UInt64 lastAudible = lastAudibleInputHostTime;
+    UInt64 checkHostTime = mach_absolute_time();
+    inputSilentTime =
+        (checkHostTime > lastAudible) ? AudioConvertHostTimeToNanos(checkHostTime - lastAudible) / 1e9 : 0;
+    bool silenceStandby = (inputIOIsActive && silenceStandbySeconds > 0 && inputSilentTime >= silenceStandbySeconds);
+
+    if (silenceStandby) {
+        shouldPlay = false;
+    }
+
+    bool stoppedAny = false;
+    bool anyStarted = false;
+
+    // A switch in progress has nothing left to hand over to
+    if (!shouldPlay) {
+        finishPrimaryOutputSwitchNoLock();
+    }
+
+    for (OutputTarget *target : outputTargetsNoLock()) {
+        if (!target->device.isValid()) {
+            continue;
+        }
+
+        bool shouldStart = (target->ready && shouldPlay);
+        UInt64 now = mach_absolute_time();
+
+        if (!target->device.isStarted && shouldStart) {
+            DebugMsg("ProxyAudio: starting output device %u", target->device.id);
+
+            // Being needed again so soon after standby ran out means standby was too short for how
+            // the machine is being used, and otherwise it can be shorter
+            if (lastOutputStandbyStopHostTime != 0) {
+                Float64 stoppedSeconds = AudioConvertHostTimeToNanos(now - lastOutputStandbyStopHostTime) / 1e9;
+                outputStandbySeconds = OutputStandby::NextStandbySeconds(outputStandbySeconds, stoppedSeconds);
+                lastOutputStandbyStopHostTime = 0;
+                DebugMsg("ProxyAudio: output standby is now %.0lf seconds", outputStandbySeconds);
+            }
+
+            target->standby = false;
+            target->needsResync = true;
+            target->preRoll = true;
+            target->warmRestart = false;
+            target->restartHostTime = now;
+            target->device.start();
+        } else if (target->device.isStarted && shouldStart && target->standby) {
+            DebugMsg("ProxyAudio: resuming output device %u from standby", target->device.id);
+            target->warmRestart = true;
+            target->restartHostTime = now;
+            target->standby = false;
+        } else if (target->device.isStarted && !shouldStart && target->ready && !target->standby) {
+            // Rather than stopping the device as soon as there's nothing to play, which would mean
+            // spinning it back up for the next sound, it's left running until one of
+            // monitorUserActivity's checks finds it's been in standby for outputStandbySeconds
+            DebugMsg("ProxyAudio: putting output device %u in standby", target->device.id);
+            target->standbyHostTime = now;
+            target->standbyAudibleHostTime = lastAudible;
+            target->standby = true;
+        } else if (target->device.isStarted && !shouldStart
+                   && (!target->ready
+                       || (!silenceStandby
+                           && AudioConvertHostTimeToNanos(now - target->standbyHostTime) / 1e9
+                                  >= outputStandbySeconds))) {
+            DebugMsg("ProxyAudio: stopping output device %u", target->device.id);
+
+            if (target->ready) {
+                lastOutputStandbyStopHostTime = now;
+            }
+
+            stopOutputTargetNoLock(*target);
+            stoppedAny = true;
+        }
+
+        anyStarted |= target->device.isStarted;
     }
 
-    if (!outputDevice.isStarted && shouldStart) {
-        DebugMsg("ProxyAudio: starting outputDevice");
-        outputDevice.start();
-    } else if (outputDevice.isStarted && !shouldStart) {
-        DebugMsg("ProxyAudio: stopping outputDevice");
-        outputDevice.stop();
+    // The other targets may still be reading from the ring buffer
+    if (stoppedAny && !anyStarted) {
         resetInputData();
     }
 
+    updateLogDrainTimerNoLock(inputIOIsActive || anyStarted);
+}
+
+// Must be called with outputDeviceMutex held. Only IO threads use the realtime log, so it only needs
+// draining every 100 ms while the proxy device's IO is running or an output device is started.
+// Otherwise the timer is suspended so an idle machine isn't woken up ten times a second, and
+// whatever they logged last is drained from here instead, which monitorUserActivity's checks also
+// come through. That's done on the audio output queue like the timer's, as only one thread may
+// drain at a time.
+void ProxyAudioDevice::updateLogDrainTimerNoLock(bool ioThreadsRunning) {
+    if (ioThreadsRunning && !logDrainTimerRunning) {
+        dispatch_resume(logDrainTimer);
+        logDrainTimerRunning = true;
+    } else if (!ioThreadsRunning) {
+        if (logDrainTimerRunning) {
+            dispatch_suspend(logDrainTimer);
+            logDrainTimerRunning = false;
+        }
+
+        ExecuteInAudioOutputThread(^{ RealtimeLog::Shared().Drain(); });
+    }
 }
 
-void ProxyAudioDevice::matchOutputDeviceSampleRateNoLock() {
+void ProxyAudioDevice::matchOutputDeviceSampleRateNoLock(OutputTarget &target) {
     DebugMsg("ProxyAudio: matchOutputDeviceSampleRateNoLock");
     
-    if (!outputDevice.isValid()) {
+    if (!target.device.isValid()) {
         DebugMsg("ProxyAudio: matchOutputDeviceSampleRateNoLock ... no valid output device");
         return;
     }
 
     Float64 currentInputSampleRate;
-    OSStatus err = outputDevice.getDoublePropertyData(outputDevice.sampleRate,
-                                                      kAudioDevicePropertyNominalSampleRate,
-                                                      kAudioObjectPropertyScopeGlobal,
-                                                      kAudioObjectPropertyElementMaster);
+    Float64 newOutputSampleRate = 0;
+    OSStatus err = target.device.getDoublePropertyData(newOutputSampleRate,
+                                                       kAudioDevicePropertyNominalSampleRate,
+                                                       kAudioObjectPropertyScopeGlobal,
+                                                       kAudioObjectPropertyElementMaster);
 
-    if (err != noErr) {
+    if (err != noErr || newOutputSampleRate <= 0) {
         syslog(LOG_WARNING, "ProxyAudio error: couldn't get new sample rate of output device");
         return;
     }
@@ -4841,41 +4837,283 @@ void ProxyAudioDevice::matchOutputDeviceSampleRateNoLock() {
         CAMutex::Locker stateMutexLocker(stateMutex);
         currentInputSampleRate = gDevice_SampleRate;
     }
-    
-    if (currentInputSampleRate == outputDevice.sampleRate) {
-        outputDeviceReady = true;
+
+    // Rather than switching the proxy device over to the output device's sample rate, which takes
+    // a round trip through the HAL and interrupts every client, we just resample to it
+    Float64 ratio = currentInputSampleRate / newOutputSampleRate;
+
+    if (target.ready && newOutputSampleRate == target.device.sampleRate
+        && ratio == target.resampler->NominalRatio()) {
         updateOutputDeviceStartedState();
         return;
     }
 
-    DebugMsg("ProxyAudio: matchOutputDeviceSampleRateNoLock changing sample rate to match: %lf", outputDevice.sampleRate);
-    // NB: it's important that we not modify OutputDevice until it is no longer playing since
-    // we're not using a locking mechanism on its attributes between this function and its IO
-    // function.
-    
-    outputDeviceReady = false;
-    updateOutputDeviceStartedState();
-    
-    resetInputData();
-    outputDevice.updateStreamInfo();
+    if (ratio > kDevice_ResamplerMaxRatio || ratio < 1.0 / kDevice_ResamplerMaxRatio) {
+        syslog(LOG_WARNING,
+               "ProxyAudio: output device using unsupported sample rate %lf, cannot play!",
+               newOutputSampleRate);
+        target.ready = false;
+        updateOutputDeviceStartedState();
+
+        if (&target == primaryOutput) {
+            requestLatencyUpdateNoLock();
+        }
 
-    if (!contains(gDevice_SampleRates, outputDevice.sampleRate)) {
-        syslog(LOG_WARNING, "ProxyAudio: output device using unavailable sample rate, cannot play!");
         return;
     }
 
-    DebugMsg("ProxyAudio: matchOutputDeviceSampleRateNoLock about to request device configuration change");
-    
-    ExecuteInAudioOutputThread(^{
-        gPlugIn_Host->RequestDeviceConfigurationChange(gPlugIn_Host, kObjectID_Device, outputDevice.sampleRate, NULL);
-    });
+    DebugMsg("ProxyAudio: matchOutputDeviceSampleRateNoLock resampling from %lf to %lf",
+             currentInputSampleRate,
+             newOutputSampleRate);
+    // NB: it's important that we not modify the target's device or resampler until it is no
+    // longer playing since we're not using a locking mechanism on them between this function and
+    // its IO function. The proxy device itself and any other targets aren't affected, and its input
+    // keeps buffering meanwhile.
+    stopOutputTargetNoLock(target);
+    target.device.sampleRate = newOutputSampleRate;
+    target.device.updateStreamInfo();
+    target.resampler->SetNominalRatio(ratio);
+    updateOutputChannelMatrixNoLock(target);
+    target.needsResync = true;
+
+    target.ready = true;
+    updateOutputDeviceStartedState();
+
+    if (&target == primaryOutput) {
+        requestLatencyUpdateNoLock();
+    }
 }
 
+// Matches every output target to the proxy device's sample rate
 void ProxyAudioDevice::matchOutputDeviceSampleRate()
 {
     DebugMsg("ProxyAudio: matchOutputDeviceSampleRate");
     CAMutex::Locker outputMutexLocker(outputDeviceMutex);
-    matchOutputDeviceSampleRateNoLock();
+    finishPrimaryOutputSwitchNoLock();
+
+    for (OutputTarget *target : outputTargetsNoLock()) {
+        matchOutputDeviceSampleRateNoLock(*target);
+    }
+}
+
+// Must be called with both outputDeviceMutex and stateMutex held
+UInt32 ProxyAudioDevice::calculateLatencyNoLock() {
+    const LatencyModeSettings &settings = kDevice_LatencyModeSettings[int(latencyMode)];
+
+    if (!primaryOutput->device.isValid() || !primaryOutput->ready) {
+        return settings.cushionFrames;
+    }
+
+    // The output device reads the frames it needs for each cycle from this far behind the proxy
+    // device's clock (see outputDeviceIOProc), and then it's another buffer and safety offset
+    // before those frames are presented, plus the output device's own latency. That's counted in
+    // the output device's frames, which may not be the same length as ours. We can only report one
+    // latency, so any additional outputs aren't taken into account.
+    Float64 ratio = primaryOutput->resampler->NominalRatio();
+    Float64 outputDeviceFrames = 2.0 * (primaryOutput->device.bufferFrameSize + primaryOutput->device.safetyOffset)
+                                 + primaryOutput->device.latency;
+
+    return UInt32(ceil(outputDeviceFrames * ratio)) + primaryOutput->resampler->Latency() + settings.cushionFrames;
+}
+
+// Must be called with outputDeviceMutex held. Brings the latency mode's settings and the latency we
+// report up to date. A new ring buffer size or safety offset is applied in a configuration change,
+// which stops IO and interrupts every client. A new cushion is applied as it is, and only the latency
+// it makes us report waits for one, see publishLatencyNoLock.
+void ProxyAudioDevice::requestLatencyUpdateNoLock() {
+    {
+        CAMutex::Locker stateMutexLocker(stateMutex);
+        const LatencyModeSettings &settings = kDevice_LatencyModeSettings[int(latencyMode)];
+
+        if (settings.ringBufferFrames != gDevice_RingBufferFrames || settings.safetyOffset != gDevice_SafetyOffset) {
+            DebugMsg("ProxyAudio: requestLatencyUpdateNoLock requesting configuration change");
+            requestConfigurationChange(kDevice_LatencyConfigurationChange);
+            return;
+        }
+
+        if (settings.cushionFrames != gDevice_CushionFrames) {
+            // The outputs just move their read positions to the new distance behind the input
+            gDevice_CushionFrames = settings.cushionFrames;
+            publishControlStateNoLock();
+            requestOutputResync();
+        }
+    }
+
+    publishLatencyNoLock();
+}
+
+// Must be called with outputDeviceMutex held. Reports a new latency, after the primary output's
+// device, sample rate or buffer size changed for instance. The latency is one of the properties the
+// HAL only lets a device change in PerformDeviceConfigurationChange, so this asks for a
+// configuration change, and applyLatencyConfigurationNoLock brings gDevice_Latency up to date. While
+// the primary output is switching devices this waits for finishPrimaryOutputSwitchNoLock, since
+// until then the old device is still the one being heard.
+void ProxyAudioDevice::publishLatencyNoLock() {
+    if (retiringOutput) {
+        return;
+    }
+
+    {
+        CAMutex::Locker stateMutexLocker(stateMutex);
+        UInt32 latency = calculateLatencyNoLock();
+
+        if (latency == gDevice_Latency) {
+            return;
+        }
+
+        DebugMsg("ProxyAudio: publishLatencyNoLock latency: %u, was %u", latency, gDevice_Latency);
+    }
+
+    requestConfigurationChange(kDevice_LatencyConfigurationChange);
+}
+
+// Asks the HAL for a configuration change, one of the kDevice_...ConfigurationChange bits. Until the
+// HAL gets round to it, any other change asked for is folded into the same request, so a new
+// configuration that changes both the latency mode and the channel layout only stops IO once.
+void ProxyAudioDevice::requestConfigurationChange(UInt64 change) {
+    {
+        CAMutex::Locker locker(stateMutex);
+        bool requested = (pendingConfigurationChanges != 0);
+        pendingConfigurationChanges |= change;
+
+        if (requested) {
+            return;
+        }
+    }
+
+    ExecuteInAudioOutputThread(^{
+        UInt64 changes;
+        {
+            CAMutex::Locker locker(stateMutex);
+            changes = pendingConfigurationChanges;
+        }
+
+        gPlugIn_Host->RequestDeviceConfigurationChange(gPlugIn_Host, kObjectID_Device, changes, NULL);
+    });
+}
+
+// Called from PerformDeviceConfigurationChange, so the HAL isn't doing any IO on the proxy device.
+// The output devices are only started again once everything has changed.
+void ProxyAudioDevice::applyConfigurationChanges(UInt64 changes) {
+    DebugMsg("ProxyAudio: applyConfigurationChanges changes: %llu", changes);
+    CAMutex::Locker outputMutexLocker(outputDeviceMutex);
+    // The outgoing device of a switch in progress reads from the ring buffer too
+    finishPrimaryOutputSwitchNoLock();
+
+    if (changes & kDevice_LatencyConfigurationChange) {
+        applyLatencyConfigurationNoLock();
+    }
+
+    if (changes & kDevice_ChannelLayoutConfigurationChange) {
+        applyChannelLayoutNoLock();
+    }
+
+    updateOutputDeviceStartedState();
+}
+
+// Must be called with outputDeviceMutex held, from applyConfigurationChanges
+void ProxyAudioDevice::applyLatencyConfigurationNoLock() {
+    DebugMsg("ProxyAudio: applyLatencyConfigurationNoLock");
+    bool resync;
+
+    {
+        CAMutex::Locker stateMutexLocker(stateMutex);
+        const LatencyModeSettings &settings = kDevice_LatencyModeSettings[int(latencyMode)];
+        // When it's only the latency we report that changed, the outputs are already reading from
+        // the right distance behind the input
+        resync = (settings.ringBufferFrames != gDevice_RingBufferFrames
+                  || settings.cushionFrames != gDevice_CushionFrames || settings.safetyOffset != gDevice_SafetyOffset);
+
+        if (settings.ringBufferFrames != gDevice_RingBufferFrames) {
+            // NB: the output devices' IO procs read from the ring buffer without a lock, so they
+            // have to be stopped before the buffer can be reallocated
+            for (OutputTarget *target : outputTargetsNoLock()) {
+                if (target->device.isStarted) {
+                    stopOutputTargetNoLock(*target);
+                }
+            }
+
+            gDevice_RingBufferFrames = settings.ringBufferFrames;
+            inputBuffer->Allocate(gDevice_BytesPerFrameInChannel * gDevice_ChannelsPerFrame,
+                                  gDevice_RingBufferFrames,
+                                  AudioRingBuffer::AllocationMode::mirrored);
+            resetInputData();
+        }
+
+        gDevice_CushionFrames = settings.cushionFrames;
+        gDevice_SafetyOffset = settings.safetyOffset;
+        gDevice_Latency = calculateLatencyNoLock();
+        publishControlStateNoLock();
+        DebugMsg("ProxyAudio: applyLatencyConfigurationNoLock latency: %u safety offset: %u ring buffer: %u",
+                 gDevice_Latency,
+                 gDevice_SafetyOffset,
+                 gDevice_RingBufferFrames);
+    }
+
+    // Start reading from the new distance behind the input
+    if (resync) {
+        requestOutputResync();
+    }
+}
+
+// Must be called with outputDeviceMutex held, from applyConfigurationChanges
+void ProxyAudioDevice::applyChannelLayoutNoLock() {
+    DebugMsg("ProxyAudio: applyChannelLayoutNoLock");
+
+    // NB: the output devices' IO procs use the ring buffer, their resamplers and their channel
+    // matrices without a lock, so they have to be stopped before any of them can be replaced
+    std::vector<OutputTarget *> targets = outputTargetsNoLock();
+
+    for (OutputTarget *target : targets) {
+        if (target->device.isStarted) {
+            stopOutputTargetNoLock(*target);
+        }
+    }
+
+    {
+        CAMutex::Locker stateMutexLocker(stateMutex);
+        gDevice_ChannelsPerFrame = channelCountForLayout(channelLayout);
+        inputBuffer->Allocate(gDevice_BytesPerFrameInChannel * gDevice_ChannelsPerFrame,
+                              gDevice_RingBufferFrames,
+                              AudioRingBuffer::AllocationMode::mirrored);
+        resetInputData();
+        publishControlStateNoLock();
+        DebugMsg("ProxyAudio: applyChannelLayoutNoLock channels: %u", gDevice_ChannelsPerFrame);
+    }
+
+    // The resamplers' histories are sized for a fixed number of channels, so they have to be
+    // replaced
+    for (OutputTarget *target : targets) {
+        createOutputResamplerNoLock(*target);
+        updateOutputChannelMatrixNoLock(*target);
+    }
+}
+
+// Must be called with outputDeviceMutex held, while the target's device isn't playing. Routes each
+// of the proxy device's channels to the target device's channel with the same label, or failing
+// that folds it down into the nearest channels the target device does have.
+void ProxyAudioDevice::updateOutputChannelMatrixNoLock(OutputTarget &target) {
+    UInt32 inputChannels = target.resampler->Channels();
+    UInt32 outputChannels = target.device.channelCount;
+
+    target.channelMatrix.clear();
+    target.channelMatrixStride = 0;
+    target.channelMatrixIsIdentity = true;
+
+    // Without knowing how many channels the output device has, just map ours straight through
+    if (!target.device.isValid() || outputChannels == 0) {
+        return;
+    }
+
+    target.channelMatrixStride = outputChannels;
+    target.channelMatrixIsIdentity =
+        MakeChannelMatrix(inputChannels, outputChannels, target.device.channelLabels, target.channelMatrix);
+
+    DebugMsg("ProxyAudio: updateOutputChannelMatrixNoLock device %u: %u channels to %u channels, identity: %d",
+             target.device.id,
+             inputChannels,
+             outputChannels,
+             target.channelMatrixIsIdentity);
 }
 
 void ProxyAudioDevice::setupTargetOutputDevice() {
@@ -4885,41 +5123,286 @@ void ProxyAudioDevice::setupTargetOutputDevice() {
     DebugMsg("ProxyAudio: setupTargetOutputDevice newOutputDevice: %d", newOutputDevice.id);
     CAMutex::Locker locker(outputDeviceMutex);
     
-    if (outputDevice.isValid() && outputDevice.id == newOutputDevice.id
-        && outputDevice.bufferFrameSize == outputDeviceBufferFrameSize) {
+    if (primaryOutput->device.isValid() && primaryOutput->device.id == newOutputDevice.id
+        && primaryOutput->device.bufferFrameSize == outputDeviceBufferFrameSize) {
         DebugMsg("ProxyAudio: setupTargetOutputDevice no change in device");
         return;
     }
 
+    if (primaryOutput->device.isStarted && newOutputDevice.isValid()
+        && primaryOutput->device.id != newOutputDevice.id) {
+        DebugMsg("ProxyAudio: setupTargetOutputDevice switching from device %u", primaryOutput->device.id);
+        switchPrimaryOutputNoLock(newOutputDevice);
+        return;
+    }
+
     DebugMsg("ProxyAudio: setupTargetOutputDevice deinitializing old device");
-    // NB: it's important that we not modify OutputDevice until it is no longer playing since
+    // NB: it's important that we not modify the output device until it is no longer playing since
     // we're not using a locking mechanism on its attributes between this function and its IO
     // function.
-    deinitializeOutputDeviceNoLock();
+    deinitializeOutputDeviceNoLock(*primaryOutput);
 
+    // The ring buffer is left alone: the new device picks a fresh read position in it when it
+    // starts, and the audio that's already buffered is still good for any other target
     if (newOutputDevice.isValid()) {
         DebugMsg("ProxyAudio: setupTargetOutputDevice setting up new device");
-        resetInputData();
-        outputDevice = newOutputDevice;
-        outputDevice.setBufferFrameSize(outputDeviceBufferFrameSize);
-        outputDevice.setupIOProc(outputDeviceIOProcStatic, this);
-        outputDevice.addPropertyListener(kAudioDevicePropertyDeviceIsAlive,
-                                         kAudioObjectPropertyScopeGlobal,
-                                         kAudioObjectPropertyElementMaster,
-                                         outputDeviceAliveListenerStatic,
-                                         this);
-        outputDevice.addPropertyListener(kAudioDevicePropertyNominalSampleRate,
-                                         kAudioObjectPropertyScopeGlobal,
-                                         kAudioObjectPropertyElementMaster,
-                                         outputDeviceSampleRateListenerStatic,
-                                         this);
-        DebugMsg("ProxyAudio: setupTargetOutputDevice will match sample rate");
-        matchOutputDeviceSampleRateNoLock();
+        setupOutputTargetNoLock(*primaryOutput, newOutputDevice);
     } else {
         syslog(LOG_WARNING, "ProxyAudio: setupTargetOutputDevice could not find output device");
     }
 }
 
+// Must be called with outputDeviceMutex held, while the primary output is playing. Moves it to
+// another device without a gap: a new target is set up for the new device, and its IO proc starts
+// reading from wherever the old target has got to in the ring buffer and fades in. Once it has
+// played, the old target fades out, and continuePrimaryOutputSwitchNoLock retires it. Nothing that's
+// already buffered is thrown away.
+void ProxyAudioDevice::switchPrimaryOutputNoLock(AudioDevice newDevice) {
+    // Only one switch at a time
+    finishPrimaryOutputSwitchNoLock();
+
+    OutputTarget *target = new OutputTarget();
+    target->owner = this;
+    target->ringReader = inputBuffer->AddReader();
+    target->handoffReader = primaryOutput->ringReader;
+    target->fadeLevel = 0.0f;
+    createOutputResamplerNoLock(*target);
+
+    retiringOutput = primaryOutput;
+    primaryOutput = target;
+    primaryOutputSwitchHostTime = mach_absolute_time();
+    setupOutputTargetNoLock(*target, newDevice);
+
+    // If the new device didn't start, there's nothing to fade over to
+    if (!target->device.isStarted) {
+        DebugMsg("ProxyAudio: switchPrimaryOutputNoLock new device %u didn't start", newDevice.id);
+        finishPrimaryOutputSwitchNoLock();
+        return;
+    }
+
+    continuePrimaryOutputSwitchNoLock();
+}
+
+// Must be called with outputDeviceMutex held. Checks on a switch of the primary output's device
+// every 10 ms until the old device can be retired.
+void ProxyAudioDevice::continuePrimaryOutputSwitchNoLock() {
+    if (!retiringOutput) {
+        return;
+    }
+
+    // The old device only starts fading out once the new one is actually playing, so that there's
+    // never a moment when neither of them is
+    if (primaryOutput->hasPlayed) {
+        retiringOutput->fadeTarget = 0.0f;
+    }
+
+    bool fadedOut = (retiringOutput->fadeTarget == 0.0f && retiringOutput->fadeLevel == 0.0f);
+    bool timedOut = (AudioConvertHostTimeToNanos(mach_absolute_time() - primaryOutputSwitchHostTime)
+                     > kDevice_OutputSwitchTimeoutMSec * NSEC_PER_MSEC);
+
+    if (fadedOut || timedOut || !primaryOutput->device.isStarted || !retiringOutput->device.isStarted) {
+        finishPrimaryOutputSwitchNoLock();
+        return;
+    }
+
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_MSEC), AudioOutputDispatchQueue(), ^() {
+        CAMutex::Locker locker(outputDeviceMutex);
+        continuePrimaryOutputSwitchNoLock();
+    });
+}
+
+// Must be called with outputDeviceMutex held. Retires the primary output's old target, if it's
+// switching devices, whether or not it has finished fading out.
+void ProxyAudioDevice::finishPrimaryOutputSwitchNoLock() {
+    if (!retiringOutput) {
+        return;
+    }
+
+    OutputTarget *target = retiringOutput;
+    retiringOutput = NULL;
+
+    DebugMsg("ProxyAudio: finishPrimaryOutputSwitchNoLock retiring device %u", target->device.id);
+    deinitializeOutputDeviceNoLock(*target);
+    inputBuffer->RemoveReader(target->ringReader);
+    delete target->resampler;
+    delete target;
+
+    // Its cursor could be reused by another target from now on. Its IO proc has stopped, so the
+    // new one can take over steering the proxy device's clock.
+    primaryOutput->handoffReader = -1;
+    primaryOutput->fadeTarget = 1.0f;
+    primaryOutput->steersClock = true;
+
+    // Only now is everything played on the new device, so this is when the latency changes
+    publishLatencyNoLock();
+}
+
+// Brings the additional outputs in line with additionalOutputDevicesList. Only the outputs that
+// were added, removed or whose device came or went are touched, so the rest keep playing. Only the
+// first kDevice_MaxAdditionalOutputs in the list are played to.
+void ProxyAudioDevice::setupAdditionalOutputTargets() {
+    static_assert(kDevice_MaxAdditionalOutputs + 2 <= size_t(AudioRingBuffer::kMaxReaders),
+                  "every output target needs a reader slot in the ring buffer");
+    DebugMsg("ProxyAudio: setupAdditionalOutputTargets");
+    std::vector<CFStringRef> uids;
+    std::vector<Float32> gains;
+
+    {
+        CAMutex::Locker locker(stateMutex);
+        parseAdditionalOutputDevices(additionalOutputDevicesList, uids, gains);
+    }
+
+    // Past that, there'd be no reader slot left for the output, and it would play without anything
+    // noticing the input side dropping audio it hadn't got to yet
+    for (size_t index = kDevice_MaxAdditionalOutputs; index < uids.size(); index++) {
+        syslog(LOG_WARNING,
+               "ProxyAudio: setupAdditionalOutputTargets ignoring output device %s, as only %zu additional "
+               "outputs are supported",
+               CFStringToStdString(uids[index]).c_str(),
+               kDevice_MaxAdditionalOutputs);
+        CFRelease(uids[index]);
+    }
+
+    if (uids.size() > kDevice_MaxAdditionalOutputs) {
+        uids.resize(kDevice_MaxAdditionalOutputs);
+        gains.resize(kDevice_MaxAdditionalOutputs);
+    }
+
+    CAMutex::Locker locker(outputDeviceMutex);
+
+    // Drop the outputs that are no longer wanted
+    for (auto it = additionalOutputs.begin(); it != additionalOutputs.end();) {
+        OutputTarget *target = *it;
+        bool wanted = std::any_of(uids.begin(), uids.end(), [target](CFStringRef uid) {
+            return CFStringCompare(uid, target->uid, 0) == kCFCompareEqualTo;
+        });
+
+        if (wanted) {
+            ++it;
+            continue;
+        }
+
+        DebugMsg("ProxyAudio: setupAdditionalOutputTargets removing %s", CFStringToStdString(target->uid).c_str());
+        deinitializeOutputDeviceNoLock(*target);
+        inputBuffer->RemoveReader(target->ringReader);
+        delete target->resampler;
+        CFRelease(target->uid);
+        delete target;
+        it = additionalOutputs.erase(it);
+    }
+
+    for (size_t index = 0; index < uids.size(); index++) {
+        auto found = std::find_if(additionalOutputs.begin(), additionalOutputs.end(), [&](OutputTarget *target) {
+            return CFStringCompare(uids[index], target->uid, 0) == kCFCompareEqualTo;
+        });
+        OutputTarget *target;
+
+        if (found != additionalOutputs.end()) {
+            target = *found;
+        } else {
+            DebugMsg("ProxyAudio: setupAdditionalOutputTargets adding %s", CFStringToStdString(uids[index]).c_str());
+            target = new OutputTarget();
+            target->owner = this;
+            target->uid = CFStringCreateCopy(NULL, uids[index]);
+            target->ringReader = inputBuffer->AddReader();
+            createOutputResamplerNoLock(*target);
+            additionalOutputs.push_back(target);
+        }
+
+        target->gain = gains[index];
+
+        AudioDeviceID deviceID = deviceRegistry.DeviceForUID(target->uid);
+
+        // Playing to the same device twice would just double it up
+        if (deviceID != kAudioObjectUnknown && primaryOutput->device.isValid()
+            && deviceID == primaryOutput->device.id) {
+            deviceID = kAudioObjectUnknown;
+        }
+
+        if (target->device.isValid() && target->device.id == deviceID
+            && target->device.bufferFrameSize == outputDeviceBufferFrameSize) {
+            continue;
+        }
+
+        deinitializeOutputDeviceNoLock(*target);
+
+        if (deviceID != kAudioObjectUnknown) {
+            setupOutputTargetNoLock(*target, AudioDevice(deviceID));
+        } else {
+            syslog(LOG_WARNING,
+                   "ProxyAudio: setupAdditionalOutputTargets could not find output device %s",
+                   CFStringToStdString(target->uid).c_str());
+        }
+    }
+
+    for (CFStringRef uid : uids) {
+        CFRelease(uid);
+    }
+}
+
+// Must be called with outputDeviceMutex held, with the target's old device already deinitialized
+void ProxyAudioDevice::setupOutputTargetNoLock(OutputTarget &target, AudioDevice newDevice) {
+    target.device = newDevice;
+
+    if (!target.device.isValid()) {
+        return;
+    }
+
+    target.device.setBufferFrameSize(outputDeviceBufferFrameSize);
+    target.device.setupIOProc(outputDeviceIOProcStatic, &target);
+    target.device.addPropertyListener(kAudioDevicePropertyDeviceIsAlive,
+                                      kAudioObjectPropertyScopeGlobal,
+                                      kAudioObjectPropertyElementMaster,
+                                      outputDeviceAliveListenerStatic,
+                                      this);
+    target.device.addPropertyListener(kAudioDevicePropertyNominalSampleRate,
+                                      kAudioObjectPropertyScopeGlobal,
+                                      kAudioObjectPropertyElementMaster,
+                                      outputDeviceSampleRateListenerStatic,
+                                      this);
+    DebugMsg("ProxyAudio: setupOutputTargetNoLock will match sample rate");
+    matchOutputDeviceSampleRateNoLock(target);
+}
+
+// Must be called with outputDeviceMutex held. Besides stopping the target's device, this takes its
+// cursor out of the ring buffer, so that a stopped target never counts as its slowest reader.
+void ProxyAudioDevice::stopOutputTargetNoLock(OutputTarget &target) {
+    target.device.stop();
+    inputBuffer->SetReaderFrame(target.ringReader, AudioRingBuffer::kReaderIdle);
+}
+
+// Must be called with outputDeviceMutex held, while the target's device isn't playing. Gives the
+// target a resampler for the proxy device's current channel count, keeping the ratio it had.
+void ProxyAudioDevice::createOutputResamplerNoLock(OutputTarget &target) {
+    Float64 nominalRatio = target.resampler ? target.resampler->NominalRatio() : 1.0;
+
+    delete target.resampler;
+    target.resampler = new AdaptiveResampler(
+        gDevice_ChannelsPerFrame, kDevice_ResamplerMaxFrames, kDevice_ResamplerMaxRatio * kDevice_DriftMaxRatio);
+    target.resampler->SetNominalRatio(nominalRatio);
+    //    big enough for any channel layout, so that changing layouts never has to reallocate it
+    target.resampledFrames.assign(kDevice_ResamplerMaxFrames * kDevice_MaxChannelsPerFrame, 0.0f);
+    target.needsResync = true;
+}
+
+// Must be called with outputDeviceMutex held. The primary output always comes first.
+std::vector<ProxyAudioDevice::OutputTarget *> ProxyAudioDevice::outputTargetsNoLock() {
+    std::vector<OutputTarget *> targets = {primaryOutput};
+    targets.insert(targets.end(), additionalOutputs.begin(), additionalOutputs.end());
+    return targets;
+}
+
+// Must be called with outputDeviceMutex held
+ProxyAudioDevice::OutputTarget *ProxyAudioDevice::outputTargetForDeviceNoLock(AudioObjectID deviceID) {
+    for (OutputTarget *target : outputTargetsNoLock()) {
+        if (target->device.isValid() && target->device.id == deviceID) {
+            return target;
+        }
+    }
+
+    return NULL;
+}
+
 void ProxyAudioDevice::initializeOutputDevice() {
     dispatch_after(dispatch_time(DISPATCH_TIME_NOW, 1000 * NSEC_PER_MSEC),
                    AudioOutputDispatchQueue(),
@@ -4928,37 +5411,35 @@ void ProxyAudioDevice::initializeOutputDevice() {
                        // in a separate thread from the rest of the driver. Otherwise we'll get
                        // deadlocks!
                        DebugMsg("ProxyAudio: initializeOutputDevice running in separate thread");
+                       // The listener goes first so that no change to the device list can be
+                       // missed between the registry reading it and the listener being added
+                       setupAudioDevicesListener();
+                       deviceRegistry.Update();
+
                        if (!outputDeviceUID) {
                            outputDeviceUID = copyDefaultProxyOutputDeviceUID();
                        }
-                       
+
                        setupTargetOutputDevice();
-                       setupAudioDevicesListener();
+                       setupAdditionalOutputTargets();
                    });
 }
 
-void ProxyAudioDevice::deinitializeOutputDeviceNoLock() {
+void ProxyAudioDevice::deinitializeOutputDeviceNoLock(OutputTarget &target) {
     DebugMsg("ProxyAudio: deinitializeOutputDeviceNoLock");
-    if (outputDevice.isValid()) {
+    if (target.device.isValid()) {
         DebugMsg("ProxyAudio: deinitializeOutputDeviceNoLock stopping device");
-        outputDevice.stop();
-        outputDeviceReady = false;
+        stopOutputTargetNoLock(target);
+        target.ready = false;
         DebugMsg("ProxyAudio: deinitializeOutputDeviceNoLock removing IO proc");
-        outputDevice.destroyIOProc();
+        target.device.destroyIOProc();
         DebugMsg("ProxyAudio: deinitializeOutputDeviceNoLock invalidating");
-        outputDevice.invalidate();
+        target.device.invalidate();
     } else {
         DebugMsg("ProxyAudio: deinitializeOutputDeviceNoLock output device is already invalidated");
     }
 }
 
-void ProxyAudioDevice::deinitializeOutputDevice()
-{
-    DebugMsg("ProxyAudio: deinitializeOutputDevice");
-    CAMutex::Locker locker(outputDeviceMutex);
-    deinitializeOutputDeviceNoLock();
-}
-
 void ProxyAudioDevice::setupAudioDevicesListener() {
     DebugMsg("ProxyAudio: setupAudioDevicesListener");
     AudioObjectPropertyAddress listenerPropertyAddress = {
@@ -4988,7 +5469,6 @@ void ProxyAudioDevice::setupAudioDevicesListener() {
 
 void ProxyAudioDevice::resetInputData() {
     DebugMsg("ProxyAudio: resetInputData");
-    CAMutex::Locker locker(&IOMutex);
     
     if (inputBuffer) {
         inputBuffer->Clear();
@@ -4996,10 +5476,14 @@ void ProxyAudioDevice::resetInputData() {
 
     lastInputFrameTime = -1;
     lastInputBufferFrameSize = -1;
-    inputOutputSampleDelta = -1;
+    requestOutputResync();
     inputFinalFrameTime = -1;
 }
 
+void ProxyAudioDevice::requestOutputResync() {
+    outputResyncGeneration++;
+}
+
 OSStatus ProxyAudioDevice::StartIO(AudioServerPlugInDriverRef inDriver,
                                    AudioObjectID inDeviceObjectID,
                                    UInt32 inClientID) {
@@ -5015,7 +5499,6 @@ OSStatus ProxyAudioDevice::StartIO(AudioServerPlugInDriverRef inDriver,
 #pragma unused(inClientID)
     
     DebugMsg("ProxyAudio: StartIO");
-    resetInputData();
 
     CAMutex::Locker locker(stateMutex);
 
@@ -5025,20 +5508,30 @@ OSStatus ProxyAudioDevice::StartIO(AudioServerPlugInDriverRef inDriver,
         theAnswer = kAudioHardwareIllegalOperationError;
     } else if (gDevice_IOIsRunning == 0) {
         //    We need to start the hardware, which in this case is just anchoring the time line.
+        //    Whatever was left in the ring buffer belongs to the old time line. Clients that start
+        //    while IO is already running, like a recorder on the loopback input, mustn't clear it
+        //    from under the outputs that are playing it.
         gDevice_IOIsRunning = 1;
-        gDevice_NumberTimeStamps = 0;
-        gDevice_AnchorSampleTime = 0;
-        gDevice_AnchorHostTime = mach_absolute_time();
-        gDevice_ElapsedTicks = 0;
-        outputAccumulatedRateRatio = 0.0;
-        outputAccumulatedRateRatioSamples = 0;
+        resetInputData();
+
+        ZeroTimeStampAnchor anchor = zeroTimeStampAnchor.Load();
+        anchor.hostTime = mach_absolute_time();
+        anchor.hostTicksPerFrame = gDevice_HostTicksPerFrame;
+        anchor.generation++;
+        zeroTimeStampAnchor.Store(anchor);
+        outputRateRatio.Reset();
     } else {
         //    IO is already running, so just bump the counter
         ++gDevice_IOIsRunning;
     }
     
+    // The silence before the first sound is timed from here
+    lastAudibleInputHostTime = mach_absolute_time();
     inputIOIsActive = (gDevice_IOIsRunning > 0);
-    ExecuteInAudioOutputThread(^ () { updateOutputDeviceStartedState(); });
+    ExecuteInAudioOutputThread(^ () {
+        CAMutex::Locker locker(outputDeviceMutex);
+        updateOutputDeviceStartedState();
+    });
     
     DebugMsg("ProxyAudio: StartIO finished");
     
@@ -5053,7 +5546,6 @@ OSStatus ProxyAudioDevice::StopIO(AudioServerPlugInDriverRef inDriver,
 
 #pragma unused(inClientID)
     DebugMsg("ProxyAudio: StopIO");
-    inputFinalFrameTime = lastInputFrameTime + lastInputBufferFrameSize;
 
     //    declare the local variables
     OSStatus theAnswer = 0;
@@ -5075,8 +5567,11 @@ OSStatus ProxyAudioDevice::StopIO(AudioServerPlugInDriverRef inDriver,
             //    underflowing is an error
             theAnswer = kAudioHardwareIllegalOperationError;
         } else if (gDevice_IOIsRunning == 1) {
-            //    We need to stop the hardware, which in this case means that there's nothing to do.
+            //    We need to stop the hardware, which in this case just means letting the outputs
+            //    play out what was written. Only the last client stopping ends the input: while any
+            //    other is running, the mix keeps being written.
             gDevice_IOIsRunning = 0;
+            inputFinalFrameTime = lastInputFrameTime + lastInputBufferFrameSize;
         } else {
             //    IO is still running, so just bump the counter
             --gDevice_IOIsRunning;
@@ -5084,7 +5579,10 @@ OSStatus ProxyAudioDevice::StopIO(AudioServerPlugInDriverRef inDriver,
     }
     
     inputIOIsActive = (gDevice_IOIsRunning > 0);
-    ExecuteInAudioOutputThread(^ () { updateOutputDeviceStartedState(); });
+    ExecuteInAudioOutputThread(^ () {
+        CAMutex::Locker locker(outputDeviceMutex);
+        updateOutputDeviceStartedState();
+    });
     
     DebugMsg("ProxyAudio: StopIO finished");
 
@@ -5117,18 +5615,27 @@ OSStatus ProxyAudioDevice::GetZeroTimeStamp(AudioServerPlugInDriverRef inDriver,
     UInt64 theNextHostTime;
 
     //    check the arguments
-    FailWithAction(inDriver != gAudioServerPlugInDriverRef,
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "GetZeroTimeStamp: bad driver reference");
-    FailWithAction(inDeviceObjectID != kObjectID_Device,
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "GetZeroTimeStamp: bad device ID");
+    RTFailWithAction(inDriver != gAudioServerPlugInDriverRef,
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "GetZeroTimeStamp: bad driver reference");
+    RTFailWithAction(inDeviceObjectID != kObjectID_Device,
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "GetZeroTimeStamp: bad device ID");
 
     {
-        CAMutex::Locker locker(&getZeroTimestampMutex);
-        
+        //    pick up the anchor StartIO published, starting the time line over if it's a new one
+        ZeroTimeStampAnchor anchor = zeroTimeStampAnchor.Load();
+
+        if (anchor.generation != gDevice_AnchorGeneration) {
+            gDevice_AnchorGeneration = anchor.generation;
+            gDevice_AnchorHostTime = anchor.hostTime;
+            gDevice_AnchorHostTicksPerFrame = anchor.hostTicksPerFrame;
+            gDevice_NumberTimeStamps = 0;
+            gDevice_ElapsedTicks = 0;
+        }
+
         //    get the current host time
         theCurrentHostTime = mach_absolute_time();
 
@@ -5137,16 +5644,11 @@ OSStatus ProxyAudioDevice::GetZeroTimeStamp(AudioServerPlugInDriverRef inDriver,
         // Then each time we calculate the next zero timestamp we slightly adjust
         // the tick count for our ring buffer by however much the output IO proc
         // deviated from its sample rate.
-        
-        Float64 rateRatio = 1.0;
-        
-        if (outputAccumulatedRateRatioSamples > 0) {
-            rateRatio = outputAccumulatedRateRatio / outputAccumulatedRateRatioSamples;
-        }
-        
+        Float64 rateRatio = outputRateRatio.CollectAverage();
+
         //    calculate the next host time
         theHostTicksPerRingBuffer =
-            gDevice_HostTicksPerFrame * ((Float64)kDevice_RingBufferSize) * rateRatio;
+            gDevice_AnchorHostTicksPerFrame * ((Float64)kDevice_RingBufferSize) * rateRatio;
         theHostTickOffset = gDevice_ElapsedTicks + theHostTicksPerRingBuffer;
         theNextHostTime = gDevice_AnchorHostTime + ((UInt64)theHostTickOffset);
 
@@ -5160,8 +5662,6 @@ OSStatus ProxyAudioDevice::GetZeroTimeStamp(AudioServerPlugInDriverRef inDriver,
         *outSampleTime = gDevice_NumberTimeStamps * kDevice_RingBufferSize;
         *outHostTime = gDevice_AnchorHostTime + gDevice_ElapsedTicks;
         *outSeed = 1;
-        outputAccumulatedRateRatio = 0.0;
-        outputAccumulatedRateRatioSamples = 0;
     }
 
 Done:
@@ -5185,14 +5685,14 @@ OSStatus ProxyAudioDevice::WillDoIOOperation(AudioServerPlugInDriverRef inDriver
     bool willDoInPlace = true;
 
     //    check the arguments
-    FailWithAction(inDriver != gAudioServerPlugInDriverRef,
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "WillDoIOOperation: bad driver reference");
-    FailWithAction(inDeviceObjectID != kObjectID_Device,
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "WillDoIOOperation: bad device ID");
+    RTFailWithAction(inDriver != gAudioServerPlugInDriverRef,
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "WillDoIOOperation: bad driver reference");
+    RTFailWithAction(inDeviceObjectID != kObjectID_Device,
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "WillDoIOOperation: bad device ID");
 
     //    figure out if we support the operation
     switch (inOperationID) {
@@ -5234,14 +5734,14 @@ OSStatus ProxyAudioDevice::BeginIOOperation(AudioServerPlugInDriverRef inDriver,
     OSStatus theAnswer = 0;
 
     //    check the arguments
-    FailWithAction(inDriver != gAudioServerPlugInDriverRef,
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "BeginIOOperation: bad driver reference");
-    FailWithAction(inDeviceObjectID != kObjectID_Device,
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "BeginIOOperation: bad device ID");
+    RTFailWithAction(inDriver != gAudioServerPlugInDriverRef,
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "BeginIOOperation: bad driver reference");
+    RTFailWithAction(inDeviceObjectID != kObjectID_Device,
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "BeginIOOperation: bad device ID");
 
 Done:
     return theAnswer;
@@ -5256,8 +5756,9 @@ OSStatus ProxyAudioDevice::DoIOOperation(AudioServerPlugInDriverRef inDriver,
                                          const AudioServerPlugInIOCycleInfo *inIOCycleInfo,
                                          void *ioMainBuffer,
                                          void *ioSecondaryBuffer) {
-    //    This is called to actuall perform a given operation. For this device, all we need to do is
-    //    clear the buffer for the ReadInput operation.
+    //    This is called to actuall perform a given operation. For this device, WriteMix stores the
+    //    mix in the ring buffer for the output devices to play, and ReadInput serves it back for the
+    //    loopback input.
 
 #pragma unused(inClientID, ioSecondaryBuffer)
 
@@ -5265,32 +5766,58 @@ OSStatus ProxyAudioDevice::DoIOOperation(AudioServerPlugInDriverRef inDriver,
     OSStatus theAnswer = 0;
 
     //    check the arguments
-    FailWithAction(inDriver != gAudioServerPlugInDriverRef,
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "DoIOOperation: bad driver reference");
-    FailWithAction(inDeviceObjectID != kObjectID_Device,
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "DoIOOperation: bad device ID");
-    FailWithAction((inStreamObjectID != kObjectID_Stream_Output),
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "DoIOOperation: bad stream ID");
+    RTFailWithAction(inDriver != gAudioServerPlugInDriverRef,
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "DoIOOperation: bad driver reference");
+    RTFailWithAction(inDeviceObjectID != kObjectID_Device,
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "DoIOOperation: bad device ID");
+    RTFailWithAction((inStreamObjectID != kObjectID_Stream_Output && inStreamObjectID != kObjectID_Stream_Input),
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "DoIOOperation: bad stream ID");
 
-    //    clear the buffer if this iskAudioServerPlugInIOOperationReadInput
     if (inOperationID == kAudioServerPlugInIOOperationReadInput) {
-        memset(ioMainBuffer, 0, inIOBufferFrameSize * 8);
+        if (inputBuffer) {
+            // The mix is stored by the sample times it was written for, so reading the input's
+            // sample times lines every frame up with what was being played at that moment. Frames
+            // that were never written, because nothing was playing or the input is running on its
+            // own, read as silence. The ring buffer holds the mix in the stream's own format, so
+            // the frames are copied straight from it into the HAL's buffer.
+            bool zeroFilled =
+                inputBuffer->Fetch((Byte *)ioMainBuffer, inIOBufferFrameSize, inIOCycleInfo->mInputTime.mSampleTime);
+            telemetry.RecordLoopbackCycle(zeroFilled);
+        } else {
+            UInt32 theBytesPerFrame = gDevice_BytesPerFrameInChannel * controlState.Load().channelCount;
+            memset(ioMainBuffer, 0, inIOBufferFrameSize * theBytesPerFrame);
+        }
 
     } else if (inOperationID == kAudioServerPlugInIOOperationWriteMix) {
         if (inputBuffer) {
-            CAMutex::Locker locker(IOMutex);
+            // No lock here: the ring buffer is safe for this thread to write while the output
+            // device's IO proc reads from it. Finding out whether the mix is digital silence here,
+            // once, saves every output device that plays it from looking. The check gives up on the
+            // first sample that isn't zero, so when there's sound it costs next to nothing.
+            bool silent = IsSilent((const Float32 *)ioMainBuffer,
+                                   inIOBufferFrameSize * inputBuffer->mBytesPerFrame / sizeof(Float32));
+            inputBuffer->Store(
+                (const Byte *)ioMainBuffer, inIOBufferFrameSize, inIOCycleInfo->mOutputTime.mSampleTime, silent);
+
+            if (!silent) {
+                lastAudibleInputHostTime = inIOCycleInfo->mCurrentTime.mHostTime;
+            }
+
+            InputTimeStamp currentTime;
+            currentTime.sampleTime = inIOCycleInfo->mCurrentTime.mSampleTime;
+            currentTime.hostTime = inIOCycleInfo->mCurrentTime.mHostTime;
+            lastInputTimeStamp.Store(currentTime);
 
-            inputBuffer->Store((const Byte *)ioMainBuffer, inIOBufferFrameSize, inIOCycleInfo->mOutputTime.mSampleTime);
-            
             lastInputFrameTime = inIOCycleInfo->mOutputTime.mSampleTime;
             lastInputBufferFrameSize = inIOBufferFrameSize;
             inputCycleCount += 1;
+            telemetry.RecordInputCycle(silent);
         }
     }
 
@@ -5309,154 +5836,384 @@ OSStatus ProxyAudioDevice::outputDeviceIOProcStatic(AudioDeviceID inDevice,
         return noErr;
     }
 
-    return ((ProxyAudioDevice *)inClientData)
-        ->outputDeviceIOProc(inDevice, inNow, inInputData, inInputTime, outOutputData, inOutputTime);
+    OutputTarget *target = (OutputTarget *)inClientData;
+
+    return target->owner->outputDeviceIOProc(
+        *target, inDevice, inNow, inInputData, inInputTime, outOutputData, inOutputTime);
 }
 
-OSStatus ProxyAudioDevice::outputDeviceIOProc(AudioDeviceID inDevice,
+OSStatus ProxyAudioDevice::outputDeviceIOProc(OutputTarget &target,
+                                              AudioDeviceID inDevice,
                                               const AudioTimeStamp *inNow,
                                               const AudioBufferList *inInputData,
                                               const AudioTimeStamp *inInputTime,
                                               AudioBufferList *outOutputData,
                                               const AudioTimeStamp *inOutputTime) {
 #pragma unused(inDevice)
-#pragma unused(inNow)
 #pragma unused(inInputData)
 #pragma unused(inInputTime)
-    CAMutex::Locker locker1(IOMutex);
-
-    // In theory we don't need a locking mechanism here, because outputDevice will only be modified
-    // while it is not playing.
-    Float64 currentOutputDeviceSampleRate = outputDevice.sampleRate;
-    UInt32 currentOutputDeviceBufferFrameSize = outputDevice.bufferFrameSize;
-    UInt32 currentOutputDeviceSafetyOffset = outputDevice.safetyOffset;
-    Float64 currentInputDeviceSampleRate;
-    UInt32 currentInputDeviceChannelCount;
-    Float32 currentVolumeR, currentVolumeL;
-    bool currentMute;
 
-    {
-        CAMutex::Locker stateLocker(&stateMutex);
-        currentInputDeviceSampleRate = gDevice_SampleRate;
-        currentInputDeviceChannelCount = gDevice_ChannelsPerFrame;
-        currentVolumeR = gVolume_Output_R_Value;
-        currentVolumeL = gVolume_Output_L_Value;
-        currentMute = gMute_Output_Mute;
-    }
+    UInt64 cycleStartHostTime = mach_absolute_time();
+
+    // In theory we don't need a locking mechanism here, because the target's device will only be
+    // modified while it is not playing.
+    UInt32 currentOutputDeviceBufferFrameSize = target.device.bufferFrameSize;
+    UInt32 currentOutputDeviceSafetyOffset = target.device.safetyOffset;
+
+    // Never take stateMutex here: the control path can hold it for much longer than a real-time
+    // thread can afford to wait
+    ControlState currentControlState = controlState.Load();
     
-    {
-        CAMutex::Locker locker(&getZeroTimestampMutex);
-        
-        // We don't need to keep taking samples of the device's ratio past
-        // 10000 samples. If we get that far then the device is idling.
-        if (outputAccumulatedRateRatioSamples < 10000) {
-            outputAccumulatedRateRatio += inOutputTime->mRateScalar;
-            outputAccumulatedRateRatioSamples += 1;
-        }
+    // The accumulator stops taking samples of the device's ratio past
+    // 10000 samples. If we get that far then the device is idling. Only
+    // the primary output's clock steers the proxy device's.
+    if (target.steersClock) {
+        outputRateRatio.AddSample(inOutputTime->mRateScalar);
+        inputCycleCount = 0;
     }
-    
-    inputCycleCount = 0;
 
-    if (lastInputFrameTime < 0 || lastInputBufferFrameSize < 0) {
-        return noErr;
+    // Once there's sound to play again, standby ends here rather than whenever the control path
+    // next gets round to looking, which could be a while when it was silence that put the device in
+    // standby. The control path finds it playing, and leaves it that way if it should be.
+    UInt64 lastAudible = lastAudibleInputHostTime;
+
+    if (target.standby && inputIOIsActive && lastAudible != target.standbyAudibleHostTime) {
+        RTDebugMsg("ProxyAudio: outputDeviceIOProc leaving standby for new audio");
+        target.warmRestart = true;
+        target.restartHostTime = lastAudible;
+        target.standby = false;
     }
 
-    if (currentOutputDeviceSampleRate != currentInputDeviceSampleRate) {
-        DebugMsg("ProxyAudio: cannot play, mismatched sample rate");
+    // In standby there's nothing to play, and the HAL has already zeroed the output buffers. The
+    // cursor is taken out of the ring buffer meanwhile, like a stopped target's.
+    if (target.standby) {
+        if (!target.wasInStandby) {
+            target.wasInStandby = true;
+            inputBuffer->SetReaderFrame(target.ringReader, AudioRingBuffer::kReaderIdle);
+        }
+
         return noErr;
     }
 
-    if (inputOutputSampleDelta == -1) {
-        DebugMsg("ProxyAudio: outputDeviceIOProc recalculating inputOutputSampleDelta");
-        Float64 targetFrameTime = (lastInputFrameTime - lastInputBufferFrameSize - currentOutputDeviceBufferFrameSize
-                                   - currentOutputDeviceSafetyOffset);
-        inputOutputSampleDelta = targetFrameTime - inOutputTime->mSampleTime;
-        smallestFramesToBufferEnd = -1;
+    if (target.wasInStandby) {
+        target.wasInStandby = false;
+        target.needsResync = true;
+        target.preRoll = true;
     }
 
-    Float64 startFrame = inOutputTime->mSampleTime + inputOutputSampleDelta;
+    // The first cycle since the control path started it playing again. Its first frame is the
+    // first one anybody hears.
+    UInt64 restartHostTime = target.restartHostTime;
+
+    if (restartHostTime != 0 && target.restartHostTime.compare_exchange_strong(restartHostTime, 0)) {
+        UInt64 firstFrameHostTime =
+            (inOutputTime->mFlags & kAudioTimeStampHostTimeValid) ? inOutputTime->mHostTime : cycleStartHostTime;
+        UInt64 restartNanos = (firstFrameHostTime > restartHostTime)
+                                  ? AudioConvertHostTimeToNanos(firstFrameHostTime - restartHostTime)
+                                  : 0;
+        telemetry.RecordOutputRestart(target.warmRestart, restartNanos);
+    }
 
-    if (inputFinalFrameTime != -1 && startFrame >= inputFinalFrameTime) {
+    if (lastInputFrameTime < 0 || lastInputBufferFrameSize < 0) {
         return noErr;
     }
 
-    bool overrun = inputBuffer->Fetch(workBuffer, currentOutputDeviceBufferFrameSize, (SInt64)startFrame);
+    // Where the proxy device's own clock is right now. The HAL tells us its current time on every
+    // IO cycle, and carrying that forward by host time gives us a fill level that, unlike the
+    // ring buffer's end frame, doesn't jump around with the input's buffer boundaries.
+    InputTimeStamp inputTime = lastInputTimeStamp.Load();
+    Float64 inputNowFrame = inputTime.sampleTime;
+
+    if ((inNow->mFlags & kAudioTimeStampHostTimeValid) && currentControlState.hostTicksPerFrame > 0) {
+        inputNowFrame += Float64(SInt64(inNow->mHostTime - inputTime.hostTime)) / currentControlState.hostTicksPerFrame;
+    }
 
-#if DEBUG
-    // This is just some debugging info to tell when we might be gradually
-    // approaching the end of the input buffer and headed for a buffer
-    // overrun
-    SInt64 framesToBufferEnd =
-        inputBuffer->mEndFrame - (SInt64(startFrame) + SInt64(currentOutputDeviceBufferFrameSize));
+    // The resampler is only reconfigured while this IO proc isn't running
+    AdaptiveResampler *resampler = target.resampler;
+    Float64 nominalRatio = resampler->NominalRatio();
+    UInt32 resyncGeneration = outputResyncGeneration;
+    bool resync = (target.needsResync || target.resyncGeneration != resyncGeneration);
+    Float64 fill = inputNowFrame - target.readFrame;
 
-    if (smallestFramesToBufferEnd == -1
-        || (framesToBufferEnd < smallestFramesToBufferEnd && smallestFramesToBufferEnd >= 0)) {
-        smallestFramesToBufferEnd = framesToBufferEnd;
-        //DebugMsg("ProxyAudio: frames to buffer end shrunk, is now: %lld", smallestFramesToBufferEnd);
+    if (!resync && fabs(fill - target.driftController.TargetFill()) > kDevice_DriftResyncFrames) {
+        RTDebugMsg("ProxyAudio: outputDeviceIOProc fill level too far off target, resyncing");
+        resync = true;
     }
-#endif
 
-    if (overrun && inputFinalFrameTime == -1 && startFrame >= inputBuffer->mStartFrame) {
-        // Since this warning could conceivably happen every cycle, explicitly make it
-        // only appear once every five seconds at most
-        static time_t lastBufferOverrunWarning = 0;
-        time_t seconds;
-        time(&seconds);
-        
-        if ((seconds - lastBufferOverrunWarning) > 5) {
-            lastBufferOverrunWarning = seconds;
-            syslog(LOG_WARNING, "ProxyAudio: output unexpected overrun");
-            syslog(LOG_WARNING, "ProxyAudio: output frame: %lf", startFrame);
-            syslog(LOG_WARNING,
-                   "ProxyAudio: output buffer start: %llu    end: %llu",
-                   inputBuffer->mStartFrame,
-                   inputBuffer->mEndFrame);
+    if (resync) {
+        RTDebugMsg("ProxyAudio: outputDeviceIOProc recalculating read position");
+        // Read from far enough behind the proxy device's clock that every frame this cycle needs,
+        // including the resampler's lookahead, has already been written, plus the latency mode's
+        // cushion. The output device's buffer and safety offset are in its own frames, which may
+        // not be the same length as ours. calculateLatencyNoLock() has to agree with this.
+        Float64 targetFrameTime = (inputNowFrame
+                                   - (currentOutputDeviceBufferFrameSize + currentOutputDeviceSafetyOffset) * nominalRatio
+                                   - resampler->Latency() - currentControlState.cushionFrames);
+        // This target has already played everything before its old read position, unless the ring
+        // buffer has been reset since
+        SInt64 playedFrame = (target.resyncGeneration == resyncGeneration) ? target.readFrame : 0;
+        target.needsResync = false;
+        target.resyncGeneration = resyncGeneration;
+        target.readFrame = SInt64(targetFrameTime);
+
+        // When taking over from another device, carry on from where that one has got to, so that
+        // the two play the same audio while they crossfade. If that's further back than we need
+        // to be, the drift controller still aims for our own fill level and gradually catches up.
+        // That fill level leaves out the resampler's lookahead, which this cycle pushes on top of
+        // its output frames' input and which stays in the resampler from then on.
+        Float64 targetFill = inputNowFrame - target.readFrame - resampler->Latency();
+        SInt64 handoffFrame = inputBuffer->ReaderFrame(target.handoffReader.exchange(-1));
+
+        if (handoffFrame < target.readFrame && target.readFrame - handoffFrame < kDevice_DriftResyncFrames
+            && handoffFrame >= inputBuffer->StartFrame()) {
+            target.readFrame = handoffFrame;
+        } else if (target.preRoll && inputFinalFrameTime == -1) {
+            // Starting up again: go back over what was written while the device was getting going,
+            // as far as the ring buffer still has it, so that the first sound isn't clipped. The
+            // drift controller catches up on the extra fill level the same way as after a handoff.
+            target.readFrame = OutputStandby::PreRollFrame(target.readFrame, inputBuffer->StartFrame(), playedFrame);
         }
-    }
-    
-    Float32 volumeFactorL = 1.0, volumeFactorR = 1.0;
-    calculateVolumeFactors(currentVolumeL, currentVolumeR, currentMute, volumeFactorL, volumeFactorR);
 
-    for (UInt32 bufferIndex = 0; bufferIndex < outOutputData->mNumberBuffers; bufferIndex++) {
-        UInt32 outputChannelCount = outOutputData->mBuffers[bufferIndex].mNumberChannels;
-        UInt32 numChannelsToProcess = std::min(outputChannelCount, currentInputDeviceChannelCount);
-
-        for (UInt32 channelIndex = 0; channelIndex < numChannelsToProcess; channelIndex++) {
-            Float32 *in = (Float32 *)workBuffer + channelIndex;
-            Float32 *out = (Float32 *)outOutputData->mBuffers[bufferIndex].mData + channelIndex;
-            long framesize = outputChannelCount * sizeof(Float32);
-
-            for (UInt32 frame = 0; frame < outOutputData->mBuffers[bufferIndex].mDataByteSize; frame += framesize) {
-                *out += (*in * ((channelIndex == 0) ? volumeFactorL : volumeFactorR));
-                in += currentInputDeviceChannelCount;
-                out += outputChannelCount;
+        target.preRoll = false;
+
+        resampler->Reset();
+        fill = inputNowFrame - target.readFrame;
+        target.driftController.Reset(targetFill);
+        telemetry.RecordResync();
+        // Whatever was dropped from under the old read position doesn't matter any more
+        inputBuffer->SetReaderFrame(target.ringReader, target.readFrame);
+        inputBuffer->TakeReaderOverrunFrames(target.ringReader);
+    }
+
+    if (inputFinalFrameTime != -1 && target.readFrame >= inputFinalFrameTime) {
+        return noErr;
+    }
+
+    // On top of converting between the two sample rates, rather than following the output
+    // device's sample time exactly, which would let the drift between the two clocks slowly empty
+    // or overflow the ring buffer, we resample at whatever ratio keeps the fill level steady
+    Float64 ratio =
+        nominalRatio * target.driftController.Update(fill, UInt32(currentOutputDeviceBufferFrameSize * nominalRatio));
+
+    // Any crossfade moves in steps of one cycle, which the gain ramp below smooths over
+    Float32 fadeLevel = target.fadeLevel;
+    Float32 fadeTarget = target.fadeTarget;
+
+    if (fadeLevel != fadeTarget) {
+        Float32 fadeStep =
+            currentOutputDeviceBufferFrameSize / (kDevice_OutputCrossfadeSeconds * target.device.sampleRate);
+        fadeLevel = (fadeTarget > fadeLevel) ? std::min(fadeTarget, fadeLevel + fadeStep)
+                                             : std::max(fadeTarget, fadeLevel - fadeStep);
+        target.fadeLevel = fadeLevel;
+    }
+
+    // Ramp linearly from the gains we ended the last cycle on to the current ones over the course
+    // of this cycle, rather than jumping straight to them and causing zipper noise
+    Float32 targetOutputGain = target.gain * fadeLevel;
+    Float32 startGains[kAudioMixKernelsMaxChannels];
+    Float32 gainSteps[kAudioMixKernelsMaxChannels];
+    bool ramping = false;
+
+    for (UInt32 channel = 0; channel < resampler->Channels(); channel++) {
+        Float32 targetGain = currentControlState.gains[channel] * targetOutputGain;
+        ramping |= (targetGain != target.appliedGains[channel]);
+        startGains[channel] = target.appliedGains[channel];
+        gainSteps[channel] = (targetGain - target.appliedGains[channel]) / currentOutputDeviceBufferFrameSize;
+        target.appliedGains[channel] = targetGain;
+    }
+
+    bool overrun = false;
+    bool underrun = false;
+    UInt32 zeroFilledFrames = 0;
+    UInt32 skippedFrames = 0;
+    UInt32 framesDone = 0;
+
+    while (framesDone < currentOutputDeviceBufferFrameSize) {
+        UInt32 frames = std::min(currentOutputDeviceBufferFrameSize - framesDone, resampler->MaxOutputFrames());
+        UInt32 inputFrames = resampler->InputFramesNeeded(frames, ratio);
+
+        // The frames go straight from the ring buffer into the resampler's history
+        if (inputFrames > 0) {
+            AudioRingBuffer::ReadSpans spans;
+            overrun |= inputBuffer->BeginRead(target.readFrame, inputFrames, spans);
+
+            if (inputBuffer->SpansAreSilent(spans)) {
+                resampler->PushSilence(inputFrames);
+            } else {
+                resampler->PushSilence(spans.leadingZeroFrames);
+
+                for (int spanIndex = 0; spanIndex < 2 && spans.frames[spanIndex] > 0; spanIndex++) {
+                    resampler->PushInput((const Float32 *)spans.data[spanIndex], spans.frames[spanIndex]);
+                }
+
+                resampler->PushSilence(spans.trailingZeroFrames);
+            }
+
+            // Frames past the end of the ring buffer haven't been written yet
+            underrun |= (spans.trailingZeroFrames > 0);
+            zeroFilledFrames += spans.leadingZeroFrames + spans.trailingZeroFrames;
+
+            if (!inputBuffer->EndRead(spans)) {
+                // The input side lapped us while we were reading, which can only happen if we've
+                // already fallen a whole ring buffer behind it
+                overrun = true;
             }
+
+            target.readFrame += inputFrames;
+        }
+
+        // With nothing but silence to resample, there'd be nothing but silence to mix in, and the
+        // HAL has already zeroed the output buffers
+        if (resampler->IsSilent()) {
+            resampler->Skip(frames, ratio);
+            skippedFrames += frames;
+        } else {
+            resampler->Process(target.resampledFrames.data(), frames, ratio);
+            mixInputFrames(target,
+                           target.resampledFrames.data(),
+                           resampler->Channels(),
+                           frames,
+                           framesDone,
+                           outOutputData,
+                           startGains,
+                           ramping ? gainSteps : NULL);
+        }
+
+        framesDone += frames;
+    }
+
+    // Let the input side know how far we've got, and find out whether it dropped anything we
+    // hadn't read yet since the last cycle
+    inputBuffer->SetReaderFrame(target.ringReader, target.readFrame);
+    overrun |= (inputBuffer->TakeReaderOverrunFrames(target.ringReader) > 0);
+
+    if (target.steersClock) {
+        telemetry.SetDriftRatio(ratio / nominalRatio);
+    }
+
+    if (!target.hasPlayed) {
+        target.hasPlayed = true;
+    }
+
+    telemetry.RecordOutputCycle(SInt64(fill),
+                                overrun,
+                                underrun,
+                                zeroFilledFrames,
+                                skippedFrames,
+                                AudioConvertHostTimeToNanos(mach_absolute_time() - cycleStartHostTime));
+
+    if (overrun && inputFinalFrameTime == -1 && target.readFrame >= inputBuffer->StartFrame()) {
+        // Since this warning could conceivably happen every cycle, explicitly make it
+        // only appear once every five seconds at most, across all of the targets
+        UInt64 now = mach_absolute_time();
+        UInt64 lastWarning = lastOverrunWarningHostTime;
+
+        if ((lastWarning == 0 || AudioConvertHostTimeToNanos(now - lastWarning) > 5 * NSEC_PER_SEC)
+            && lastOverrunWarningHostTime.compare_exchange_strong(lastWarning, now)) {
+            RTLogMsg(LOG_WARNING, "ProxyAudio: output unexpected overrun");
+            RTLogMsg(LOG_WARNING, "ProxyAudio: output device: %u frame: %lld", target.device.id, target.readFrame);
+            RTLogMsg(LOG_WARNING,
+                     "ProxyAudio: output buffer start: %llu    end: %llu",
+                     inputBuffer->StartFrame(),
+                     inputBuffer->EndFrame());
         }
     }
 
     return noErr;
 }
 
-void ProxyAudioDevice::calculateVolumeFactors(Float32 volumeL,
-                                              Float32 volumeR,
-                                              bool mute,
-                                              Float32 &volumeFactorL,
-                                              Float32 &volumeFactorR) {
-    if (volumeL <= 0.0 || mute) {
-        volumeFactorL = 0.0;
-    } else if (volumeL >= 1.0) {
-        volumeFactorL = 1.0;
-    } else {
-        volumeFactorL = pow(10, (volumeL * (kVolume_MaxDB - kVolume_MinDB) + kVolume_MinDB) / 10);
+void ProxyAudioDevice::mixInputFrames(OutputTarget &target,
+                                      const Float32 *input,
+                                      UInt32 inputChannelCount,
+                                      UInt32 frameCount,
+                                      UInt32 outputFrameOffset,
+                                      AudioBufferList *outOutputData,
+                                      const Float32 *startGains,
+                                      const Float32 *gainSteps) {
+    // The gains are given for the first frame of the output buffer, so move them forward to where
+    // these frames start. Our own stream never has more than kAudioMixKernelsMaxChannels channels.
+    Float32 gains[kAudioMixKernelsMaxChannels];
+
+    for (UInt32 channelIndex = 0; channelIndex < inputChannelCount; channelIndex++) {
+        gains[channelIndex] = startGains[channelIndex];
+
+        if (gainSteps) {
+            gains[channelIndex] += outputFrameOffset * gainSteps[channelIndex];
+        }
     }
 
-    if (volumeR <= 0.0 || mute) {
-        volumeFactorR = 0.0;
-    } else if (volumeR >= 1.0) {
-        volumeFactorR = 1.0;
-    } else {
-        volumeFactorR = pow(10, (volumeR * (kVolume_MaxDB - kVolume_MinDB) + kVolume_MinDB) / 10);
+    // The routing matrix covers all of the target device's channels, across all of its buffers. It's
+    // only rebuilt while its IO proc isn't running. When it maps every channel straight through,
+    // the plain per-channel kernels do the same job for less.
+    bool useMatrix =
+        !target.channelMatrix.empty() && !(target.channelMatrixIsIdentity && outOutputData->mNumberBuffers == 1);
+    UInt32 outputChannelOffset = 0;
+
+    for (UInt32 bufferIndex = 0; bufferIndex < outOutputData->mNumberBuffers; bufferIndex++) {
+        AudioBuffer &outputBuffer = outOutputData->mBuffers[bufferIndex];
+        UInt32 outputChannelCount = outputBuffer.mNumberChannels;
+        UInt32 channelOffset = outputChannelOffset;
+        outputChannelOffset += outputChannelCount;
+
+        if (outputChannelCount == 0) {
+            continue;
+        }
+
+        UInt32 outputFrameCount = outputBuffer.mDataByteSize / (outputChannelCount * sizeof(Float32));
+
+        if (outputFrameOffset >= outputFrameCount) {
+            continue;
+        }
+
+        UInt32 framesToMix = std::min(frameCount, outputFrameCount - outputFrameOffset);
+        Float32 *output = (Float32 *)outputBuffer.mData + outputFrameOffset * outputChannelCount;
+
+        if (useMatrix) {
+            // Shouldn't happen, since the matrix is built from the device's stream configuration,
+            // but never read past the end of it
+            if (channelOffset + outputChannelCount > target.channelMatrixStride
+                || target.channelMatrix.size() < size_t(inputChannelCount) * target.channelMatrixStride) {
+                continue;
+            }
+
+            MixInterleavedWithMatrix(input,
+                                     inputChannelCount,
+                                     output,
+                                     outputChannelCount,
+                                     framesToMix,
+                                     target.channelMatrix.data() + channelOffset,
+                                     target.channelMatrixStride,
+                                     gains,
+                                     gainSteps);
+        } else if (gainSteps) {
+            MixInterleavedWithGainRamp(
+                input, inputChannelCount, output, outputChannelCount, framesToMix, gains, gainSteps);
+        } else {
+            MixInterleavedWithGain(input, inputChannelCount, output, outputChannelCount, framesToMix, gains);
+        }
+    }
+}
+
+Float32 ProxyAudioDevice::volumeToGain(Float32 volume) {
+    if (volume <= 0.0) {
+        return 0.0;
+    } else if (volume >= 1.0) {
+        return 1.0;
+    }
+
+    return pow(10, (volume * (kVolume_MaxDB - kVolume_MinDB) + kVolume_MinDB) / 10);
+}
+
+void ProxyAudioDevice::publishControlStateNoLock() {
+    ControlState state;
+    state.sampleRate = gDevice_SampleRate;
+    state.channelCount = gDevice_ChannelsPerFrame;
+    state.hostTicksPerFrame = gDevice_HostTicksPerFrame;
+    for (UInt32 channel = 0; channel < kDevice_MaxChannelsPerFrame; channel++) {
+        state.gains[channel] = gMute_Output_Mute ? 0.0 : volumeToGain(gVolume_Output_Values[channel]);
     }
+    state.cushionFrames = gDevice_CushionFrames;
+    controlState.Store(state);
 }
 
 OSStatus ProxyAudioDevice::EndIOOperation(AudioServerPlugInDriverRef inDriver,
@@ -5474,95 +6231,232 @@ OSStatus ProxyAudioDevice::EndIOOperation(AudioServerPlugInDriverRef inDriver,
     OSStatus theAnswer = 0;
 
     //    check the arguments
-    FailWithAction(inDriver != gAudioServerPlugInDriverRef,
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "EndIOOperation: bad driver reference");
-    FailWithAction(inDeviceObjectID != kObjectID_Device,
-                   theAnswer = kAudioHardwareBadObjectError,
-                   Done,
-                   "EndIOOperation: bad device ID");
+    RTFailWithAction(inDriver != gAudioServerPlugInDriverRef,
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "EndIOOperation: bad driver reference");
+    RTFailWithAction(inDeviceObjectID != kObjectID_Device,
+                     theAnswer = kAudioHardwareBadObjectError,
+                     Done,
+                     "EndIOOperation: bad device ID");
 
 Done:
     return theAnswer;
 }
 
-void ProxyAudioDevice::parseConfigurationString(CFStringRef configString, ConfigType &action, CFStringRef &value) {
-    CFRange splitter = CFStringFind(configString, CFSTR("="), 0);
+#pragma mark Driver Configuration
 
-    if (splitter.location == kCFNotFound) {
-        return;
+// The keys of kProxyAudioDevicePropertyConfiguration's dictionary
+static const struct {
+    ProxyAudioDevice::ConfigType type;
+    CFStringRef key;
+} kConfigurationKeys[] = {
+    {ProxyAudioDevice::ConfigType::outputDevice, CFSTR("outputDevice")},
+    {ProxyAudioDevice::ConfigType::outputDeviceBufferFrameSize, CFSTR("outputDeviceBufferFrameSize")},
+    {ProxyAudioDevice::ConfigType::deviceName, CFSTR("deviceName")},
+    {ProxyAudioDevice::ConfigType::deviceActiveCondition, CFSTR("outputDeviceActiveCondition")},
+    {ProxyAudioDevice::ConfigType::latencyMode, CFSTR("latencyMode")},
+    {ProxyAudioDevice::ConfigType::channelLayout, CFSTR("channelLayout")},
+    {ProxyAudioDevice::ConfigType::additionalOutputDevices, CFSTR("additionalOutputDevices")},
+    {ProxyAudioDevice::ConfigType::silenceStandbySeconds, CFSTR("silenceStandbySeconds")},
+};
+
+bool ProxyAudioDevice::isValidConfigurationValue(ConfigType type, CFPropertyListRef value) {
+    if (value == NULL) {
+        return false;
     }
 
-    CFStringSmartRef actionString = CFStringCreateWithSubstring(NULL, configString, CFRangeMake(0, splitter.location));
+    switch (type) {
+        case ConfigType::outputDevice:
+        case ConfigType::deviceName:
+        case ConfigType::additionalOutputDevices:
+            return CFGetTypeID(value) == CFStringGetTypeID();
 
-    if (CFStringCompare(actionString, CFSTR("outputDevice"), 0) == kCFCompareEqualTo) {
-        action = ConfigType::outputDevice;
-    } else if (CFStringCompare(actionString, CFSTR("outputDeviceBufferFrameSize"), 0) == kCFCompareEqualTo) {
-        action = ConfigType::outputDeviceBufferFrameSize;
-    } else if (CFStringCompare(actionString, CFSTR("deviceName"), 0) == kCFCompareEqualTo) {
-        action = ConfigType::deviceName;
-    } else if (CFStringCompare(actionString, CFSTR("outputDeviceActiveCondition"), 0) == kCFCompareEqualTo) {
-        action = ConfigType::deviceActiveCondition;
-    } else {
-        return;
+        default:
+            break;
     }
 
-    if (splitter.location == kCFNotFound) {
-        return;
+    SInt64 number;
+
+    if (CFGetTypeID(value) != CFNumberGetTypeID()
+        || !CFNumberGetValue(CFNumberRef(value), kCFNumberSInt64Type, &number)) {
+        return false;
     }
 
-    value =
-        CFStringCreateWithSubstring(NULL,
-                                    configString,
-                                    CFRangeMake(splitter.location + splitter.length,
-                                                CFStringGetLength(configString) - splitter.location - splitter.length));
+    switch (type) {
+        case ConfigType::outputDeviceBufferFrameSize:
+            return number >= kOutputDeviceMinBufferFrameSize && number <= INT32_MAX;
+
+        case ConfigType::deviceActiveCondition:
+            return number >= SInt64(ActiveCondition::proxiedDeviceActive) && number <= SInt64(ActiveCondition::always);
+
+        case ConfigType::latencyMode:
+            return number >= SInt64(LatencyMode::low) && number <= SInt64(LatencyMode::safe);
+
+        case ConfigType::channelLayout:
+            return number >= 0 && number < kDevice_ChannelLayoutCount;
+
+        case ConfigType::silenceStandbySeconds:
+            return number >= 0 && number <= kDeviceMaxSilenceStandbySeconds;
+
+        default:
+            return false;
+    }
 }
 
-#pragma mark Driver Configuration
+// The value must have been checked with isValidConfigurationValue
+void ProxyAudioDevice::setConfigurationValue(ConfigType type, CFPropertyListRef value) {
+    SInt32 number = 0;
+
+    if (CFGetTypeID(value) == CFNumberGetTypeID()) {
+        CFNumberGetValue(CFNumberRef(value), kCFNumberSInt32Type, &number);
+    }
 
-void ProxyAudioDevice::setConfigurationValue(ConfigType type, CFStringRef value) {
     switch (type) {
         case ConfigType::outputDevice:
-            setOutputDevice(value);
+            setOutputDevice(CFStringRef(value));
             break;
 
         case ConfigType::outputDeviceBufferFrameSize:
-            setOutputDeviceBufferFrameSize(CFStringGetIntValue(value));
+            setOutputDeviceBufferFrameSize(UInt32(number));
             break;
 
         case ConfigType::deviceName:
-            setDeviceName(value);
+            setDeviceName(CFStringRef(value));
             break;
 
         case ConfigType::deviceActiveCondition:
-            setOutputDeviceActiveCondition((ActiveCondition)CFStringGetIntValue(value));
+            setOutputDeviceActiveCondition(ActiveCondition(number));
             break;
-        
-        default:
+
+        case ConfigType::latencyMode:
+            setLatencyMode(LatencyMode(number));
+            break;
+
+        case ConfigType::channelLayout:
+            setChannelLayout(ChannelLayout(number));
+            break;
+
+        case ConfigType::additionalOutputDevices:
+            setAdditionalOutputDevices(CFStringRef(value));
+            break;
+
+        case ConfigType::silenceStandbySeconds:
+            setSilenceStandbySeconds(UInt32(number));
             break;
     }
 }
 
-CFStringRef ProxyAudioDevice::copyConfigurationValue(ConfigType type) {
+// Returns a CFString for the settings that are strings, and a CFNumber for the rest. The caller
+// owns it.
+CFPropertyListRef ProxyAudioDevice::copyConfigurationValue(ConfigType type) {
     CAMutex::Locker locker(stateMutex);
-    
+    SInt32 number = 0;
+
     switch (type) {
         case ConfigType::outputDevice:
-            return CFStringCreateCopy(NULL, outputDeviceUID);
-            
+            return CFStringCreateCopy(NULL, outputDeviceUID ? outputDeviceUID : CFSTR(""));
+
         case ConfigType::outputDeviceBufferFrameSize:
-            return CFStringCreateWithFormat(NULL, NULL, CFSTR("%u"), outputDeviceBufferFrameSize);
-                
+            number = SInt32(outputDeviceBufferFrameSize);
+            break;
+
         case ConfigType::deviceName:
-            return CFStringCreateCopy(NULL, deviceName);
+            return CFStringCreateCopy(NULL, deviceName ? deviceName : CFSTR(""));
 
         case ConfigType::deviceActiveCondition:
-            return CFStringCreateWithFormat(NULL, NULL, CFSTR("%u"), outputDeviceActiveCondition);
-            
-        default:
-            return nullptr;
+            number = SInt32(outputDeviceActiveCondition);
+            break;
+
+        case ConfigType::latencyMode:
+            number = SInt32(latencyMode);
+            break;
+
+        case ConfigType::channelLayout:
+            number = SInt32(channelLayout);
+            break;
+
+        case ConfigType::additionalOutputDevices:
+            return CFStringCreateCopy(NULL, additionalOutputDevicesList ? additionalOutputDevicesList : CFSTR(""));
+
+        case ConfigType::silenceStandbySeconds:
+            number = SInt32(silenceStandbySeconds);
+            break;
+    }
+
+    return CFNumberCreate(NULL, kCFNumberSInt32Type, &number);
+}
+
+CFDictionaryRef ProxyAudioDevice::copyConfiguration() {
+    CFMutableDictionaryRef configuration =
+        CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+
+    if (!configuration) {
+        return NULL;
     }
+
+    for (const auto &entry : kConfigurationKeys) {
+        CFPropertyListSmartRef value = copyConfigurationValue(entry.type);
+
+        if (value) {
+            CFDictionarySetValue(configuration, entry.key, value);
+        }
+    }
+
+    return configuration;
+}
+
+// Every key and value is checked before any of them is applied, so a bad dictionary changes
+// nothing. Settings that aren't in the dictionary are left alone.
+bool ProxyAudioDevice::setConfiguration(CFDictionaryRef configuration) {
+    CAMutex::Locker locker(configurationMutex);
+    CFIndex count = CFDictionaryGetCount(configuration);
+    std::vector<const void *> keys(count);
+    std::vector<const void *> values(count);
+    std::vector<ConfigType> types(count);
+    CFDictionaryGetKeysAndValues(configuration, keys.data(), values.data());
+
+    for (CFIndex index = 0; index < count; index++) {
+        bool found = false;
+
+        for (const auto &entry : kConfigurationKeys) {
+            if (CFGetTypeID(keys[index]) == CFStringGetTypeID()
+                && CFStringCompare(CFStringRef(keys[index]), entry.key, 0) == kCFCompareEqualTo) {
+                types[index] = entry.type;
+                found = true;
+                break;
+            }
+        }
+
+        if (!found || !isValidConfigurationValue(types[index], values[index])) {
+            return false;
+        }
+    }
+
+    for (CFIndex index = 0; index < count; index++) {
+        setConfigurationValue(types[index], values[index]);
+    }
+
+    return true;
+}
+
+// The settings that have a custom property each also show up in the configuration dictionary, so
+// listeners to either hear about changes to them
+void ProxyAudioDevice::notifyConfigurationChanged() {
+    ExecuteInAudioOutputThread(^{
+        const AudioObjectPropertySelector theSelectors[] = {kProxyAudioDevicePropertyConfiguration,
+                                                            kProxyAudioDevicePropertyOutputDeviceUID,
+                                                            kProxyAudioDevicePropertyOutputDeviceBufferFrameSize,
+                                                            kProxyAudioDevicePropertyOutputDeviceActiveCondition};
+        AudioObjectPropertyAddress theAddresses[4];
+
+        for (UInt32 theIndex = 0; theIndex < 4; theIndex++) {
+            theAddresses[theIndex] = {
+                theSelectors[theIndex], kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster};
+        }
+
+        gPlugIn_Host->PropertiesChanged(gPlugIn_Host, kObjectID_Device, 4, theAddresses);
+    });
 }
 
 CFStringRef ProxyAudioDevice::copyDeviceNameFromStorage()
@@ -5631,21 +6525,25 @@ CFStringRef ProxyAudioDevice::copyDefaultProxyOutputDeviceUID() {
     AudioObjectID defaultDevice = AudioDevice::defaultOutputDevice();
     
     if (defaultDevice != kAudioObjectUnknown) {
-        CFStringRef uid = AudioDevice::copyDeviceUID(defaultDevice);
+        CFStringRef uid = deviceRegistry.CopyUIDForDevice(defaultDevice);
         
         if (uid && CFStringCompare(uid, CFSTR(kDevice_UID), 0) != kCFCompareEqualTo) {
             DebugMsg("ProxyAudio: copyDefaultProxyOutputDeviceUID returning default output device");
             return uid;
         }
+
+        if (uid) {
+            CFRelease(uid);
+        }
     }
     
-    // Failing that, we scan through all devices with stereo output capabilities and find the first
-    // one that's not the proxy audio device:
-    std::vector<AudioObjectID> outputDevices = AudioDevice::devicesWithOutputCapabilitiesThatAreNotProxyAudioDevice();
+    // Failing that, we take the first device with stereo output capabilities that's not the proxy
+    // audio device:
+    AudioObjectID outputDevice = deviceRegistry.FirstStereoOutputDeviceExcept(CFSTR(kDevice_UID));
     
-    if (outputDevices.size() > 0) {
+    if (outputDevice != kAudioObjectUnknown) {
         DebugMsg("ProxyAudio: copyDefaultProxyOutputDeviceUID returning first viable output device in list");
-        return AudioDevice::copyDeviceUID(outputDevices[0]);
+        return deviceRegistry.CopyUIDForDevice(outputDevice);
     }
     
     DebugMsg("ProxyAudio: copyDefaultProxyOutputDeviceUID could not find output device");
@@ -5700,6 +6598,7 @@ void ProxyAudioDevice::setOutputDevice(CFStringRef deviceUID) {
     
     ExecuteInAudioOutputThread(^{
         setupTargetOutputDevice();
+        setupAdditionalOutputTargets();
     });
 }
 
@@ -5742,6 +6641,7 @@ void ProxyAudioDevice::setOutputDeviceBufferFrameSize(UInt32 newSize) {
     
     ExecuteInAudioOutputThread(^{
         setupTargetOutputDevice();
+        setupAdditionalOutputTargets();
     });
 }
 
@@ -5776,15 +6676,355 @@ void ProxyAudioDevice::setOutputDeviceActiveCondition(ActiveCondition newActiveC
         CFNumberSmartRef newActiveConditionRef = CFNumberCreate(NULL, kCFNumberSInt32Type, &newActiveCondition);
         gPlugIn_Host->WriteToStorage(gPlugIn_Host, CFSTR("outputDeviceActiveCondition"), newActiveConditionRef);
     }
+
+    // The next check could be a long way off, and may not be due at all under the new condition
+    ExecuteInAudioOutputThread(^{
+        monitorUserActivity();
+    });
+}
+
+ProxyAudioDevice::LatencyMode ProxyAudioDevice::retrieveLatencyModeFromStorage() {
+    DebugMsg("ProxyAudio: retrieveLatencyModeFromStorage");
+
+    if (!gPlugIn_Host) {
+        DebugMsg("ProxyAudio: retrieveLatencyModeFromStorage no plugin host");
+        return kDeviceDefaultLatencyMode;
+    }
+
+    CFPropertyListSmartRef data;
+    gPlugIn_Host->CopyFromStorage(gPlugIn_Host, CFSTR("latencyMode"), &data);
+
+    if (data == NULL || CFGetTypeID(data) != CFNumberGetTypeID()) {
+        DebugMsg("ProxyAudio: retrieveLatencyModeFromStorage finished returning default latency mode");
+        return kDeviceDefaultLatencyMode;
+    }
+
+    SInt32 value;
+    CFNumberGetValue(CFNumberRef(CFPropertyListRef(data)), kCFNumberSInt32Type, &value);
+
+    if (value < SInt32(LatencyMode::low) || value > SInt32(LatencyMode::safe)) {
+        DebugMsg("ProxyAudio: retrieveLatencyModeFromStorage finished returning default latency mode");
+        return kDeviceDefaultLatencyMode;
+    }
+
+    DebugMsg("ProxyAudio: retrieveLatencyModeFromStorage finished returning stored latency mode");
+
+    return LatencyMode(value);
+}
+
+void ProxyAudioDevice::setLatencyMode(LatencyMode newLatencyMode) {
+    if (newLatencyMode < LatencyMode::low || newLatencyMode > LatencyMode::safe) {
+        return;
+    }
+
+    {
+        CAMutex::Locker locker(&stateMutex);
+        latencyMode = newLatencyMode;
+        CFNumberSmartRef newLatencyModeRef = CFNumberCreate(NULL, kCFNumberSInt32Type, &newLatencyMode);
+        gPlugIn_Host->WriteToStorage(gPlugIn_Host, CFSTR("latencyMode"), newLatencyModeRef);
+    }
+
+    ExecuteInAudioOutputThread(^{
+        CAMutex::Locker locker(outputDeviceMutex);
+        requestLatencyUpdateNoLock();
+    });
+}
+
+UInt32 ProxyAudioDevice::retrieveSilenceStandbySecondsFromStorage() {
+    DebugMsg("ProxyAudio: retrieveSilenceStandbySecondsFromStorage");
+
+    if (!gPlugIn_Host) {
+        DebugMsg("ProxyAudio: retrieveSilenceStandbySecondsFromStorage no plugin host");
+        return kDeviceDefaultSilenceStandbySeconds;
+    }
+
+    CFPropertyListSmartRef data;
+    gPlugIn_Host->CopyFromStorage(gPlugIn_Host, CFSTR("silenceStandbySeconds"), &data);
+
+    if (data == NULL || CFGetTypeID(data) != CFNumberGetTypeID()) {
+        DebugMsg("ProxyAudio: retrieveSilenceStandbySecondsFromStorage finished returning default");
+        return kDeviceDefaultSilenceStandbySeconds;
+    }
+
+    SInt32 value;
+    CFNumberGetValue(CFNumberRef(CFPropertyListRef(data)), kCFNumberSInt32Type, &value);
+
+    if (value < 0 || value > kDeviceMaxSilenceStandbySeconds) {
+        DebugMsg("ProxyAudio: retrieveSilenceStandbySecondsFromStorage finished returning default");
+        return kDeviceDefaultSilenceStandbySeconds;
+    }
+
+    DebugMsg("ProxyAudio: retrieveSilenceStandbySecondsFromStorage finished returning stored value");
+
+    return UInt32(value);
+}
+
+void ProxyAudioDevice::setSilenceStandbySeconds(UInt32 seconds) {
+    if (seconds > kDeviceMaxSilenceStandbySeconds) {
+        return;
+    }
+
+    {
+        CAMutex::Locker locker(&stateMutex);
+        silenceStandbySeconds = seconds;
+        CFNumberSmartRef secondsRef = CFNumberCreate(NULL, kCFNumberSInt32Type, &seconds);
+        gPlugIn_Host->WriteToStorage(gPlugIn_Host, CFSTR("silenceStandbySeconds"), secondsRef);
+    }
+
+    // The silence may already have gone on long enough, and the next check is timed for the old
+    // setting
+    ExecuteInAudioOutputThread(^{
+        monitorUserActivity();
+    });
+}
+
+#pragma mark Channel Layout
+
+UInt32 ProxyAudioDevice::channelCountForLayout(ChannelLayout layout) {
+    switch (layout) {
+        case ChannelLayout::surround51:
+            return 6;
+
+        case ChannelLayout::surround71:
+            return 8;
+
+        default:
+            return 2;
+    }
+}
+
+UInt32 ProxyAudioDevice::volumeControlChannel(AudioObjectID objectID) {
+    switch (objectID) {
+        case kObjectID_Volume_Output_L:
+            return 0;
+        case kObjectID_Volume_Output_R:
+            return 1;
+        default:
+            return 2 + (objectID - kObjectID_Volume_Output_C);
+    }
+}
+
+AudioObjectID ProxyAudioDevice::volumeControlForChannel(UInt32 channel) {
+    switch (channel) {
+        case 0:
+            return kObjectID_Volume_Output_L;
+        case 1:
+            return kObjectID_Volume_Output_R;
+        default:
+            return kObjectID_Volume_Output_C + (channel - 2);
+    }
+}
+
+// The mute and data source controls are always there, but there's only a volume control for each
+// channel the current layout has
+bool ProxyAudioDevice::isControlPresent(AudioObjectID objectID) {
+    switch (objectID) {
+        case kObjectID_Volume_Output_L:
+        case kObjectID_Volume_Output_R:
+        case kObjectID_Mute_Output_Master:
+        case kObjectID_DataSource_Output_Master:
+            return true;
+
+        case kObjectID_Volume_Output_C:
+        case kObjectID_Volume_Output_LFE:
+        case kObjectID_Volume_Output_Ls:
+        case kObjectID_Volume_Output_Rs:
+        case kObjectID_Volume_Output_Lrs:
+        case kObjectID_Volume_Output_Rrs: {
+            CAMutex::Locker locker(stateMutex);
+            return volumeControlChannel(objectID) < gDevice_ChannelsPerFrame;
+        }
+
+        default:
+            return false;
+    }
+}
+
+UInt32 ProxyAudioDevice::deviceControlCount() {
+    CAMutex::Locker locker(stateMutex);
+    return gDevice_ChannelsPerFrame + 2;
+}
+
+// The device's controls in the order they're listed in: a volume control per channel, then mute,
+// then data source
+AudioObjectID ProxyAudioDevice::deviceControlAtIndex(UInt32 index) {
+    UInt32 channels;
+
+    {
+        CAMutex::Locker locker(stateMutex);
+        channels = gDevice_ChannelsPerFrame;
+    }
+
+    if (index < channels) {
+        return volumeControlForChannel(index);
+    } else if (index == channels) {
+        return kObjectID_Mute_Output_Master;
+    } else {
+        return kObjectID_DataSource_Output_Master;
+    }
+}
+
+ProxyAudioDevice::ChannelLayout ProxyAudioDevice::retrieveChannelLayoutFromStorage() {
+    DebugMsg("ProxyAudio: retrieveChannelLayoutFromStorage");
+
+    if (!gPlugIn_Host) {
+        DebugMsg("ProxyAudio: retrieveChannelLayoutFromStorage no plugin host");
+        return kDeviceDefaultChannelLayout;
+    }
+
+    CFPropertyListSmartRef data;
+    gPlugIn_Host->CopyFromStorage(gPlugIn_Host, CFSTR("channelLayout"), &data);
+
+    if (data == NULL || CFGetTypeID(data) != CFNumberGetTypeID()) {
+        DebugMsg("ProxyAudio: retrieveChannelLayoutFromStorage finished returning default channel layout");
+        return kDeviceDefaultChannelLayout;
+    }
+
+    SInt32 value;
+    CFNumberGetValue(CFNumberRef(CFPropertyListRef(data)), kCFNumberSInt32Type, &value);
+
+    if (value < SInt32(ChannelLayout::stereo) || value > SInt32(ChannelLayout::surround71)) {
+        DebugMsg("ProxyAudio: retrieveChannelLayoutFromStorage finished returning default channel layout");
+        return kDeviceDefaultChannelLayout;
+    }
+
+    DebugMsg("ProxyAudio: retrieveChannelLayoutFromStorage finished returning stored channel layout");
+
+    return ChannelLayout(value);
+}
+
+void ProxyAudioDevice::setChannelLayout(ChannelLayout newChannelLayout) {
+    if (newChannelLayout < ChannelLayout::stereo || newChannelLayout > ChannelLayout::surround71) {
+        return;
+    }
+
+    {
+        CAMutex::Locker locker(&stateMutex);
+        channelLayout = newChannelLayout;
+        CFNumberSmartRef newChannelLayoutRef = CFNumberCreate(NULL, kCFNumberSInt32Type, &newChannelLayout);
+        gPlugIn_Host->WriteToStorage(gPlugIn_Host, CFSTR("channelLayout"), newChannelLayoutRef);
+
+        if (channelCountForLayout(newChannelLayout) == gDevice_ChannelsPerFrame) {
+            return;
+        }
+    }
+
+    //    the stream's format changes, so this has to go through the HAL
+    requestConfigurationChange(kDevice_ChannelLayoutConfigurationChange);
+}
+
+#pragma mark Additional Outputs
+
+CFStringRef ProxyAudioDevice::copyAdditionalOutputDevicesFromStorage() {
+    DebugMsg("ProxyAudio: copyAdditionalOutputDevicesFromStorage");
+
+    if (!gPlugIn_Host) {
+        DebugMsg("ProxyAudio: copyAdditionalOutputDevicesFromStorage no plugin host");
+        return nullptr;
+    }
+
+    CFPropertyListSmartRef data;
+    gPlugIn_Host->CopyFromStorage(gPlugIn_Host, CFSTR("additionalOutputDevices"), &data);
+
+    if (data == NULL || CFGetTypeID(data) != CFStringGetTypeID()) {
+        DebugMsg("ProxyAudio: copyAdditionalOutputDevicesFromStorage no additional output devices in storage");
+        return nullptr;
+    }
+
+    DebugMsg("ProxyAudio: copyAdditionalOutputDevicesFromStorage finished with stored additional output devices");
+
+    return CFStringCreateCopy(NULL, CFStringRef(CFPropertyListRef(data)));
+}
+
+void ProxyAudioDevice::setAdditionalOutputDevices(CFStringRef list) {
+    if (!gPlugIn_Host) {
+        return;
+    }
+
+    {
+        CAMutex::Locker locker(&stateMutex);
+
+        if (additionalOutputDevicesList) {
+            CFRelease(additionalOutputDevicesList);
+        }
+
+        additionalOutputDevicesList = CFStringCreateCopy(NULL, list);
+        gPlugIn_Host->WriteToStorage(gPlugIn_Host, CFSTR("additionalOutputDevices"), additionalOutputDevicesList);
+    }
+
+    ExecuteInAudioOutputThread(^{
+        setupAdditionalOutputTargets();
+    });
+}
+
+// Splits a list of additional outputs, one per line as "<gain>:<device UID>", into the device UIDs,
+// which the caller has to release, and their linear gains. Lines without both are skipped.
+void ProxyAudioDevice::parseAdditionalOutputDevices(CFStringRef list,
+                                                    std::vector<CFStringRef> &outUIDs,
+                                                    std::vector<Float32> &outGains) {
+    if (!list) {
+        return;
+    }
+
+    CFArraySmartRef lines = CFStringCreateArrayBySeparatingStrings(NULL, list, CFSTR("\n"));
+
+    for (CFIndex index = 0; index < CFArrayGetCount(lines); index++) {
+        CFStringRef line = (CFStringRef)CFArrayGetValueAtIndex(lines, index);
+        CFIndex length = CFStringGetLength(line);
+        CFRange splitter = CFStringFind(line, CFSTR(":"), 0);
+
+        if (splitter.location == kCFNotFound || splitter.location == 0 || splitter.location + 1 >= length) {
+            continue;
+        }
+
+        CFStringSmartRef gainString = CFStringCreateWithSubstring(NULL, line, CFRangeMake(0, splitter.location));
+        outGains.push_back(std::clamp(Float32(CFStringGetDoubleValue(gainString)), 0.0f, 1.0f));
+        CFRange uidRange = CFRangeMake(splitter.location + 1, length - splitter.location - 1);
+        outUIDs.push_back(CFStringCreateWithSubstring(NULL, line, uidRange));
+    }
 }
 
 #pragma mark Other stuff!
 
+// Runs on the audio output queue, and sets inputMonitoringTimer for the next time it needs to, see
+// UserActivitySchedule. Note that when the user comes back from being idle, the output devices
+// restart at this check, which can be up to 5 seconds later, rather than within the 500 ms the
+// fixed rate timer this replaced took. Playing anything starts them straight away regardless.
 void ProxyAudioDevice::monitorUserActivity() {
+    CFTimeInterval nextCheck;
+
     {
         CAMutex::Locker outputMutexLocker(outputDeviceMutex);
         updateOutputDeviceStartedState();
+        nextCheck = UserActivitySchedule::NextCheck(outputDeviceActiveCondition == ActiveCondition::userActive,
+                                                    userIdleTime);
+
+        // Likewise the mix can't have been silent for long enough until that long after the last
+        // sound. Once it has, the output devices' IO procs take over, see outputDeviceIOProc.
+        if (inputIOIsActive && silenceStandbySeconds > 0 && inputSilentTime < silenceStandbySeconds) {
+            nextCheck = UserActivitySchedule::NextCheckBy(nextCheck, silenceStandbySeconds - inputSilentTime);
+        }
+
+        // And an output device in standby is due to be stopped once it's been in it for
+        // outputStandbySeconds, unless it's only there because of the silence
+        bool silenceStandby =
+            (inputIOIsActive && silenceStandbySeconds > 0 && inputSilentTime >= silenceStandbySeconds);
+        UInt64 now = mach_absolute_time();
+
+        for (OutputTarget *target : outputTargetsNoLock()) {
+            if (silenceStandby || !target->device.isStarted || !target->standby) {
+                continue;
+            }
+
+            CFTimeInterval standbyTime = AudioConvertHostTimeToNanos(now - target->standbyHostTime) / 1e9;
+            nextCheck = UserActivitySchedule::NextCheckBy(nextCheck, outputStandbySeconds - standbyTime);
+        }
     }
+
+    dispatch_source_set_timer(inputMonitoringTimer,
+                              dispatch_time(DISPATCH_TIME_NOW, int64_t(nextCheck * NSEC_PER_SEC)),
+                              DISPATCH_TIME_FOREVER,
+                              uint64_t(UserActivitySchedule::Leeway(nextCheck) * NSEC_PER_SEC));
 }
 
 dispatch_queue_t ProxyAudioDevice::AudioOutputDispatchQueue() {
@@ -6,10 +6,19 @@
 #include <vector>
 #include <atomic>
 
+#include "AdaptiveResampler.h"
 #include "AudioDevice.h"
+#include "AudioDeviceRegistry.h"
+#include "ChannelMatrix.h"
 #include "CAMutex.h"
+#include "IOTelemetry.h"
+#include "OutputStandby.h"
+#include "RateRatioAccumulator.h"
+#include "SeqLockedValue.h"
+#include "UserActivitySchedule.h"
 
 class AudioRingBuffer;
+struct PropertyInfo;
 
 enum {
     kObjectID_PlugIn = kAudioObjectPlugInObject,
@@ -19,7 +28,33 @@ enum {
     kObjectID_Volume_Output_L = 5,
     kObjectID_Volume_Output_R = 6,
     kObjectID_Mute_Output_Master = 7,
-    kObjectID_DataSource_Output_Master = 8
+    kObjectID_DataSource_Output_Master = 8,
+    // The volume controls for the channels past the first two, which only exist when the channel
+    // layout has them
+    kObjectID_Volume_Output_C = 9,
+    kObjectID_Volume_Output_LFE = 10,
+    kObjectID_Volume_Output_Ls = 11,
+    kObjectID_Volume_Output_Rs = 12,
+    kObjectID_Volume_Output_Lrs = 13,
+    kObjectID_Volume_Output_Rrs = 14,
+    // Plays back whatever is being played to the device, for recording it
+    kObjectID_Stream_Input = 15
+};
+
+// The device's custom properties, which are how other processes configure the driver. Each call
+// stands on its own, so any number of processes can use them at once.
+enum {
+    // The UID of the device we play to, as a CFString
+    kProxyAudioDevicePropertyOutputDeviceUID = 'pout',
+    // The IO buffer size we ask the output device for, as a CFNumber
+    kProxyAudioDevicePropertyOutputDeviceBufferFrameSize = 'pbfs',
+    // A ProxyAudioDevice::ActiveCondition, as a CFNumber
+    kProxyAudioDevicePropertyOutputDeviceActiveCondition = 'pact',
+    // Every setting at once, as a CFDictionary. Setting it only changes the settings that are in
+    // the dictionary, and changes none of them if any key or value is bad.
+    kProxyAudioDevicePropertyConfiguration = 'pcfg',
+    // A CFDictionary of the IO counters and histograms collected by IOTelemetry. Read only.
+    kProxyAudioDevicePropertyTelemetry = 'ptlm'
 };
 
 #define kPlugIn_BundleID "net.briankendall.ProxyAudioDevice"
@@ -29,11 +64,29 @@ enum {
 #define kOutputDeviceDefaultBufferFrameSize 512
 #define kOutputDeviceMinBufferFrameSize 4
 #define kOutputDeviceDefaultActiveCondition ActiveCondition::userActive
+#define kDeviceDefaultLatencyMode LatencyMode::balanced
+#define kDeviceDefaultChannelLayout ChannelLayout::stereo
+#define kDeviceDefaultSilenceStandbySeconds 0
+#define kDeviceMaxSilenceStandbySeconds 3600
+#define kDevice_MaxChannelsPerFrame 8
 
 class ProxyAudioDevice {
   public:
-    enum class ConfigType { none, outputDevice, outputDeviceBufferFrameSize, deviceName, deviceActiveCondition };
+    enum class ConfigType {
+        outputDevice,
+        outputDeviceBufferFrameSize,
+        deviceName,
+        deviceActiveCondition,
+        latencyMode,
+        channelLayout,
+        additionalOutputDevices,
+        silenceStandbySeconds
+    };
     enum class ActiveCondition { proxiedDeviceActive = 0, userActive = 1, always = 2 };
+    enum class LatencyMode { low = 0, balanced = 1, safe = 2 };
+    enum class ChannelLayout { stereo = 0, surround51 = 1, surround71 = 2 };
+
+    struct OutputTarget;
 
     ProxyAudioDevice() : inputIOIsActive(false) {};
     AudioDevice findTargetOutputAudioDevice();
@@ -52,7 +105,8 @@ class ProxyAudioDevice {
                                        UInt32 inNumberAddresses,
                                        const AudioObjectPropertyAddress *inAddresses);
     void updateOutputDeviceStartedState();
-    void matchOutputDeviceSampleRateNoLock();
+    void updateLogDrainTimerNoLock(bool ioThreadsRunning);
+    void matchOutputDeviceSampleRateNoLock(OutputTarget &target);
     void matchOutputDeviceSampleRate();
     static int devicesListenerProcStatic(AudioObjectID inObjectID,
                                          UInt32 inNumberAddresses,
@@ -61,12 +115,22 @@ class ProxyAudioDevice {
     int devicesListenerProc(AudioObjectID inObjectID,
                             UInt32 inNumberAddresses,
                             const AudioObjectPropertyAddress *inAddresses);
+    void updateDeviceRegistry(UInt32 retry);
     void setupAudioDevicesListener();
     void setupTargetOutputDevice();
+    void switchPrimaryOutputNoLock(AudioDevice newDevice);
+    void continuePrimaryOutputSwitchNoLock();
+    void finishPrimaryOutputSwitchNoLock();
+    void setupAdditionalOutputTargets();
+    void setupOutputTargetNoLock(OutputTarget &target, AudioDevice newDevice);
+    void createOutputResamplerNoLock(OutputTarget &target);
+    void stopOutputTargetNoLock(OutputTarget &target);
+    std::vector<OutputTarget *> outputTargetsNoLock();
+    OutputTarget *outputTargetForDeviceNoLock(AudioObjectID deviceID);
     void initializeOutputDevice();
-    void deinitializeOutputDeviceNoLock();
-    void deinitializeOutputDevice();
+    void deinitializeOutputDeviceNoLock(OutputTarget &target);
     void resetInputData();
+    void requestOutputResync();
     static OSStatus outputDeviceIOProcStatic(AudioDeviceID inDevice,
                                              const AudioTimeStamp *inNow,
                                              const AudioBufferList *inInputData,
@@ -74,21 +138,30 @@ class ProxyAudioDevice {
                                              AudioBufferList *outOutputData,
                                              const AudioTimeStamp *inOutputTime,
                                              void *inClientData);
-    OSStatus outputDeviceIOProc(AudioDeviceID inDevice,
+    OSStatus outputDeviceIOProc(OutputTarget &target,
+                                AudioDeviceID inDevice,
                                 const AudioTimeStamp *inNow,
                                 const AudioBufferList *inInputData,
                                 const AudioTimeStamp *inInputTime,
                                 AudioBufferList *outOutputData,
                                 const AudioTimeStamp *inOutputTime);
-    void calculateVolumeFactors(Float32 volumeL,
-                                Float32 volumeR,
-                                bool mute,
-                                Float32 &volumeFactorL,
-                                Float32 &volumeFactorR);
-    bool isConfigurationString(CFStringRef val);
-    void parseConfigurationString(CFStringRef configString, ConfigType &action, CFStringRef &value);
-    void setConfigurationValue(ConfigType action, CFStringRef value);
-    CFStringRef copyConfigurationValue(ConfigType action);
+    void mixInputFrames(OutputTarget &target,
+                        const Float32 *input,
+                        UInt32 inputChannelCount,
+                        UInt32 frameCount,
+                        UInt32 outputFrameOffset,
+                        AudioBufferList *outOutputData,
+                        const Float32 *startGains,
+                        const Float32 *gainSteps);
+    Float32 volumeToGain(Float32 volume);
+    void publishControlStateNoLock();
+    static ConfigType configTypeForProperty(AudioObjectPropertySelector selector);
+    bool isValidConfigurationValue(ConfigType type, CFPropertyListRef value);
+    void setConfigurationValue(ConfigType type, CFPropertyListRef value);
+    CFPropertyListRef copyConfigurationValue(ConfigType type);
+    CFDictionaryRef copyConfiguration();
+    bool setConfiguration(CFDictionaryRef configuration);
+    void notifyConfigurationChanged();
     CFStringRef copyDeviceNameFromStorage();
     void setDeviceName(CFStringRef newName);
     CFStringRef copyDefaultProxyOutputDeviceUID();
@@ -98,6 +171,32 @@ class ProxyAudioDevice {
     void setOutputDeviceBufferFrameSize(UInt32 size);
     ActiveCondition retrieveOutputDeviceActiveConditionFromStorage();
     void setOutputDeviceActiveCondition(ActiveCondition newActiveCondition);
+    LatencyMode retrieveLatencyModeFromStorage();
+    void setLatencyMode(LatencyMode newLatencyMode);
+    UInt32 retrieveSilenceStandbySecondsFromStorage();
+    void setSilenceStandbySeconds(UInt32 seconds);
+    UInt32 calculateLatencyNoLock();
+    void requestLatencyUpdateNoLock();
+    void publishLatencyNoLock();
+    void requestConfigurationChange(UInt64 change);
+    void applyConfigurationChanges(UInt64 changes);
+    void applyLatencyConfigurationNoLock();
+    ChannelLayout retrieveChannelLayoutFromStorage();
+    void setChannelLayout(ChannelLayout newChannelLayout);
+    CFStringRef copyAdditionalOutputDevicesFromStorage();
+    void setAdditionalOutputDevices(CFStringRef list);
+    static void parseAdditionalOutputDevices(CFStringRef list,
+                                             std::vector<CFStringRef> &outUIDs,
+                                             std::vector<Float32> &outGains);
+    void applyChannelLayoutNoLock();
+    void updateOutputChannelMatrixNoLock(OutputTarget &target);
+    static UInt32 channelCountForLayout(ChannelLayout layout);
+    static UInt32 volumeControlChannel(AudioObjectID objectID);
+    static AudioObjectID volumeControlForChannel(UInt32 channel);
+    bool isControlPresent(AudioObjectID objectID);
+    UInt32 deviceControlCount();
+    AudioObjectID deviceControlAtIndex(UInt32 index);
+    static const PropertyInfo *propertyList(AudioObjectID objectID, UInt32 &outCount);
 
     static ProxyAudioDevice *deviceForDriver(void *inDriver);
 
@@ -472,31 +571,136 @@ class ProxyAudioDevice {
     void ExecuteInAudioOutputThread(void (^block)());
     
     CAMutex stateMutex = CAMutex("ProxyAudioStateMutex");
-    CAMutex IOMutex = CAMutex("ProxyAudioIOMutex");
+    // Held while a new configuration is checked and applied, so another one can't get in between.
+    // Taken before any of the other mutexes.
+    CAMutex configurationMutex = CAMutex("ProxyAudioConfigurationMutex");
     CAMutex outputDeviceMutex = CAMutex("ProxyAudioOutputDeviceMutex");
-    CAMutex getZeroTimestampMutex = CAMutex("ProxyAudioGetZeroTimestampMutex");
     dispatch_queue_t audioOutputQueue = NULL;
+    // A one-shot timer that monitorUserActivity sets again every time it runs
     dispatch_source_t inputMonitoringTimer = NULL;
+    // As of the last time updateOutputDeviceStartedState looked, which is with outputDeviceMutex held
+    CFTimeInterval userIdleTime = 0;
+    // Likewise, how long the mix had been digital silence for
+    CFTimeInterval inputSilentTime = 0;
+    dispatch_source_t logDrainTimer = NULL;
+    // Whether logDrainTimer has been resumed, so its suspends and resumes stay balanced. Guarded by
+    // outputDeviceMutex.
+    bool logDrainTimerRunning = false;
     AudioRingBuffer *inputBuffer = NULL;
-    Byte *workBuffer = NULL;
-    AudioDevice outputDevice;
-    bool outputDeviceReady = false;
+    // Kept up to date by devicesListenerProc, and used to find output devices by their UIDs
+    AudioDeviceRegistry deviceRegistry;
+    // How many times updateDeviceRegistry tries again for devices that couldn't be read, starting
+    // after 250 ms, so the last try is a little under 8 seconds after the device list changed
+    const UInt32 kDeviceRegistryMaxRetries = 5;
+    // One of the devices we play the proxy device's audio to. The primary output is the device
+    // picked by outputDeviceUID; the additional outputs come from additionalOutputDevicesList. Every
+    // target has its own IO proc, read position, resampler and drift controller, so targets can come
+    // and go while the others keep playing. Everything its IO proc uses is only modified while its
+    // device is stopped, apart from the gain and the crossfade.
+    struct OutputTarget {
+        ProxyAudioDevice *owner = NULL;
+        // Whether its IO proc feeds outputRateRatio, which steers the proxy device's clock. That's
+        // the primary output, except while it's switching devices, when only the outgoing one does.
+        std::atomic_bool steersClock = {false};
+        // The UID it was configured with, for additional outputs
+        CFStringRef uid = NULL;
+        AudioDevice device;
+        bool ready = false;
+        // Applied on top of the volume controls, and ramped to like them when it changes
+        std::atomic<Float32> gain = {1.0f};
+        // For crossfading between the old and new devices when the primary output switches. The IO
+        // proc moves fadeLevel towards fadeTarget over kDevice_OutputCrossfadeSeconds and applies it
+        // on top of the gain. Only the IO proc writes fadeLevel.
+        std::atomic<Float32> fadeTarget = {1.0f};
+        std::atomic<Float32> fadeLevel = {1.0f};
+        // The ring buffer cursor of the target this one is taking over from, which its IO proc
+        // starts reading from instead of a fresh read position, and then sets back to -1
+        std::atomic_int handoffReader = {-1};
+        // Set by the IO proc once it has played a cycle of audio
+        std::atomic_bool hasPlayed = {false};
+        // Set by the control path to leave the device running while there's nothing to play, so
+        // that it can start playing again without spinning back up. Its IO proc does no work then,
+        // and can clear it again itself, see standbyAudibleHostTime.
+        std::atomic_bool standby = {false};
+        // When it was last asked to start playing again, for the IO proc to report how long that
+        // took to telemetry. 0 once it's been reported.
+        std::atomic<UInt64> restartHostTime = {0};
+        std::atomic_bool warmRestart = {false};
+        // What lastAudibleInputHostTime was when the control path put it in standby. Its IO proc
+        // takes it back out of standby by itself as soon as the proxy device is running and that
+        // has moved on, see outputDeviceIOProc.
+        std::atomic<UInt64> standbyAudibleHostTime = {0};
+        // Only used by the control path
+        UInt64 standbyHostTime = 0;
+        // The rest is only used by outputDeviceIOProc. The read position is where the next input
+        // frame for the resampler comes from, and moves at whatever rate the drift controller
+        // settles on.
+        AdaptiveResampler *resampler = NULL;
+        std::vector<Float32> resampledFrames;
+        DriftController driftController;
+        // How the proxy device's channels are routed onto this device's: the gain from our channel
+        // i into its channel o is at [i * channelMatrixStride + o], as used by
+        // MixInterleavedWithMatrix
+        std::vector<Float32> channelMatrix;
+        UInt32 channelMatrixStride = 0;
+        bool channelMatrixIsIdentity = true;
+        SInt64 readFrame = 0;
+        // Its cursor in inputBuffer, which it moves to readFrame every cycle
+        int ringReader = -1;
+        // Set by the control path while the device is stopped, or by the IO proc when it comes
+        // out of standby, and compared against outputResyncGeneration, to make the IO proc pick a
+        // fresh read position. preRoll makes that read position go back over whatever was written
+        // while the device was starting up.
+        bool needsResync = true;
+        bool preRoll = false;
+        bool wasInStandby = false;
+        UInt32 resyncGeneration = 0;
+        // The gains the IO proc applied at the end of its last cycle, which it ramps from
+        Float32 appliedGains[kDevice_MaxChannelsPerFrame] = {};
+    };
+    // Only ever NULL before Initialize
+    OutputTarget *primaryOutput = NULL;
+    // The primary output's previous target while it's being faded out, see switchPrimaryOutputNoLock
+    OutputTarget *retiringOutput = NULL;
+    UInt64 primaryOutputSwitchHostTime = 0;
+    // How long an output device is left in standby before it's stopped, which adapts to how soon
+    // it tends to be needed again afterwards, see updateOutputDeviceStartedState
+    Float64 outputStandbySeconds = 0;
+    UInt64 lastOutputStandbyStopHostTime = 0;
+    std::vector<OutputTarget *> additionalOutputs;
     std::atomic_bool inputIOIsActive;
-    Float64 lastInputFrameTime = -1;
-    Float64 lastInputBufferFrameSize = -1;
-    Float64 inputOutputSampleDelta = -1;
-    Float64 inputFinalFrameTime = -1;
-    int inputCycleCount = 0;
-    ConfigType nextConfigurationToRead = ConfigType::none;
-    pid_t configuratorPid = 0;
+    // Shared between DoIOOperation and outputDeviceIOProc, which run on different real-time
+    // threads and never take a lock on each other.
+    std::atomic<Float64> lastInputFrameTime = {-1};
+    std::atomic<Float64> lastInputBufferFrameSize = {-1};
+    // Bumped whenever every output target needs to pick a fresh read position
+    std::atomic<UInt32> outputResyncGeneration = {0};
+    std::atomic<Float64> inputFinalFrameTime = {-1};
+    // When DoIOOperation last stored a mix that wasn't digital silence, or when IO started
+    std::atomic<UInt64> lastAudibleInputHostTime = {0};
+    std::atomic<UInt64> lastOverrunWarningHostTime = {0};
+    // Updated by both of them on every cycle, and read through kProxyAudioDevicePropertyTelemetry
+    IOTelemetry telemetry;
+    std::atomic_int inputCycleCount = {0};
+    // The proxy device's clock as of its last IO cycle, published by DoIOOperation
+    struct InputTimeStamp {
+        Float64 sampleTime = 0.0;
+        UInt64 hostTime = 0;
+    };
+    SeqLockedValue<InputTimeStamp> lastInputTimeStamp;
     CFStringRef deviceName = NULL;
     CFStringRef boxName = NULL;
     CFStringRef outputDeviceUID = NULL;
+    // One additional output per line, as "<gain>:<device UID>"
+    CFStringRef additionalOutputDevicesList = NULL;
     UInt32 outputDeviceBufferFrameSize = kOutputDeviceDefaultBufferFrameSize;
-    SInt64 smallestFramesToBufferEnd = -1;
-    Float64 outputAccumulatedRateRatio = 0.0;
-    UInt64 outputAccumulatedRateRatioSamples = 0;
+    // Fed by the primary output's IO proc and collected by GetZeroTimeStamp, both on real-time threads
+    RateRatioAccumulator outputRateRatio;
     ActiveCondition outputDeviceActiveCondition = ActiveCondition::userActive;
+    LatencyMode latencyMode = kDeviceDefaultLatencyMode;
+    // How long the mix has to be digital silence for before the output devices go into standby
+    // while the proxy device is running, or 0 to keep them playing
+    UInt32 silenceStandbySeconds = kDeviceDefaultSilenceStandbySeconds;
     
     UInt32 gPlugIn_RefCount = 0;
     AudioServerPlugInHostRef gPlugIn_Host = NULL;
@@ -505,20 +709,91 @@ class ProxyAudioDevice {
     std::vector<Float64> gDevice_SampleRates = {22050, 44100, 48000, 88200, 96000, 176400, 192000};
     UInt64 gDevice_IOIsRunning = 0;
     const UInt32 kDevice_RingBufferSize = 16384;
+    const UInt32 kDevice_ResamplerMaxFrames = 4096;
+    // Enough to convert between any two of gDevice_SampleRates, with room for drift on top
+    const Float64 kDevice_ResamplerMaxRatio = 192000.0 / 22050.0;
+    const Float64 kDevice_DriftMaxRatio = 1.01;
+    // If the fill level ever ends up this far from its target, something other than clock drift
+    // happened (a device glitch, a missed cycle), so we start over from a fresh read position
+    // rather than slowly steering back
+    const Float64 kDevice_DriftResyncFrames = 8192;
+    // How long switching the primary output crossfades from the old device to the new one, and how
+    // long the old one is kept waiting for the new one to start playing before giving up on it
+    const Float64 kDevice_OutputCrossfadeSeconds = 0.1;
+    const UInt64 kDevice_OutputSwitchTimeoutMSec = 2000;
+    // Every output target has a reader slot of its own in the ring buffer, which has
+    // AudioRingBuffer::kMaxReaders of them. The primary output takes one, and the target it's
+    // switching to takes another during a switch, which leaves the rest for the additional outputs.
+    static constexpr size_t kDevice_MaxAdditionalOutputs = 6;
     Float64 gDevice_HostTicksPerFrame = 0.0;
+    // The time line anchor, published by StartIO (with stateMutex held) whenever the hardware is
+    // started. GetZeroTimeStamp starts its time line over whenever the generation changes.
+    struct ZeroTimeStampAnchor {
+        UInt64 hostTime = 0;
+        Float64 hostTicksPerFrame = 0.0;
+        UInt32 generation = 0;
+    };
+    SeqLockedValue<ZeroTimeStampAnchor> zeroTimeStampAnchor;
+    // Only touched by GetZeroTimeStamp, which the HAL only calls from the device's IO thread
+    UInt32 gDevice_AnchorGeneration = 0;
     UInt64 gDevice_NumberTimeStamps = 0;
-    Float64 gDevice_AnchorSampleTime = 0.0;
     Float64 gDevice_ElapsedTicks = 0.0;
     UInt64 gDevice_AnchorHostTime = 0;
+    Float64 gDevice_AnchorHostTicksPerFrame = 0.0;
     bool gStream_Output_IsActive = true;
+    bool gStream_Input_IsActive = true;
     const Float32 kVolume_MinDB = -25.0;
     const Float32 kVolume_MaxDB = 0.0;
-    Float32 gVolume_Output_L_Value = 0.0;
-    Float32 gVolume_Output_R_Value = 0.0;
+    Float32 gVolume_Output_Values[kDevice_MaxChannelsPerFrame] = {};
     bool gMute_Output_Mute = false;
+    // A snapshot of the state above that the IO thread needs, republished by the control path
+    // (with stateMutex held) whenever any of it changes. The volume and mute controls are
+    // converted to linear gains up front so that the IO thread never has to.
+    struct ControlState {
+        Float64 sampleRate = 44100.0;
+        UInt32 channelCount = 2;
+        Float64 hostTicksPerFrame = 0.0;
+        Float32 gains[kDevice_MaxChannelsPerFrame] = {};
+        UInt32 cushionFrames = 0;
+    };
+    SeqLockedValue<ControlState> controlState;
     const UInt32 gDevice_BytesPerFrameInChannel = 4;
-    const UInt32 gDevice_ChannelsPerFrame = 2;
-    const UInt32 gDevice_SafetyOffset = 0;
+    // Follows the channel layout, which PerformDeviceConfigurationChange applies
+    ChannelLayout channelLayout = kDeviceDefaultChannelLayout;
+    const UInt32 kDevice_ChannelLayoutCount = 3;
+    static const UInt32 kDevice_CustomPropertyCount = 5;
+    static const AudioServerPlugInCustomPropertyInfo kDevice_CustomProperties[kDevice_CustomPropertyCount];
+    UInt32 gDevice_ChannelsPerFrame = 2;
+    // What each latency mode trades off: how many frames the ring buffer holds, how many frames of
+    // cushion the output device reads behind the proxy device's clock on top of the minimum its own
+    // buffering requires, and the safety offset we ask the HAL to keep when writing to us
+    struct LatencyModeSettings {
+        UInt32 ringBufferFrames;
+        UInt32 cushionFrames;
+        UInt32 safetyOffset;
+    };
+    const LatencyModeSettings kDevice_LatencyModeSettings[3] = {
+        {32768, 0, 0},
+        {88200, 512, 0},
+        {176400, 2048, 256},
+    };
+    // Passed to RequestDeviceConfigurationChange in place of a sample rate when the latency
+    // related properties below, or the channel layout, need to change. They're bits, so one request
+    // can cover both.
+    const UInt64 kDevice_LatencyConfigurationChange = 1;
+    const UInt64 kDevice_ChannelLayoutConfigurationChange = 2;
+    const UInt64 kDevice_ConfigurationChangeMask =
+        kDevice_LatencyConfigurationChange | kDevice_ChannelLayoutConfigurationChange;
+    // The configuration changes asked for since the last request the HAL went through with, see
+    // requestConfigurationChange. Guarded by stateMutex.
+    UInt64 pendingConfigurationChanges = 0;
+    // The latency mode's settings as last applied, along with the latency we report, in the proxy
+    // device's frames. The ring buffer size and safety offset only change in
+    // PerformDeviceConfigurationChange.
+    UInt32 gDevice_RingBufferFrames = 0;
+    UInt32 gDevice_CushionFrames = 0;
+    UInt32 gDevice_SafetyOffset = 0;
+    UInt32 gDevice_Latency = 0;
 };
 
 extern "C" void *ProxyAudio_Create(CFAllocatorRef inAllocator, CFUUIDRef inRequestedTypeUUID);
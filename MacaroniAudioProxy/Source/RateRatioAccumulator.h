@@ -0,0 +1,60 @@
+#ifndef __RateRatioAccumulator_h__
+#define __RateRatioAccumulator_h__
+
+#include "PortableTypes.h"
+#include <atomic>
+
+// Averages the rate scalars reported by one real-time thread for another real-time thread to
+// collect, without either of them ever taking a lock or retrying.
+//
+// The sample count and the sum are packed into one 64-bit word, so adding a sample is a single
+// fetch_add and collecting the average is a single exchange, and the two can never be observed out
+// of step with each other. The top 16 bits hold the count and the low 48 bits hold the sum as a
+// fixed point number with 32 fractional bits, which is plenty for kMaxSamples rate scalars that are
+// always very close to 1.
+class RateRatioAccumulator {
+  public:
+    static const UInt32 kMaxSamples = 10000;
+
+    void AddSample(Float64 rateScalar) {
+        // Written this way round so that NaNs are turned away too
+        if (!(rateScalar > 0.0 && rateScalar < kMaxRateScalar)) {
+            return;
+        }
+
+        // Only one thread adds samples, so the count can't move past the limit between this check
+        // and the add below
+        if (Count(mPacked.load(std::memory_order_relaxed)) >= kMaxSamples) {
+            return;
+        }
+
+        mPacked.fetch_add(kCountUnit + UInt64(rateScalar * kSumScale + 0.5), std::memory_order_relaxed);
+    }
+
+    // Returns the average of the samples added since the last call, or 1 if there weren't any, and
+    // starts over
+    Float64 CollectAverage() {
+        UInt64 packed = mPacked.exchange(0, std::memory_order_relaxed);
+        UInt64 count = Count(packed);
+
+        if (count == 0) {
+            return 1.0;
+        }
+
+        return (Float64(packed & kSumMask) / kSumScale) / count;
+    }
+
+    void Reset() { mPacked.store(0, std::memory_order_relaxed); }
+
+  private:
+    static constexpr Float64 kSumScale = 4294967296.0;
+    static constexpr Float64 kMaxRateScalar = 4.0;
+    static const UInt64 kCountUnit = 1ull << 48;
+    static const UInt64 kSumMask = kCountUnit - 1;
+
+    static UInt64 Count(UInt64 packed) { return packed >> 48; }
+
+    std::atomic<UInt64> mPacked = {0};
+};
+
+#endif // __RateRatioAccumulator_h__
@@ -0,0 +1,172 @@
+#include "RealtimeLog.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/syslog.h>
+
+static_assert((RealtimeLog::kCapacity & (RealtimeLog::kCapacity - 1)) == 0, "capacity must be a power of two");
+
+RealtimeLog &RealtimeLog::Shared() {
+    static RealtimeLog sharedLog;
+    return sharedLog;
+}
+
+RealtimeLog::RealtimeLog() : mWritePosition(0), mDroppedCount(0), mReadPosition(0) {
+    for (UInt32 index = 0; index < kCapacity; index++) {
+        mRecords[index].sequence.store(index, std::memory_order_relaxed);
+    }
+}
+
+RealtimeLog::Record *RealtimeLog::BeginWrite(UInt64 &position) {
+    position = mWritePosition.load(std::memory_order_relaxed);
+
+    for (;;) {
+        Record &record = mRecords[position & (kCapacity - 1)];
+        SInt64 lag = SInt64(record.sequence.load(std::memory_order_acquire) - position);
+
+        if (lag == 0) {
+            // The record is free for this position, as long as no other writer claims it first
+            if (mWritePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                return &record;
+            }
+        } else if (lag < 0) {
+            // The drain hasn't got to the record's last message yet, so the ring is full
+            mDroppedCount.fetch_add(1, std::memory_order_relaxed);
+            return NULL;
+        } else {
+            // Another writer got this position first
+            position = mWritePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void RealtimeLog::EndWrite(Record *record, UInt64 position) {
+    record->sequence.store(position + 1, std::memory_order_release);
+}
+
+void RealtimeLog::SyslogOutput(int priority, const char *message) {
+    syslog(priority, "%s", message);
+}
+
+void RealtimeLog::Drain(Output output) {
+    char message[512];
+
+    for (;;) {
+        Record &record = mRecords[mReadPosition & (kCapacity - 1)];
+
+        if (record.sequence.load(std::memory_order_acquire) != mReadPosition + 1) {
+            break;
+        }
+
+        Format(record, message, sizeof(message));
+        output(record.priority, message);
+
+        // Hand the record back to the writers for the position one lap ahead
+        record.sequence.store(mReadPosition + kCapacity, std::memory_order_release);
+        mReadPosition++;
+    }
+
+    UInt64 droppedCount = mDroppedCount.exchange(0, std::memory_order_relaxed);
+
+    if (droppedCount > 0) {
+        snprintf(message,
+                 sizeof(message),
+                 "ProxyAudio: real-time log was full, dropped %llu messages",
+                 (unsigned long long)droppedCount);
+        output(LOG_WARNING, message);
+    }
+}
+
+void RealtimeLog::Format(const Record &record, char *buffer, size_t bufferSize) {
+    const char *format = record.format;
+    size_t length = 0;
+    UInt32 argIndex = 0;
+
+    // Copies the format up to each conversion, and formats the conversion on its own with the
+    // stored argument, after swapping its length modifier for the one that matches how the
+    // argument was stored
+    while (*format && length + 1 < bufferSize) {
+        if (*format != '%') {
+            buffer[length++] = *format++;
+            continue;
+        }
+
+        if (format[1] == '%') {
+            buffer[length++] = '%';
+            format += 2;
+            continue;
+        }
+
+        const char *specStart = format;
+        char spec[32];
+        size_t specLength = 0;
+        spec[specLength++] = *format++;
+
+        while (*format && strchr("-+ #0123456789.", *format) && specLength < sizeof(spec) - 4) {
+            spec[specLength++] = *format++;
+        }
+
+        while (*format && strchr("hlqjztL", *format)) {
+            format++;
+        }
+
+        char conversion = *format;
+
+        if (!conversion) {
+            break;
+        }
+
+        format++;
+
+        if (argIndex >= record.argCount) {
+            // More conversions than arguments: leave the rest of the format as it is
+            size_t specTextLength = std::min(size_t(format - specStart), bufferSize - length - 1);
+            memcpy(buffer + length, specStart, specTextLength);
+            length += specTextLength;
+            continue;
+        }
+
+        const Arg &arg = record.args[argIndex++];
+        size_t remaining = bufferSize - length;
+        int written = 0;
+
+        if (strchr("diouxXc", conversion)) {
+            if (conversion != 'c') {
+                spec[specLength++] = 'l';
+                spec[specLength++] = 'l';
+            }
+
+            spec[specLength++] = conversion;
+            spec[specLength] = 0;
+
+            if (conversion == 'c') {
+                written = snprintf(buffer + length, remaining, spec, int(arg.sint));
+            } else if (arg.type == Arg::Type::real) {
+                written = snprintf(buffer + length, remaining, spec, (long long)arg.real);
+            } else {
+                written = snprintf(buffer + length, remaining, spec, (long long)arg.sint);
+            }
+        } else if (strchr("eEfFgGaA", conversion)) {
+            spec[specLength++] = conversion;
+            spec[specLength] = 0;
+            Float64 value = (arg.type == Arg::Type::real) ? arg.real
+                            : (arg.type == Arg::Type::sint) ? Float64(arg.sint)
+                                                            : Float64(arg.uint);
+            written = snprintf(buffer + length, remaining, spec, value);
+        } else if (conversion == 's') {
+            spec[specLength++] = 's';
+            spec[specLength] = 0;
+            const char *string = (arg.type == Arg::Type::string && arg.string) ? arg.string : "(?)";
+            written = snprintf(buffer + length, remaining, spec, string);
+        } else if (conversion == 'p') {
+            written = snprintf(buffer + length, remaining, "%p", arg.pointer);
+        }
+
+        if (written > 0) {
+            length += std::min(size_t(written), remaining - 1);
+        }
+    }
+
+    buffer[std::min(length, bufferSize - 1)] = 0;
+}
@@ -0,0 +1,121 @@
+#ifndef __RealtimeLog_h__
+#define __RealtimeLog_h__
+
+#include "PortableTypes.h"
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+
+// A log that real-time threads can write to without blocking, allocating or making system calls.
+// syslog() can do all three, so it mustn't be called from an IO thread.
+//
+// A message is stored as a fixed-size record holding its priority, its format string and its
+// arguments, and is only formatted and handed to syslog() when a non-real-time thread calls Drain.
+// Any number of threads may write at once: each claims a record by moving the shared write
+// position along with a compare-and-swap, and publishes it through the record's sequence number
+// once it's filled in. If the ring is full the message is dropped, and the next Drain reports how
+// many were.
+//
+// The format string has to be a string literal, and so do any strings passed for %s, since they're
+// only read when the message is formatted. Arguments are widened to 64 bits as they're stored, so
+// the format's length modifiers are ignored and %d, %u, %f and so on work for any size of integer
+// or floating point value. At most kMaxArgs arguments can be passed, and * widths aren't supported.
+class RealtimeLog {
+  public:
+    static const UInt32 kCapacity = 256;
+    static const UInt32 kMaxArgs = 6;
+
+    static RealtimeLog &Shared();
+
+    RealtimeLog();
+
+    template <typename... Args>
+    void Log(int priority, const char *format, Args... args) {
+        static_assert(sizeof...(Args) <= kMaxArgs, "too many arguments for a real-time log message");
+
+        UInt64 position;
+        Record *record = BeginWrite(position);
+
+        if (!record) {
+            return;
+        }
+
+        record->priority = priority;
+        record->format = format;
+        record->argCount = sizeof...(Args);
+        UInt32 index = 0;
+        (void)index;
+        ((record->args[index++] = MakeArg(args)), ...);
+        EndWrite(record, position);
+    }
+
+    // Formats every message written so far and hands it to output, which passes it on to syslog()
+    // unless told otherwise. Must only be called from one thread at a time, which mustn't be a
+    // real-time one.
+    typedef void (*Output)(int priority, const char *message);
+    void Drain(Output output = SyslogOutput);
+
+    static void SyslogOutput(int priority, const char *message);
+
+  private:
+    struct Arg {
+        enum class Type : UInt8 { sint, uint, real, pointer, string };
+        Type type;
+        union {
+            SInt64 sint;
+            UInt64 uint;
+            Float64 real;
+            const void *pointer;
+            const char *string;
+        };
+    };
+
+    struct Record {
+        // Equal to the write position it's free for, and one past it once it's been written
+        std::atomic<UInt64> sequence;
+        int priority;
+        UInt32 argCount;
+        const char *format;
+        Arg args[kMaxArgs];
+    };
+
+    template <typename T>
+    static Arg MakeArg(T value) {
+        Arg arg;
+
+        if constexpr (std::is_same_v<T, const char *> || std::is_same_v<T, char *>) {
+            arg.type = Arg::Type::string;
+            arg.string = value;
+        } else if constexpr (std::is_pointer_v<T>) {
+            arg.type = Arg::Type::pointer;
+            arg.pointer = value;
+        } else if constexpr (std::is_floating_point_v<T>) {
+            arg.type = Arg::Type::real;
+            arg.real = value;
+        } else if constexpr (std::is_enum_v<T>) {
+            arg.type = Arg::Type::sint;
+            arg.sint = SInt64(value);
+        } else if constexpr (std::is_signed_v<T>) {
+            arg.type = Arg::Type::sint;
+            arg.sint = value;
+        } else {
+            static_assert(std::is_integral_v<T>, "unsupported real-time log argument");
+            arg.type = Arg::Type::uint;
+            arg.uint = value;
+        }
+
+        return arg;
+    }
+
+    Record *BeginWrite(UInt64 &position);
+    void EndWrite(Record *record, UInt64 position);
+    static void Format(const Record &record, char *buffer, size_t bufferSize);
+
+    Record mRecords[kCapacity];
+    std::atomic<UInt64> mWritePosition;
+    std::atomic<UInt64> mDroppedCount;
+    // Only touched by Drain
+    UInt64 mReadPosition;
+};
+
+#endif // __RealtimeLog_h__
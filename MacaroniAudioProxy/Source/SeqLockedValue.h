@@ -0,0 +1,81 @@
+#ifndef __SeqLockedValue_h__
+#define __SeqLockedValue_h__
+
+#include "PortableTypes.h"
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+// Holds a small value that a (serialized) control thread publishes and that real-time threads can
+// read without ever taking a lock or waiting on the writer.
+//
+// The value is kept in two slots, each guarded by its own sequence number. The writer always fills
+// the slot that isn't current, then makes it the current one. A reader copies the current slot and
+// checks that its sequence number didn't change in the meantime. If it did, the writer has already
+// published the other slot, so the reader simply tries again with that one. A writer that gets
+// preempted halfway through a store therefore never holds readers up, since they keep reading the
+// previously published slot.
+template <typename T> class SeqLockedValue {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLockedValue requires a trivially copyable type");
+
+  public:
+    SeqLockedValue(const T &value = T()) { Store(value); }
+
+    // Calls to Store must be serialized by the caller, e.g. by holding a mutex
+    void Store(const T &value) {
+        UInt64 words[kWordCount] = {};
+        memcpy(words, &value, sizeof(T));
+
+        UInt32 slotIndex = 1 - mCurrentSlot.load(std::memory_order_relaxed);
+        Slot &slot = mSlots[slotIndex];
+        UInt32 sequence = slot.sequence.load(std::memory_order_relaxed);
+
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (UInt32 i = 0; i < kWordCount; i++) {
+            slot.words[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+        mCurrentSlot.store(slotIndex, std::memory_order_release);
+    }
+
+    // Safe to call from any thread, including real-time ones
+    T Load() const {
+        UInt64 words[kWordCount];
+
+        for (;;) {
+            const Slot &slot = mSlots[mCurrentSlot.load(std::memory_order_acquire)];
+            UInt32 sequenceBefore = slot.sequence.load(std::memory_order_acquire);
+
+            for (UInt32 i = 0; i < kWordCount; i++) {
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            UInt32 sequenceAfter = slot.sequence.load(std::memory_order_relaxed);
+
+            if ((sequenceBefore & 1) == 0 && sequenceBefore == sequenceAfter) {
+                break;
+            }
+        }
+
+        T value;
+        memcpy(&value, words, sizeof(T));
+        return value;
+    }
+
+  private:
+    static const UInt32 kWordCount = (sizeof(T) + sizeof(UInt64) - 1) / sizeof(UInt64);
+
+    struct Slot {
+        std::atomic<UInt32> sequence = {0};
+        std::atomic<UInt64> words[kWordCount] = {};
+    };
+
+    Slot mSlots[2];
+    std::atomic<UInt32> mCurrentSlot = {0};
+};
+
+#endif // __SeqLockedValue_h__
@@ -0,0 +1,55 @@
+#ifndef __UserActivitySchedule_h__
+#define __UserActivitySchedule_h__
+
+#include "PortableTypes.h"
+#include <algorithm>
+
+// When ProxyAudioDevice::monitorUserActivity checks on the user and the output devices next.
+// Rather than checking at a fixed rate, it works out when the next check could first make a
+// difference, so the driver doesn't keep waking the CPU on an idle machine:
+//
+// - An active user can't go idle until kUserIdleThreshold has passed since whatever they last did,
+//   so that's when the next check is.
+// - Once they're idle, it looks for them coming back every kIdleCheckInterval. Their coming back
+//   only starts the output devices early, since StartIO starts them anyway as soon as there's audio
+//   to play, so this can be slow: the output devices start up to kIdleCheckInterval (plus the
+//   timer's leeway) after the user comes back, where checking every 500 ms, as the driver used to,
+//   started them within half a second.
+// - When whether the output devices play doesn't depend on the user, it only checks every
+//   kUserIgnoredCheckInterval.
+//
+// Other deadlines, like a standby running out, can bring the next check forward with NextCheckBy.
+// See Tests/UserActivityScheduleTests.cpp for how many checks this comes to.
+class UserActivitySchedule {
+  public:
+    // The user counts as active if they've done anything in this long
+    static constexpr Float64 kUserIdleThreshold = 30;
+    static constexpr Float64 kIdleCheckInterval = 5;
+    static constexpr Float64 kUserIgnoredCheckInterval = 30;
+    // Checks are never closer together than this, so a deadline that's only just passed doesn't
+    // have the timer firing over and over
+    static constexpr Float64 kMinCheckInterval = 0.5;
+
+    // Seconds until the next check, given how long the user had been idle at this one
+    static Float64 NextCheck(bool dependsOnUser, Float64 userIdleTime) {
+        if (!dependsOnUser) {
+            return kUserIgnoredCheckInterval;
+        }
+
+        if (userIdleTime < kUserIdleThreshold) {
+            return std::max(kUserIdleThreshold - userIdleTime, kMinCheckInterval);
+        }
+
+        return kIdleCheckInterval;
+    }
+
+    // Brings nextCheck forward to a deadline that's secondsLeft away, if that's sooner
+    static Float64 NextCheckBy(Float64 nextCheck, Float64 secondsLeft) {
+        return std::min(nextCheck, std::max(secondsLeft, kMinCheckInterval));
+    }
+
+    // The timer's leeway, which lets the system fold the wakeup in with others
+    static Float64 Leeway(Float64 nextCheck) { return nextCheck / 10; }
+};
+
+#endif // __UserActivitySchedule_h__
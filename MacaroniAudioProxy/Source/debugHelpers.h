@@ -3,6 +3,12 @@
 
 #include <sys/syslog.h>
 
+#include "RealtimeLog.h"
+
+// For IO callbacks and anything else on a real-time thread, where syslog() mustn't be called.
+// The messages are queued on RealtimeLog::Shared() and reach syslog when the log is drained.
+#define RTLogMsg(inPriority, inFormat, ...) RealtimeLog::Shared().Log(inPriority, inFormat, ##__VA_ARGS__)
+
 #if DEBUG
 #define DebugMsg(inFormat, ...) syslog(LOG_NOTICE, inFormat, ##__VA_ARGS__)
 
@@ -19,6 +25,15 @@
         goto inHandler;                                                                                                \
     }
 
+#define RTDebugMsg(inFormat, ...) RTLogMsg(LOG_NOTICE, inFormat, ##__VA_ARGS__)
+
+#define RTFailWithAction(inCondition, inAction, inHandler, inMessage)                                                  \
+    if (inCondition) {                                                                                                 \
+        RTDebugMsg("ProxyAudio error: " inMessage);                                                                    \
+        { inAction; }                                                                                                  \
+        goto inHandler;                                                                                                \
+    }
+
 #else
 
 #define DebugMsg(inFormat, ...)
@@ -36,6 +51,11 @@
         goto inHandler;                                                                                                \
     }
 
+#define RTDebugMsg(inFormat, ...)
+
+#define RTFailWithAction(inCondition, inAction, inHandler, inMessage)                                                  \
+    FailWithAction(inCondition, inAction, inHandler, inMessage)
+
 #endif
 
 #endif
@@ -3,58 +3,38 @@
 #include <IOKit/hidsystem/IOHIDParameter.h>
 #include "utilities.h"
 
+// The IOHIDSystem registry entry never goes away, so it's only looked up the first time it's
+// needed and kept from then on, rather than being looked up again on every check. 0 if there's
+// no such entry, which shouldn't happen.
+static io_registry_entry_t hidSystemEntry() {
+    static io_registry_entry_t entry = IOServiceGetMatchingService(MACH_PORT_NULL,
+                                                                   IOServiceMatching(kIOHIDSystemClass));
+    return entry;
+}
+
 // Based on StackOverflow thread: https://stackoverflow.com/questions/4643579/objective-c-get-notifications-about-a-users-idle-state
+// Only reads HIDIdleTime, rather than copying all of the entry's properties to find it.
 CFTimeInterval getUserIdleTimeInterval() {
     uint64_t idle = 0;
-    kern_return_t error;
-    
-    mach_port_t port;
-    io_iterator_t iter;
-    IOMasterPort(MACH_PORT_NULL, &port);
-    IOServiceGetMatchingServices(port, IOServiceMatching(kIOHIDSystemClass), &iter);
-    
-    if (!iter) {
-        return 0;
-    }
-    
-    io_registry_entry_t entry = IOIteratorNext(iter);
-    
+    io_registry_entry_t entry = hidSystemEntry();
+
     if (!entry) {
-        IOObjectRelease(iter);
         return 0;
     }
-    
-    CFMutableDictionaryRef properties = NULL;
-    error = IORegistryEntryCreateCFProperties(entry, &properties, kCFAllocatorDefault, 0);
-    
-    if (error != KERN_SUCCESS || !properties) {
-        if (properties) {
-            CFRelease(properties);
-        }
-        
-        IOObjectRelease(entry);
-        IOObjectRelease(iter);
-        return 0;
-    }
-    
-    CFTypeRef value = kCFNull;
-    
-    if (!CFDictionaryGetValueIfPresent(properties, CFSTR(kIOHIDIdleTimeKey), &value)) {
-        CFRelease(properties);
-        IOObjectRelease(entry);
-        IOObjectRelease(iter);
+
+    CFTypeRef value = IORegistryEntryCreateCFProperty(entry, CFSTR(kIOHIDIdleTimeKey), kCFAllocatorDefault, 0);
+
+    if (!value) {
         return 0;
     }
-    
+
     if (CFGetTypeID(value) == CFDataGetTypeID()) {
         CFDataGetBytes((CFDataRef)value, CFRangeMake(0, sizeof(idle)), (UInt8 *)&idle);
     } else if (CFGetTypeID(value) == CFNumberGetTypeID()) {
         CFNumberGetValue((CFNumberRef)value, kCFNumberSInt64Type, &idle);
     }
 
-    CFRelease(properties);
-    IOObjectRelease(entry);
-    IOObjectRelease(iter);
+    CFRelease(value);
 
     return idle / 1000000000.0;
 }
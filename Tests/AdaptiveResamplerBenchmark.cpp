@@ -0,0 +1,56 @@
+#include "AdaptiveResampler.h"
+
+#include <vector>
+
+#include "TestHarness.h"
+
+// The resampler's CPU cost per channel for conversions between the proxy device's sample rates,
+// converting 512 frame output cycles with a little drift on top of the nominal ratio, the way
+// outputDeviceIOProc runs it. The cost is per second of output, so it's the share of one core that
+// each channel takes to keep up in real time.
+
+static const UInt32 kOutputFrames = 512;
+
+static void Benchmark(Float64 proxyRate, Float64 outputRate, UInt32 channels) {
+    const Float64 nominalRatio = proxyRate / outputRate;
+    const Float64 ratio = nominalRatio * 1.0001;
+    AdaptiveResampler resampler(channels, kOutputFrames, ratio);
+    std::vector<Float32> input((UInt32(kOutputFrames * ratio) + AdaptiveResampler::kMaxTaps) * channels, 0.1f);
+    std::vector<Float32> output(kOutputFrames * channels);
+
+    resampler.SetNominalRatio(nominalRatio);
+
+    double seconds = TestHarness::TimePerCall([&] {
+        resampler.PushInput(input.data(), resampler.InputFramesNeeded(kOutputFrames, ratio));
+        resampler.Process(output.data(), kOutputFrames, ratio);
+    });
+    double perFramePerChannel = seconds / kOutputFrames / channels;
+
+    printf("%6.0f -> %6.0f Hz  %u ch  %6.1f ns per frame per channel  %5.2f%% of a core per channel\n",
+           proxyRate,
+           outputRate,
+           channels,
+           perFramePerChannel * 1e9,
+           perFramePerChannel * outputRate * 100);
+}
+
+int main() {
+    const Float64 rates[][2] = {
+        {44100, 48000},
+        {48000, 44100},
+        {48000, 48000},
+        {48000, 96000},
+        {96000, 48000},
+        {44100, 192000},
+        {192000, 44100},
+        {192000, 22050},
+    };
+
+    for (UInt32 channels : {2u, 8u}) {
+        for (const Float64 *pair : rates) {
+            Benchmark(pair[0], pair[1], channels);
+        }
+    }
+
+    return 0;
+}
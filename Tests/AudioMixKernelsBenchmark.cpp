@@ -0,0 +1,123 @@
+#include "AudioMixKernels.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "TestHarness.h"
+
+// Times each mix kernel against its scalar reference at the buffer sizes the driver sees, from a
+// low latency 64 frames up to 4096 frames. Stereo unless the kernel is about different layouts.
+//
+// A vector path is only worth having if it beats the scalar one, so the benchmark fails if any of
+// them is slower. Timings on a busy machine are noisy, so a kernel that comes out slower is timed
+// again a couple of times, and only its best time counts.
+
+static const UInt32 kFrameCounts[] = {64, 512, 4096};
+static const int kRetimes = 2;
+
+static int gSlower = 0;
+
+template <typename Scalar, typename Vector>
+static void Report(const char *name, UInt32 frames, Scalar scalar, Vector vector) {
+    double scalarSeconds = TestHarness::TimePerCall(scalar);
+    double vectorSeconds = TestHarness::TimePerCall(vector);
+
+    for (int retime = 0; retime < kRetimes && vectorSeconds > scalarSeconds; retime++) {
+        scalarSeconds = std::min(scalarSeconds, TestHarness::TimePerCall(scalar));
+        vectorSeconds = std::min(vectorSeconds, TestHarness::TimePerCall(vector));
+    }
+
+    bool slower = (vectorSeconds > scalarSeconds);
+    gSlower += slower;
+    printf("%-28s %5u frames  scalar %9.1f ns  vector %9.1f ns  %5.2fx%s\n",
+           name,
+           frames,
+           scalarSeconds * 1e9,
+           vectorSeconds * 1e9,
+           scalarSeconds / vectorSeconds,
+           slower ? "  SLOWER" : "");
+}
+
+int main() {
+    printf("AudioMixKernelsBenchmark: %s\n", AudioMixKernelsImplementationName());
+
+    for (UInt32 frames : kFrameCounts) {
+        const UInt32 maxChannels = 8;
+        std::vector<Float32> in(frames * maxChannels, 0.25f);
+        std::vector<Float32> out(frames * maxChannels, 0.0f);
+        std::vector<Float32> silence(frames * 2, 0.0f);
+        std::vector<Float32> gains(kAudioMixKernelsMaxChannels, 0.5f);
+        std::vector<Float32> steps(kAudioMixKernelsMaxChannels, 1e-6f);
+        std::vector<Float32> matrix(maxChannels * maxChannels, 0.5f);
+        const Float32 *i = in.data();
+        Float32 *o = out.data();
+        const Float32 *g = gains.data();
+        const Float32 *s = steps.data();
+        const Float32 *m = matrix.data();
+
+        Report(
+            "gain 2 -> 2",
+            frames,
+            [&] { MixInterleavedWithGainScalar(i, 2, o, 2, frames, g); },
+            [&] { MixInterleavedWithGain(i, 2, o, 2, frames, g); });
+        Report(
+            "gain 2 -> 8",
+            frames,
+            [&] { MixInterleavedWithGainScalar(i, 2, o, 8, frames, g); },
+            [&] { MixInterleavedWithGain(i, 2, o, 8, frames, g); });
+        Report(
+            "gain 8 -> 2",
+            frames,
+            [&] { MixInterleavedWithGainScalar(i, 8, o, 2, frames, g); },
+            [&] { MixInterleavedWithGain(i, 8, o, 2, frames, g); });
+        Report(
+            "gain 6 -> 8",
+            frames,
+            [&] { MixInterleavedWithGainScalar(i, 6, o, 8, frames, g); },
+            [&] { MixInterleavedWithGain(i, 6, o, 8, frames, g); });
+        Report(
+            "gain ramp 2 -> 2",
+            frames,
+            [&] { MixInterleavedWithGainRampScalar(i, 2, o, 2, frames, g, s); },
+            [&] { MixInterleavedWithGainRamp(i, 2, o, 2, frames, g, s); });
+        Report(
+            "gain ramp 2 -> 8",
+            frames,
+            [&] { MixInterleavedWithGainRampScalar(i, 2, o, 8, frames, g, s); },
+            [&] { MixInterleavedWithGainRamp(i, 2, o, 8, frames, g, s); });
+        Report(
+            "matrix 6 -> 2",
+            frames,
+            [&] { MixInterleavedWithMatrixScalar(i, 6, o, 2, frames, m, 2, g, NULL); },
+            [&] { MixInterleavedWithMatrix(i, 6, o, 2, frames, m, 2, g, NULL); });
+        Report(
+            "matrix 2 -> 8",
+            frames,
+            [&] { MixInterleavedWithMatrixScalar(i, 2, o, 8, frames, m, 8, g, NULL); },
+            [&] { MixInterleavedWithMatrix(i, 2, o, 8, frames, m, 8, g, NULL); });
+
+        // The sum is kept so the calls can't be optimized away
+        volatile Float32 sum = 0;
+        Report(
+            "dot product",
+            frames,
+            [&] { sum = sum + DotProductScalar(i, o, frames); },
+            [&] { sum = sum + DotProduct(i, o, frames); });
+
+        // Silence is the worst case, since every sample has to be looked at
+        volatile bool silent = false;
+        Report(
+            "is silent 2 channels",
+            frames,
+            [&] { silent = IsSilentScalar(silence.data(), frames * 2); },
+            [&] { silent = IsSilent(silence.data(), frames * 2); });
+        (void)silent;
+    }
+
+    if (gSlower > 0) {
+        fprintf(stderr, "AudioMixKernelsBenchmark: %d vector kernel(s) slower than scalar\n", gSlower);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "AudioMixKernels.h"
+#include "AudioRingBuffer.h"
+
+#include <vector>
+
+#include "TestHarness.h"
+
+// What the output IO proc does with each cycle's frames, done the way it used to (Fetch into a
+// work buffer, then mix the work buffer into the output) and the way it does now (mix straight from
+// the spans BeginRead returns). The bytes moved are counted from what each way reads and writes:
+// the copy reads the ring and writes the work buffer, the mix reads its input and reads and writes
+// the output.
+
+static const UInt32 kFrameCounts[] = {64, 512, 4096};
+static const UInt32 kRingFrames = 16384;
+// The ring is filled from here, so the stored frames wrap around its end
+static const SInt64 kFirstFrame = 1000;
+
+struct ReadPosition {
+    UInt32 frames;
+    SInt64 frameNumber = 0;
+
+    // The reads walk through the stored frames, so some of them wrap around the end of the ring
+    SInt64 NextFrame() {
+        frameNumber = (frameNumber + frames + 7) % (kRingFrames - frames);
+        return kFirstFrame + frameNumber;
+    }
+};
+
+static void Report(const char *name, UInt32 channels, UInt32 frames, UInt64 bytes, double seconds) {
+    printf("%-22s %u ch %5u frames  %8llu bytes moved  %9.1f ns\n",
+           name,
+           channels,
+           frames,
+           (unsigned long long)bytes,
+           seconds * 1e9);
+}
+
+static void Benchmark(UInt32 channels, UInt32 frames) {
+    const UInt32 bytesPerFrame = channels * sizeof(Float32);
+    AudioRingBuffer heapRing(bytesPerFrame, kRingFrames);
+    AudioRingBuffer mirroredRing(bytesPerFrame, kRingFrames, AudioRingBuffer::AllocationMode::mirrored);
+    std::vector<Float32> input(kRingFrames * channels, 0.25f);
+    std::vector<Float32> workBuffer(frames * channels);
+    std::vector<Float32> output(frames * channels);
+    std::vector<Float32> gains(kAudioMixKernelsMaxChannels, 0.5f);
+
+    heapRing.Store((const Byte *)input.data(), kRingFrames, kFirstFrame);
+    mirroredRing.Store((const Byte *)input.data(), kRingFrames, kFirstFrame);
+
+    const UInt64 mixBytes = UInt64(frames) * bytesPerFrame * 3;
+    const UInt64 copyBytes = UInt64(frames) * bytesPerFrame * 2;
+
+    ReadPosition copyPosition = {frames};
+    double copySeconds = TestHarness::TimePerCall([&] {
+        heapRing.Fetch((Byte *)workBuffer.data(), frames, copyPosition.NextFrame());
+        MixInterleavedWithGain(workBuffer.data(), channels, output.data(), channels, frames, gains.data());
+    });
+    Report("Fetch and mix", channels, frames, copyBytes + mixBytes, copySeconds);
+
+    for (AudioRingBuffer *ring : {&heapRing, &mirroredRing}) {
+        ReadPosition spanPosition = {frames};
+        double spanSeconds = TestHarness::TimePerCall([&] {
+            AudioRingBuffer::ReadSpans spans;
+            ring->BeginRead(spanPosition.NextFrame(), frames, spans);
+            Float32 *out = output.data() + spans.leadingZeroFrames * channels;
+
+            for (int span = 0; span < 2; span++) {
+                const Float32 *in = (const Float32 *)spans.data[span];
+                MixInterleavedWithGain(in, channels, out, channels, spans.frames[span], gains.data());
+                out += spans.frames[span] * channels;
+            }
+
+            ring->EndRead(spans);
+        });
+        Report(ring->IsMirrored() ? "spans, mirrored" : "spans, heap", channels, frames, mixBytes, spanSeconds);
+    }
+}
+
+int main() {
+    for (UInt32 channels : {2u, 8u}) {
+        for (UInt32 frames : kFrameCounts) {
+            Benchmark(channels, frames);
+        }
+    }
+
+    return 0;
+}
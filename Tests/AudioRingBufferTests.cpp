@@ -0,0 +1,507 @@
+#include "AudioRingBuffer.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "TestHarness.h"
+
+// Frames of kChannels floats, each sample holding its frame number and channel so that where it came
+// from can be told from its value alone
+static const UInt32 kChannels = 2;
+static const UInt32 kBytesPerFrame = kChannels * sizeof(Float32);
+
+static Float32 SampleValue(SInt64 frame, UInt32 channel) {
+    return Float32(frame % 1000003) + channel * 0.25f;
+}
+
+static std::vector<Float32> MakeFrames(SInt64 firstFrame, UInt32 nFrames) {
+    std::vector<Float32> frames(nFrames * kChannels);
+
+    for (UInt32 frame = 0; frame < nFrames; frame++) {
+        for (UInt32 channel = 0; channel < kChannels; channel++) {
+            frames[frame * kChannels + channel] = SampleValue(firstFrame + frame, channel);
+        }
+    }
+
+    return frames;
+}
+
+static bool FramesMatch(const Float32 *frames, SInt64 firstFrame, UInt32 nFrames) {
+    for (UInt32 frame = 0; frame < nFrames; frame++) {
+        for (UInt32 channel = 0; channel < kChannels; channel++) {
+            if (frames[frame * kChannels + channel] != SampleValue(firstFrame + frame, channel)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool FramesAreZero(const Float32 *frames, UInt32 nFrames) {
+    for (UInt32 sample = 0; sample < nFrames * kChannels; sample++) {
+        if (frames[sample] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void Store(AudioRingBuffer &buffer, SInt64 firstFrame, UInt32 nFrames) {
+    std::vector<Float32> frames = MakeFrames(firstFrame, nFrames);
+    CHECK(buffer.Store((const Byte *)frames.data(), nFrames, firstFrame));
+}
+
+static void TestStoreAndFetch(AudioRingBuffer::AllocationMode mode) {
+    AudioRingBuffer buffer(kBytesPerFrame, 1000, mode);
+    UInt32 capacity = buffer.mCapacityFrames;
+    std::vector<Float32> frames(256 * kChannels);
+
+    // Stores that wrap around the end of the buffer several times
+    for (SInt64 frame = 0; frame < 5 * capacity; frame += 96) {
+        Store(buffer, frame, 96);
+    }
+
+    SInt64 end = buffer.EndFrame();
+    CHECK_EQUAL(end - buffer.StartFrame(), SInt64(capacity));
+
+    for (SInt64 frame = end - capacity; frame + 256 <= end; frame += 37) {
+        CHECK(!buffer.Fetch((Byte *)frames.data(), 256, frame));
+        CHECK(FramesMatch(frames.data(), frame, 256));
+    }
+
+    // Frames that fell off the start of the window, or that haven't been stored yet, read as silence
+    CHECK(buffer.Fetch((Byte *)frames.data(), 256, end - capacity - 256));
+    CHECK(FramesAreZero(frames.data(), 256));
+    CHECK(buffer.Fetch((Byte *)frames.data(), 256, end));
+    CHECK(FramesAreZero(frames.data(), 256));
+
+    // Half of them available
+    CHECK(buffer.Fetch((Byte *)frames.data(), 256, end - 128));
+    CHECK(FramesMatch(frames.data(), end - 128, 128));
+    CHECK(FramesAreZero(frames.data() + 128 * kChannels, 128));
+
+    // A gap in the stores reads as silence
+    Store(buffer, end + 100, 50);
+    CHECK(!buffer.Fetch((Byte *)frames.data(), 150, end));
+    CHECK(FramesAreZero(frames.data(), 100));
+    CHECK(FramesMatch(frames.data() + 100 * kChannels, end + 100, 50));
+
+    buffer.Clear();
+    CHECK(buffer.Fetch((Byte *)frames.data(), 50, end + 100));
+    CHECK(FramesAreZero(frames.data(), 50));
+}
+
+static void TestMirrored() {
+    AudioRingBuffer buffer(kBytesPerFrame, 1000, AudioRingBuffer::AllocationMode::mirrored);
+
+#if __APPLE__ || __linux__
+    CHECK(buffer.IsMirrored());
+#endif
+
+    if (!buffer.IsMirrored()) {
+        return;
+    }
+
+    // The capacity is rounded up to whole pages and whole frames
+    UInt32 capacity = buffer.mCapacityFrames;
+    CHECK(capacity >= 1000);
+    CHECK_EQUAL(buffer.mCapacityBytes, capacity * kBytesPerFrame);
+
+    // A read across the end of the buffer is one span, since the memory past the end is the start
+    // of the buffer again
+    SInt64 wrapFrame = 3 * SInt64(capacity);
+    Store(buffer, wrapFrame - 300, 300);
+    Store(buffer, wrapFrame, 300);
+
+    AudioRingBuffer::ReadSpans spans;
+    CHECK(!buffer.BeginRead(wrapFrame - 200, 400, spans));
+    CHECK_EQUAL(spans.leadingZeroFrames, 0u);
+    CHECK_EQUAL(spans.frames[0], 400u);
+    CHECK_EQUAL(spans.frames[1], 0u);
+    CHECK_EQUAL(spans.trailingZeroFrames, 0u);
+    CHECK(FramesMatch((const Float32 *)spans.data[0], wrapFrame - 200, 400));
+    CHECK(buffer.EndRead(spans));
+
+    for (UInt32 byte = 0; byte < buffer.mCapacityBytes; byte += 997) {
+        CHECK_EQUAL(buffer.mBuffer[byte], buffer.mBuffer[buffer.mCapacityBytes + byte]);
+    }
+
+    // Reallocating maps it again
+    buffer.Allocate(3 * sizeof(Float32), 5000, AudioRingBuffer::AllocationMode::mirrored);
+    CHECK(buffer.IsMirrored());
+    CHECK(buffer.mCapacityFrames >= 5000);
+    CHECK_EQUAL(buffer.EndFrame(), SInt64(0));
+}
+
+static void TestHeapSpansSplitAtWrap() {
+    AudioRingBuffer buffer(kBytesPerFrame, 1000);
+    CHECK(!buffer.IsMirrored());
+
+    Store(buffer, 900, 100);
+    Store(buffer, 1000, 100);
+
+    AudioRingBuffer::ReadSpans spans;
+    CHECK(!buffer.BeginRead(950, 100, spans));
+    CHECK_EQUAL(spans.frames[0], 50u);
+    CHECK_EQUAL(spans.frames[1], 50u);
+    CHECK(FramesMatch((const Float32 *)spans.data[0], 950, 50));
+    CHECK(FramesMatch((const Float32 *)spans.data[1], 1000, 50));
+    CHECK(buffer.EndRead(spans));
+}
+
+static void TestReaderCursors() {
+    AudioRingBuffer buffer(kBytesPerFrame, 1024);
+    int first = buffer.AddReader();
+    int second = buffer.AddReader();
+    CHECK(first >= 0 && second >= 0 && first != second);
+
+    // Readers start out idle, and idle readers never hold the writer up
+    CHECK_EQUAL(buffer.ReaderFrame(first), AudioRingBuffer::kReaderIdle);
+    CHECK_EQUAL(buffer.SlowestReaderFrame(), AudioRingBuffer::kReaderIdle);
+
+    buffer.SetReaderFrame(first, 0);
+    buffer.SetReaderFrame(second, 0);
+
+    for (SInt64 frame = 0; frame < 1024; frame += 256) {
+        Store(buffer, frame, 256);
+    }
+
+    // The buffer is full and neither has read anything, so the next store would drop what they
+    // haven't read
+    CHECK_EQUAL(buffer.UnreadFramesDroppedByStore(256, 1024), 256u);
+
+    buffer.SetReaderFrame(first, 1024);
+    buffer.SetReaderFrame(second, 512);
+    CHECK_EQUAL(buffer.ReaderFrame(second), SInt64(512));
+    CHECK_EQUAL(buffer.SlowestReaderFrame(), SInt64(512));
+    CHECK_EQUAL(buffer.UnreadFramesDroppedByStore(256, 1024), 0u);
+    CHECK_EQUAL(buffer.UnreadFramesDroppedByStore(768, 1024), 256u);
+
+    // A reader that stops reading doesn't count any more
+    buffer.SetReaderFrame(second, AudioRingBuffer::kReaderIdle);
+    CHECK_EQUAL(buffer.SlowestReaderFrame(), SInt64(1024));
+    buffer.SetReaderFrame(second, 512);
+
+    // All the slots can be taken, and a removed reader's slot can be reused
+    std::vector<int> readers;
+
+    for (int reader; (reader = buffer.AddReader()) >= 0;) {
+        readers.push_back(reader);
+    }
+
+    CHECK_EQUAL(int(readers.size()), AudioRingBuffer::kMaxReaders - 2);
+    buffer.RemoveReader(readers.back());
+    CHECK_EQUAL(buffer.AddReader(), readers.back());
+    CHECK_EQUAL(buffer.ReaderFrame(readers.back()), AudioRingBuffer::kReaderIdle);
+
+    for (int reader : readers) {
+        buffer.RemoveReader(reader);
+    }
+
+    buffer.RemoveReader(first);
+    buffer.RemoveReader(second);
+    CHECK_EQUAL(buffer.SlowestReaderFrame(), AudioRingBuffer::kReaderIdle);
+}
+
+static void TestReaderOverruns() {
+    AudioRingBuffer buffer(kBytesPerFrame, 1024);
+    int fast = buffer.AddReader();
+    int slow = buffer.AddReader();
+    int idle = buffer.AddReader();
+
+    for (SInt64 frame = 0; frame < 1024; frame += 256) {
+        Store(buffer, frame, 256);
+    }
+
+    buffer.SetReaderFrame(fast, 1024);
+    buffer.SetReaderFrame(slow, 512);
+
+    // Frames 1024 to 1792 push frames 0 to 768 out, of which the slow reader hadn't read 512 to 768
+    for (SInt64 frame = 1024; frame < 1792; frame += 256) {
+        Store(buffer, frame, 256);
+    }
+
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(fast), 0ull);
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(slow), 256ull);
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(slow), 0ull);
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(idle), 0ull);
+
+    // What it missed reads as silence
+    std::vector<Float32> frames(256 * kChannels);
+    CHECK(buffer.Fetch((Byte *)frames.data(), 256, 512));
+    CHECK(FramesAreZero(frames.data(), 256));
+
+    Store(buffer, 1792, 256);
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(slow), 256ull);
+
+    // Catching up to where the window starts means nothing more is missed
+    buffer.SetReaderFrame(slow, buffer.StartFrame());
+    Store(buffer, 2048, 256);
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(slow), 256ull);
+    buffer.SetReaderFrame(slow, buffer.EndFrame());
+    Store(buffer, 2304, 256);
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(slow), 0ull);
+
+    // A jump of more than the capacity starts the buffer over like Clear does, which readers find
+    // out about from their reads rather than as overruns
+    SInt64 oldEnd = buffer.EndFrame();
+    buffer.SetReaderFrame(fast, oldEnd - 100);
+    buffer.TakeReaderOverrunFrames(fast);
+    Store(buffer, oldEnd + 5000, 256);
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(fast), 0ull);
+    CHECK_EQUAL(buffer.StartFrame(), oldEnd + 5000);
+    CHECK(buffer.Fetch((Byte *)frames.data(), 100, oldEnd - 100));
+    CHECK(FramesAreZero(frames.data(), 100));
+}
+
+// Every reader slot taken, the way the proxy takes them with the most additional outputs it plays
+// to while its primary output is switching devices: each of them still has its own overruns
+// counted, and one more reader is turned away rather than sharing a slot.
+static void TestFullReaderTable() {
+    AudioRingBuffer buffer(kBytesPerFrame, 1024);
+    std::vector<int> readers;
+
+    for (int index = 0; index < AudioRingBuffer::kMaxReaders; index++) {
+        readers.push_back(buffer.AddReader());
+        CHECK(readers.back() >= 0);
+    }
+
+    CHECK_EQUAL(buffer.AddReader(), -1);
+
+    for (SInt64 frame = 0; frame < 1024; frame += 256) {
+        Store(buffer, frame, 256);
+    }
+
+    // Reader n has read n * 64 frames, so storing another 512 drops 512 - n * 64 it hadn't
+    for (int index = 0; index < AudioRingBuffer::kMaxReaders; index++) {
+        buffer.SetReaderFrame(readers[index], index * 64);
+    }
+
+    Store(buffer, 1024, 512);
+
+    for (int index = 0; index < AudioRingBuffer::kMaxReaders; index++) {
+        CHECK_EQUAL(buffer.TakeReaderOverrunFrames(readers[index]), UInt64(512 - index * 64));
+    }
+
+    CHECK_EQUAL(buffer.SlowestReaderFrame(), SInt64(0));
+
+    // Once one of them goes, its slot is free for the next one
+    buffer.RemoveReader(readers[3]);
+    CHECK_EQUAL(buffer.AddReader(), readers[3]);
+    CHECK_EQUAL(buffer.AddReader(), -1);
+}
+
+// Switching the primary output: the new device's target takes a reader slot of its own, starts
+// reading where the old one has got to, and both play the same frames while they crossfade. Then
+// the old one goes idle and gives its slot up. Each of them only ever has its own overruns counted,
+// and until the old one goes, it counts as the slowest reader.
+static void TestReaderHandoff() {
+    const UInt32 kCycleFrames = 256;
+    AudioRingBuffer buffer(kBytesPerFrame, 2048);
+    int oldReader = buffer.AddReader();
+    SInt64 frame = 0;
+
+    for (; frame < 1024; frame += kCycleFrames) {
+        Store(buffer, frame, kCycleFrames);
+    }
+
+    // The old device has played half of what's there
+    SInt64 oldFrame = 512;
+    buffer.SetReaderFrame(oldReader, oldFrame);
+
+    // No handoff to take over is the same as a reader that isn't reading
+    CHECK_EQUAL(buffer.ReaderFrame(-1), AudioRingBuffer::kReaderIdle);
+
+    int newReader = buffer.AddReader();
+    CHECK(newReader >= 0 && newReader != oldReader);
+    SInt64 newFrame = buffer.ReaderFrame(oldReader);
+    CHECK_EQUAL(newFrame, oldFrame);
+    buffer.SetReaderFrame(newReader, newFrame);
+
+    // Crossfading: both read the same frames each cycle
+    for (int cycle = 0; cycle < 4; cycle++) {
+        Store(buffer, frame, kCycleFrames);
+        frame += kCycleFrames;
+
+        AudioRingBuffer::ReadSpans oldSpans;
+        AudioRingBuffer::ReadSpans newSpans;
+        CHECK(!buffer.BeginRead(oldFrame, kCycleFrames, oldSpans));
+        CHECK(!buffer.BeginRead(newFrame, kCycleFrames, newSpans));
+        CHECK(oldSpans.data[0] == newSpans.data[0] && oldSpans.frames[0] == newSpans.frames[0]);
+        CHECK(FramesMatch((const Float32 *)newSpans.data[0], newFrame, newSpans.frames[0]));
+        CHECK(buffer.EndRead(oldSpans) && buffer.EndRead(newSpans));
+
+        oldFrame += kCycleFrames;
+        newFrame += kCycleFrames;
+        buffer.SetReaderFrame(oldReader, oldFrame);
+        buffer.SetReaderFrame(newReader, newFrame);
+    }
+
+    // The old device stalls on its way out: the overruns that causes are its own
+    buffer.SetReaderFrame(newReader, frame);
+
+    for (int cycle = 0; cycle < 8; cycle++) {
+        Store(buffer, frame, kCycleFrames);
+        frame += kCycleFrames;
+        buffer.SetReaderFrame(newReader, frame);
+    }
+
+    CHECK_EQUAL(buffer.SlowestReaderFrame(), oldFrame);
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(oldReader), UInt64(frame - buffer.mCapacityFrames - oldFrame));
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(newReader), 0ull);
+
+    // Once it's retired, only the new device counts, and the slot is free again
+    buffer.SetReaderFrame(oldReader, AudioRingBuffer::kReaderIdle);
+    buffer.RemoveReader(oldReader);
+    CHECK_EQUAL(buffer.SlowestReaderFrame(), frame);
+    CHECK_EQUAL(buffer.UnreadFramesDroppedByStore(kCycleFrames, frame), 0u);
+    CHECK_EQUAL(buffer.AddReader(), oldReader);
+}
+
+// The proxy's loopback input reads the mix back out of the same buffer the output devices play it
+// from. WriteMix stores each cycle at its output sample time and ReadInput fetches at the input
+// sample time, which for the same cycle is further back, so the input gets what was written for
+// each moment. Its fetches are unregistered reads, so they move no reader's cursor and cost the
+// output readers nothing.
+static void TestLoopbackInput() {
+    const UInt32 kCycleFrames = 256;
+    const SInt64 kOutputAhead = 2 * kCycleFrames;
+    AudioRingBuffer buffer(kBytesPerFrame, 4096);
+    int output = buffer.AddReader();
+    std::vector<Float32> frames(kCycleFrames * kChannels);
+
+    // Only the input running, before anything has played: every cycle reads as silence
+    for (SInt64 inputTime = 0; inputTime < 4 * kCycleFrames; inputTime += kCycleFrames) {
+        CHECK(buffer.Fetch((Byte *)frames.data(), kCycleFrames, inputTime));
+        CHECK(FramesAreZero(frames.data(), kCycleFrames));
+    }
+
+    // Playing and recording: once the output times the mix was stored at come round as input
+    // times, each cycle reads back exactly what was written for it
+    SInt64 playStart = 10 * kCycleFrames;
+    buffer.SetReaderFrame(output, playStart);
+
+    for (SInt64 inputTime = playStart - kOutputAhead; inputTime < playStart + 8 * kCycleFrames;
+         inputTime += kCycleFrames) {
+        Store(buffer, inputTime + kOutputAhead, kCycleFrames);
+        bool zeroFilled = buffer.Fetch((Byte *)frames.data(), kCycleFrames, inputTime);
+
+        if (inputTime < playStart) {
+            CHECK(zeroFilled);
+            CHECK(FramesAreZero(frames.data(), kCycleFrames));
+        } else {
+            CHECK(!zeroFilled);
+            CHECK(FramesMatch(frames.data(), inputTime, kCycleFrames));
+        }
+
+        // The output reader's cursor is its own
+        CHECK_EQUAL(buffer.ReaderFrame(output), playStart);
+    }
+
+    CHECK_EQUAL(buffer.TakeReaderOverrunFrames(output), 0ull);
+
+    // Playback stops while recording carries on: what was already written can still be read, and
+    // after that it's silence again
+    SInt64 lastWritten = buffer.EndFrame();
+    CHECK(!buffer.Fetch((Byte *)frames.data(), kCycleFrames, lastWritten - kCycleFrames));
+    CHECK(buffer.Fetch((Byte *)frames.data(), kCycleFrames, lastWritten));
+    CHECK(FramesAreZero(frames.data(), kCycleFrames));
+}
+
+// Whether every frame in frames is either what was stored for it or silence, rather than partly one
+// and partly the other, or some other frame's samples
+static bool FramesAreWhole(const Float32 *frames, SInt64 firstFrame, UInt32 nFrames) {
+    for (UInt32 frame = 0; frame < nFrames; frame++) {
+        const Float32 *samples = frames + frame * kChannels;
+
+        if (!FramesAreZero(samples, 1) && !FramesMatch(samples, firstFrame + frame, 1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// One thread stores while another fetches from wherever the window is, so the writer is always
+// about to reclaim some of the frames being read. Neither Fetch nor a BeginRead that EndRead says
+// is intact may ever hand back a torn frame.
+static void TestConcurrentStoreAndFetch(AudioRingBuffer::AllocationMode mode) {
+    const UInt32 kStoreFrames = 64;
+    const SInt64 kTotalFrames = 4000000;
+    AudioRingBuffer buffer(kBytesPerFrame, 4096, mode);
+    SInt64 capacity = buffer.mCapacityFrames;
+    std::atomic<bool> done(false);
+    std::atomic<SInt64> written(0);
+
+    std::thread writer([&] {
+        for (SInt64 frame = 0; frame < kTotalFrames; frame += kStoreFrames) {
+            std::vector<Float32> frames = MakeFrames(frame, kStoreFrames);
+            buffer.Store((const Byte *)frames.data(), kStoreFrames, frame);
+            written.store(frame + kStoreFrames, std::memory_order_release);
+
+            // Now and then start over, like a client restarting IO does
+            if (frame % (kStoreFrames * 20000) == 0) {
+                buffer.Clear();
+            }
+        }
+
+        done = true;
+    });
+
+    std::mt19937 random(1);
+    std::vector<Float32> frames(256 * kChannels);
+    long reads = 0;
+    long tornFetches = 0;
+    long tornSpans = 0;
+
+    while (!done) {
+        // Mostly from the oldest frames, which are the ones being reclaimed
+        SInt64 end = written.load(std::memory_order_acquire);
+        SInt64 frame = end - capacity + SInt64(random() % 512) - 128;
+        UInt32 nFrames = 1 + random() % 256;
+
+        buffer.Fetch((Byte *)frames.data(), nFrames, frame);
+        tornFetches += !FramesAreWhole(frames.data(), frame, nFrames);
+
+        AudioRingBuffer::ReadSpans spans;
+        buffer.BeginRead(frame, nFrames, spans);
+        std::vector<Float32> copy;
+
+        for (int span = 0; span < 2; span++) {
+            const Float32 *data = (const Float32 *)spans.data[span];
+            copy.insert(copy.end(), data, data + spans.frames[span] * kChannels);
+        }
+
+        UInt32 copiedFrames = UInt32(copy.size() / kChannels);
+
+        if (buffer.EndRead(spans)) {
+            tornSpans += !FramesMatch(copy.data(), frame + spans.leadingZeroFrames, copiedFrames);
+        }
+
+        reads++;
+    }
+
+    writer.join();
+    CHECK(reads > 0);
+    CHECK_EQUAL(tornFetches, 0);
+    CHECK_EQUAL(tornSpans, 0);
+}
+
+int main() {
+    TestStoreAndFetch(AudioRingBuffer::AllocationMode::heap);
+    TestStoreAndFetch(AudioRingBuffer::AllocationMode::mirrored);
+    TestMirrored();
+    TestHeapSpansSplitAtWrap();
+    TestReaderCursors();
+    TestReaderOverruns();
+    TestFullReaderTable();
+    TestReaderHandoff();
+    TestLoopbackInput();
+    TestConcurrentStoreAndFetch(AudioRingBuffer::AllocationMode::heap);
+    TestConcurrentStoreAndFetch(AudioRingBuffer::AllocationMode::mirrored);
+    return TestResult();
+}
@@ -0,0 +1,164 @@
+#include "ChannelMatrix.h"
+
+#include <cmath>
+
+#include "TestHarness.h"
+
+// When the device the proxy plays to doesn't have the same channels as the proxy, the output IO
+// proc mixes through a matrix that routes each of our channels to the device's channel with the
+// same label, or folds it down into the ones it has. These check the matrices built for the
+// layouts the proxy offers against the devices it's likely to play to.
+
+static const AudioChannelLabel L = kAudioChannelLabel_Left;
+static const AudioChannelLabel R = kAudioChannelLabel_Right;
+static const AudioChannelLabel C = kAudioChannelLabel_Center;
+static const AudioChannelLabel LFE = kAudioChannelLabel_LFEScreen;
+static const AudioChannelLabel Ls = kAudioChannelLabel_LeftSurround;
+static const AudioChannelLabel Rs = kAudioChannelLabel_RightSurround;
+static const AudioChannelLabel Rls = kAudioChannelLabel_RearSurroundLeft;
+static const AudioChannelLabel Rrs = kAudioChannelLabel_RearSurroundRight;
+static const AudioChannelLabel Mono = kAudioChannelLabel_Mono;
+static const AudioChannelLabel Unknown = kAudioChannelLabel_Unknown;
+
+static const Float32 kHalf = 0.5f;
+static const Float32 kRootHalf = Float32(M_SQRT1_2);
+
+// Whether matrix is expected, given as a row of gains for each of our channels
+static bool MatrixIs(const std::vector<Float32> &matrix, const std::vector<std::vector<Float32>> &expected) {
+    std::vector<Float32> flattened;
+
+    for (const std::vector<Float32> &row : expected) {
+        flattened.insert(flattened.end(), row.begin(), row.end());
+    }
+
+    if (matrix != flattened) {
+        printf("matrix:");
+
+        for (Float32 gain : matrix) {
+            printf(" %.3f", gain);
+        }
+
+        printf("\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool IsIdentity(UInt32 channels, const std::vector<Float32> &matrix) {
+    for (UInt32 input = 0; input < channels; input++) {
+        for (UInt32 output = 0; output < channels; output++) {
+            if (matrix[input * channels + output] != (input == output ? 1.0f : 0.0f)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static void TestLabels() {
+    const AudioChannelLabel expected[] = {L, R, C, LFE, Ls, Rs, Rls, Rrs};
+
+    for (UInt32 channel = 0; channel < 8; channel++) {
+        CHECK_EQUAL(ProxyChannelLabel(channel), expected[channel]);
+    }
+
+    CHECK_EQUAL(ProxyChannelLabel(8), Unknown);
+    CHECK_EQUAL(ProxyChannelLabel(100), Unknown);
+}
+
+static void TestIdentity() {
+    std::vector<Float32> matrix;
+
+    // The same layout on both sides, whether the device labels its channels or not
+    CHECK(MakeChannelMatrix(2, 2, {L, R}, matrix));
+    CHECK(IsIdentity(2, matrix));
+    CHECK(MakeChannelMatrix(2, 2, {}, matrix));
+    CHECK(MakeChannelMatrix(6, 6, {L, R, C, LFE, Ls, Rs}, matrix));
+    CHECK(IsIdentity(6, matrix));
+    CHECK(MakeChannelMatrix(8, 8, {}, matrix));
+    CHECK(IsIdentity(8, matrix));
+
+    // Stereo into a device with more channels goes to its front pair and leaves the rest silent,
+    // which the plain mix does too
+    CHECK(MakeChannelMatrix(2, 8, {}, matrix));
+    CHECK(MatrixIs(matrix, {{1, 0, 0, 0, 0, 0, 0, 0}, {0, 1, 0, 0, 0, 0, 0, 0}}));
+
+    // A device with its front channels the other way round
+    CHECK(!MakeChannelMatrix(2, 2, {R, L}, matrix));
+    CHECK(MatrixIs(matrix, {{0, 1}, {1, 0}}));
+}
+
+static void TestFoldDown() {
+    std::vector<Float32> matrix;
+
+    // 5.1 into stereo: the centre goes to both sides, the surrounds to their side, and the LFE
+    // nowhere
+    CHECK(!MakeChannelMatrix(6, 2, {L, R}, matrix));
+    CHECK(MatrixIs(matrix, {{1, 0}, {0, 1}, {kRootHalf, kRootHalf}, {0, 0}, {kRootHalf, 0}, {0, kRootHalf}}));
+
+    // 7.1 into 5.1: the rear surrounds go to the side surrounds at full level
+    CHECK(!MakeChannelMatrix(8, 6, {L, R, C, LFE, Ls, Rs}, matrix));
+    CHECK(MatrixIs(matrix,
+                   {{1, 0, 0, 0, 0, 0},
+                    {0, 1, 0, 0, 0, 0},
+                    {0, 0, 1, 0, 0, 0},
+                    {0, 0, 0, 1, 0, 0},
+                    {0, 0, 0, 0, 1, 0},
+                    {0, 0, 0, 0, 0, 1},
+                    {0, 0, 0, 0, 1, 0},
+                    {0, 0, 0, 0, 0, 1}}));
+
+    // And 5.1 into a device with only rear surrounds uses those instead
+    CHECK(!MakeChannelMatrix(6, 4, {L, R, Rls, Rrs}, matrix));
+    CHECK(MatrixIs(matrix, {{1, 0, 0, 0}, {0, 1, 0, 0}, {kRootHalf, kRootHalf, 0, 0}, {0, 0, 0, 0}, {0, 0, 1, 0},
+                            {0, 0, 0, 1}}));
+
+    // No centre channel and no surrounds on a quad device without labels: the standard order makes
+    // it L R C LFE, so the surrounds fold into the fronts
+    CHECK(!MakeChannelMatrix(6, 4, {}, matrix));
+    CHECK(MatrixIs(matrix, {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}, {kRootHalf, 0, 0, 0},
+                            {0, kRootHalf, 0, 0}}));
+}
+
+static void TestMono() {
+    std::vector<Float32> matrix;
+
+    // A single channel is mono, labelled or not
+    CHECK(!MakeChannelMatrix(2, 1, {Mono}, matrix));
+    CHECK(MatrixIs(matrix, {{kHalf}, {kHalf}}));
+    CHECK(!MakeChannelMatrix(2, 1, {}, matrix));
+    CHECK(MatrixIs(matrix, {{kHalf}, {kHalf}}));
+
+    CHECK(!MakeChannelMatrix(6, 1, {}, matrix));
+    CHECK(MatrixIs(matrix, {{kHalf}, {kHalf}, {kRootHalf}, {0}, {kHalf}, {kHalf}}));
+}
+
+static void TestUnderstoodLabels() {
+    std::vector<Float32> matrix;
+    std::vector<Float32> standard;
+
+    // Labels that don't say where the front left is, or don't match the channel count, are ignored
+    // in favour of the standard order
+    MakeChannelMatrix(6, 6, {}, standard);
+    CHECK(MakeChannelMatrix(6, 6, {Unknown, Unknown, Unknown, Unknown, Unknown, Unknown}, matrix));
+    CHECK(matrix == standard);
+    CHECK(MakeChannelMatrix(6, 6, {R, L}, matrix));
+    CHECK(matrix == standard);
+    CHECK(MakeChannelMatrix(6, 6, {Rs, Ls, LFE, C, R, Unknown}, matrix));
+    CHECK(matrix == standard);
+
+    // A mono device that calls its channel something else is still mono
+    CHECK(!MakeChannelMatrix(2, 1, {C}, matrix));
+    CHECK(MatrixIs(matrix, {{kHalf}, {kHalf}}));
+}
+
+int main() {
+    TestLabels();
+    TestIdentity();
+    TestFoldDown();
+    TestMono();
+    TestUnderstoodLabels();
+    return TestResult();
+}
@@ -0,0 +1,323 @@
+#include "DeviceRegistry.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "TestHarness.h"
+
+// The proxy finds its output devices through an AudioDeviceRegistry, which keeps what it's read
+// from the HAL about each device so that lookups don't have to ask again. These run the registry
+// against a simulated HAL whose devices come and go, and check that it keeps up with them, only
+// reads the devices that are new, tries the ones it couldn't read again, and releases every UID
+// and name it's given.
+
+// Reference counted, like a CFString
+struct FakeString {
+    std::string text;
+    int references;
+};
+
+struct FakeDevice {
+    UInt32 id;
+    std::string uid;
+    std::string name;
+    UInt32 transportType;
+    UInt32 outputChannelCount;
+    bool hasStereoOutput;
+    // Whether reading its UID fails, as it can for a device that's going away
+    bool unreadable;
+};
+
+// The HAL's devices, in its order
+static std::vector<FakeDevice> gDevices;
+// How many times the registry has asked for a device's UID, which is the first thing it reads
+static UInt32 gDeviceReads = 0;
+// How many strings haven't been released yet
+static std::atomic<SInt32> gLiveStrings(0);
+
+static const FakeDevice *FindDevice(UInt32 deviceID) {
+    for (const FakeDevice &device : gDevices) {
+        if (device.id == deviceID) {
+            return &device;
+        }
+    }
+
+    return NULL;
+}
+
+static FakeString *MakeString(const std::string &text) {
+    gLiveStrings++;
+    return new FakeString{text, 1};
+}
+
+struct FakeSystem {
+    typedef UInt32 ObjectID;
+    typedef FakeString *String;
+
+    static constexpr UInt32 kUnknownDevice = 0;
+
+    typedef std::mutex Mutex;
+    typedef std::lock_guard<std::mutex> Locker;
+
+    static std::vector<UInt32> DeviceIDs() {
+        std::vector<UInt32> deviceIDs;
+
+        for (const FakeDevice &device : gDevices) {
+            deviceIDs.push_back(device.id);
+        }
+
+        return deviceIDs;
+    }
+
+    static FakeString *CopyUID(UInt32 deviceID) {
+        const FakeDevice *device = FindDevice(deviceID);
+        gDeviceReads++;
+        return (device && !device->unreadable) ? MakeString(device->uid) : NULL;
+    }
+
+    static FakeString *CopyName(UInt32 deviceID) {
+        const FakeDevice *device = FindDevice(deviceID);
+        return device ? MakeString(device->name) : NULL;
+    }
+
+    static UInt32 TransportType(UInt32 deviceID) { return FindDevice(deviceID)->transportType; }
+    static UInt32 OutputChannelCount(UInt32 deviceID) { return FindDevice(deviceID)->outputChannelCount; }
+    static bool HasStereoOutput(UInt32 deviceID) { return FindDevice(deviceID)->hasStereoOutput; }
+
+    static void Retain(FakeString *string) { string->references++; }
+
+    static void Release(FakeString *string) {
+        if (--string->references == 0) {
+            gLiveStrings--;
+            delete string;
+        }
+    }
+
+    static size_t Hash(FakeString *string) { return std::hash<std::string>()(string->text); }
+    static bool Equal(FakeString *string1, FakeString *string2) { return string1->text == string2->text; }
+
+    static void GetCString(FakeString *string, char *buffer, size_t size) {
+        snprintf(buffer, size, "%s", string->text.c_str());
+    }
+};
+
+typedef DeviceRegistry<FakeSystem> Registry;
+
+// 'usb '
+static const UInt32 kTransportTypeUSB = 0x75736220;
+
+static FakeDevice Device(UInt32 id, const std::string &uid, bool hasStereoOutput = true) {
+    return FakeDevice{id, uid, uid + " name", kTransportTypeUSB, hasStereoOutput ? 2u : 0u, hasStereoOutput, false};
+}
+
+static UInt32 DeviceForUID(Registry &registry, const std::string &uid) {
+    FakeString *string = MakeString(uid);
+    UInt32 device = registry.DeviceForUID(string);
+    FakeSystem::Release(string);
+    return device;
+}
+
+static std::string UIDForDevice(Registry &registry, UInt32 deviceID) {
+    FakeString *uid = registry.CopyUIDForDevice(deviceID);
+
+    if (!uid) {
+        return "(none)";
+    }
+
+    std::string text = uid->text;
+    FakeSystem::Release(uid);
+    return text;
+}
+
+static UInt32 FirstStereoOutputDeviceExcept(Registry &registry, const char *uid) {
+    FakeString *string = uid ? MakeString(uid) : NULL;
+    UInt32 device = registry.FirstStereoOutputDeviceExcept(string);
+
+    if (string) {
+        FakeSystem::Release(string);
+    }
+
+    return device;
+}
+
+static void TestAddAndRemove() {
+    {
+        Registry registry;
+        gDevices = {Device(10, "speakers"), Device(11, "headphones"), Device(12, "microphone", false)};
+        gDeviceReads = 0;
+
+        // Nothing's known until the first update, which reads every device
+        CHECK_EQUAL(DeviceForUID(registry, "speakers"), 0u);
+        CHECK(registry.Update());
+        CHECK_EQUAL(gDeviceReads, 3u);
+        CHECK_EQUAL(DeviceForUID(registry, "speakers"), 10u);
+        CHECK_EQUAL(DeviceForUID(registry, "headphones"), 11u);
+        CHECK_EQUAL(DeviceForUID(registry, "microphone"), 12u);
+        CHECK_EQUAL(DeviceForUID(registry, "nothing"), 0u);
+        CHECK_EQUAL(registry.DeviceForUID(NULL), 0u);
+        CHECK(UIDForDevice(registry, 11) == "headphones");
+        CHECK(UIDForDevice(registry, 99) == "(none)");
+        CHECK(!registry.HasUnreadableDevices());
+
+        // With nothing added or removed, an update has nothing to read and nothing changes
+        CHECK(!registry.Update());
+        CHECK_EQUAL(gDeviceReads, 3u);
+
+        // Only the new device is read
+        gDevices.insert(gDevices.begin() + 1, Device(13, "hdmi"));
+        CHECK(registry.Update());
+        CHECK_EQUAL(gDeviceReads, 4u);
+        CHECK_EQUAL(DeviceForUID(registry, "hdmi"), 13u);
+
+        // A device that's gone can't be found any more, by its UID or its ID
+        gDevices.erase(gDevices.begin());
+        CHECK(registry.Update());
+        CHECK_EQUAL(gDeviceReads, 4u);
+        CHECK_EQUAL(DeviceForUID(registry, "speakers"), 0u);
+        CHECK(UIDForDevice(registry, 10) == "(none)");
+        CHECK_EQUAL(DeviceForUID(registry, "hdmi"), 13u);
+
+        // A device that comes back gets a new ID from the HAL, but keeps its UID
+        gDevices.push_back(Device(14, "speakers"));
+        CHECK(registry.Update());
+        CHECK_EQUAL(DeviceForUID(registry, "speakers"), 14u);
+
+        // All of them gone
+        gDevices.clear();
+        CHECK(registry.Update());
+        CHECK_EQUAL(DeviceForUID(registry, "hdmi"), 0u);
+        CHECK(!registry.Update());
+
+        gDevices = {Device(20, "a"), Device(21, "b")};
+        registry.Update();
+    }
+
+    // The registry has released everything it read, including what it still had when it was
+    // destroyed
+    CHECK_EQUAL(gLiveStrings.load(), 0);
+}
+
+static void TestUnreadableDevices() {
+    {
+        Registry registry;
+        gDevices = {Device(30, "speakers"), Device(31, "going"), Device(32, "headphones")};
+        gDevices[1].unreadable = true;
+        gDeviceReads = 0;
+
+        // The device that can't be read is left out, and the rest are there
+        CHECK(registry.Update());
+        CHECK(registry.HasUnreadableDevices());
+        CHECK_EQUAL(DeviceForUID(registry, "speakers"), 30u);
+        CHECK_EQUAL(DeviceForUID(registry, "going"), 0u);
+        CHECK(UIDForDevice(registry, 31) == "(none)");
+
+        // It's tried again every update until it can be read, which counts as a change
+        CHECK(!registry.Update());
+        CHECK(registry.HasUnreadableDevices());
+        CHECK_EQUAL(gDeviceReads, 4u);
+
+        gDevices[1].unreadable = false;
+        CHECK(registry.Update());
+        CHECK(!registry.HasUnreadableDevices());
+        CHECK_EQUAL(DeviceForUID(registry, "going"), 31u);
+        CHECK_EQUAL(gDeviceReads, 5u);
+
+        // And if it goes away instead, it's no longer waited for
+        gDevices.push_back(Device(33, "gone"));
+        gDevices.back().unreadable = true;
+        CHECK(!registry.Update());
+        CHECK(registry.HasUnreadableDevices());
+        gDevices.pop_back();
+        CHECK(!registry.Update());
+        CHECK(!registry.HasUnreadableDevices());
+    }
+
+    CHECK_EQUAL(gLiveStrings.load(), 0);
+}
+
+static void TestFirstStereoOutputDevice() {
+    {
+        Registry registry;
+        gDevices = {Device(40, "microphone", false), Device(41, "proxy"), Device(42, "speakers"), Device(43, "usb")};
+        registry.Update();
+
+        // The first in the HAL's order that has stereo output, skipping the one asked to
+        CHECK_EQUAL(FirstStereoOutputDeviceExcept(registry, NULL), 41u);
+        CHECK_EQUAL(FirstStereoOutputDeviceExcept(registry, "proxy"), 42u);
+        CHECK_EQUAL(FirstStereoOutputDeviceExcept(registry, "speakers"), 41u);
+
+        // The HAL's order is kept as devices come and go, and a device that couldn't be read isn't
+        // chosen
+        gDevices.insert(gDevices.begin(), Device(44, "unreadable"));
+        gDevices[0].unreadable = true;
+        gDevices.insert(gDevices.begin() + 2, Device(45, "hdmi"));
+        registry.Update();
+        CHECK_EQUAL(FirstStereoOutputDeviceExcept(registry, "proxy"), 45u);
+
+        gDevices.erase(gDevices.begin() + 2);
+        registry.Update();
+        CHECK_EQUAL(FirstStereoOutputDeviceExcept(registry, "proxy"), 42u);
+
+        // None at all
+        gDevices = {Device(40, "microphone", false), Device(41, "proxy")};
+        registry.Update();
+        CHECK_EQUAL(FirstStereoOutputDeviceExcept(registry, "proxy"), 0u);
+    }
+
+    CHECK_EQUAL(gLiveStrings.load(), 0);
+}
+
+// The lookups happen on other threads than the updates. A device that stays put has to be found by
+// every lookup while the devices around it come and go.
+static void TestLookupsDuringUpdates() {
+    const UInt32 kUpdates = 20000;
+    Registry registry;
+    gDevices = {Device(50, "speakers")};
+    registry.Update();
+    std::atomic<bool> done(false);
+    std::atomic<UInt64> lookups(0);
+    std::atomic<UInt64> missed(0);
+
+    FakeString *speakers = MakeString("speakers");
+    std::thread lookup([&] {
+        while (!done.load()) {
+            missed += (registry.DeviceForUID(speakers) != 50);
+            missed += (registry.FirstStereoOutputDeviceExcept(NULL) != 50);
+            lookups++;
+        }
+    });
+
+    for (UInt32 update = 0; update < kUpdates; update++) {
+        if (update % 2 == 0) {
+            gDevices.insert(gDevices.begin(), Device(100 + update, "added " + std::to_string(update), false));
+        } else {
+            gDevices.erase(gDevices.begin());
+        }
+
+        // The added devices come first, but have no stereo output, so they're never chosen
+        registry.Update();
+
+        if (update % 64 == 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    done.store(true);
+    lookup.join();
+    FakeSystem::Release(speakers);
+    printf("%u updates, %llu lookups during them\n", kUpdates, (unsigned long long)lookups.load());
+    CHECK_EQUAL(missed.load(), 0u);
+    CHECK(lookups.load() > 0);
+}
+
+int main() {
+    TestAddAndRemove();
+    TestUnreadableDevices();
+    TestFirstStereoOutputDevice();
+    TestLookupsDuringUpdates();
+    CHECK_EQUAL(gLiveStrings.load(), 0);
+    return TestResult();
+}
@@ -0,0 +1,47 @@
+#include "DriftSimulation.h"
+
+#include "TestHarness.h"
+
+// Runs DriftSimulation across a sweep of clock offsets and checks that the controller tracks each
+// one: the ratio ends up off nominal by the offset, the fill level comes back to its target, and
+// the cycle jitter the controller sees doesn't get through to the fill level.
+
+static const Float64 kOffsetsPPM[] = {0, 20, 100, 500};
+static const Float64 kSeconds = 600;
+
+static void CheckSettled(const DriftSimulation::Result &result, Float64 ppm) {
+    // A fast output clock takes frames sooner, so fewer input frames per output frame
+    CHECK(fabs(result.meanDeviationPPM + ppm) < 1.0);
+    CHECK(fabs(result.meanError) < 1.0);
+
+    // The jitter alone would make the fill level measured at each cycle vary by 13.9 frames
+    CHECK(result.fillStdDev < 2.0);
+}
+
+static void TestSweep(Float64 proxyRate, Float64 outputRate) {
+    Float64 lastPeakError = 0;
+
+    for (Float64 ppm : kOffsetsPPM) {
+        DriftSimulation::Result fast = DriftSimulation::Simulate(ppm, kSeconds, proxyRate, outputRate, 512);
+        DriftSimulation::Result slow = DriftSimulation::Simulate(-ppm, kSeconds, proxyRate, outputRate, 512);
+        CheckSettled(fast, ppm);
+        CheckSettled(slow, -ppm);
+
+        // The further off the output clock is, the further the fill level strays before the
+        // integral term catches up, in either direction alike
+        CHECK(fast.peakError > lastPeakError * 1.5);
+        CHECK(slow.peakError > lastPeakError * 1.5);
+        CHECK(fabs(fast.peakError - slow.peakError) < 0.1 * fast.peakError + 1.0);
+        lastPeakError = std::max(fast.peakError, slow.peakError);
+    }
+
+    // Even a large offset shouldn't use up much of the room the latency mode's cushion leaves
+    CHECK(lastPeakError < DriftSimulation::kCushionFrames / 2);
+}
+
+int main() {
+    TestSweep(48000, 48000);
+    TestSweep(48000, 44100);
+    TestSweep(44100, 96000);
+    return TestResult();
+}
@@ -0,0 +1,100 @@
+#ifndef __DriftSimulation_h__
+#define __DriftSimulation_h__
+
+#include "AdaptiveResampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// Plays the proxy device's clock against an output device's clock that runs ppm parts per million
+// fast, the way outputDeviceIOProc does: every output cycle measures the ring buffer's fill level
+// against the proxy's clock, has the drift controller pick a ratio, and moves the read position on
+// by however many input frames the resampler takes at that ratio.
+//
+// The output device's IO cycles don't start exactly on time, so the fill level the controller is
+// given is measured at a jittered time. What's reported is the fill level at the time each cycle
+// was due, which is what the controller is really steering and what the latency depends on.
+//
+// Only the position arithmetic matters here, so the resampler is fed silence and skips its output,
+// which moves through the input exactly as producing it would.
+namespace DriftSimulation {
+
+static const Float64 kCycleJitterSeconds = 0.0005;
+// Long enough for the integral term to have taken over
+static const Float64 kSettleSeconds = 300;
+// The balanced latency mode's cushion
+static const Float64 kCushionFrames = 512;
+
+struct Result {
+    Float64 targetFill;
+    // The largest distance of the fill level from its target at any time, including while the
+    // controller was still catching up with the drift
+    Float64 peakError;
+    // Once settled
+    Float64 meanError;
+    Float64 fillStdDev;
+    Float64 meanDeviationPPM;
+    Float64 maxDeviationPPM;
+};
+
+inline Result Simulate(Float64 ppm, Float64 seconds, Float64 proxyRate, Float64 outputRate, UInt32 bufferFrames) {
+    const Float64 nominalRatio = proxyRate / outputRate;
+    AdaptiveResampler resampler(2, bufferFrames, nominalRatio * 1.01);
+    DriftController controller;
+    std::mt19937 random(1);
+    std::uniform_real_distribution<Float64> jitter(-kCycleJitterSeconds, kCycleJitterSeconds);
+
+    resampler.SetNominalRatio(nominalRatio);
+
+    // The same read position and fill level target outputDeviceIOProc starts from after a resync
+    const Float64 outputFramesPerSecond = outputRate * (1.0 + ppm * 1e-6);
+    Float64 readFrame = -(bufferFrames * nominalRatio + resampler.Latency() + kCushionFrames);
+    controller.Reset(-readFrame - resampler.Latency());
+
+    Result result = {controller.TargetFill(), 0, 0, 0, 0, 0};
+    Float64 sumSquares = 0;
+    UInt64 samples = 0;
+    UInt64 cycles = UInt64(seconds * outputRate / bufferFrames);
+
+    for (UInt64 cycle = 0; cycle < cycles; cycle++) {
+        // Time as the proxy's clock measures it, when this cycle was due and when it started
+        Float64 due = cycle * bufferFrames / outputFramesPerSecond;
+        Float64 fill = due * proxyRate - readFrame;
+        Float64 measuredFill = (due + jitter(random)) * proxyRate - readFrame;
+        Float64 ratio = nominalRatio * controller.Update(measuredFill, UInt32(bufferFrames * nominalRatio));
+
+        UInt32 inputFrames = resampler.InputFramesNeeded(bufferFrames, ratio);
+        resampler.PushSilence(inputFrames);
+        resampler.Skip(bufferFrames, ratio);
+        readFrame += inputFrames;
+
+        Float64 error = fill - result.targetFill;
+        Float64 deviationPPM = (ratio / nominalRatio - 1.0) * 1e6;
+
+        // The first cycle after a resync also pushes the resampler's lookahead
+        if (cycle > 0) {
+            result.peakError = std::max(result.peakError, fabs(error));
+        }
+
+        if (due >= kSettleSeconds) {
+            result.meanError += error;
+            sumSquares += error * error;
+            result.meanDeviationPPM += deviationPPM;
+            result.maxDeviationPPM = std::max(result.maxDeviationPPM, fabs(deviationPPM));
+            samples++;
+        }
+    }
+
+    if (samples > 0) {
+        result.meanError /= samples;
+        result.meanDeviationPPM /= samples;
+        result.fillStdDev = sqrt(std::max(sumSquares / samples - result.meanError * result.meanError, 0.0));
+    }
+
+    return result;
+}
+
+} // namespace DriftSimulation
+
+#endif // __DriftSimulation_h__
@@ -0,0 +1,48 @@
+#include "DriftSimulation.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+// Runs DriftSimulation at a range of clock offsets, or at one, and reports how far the fill level
+// strayed from its target while the controller caught up with the drift, how much it varies once
+// settled, and how far from the nominal ratio the controller had to go.
+//
+//   DriftSimulator                      a range of offsets, for an hour each, from 48 kHz to 48 kHz
+//                                       and to 44.1 kHz
+//   DriftSimulator ppm [seconds [proxyRate outputRate [bufferFrames]]]
+
+static void Report(Float64 ppm, Float64 seconds, Float64 proxyRate, Float64 outputRate, UInt32 bufferFrames) {
+    DriftSimulation::Result result = DriftSimulation::Simulate(ppm, seconds, proxyRate, outputRate, bufferFrames);
+    printf("%6.0f -> %6.0f Hz %+6.0f ppm  fill target %6.1f  peak error %6.1f  settled error %+6.2f  "
+           "std dev %5.2f  ratio off by %+7.1f ppm, up to %5.0f\n",
+           proxyRate,
+           outputRate,
+           ppm,
+           result.targetFill,
+           result.peakError,
+           result.meanError,
+           result.fillStdDev,
+           result.meanDeviationPPM,
+           result.maxDeviationPPM);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        Float64 ppm = atof(argv[1]);
+        Float64 seconds = (argc > 2) ? atof(argv[2]) : 3600;
+        Float64 proxyRate = (argc > 4) ? atof(argv[3]) : 48000;
+        Float64 outputRate = (argc > 4) ? atof(argv[4]) : 48000;
+        UInt32 bufferFrames = (argc > 5) ? UInt32(atoi(argv[5])) : 512;
+
+        Report(ppm, seconds, proxyRate, outputRate, bufferFrames);
+        return 0;
+    }
+
+    for (Float64 outputRate : {48000.0, 44100.0}) {
+        for (Float64 ppm : {-500.0, -100.0, -20.0, 0.0, 20.0, 100.0, 500.0}) {
+            Report(ppm, 3600, 48000, outputRate, 512);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "DriverFormat.h"
+#include "LoopbackEngine.h"
+
+#include <vector>
+
+#include "TestHarness.h"
+
+// Walks the device through a sequence of sample rate changes the way MacaroniAudioDriver handles
+// them: PerformDeviceConfigurationChange picks the IO buffer length for the new rate, then
+// StartDevice resets the loopback and restarts the zero time stamps with that period.
+
+static LoopbackEngine gEngine;
+
+static const uint32_t kChannels = 2;
+
+// The driver works this out from the mach timebase; any rate will do here
+static const double kHostTicksPerSecond = 1000000000.0;
+
+struct DeviceFormat {
+    double sampleRate = kDefaultSampleRate;
+    uint32_t bufferFrames = BufferFramesForSampleRate(kDefaultSampleRate);
+};
+
+// PerformDeviceConfigurationChange, minus the DriverKit calls
+static bool ChangeSampleRate(DeviceFormat &format, uint64_t rate) {
+    if (!IsSupportedSampleRate(double(rate))) {
+        return false;
+    }
+
+    format.sampleRate = double(rate);
+    format.bufferFrames = BufferFramesForSampleRate(format.sampleRate);
+    return true;
+}
+
+// StartDevice and a few IO cycles at the device's format; returns how many cycles' input didn't
+// match the output written for them
+static uint32_t RunCycles(const DeviceFormat &format, uint32_t cycles) {
+    ZeroTimestampClock clock;
+    uint64_t sampleTime = 0;
+    uint64_t hostTime = 0;
+    double hostTicksPerFrame = kHostTicksPerSecond / format.sampleRate;
+    std::vector<float> output(format.bufferFrames * kChannels);
+    std::vector<float> input(format.bufferFrames * kChannels);
+    uint32_t mismatches = 0;
+
+    gEngine.Reset(kChannels);
+    clock.Start(1000, hostTicksPerFrame, format.bufferFrames);
+
+    for (uint32_t cycle = 0; cycle < cycles; cycle++) {
+        bool updated = clock.Update(clock.NextHostTime(), sampleTime, hostTime);
+
+        if (!updated || sampleTime != uint64_t(cycle + 1) * format.bufferFrames) {
+            mismatches++;
+            continue;
+        }
+
+        // Each cycle is a whole IO buffer, written and then read straight back
+        for (uint32_t sample = 0; sample < output.size(); sample++) {
+            output[sample] = float(sampleTime + sample / kChannels) + (sample % kChannels) * 0.5f;
+        }
+
+        gEngine.WriteOutput(output.data(), format.bufferFrames, sampleTime, format.bufferFrames);
+        gEngine.ReadInput(input.data(), format.bufferFrames, sampleTime, format.bufferFrames);
+        mismatches += (input != output);
+    }
+
+    return mismatches;
+}
+
+static void TestFormatChanges() {
+    struct Change {
+        uint64_t rate;
+        bool accepted;
+        double expectedRate;
+        uint32_t expectedBufferFrames;
+    };
+
+    // Up and down through the rates, including back to one already used and a few the driver
+    // doesn't offer, which have to leave the format as it was
+    const Change changes[] = {
+        {48000, true, 48000, 512},
+        {44100, true, 44100, 512},
+        {96000, true, 96000, 1024},
+        {22050, false, 96000, 1024},
+        {192000, true, 192000, 2048},
+        {88200, true, 88200, 1024},
+        {47999, false, 88200, 1024},
+        {48000, true, 48000, 512},
+        {192000, true, 192000, 2048},
+        {0, false, 192000, 2048},
+        {44100, true, 44100, 512},
+    };
+
+    DeviceFormat format;
+    gEngine.SetGain(1.0f);
+    CHECK_EQUAL(format.bufferFrames, 512u);
+    CHECK_EQUAL(RunCycles(format, 8), 0u);
+
+    for (const Change &change : changes) {
+        CHECK_EQUAL(ChangeSampleRate(format, change.rate), change.accepted);
+        CHECK(format.sampleRate == change.expectedRate);
+        CHECK_EQUAL(format.bufferFrames, change.expectedBufferFrames);
+
+        // The zero time stamp period is never shorter than at 48 kHz
+        CHECK(format.bufferFrames / format.sampleRate >= 512 / 48000.0);
+        CHECK_EQUAL(RunCycles(format, 8), 0u);
+    }
+}
+
+static void TestSupportedSampleRates() {
+    for (double rate : kSupportedSampleRates) {
+        CHECK(IsSupportedSampleRate(rate));
+        CHECK(BufferFramesForSampleRate(rate) <= LoopbackEngine::kHistoryFrames / 2);
+    }
+
+    CHECK(IsSupportedSampleRate(kDefaultSampleRate));
+    CHECK(!IsSupportedSampleRate(48000.5));
+}
+
+int main() {
+    TestSupportedSampleRates();
+    TestFormatChanges();
+    return TestResult();
+}
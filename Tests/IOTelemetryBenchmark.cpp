@@ -0,0 +1,92 @@
+#include "IOTelemetry.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "TestHarness.h"
+
+// What the telemetry costs the IO paths: each of the calls they make, all of an output cycle's
+// telemetry including the two clock reads that time it, and the same again while other threads are
+// recording too, the way the input side and any additional outputs do. The cost is also given as a
+// share of the shortest cycle the proxy device runs, 32 frames at 48 kHz.
+
+static const double kShortestCycleSeconds = 32 / 48000.0;
+
+static void Report(const char *name, double seconds) {
+    printf("%-40s %6.1f ns  %6.4f%% of a 32 frame cycle\n", name, seconds * 1e9, seconds / kShortestCycleSeconds * 100);
+}
+
+// The fill levels and durations move around from one cycle to the next, so different buckets are hit
+struct CycleValues {
+    UInt64 cycle = 0;
+
+    SInt64 Fill() { return 1024 + (cycle * 37) % 512; }
+    UInt64 DurationNanos() { return 20000 + (cycle * 7919) % 30000; }
+    void Next() { cycle++; }
+};
+
+// Stands in for outputDeviceIOProc's mach_absolute_time and AudioConvertHostTimeToNanos
+static UInt64 NowNanos() {
+    return UInt64(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count());
+}
+
+static void RecordOutputCycle(IOTelemetry &telemetry, CycleValues &values) {
+    telemetry.RecordOutputCycle(values.Fill(), false, false, 0, 0, values.DurationNanos());
+    values.Next();
+}
+
+static void RecordWholeOutputCycle(IOTelemetry &telemetry, CycleValues &values) {
+    UInt64 cycleStart = NowNanos();
+    telemetry.SetDriftRatio(1.0 + (values.cycle % 100) * 1e-6);
+    telemetry.RecordOutputCycle(values.Fill(), false, false, 0, 0, NowNanos() - cycleStart);
+    values.Next();
+}
+
+// Times body on this thread while busy records on another, as fast as it can
+template <typename Body, typename Busy>
+static double TimeAlongside(Body body, Busy busy) {
+    std::atomic<bool> done(false);
+    std::thread other([&] {
+        while (!done.load(std::memory_order_relaxed)) {
+            busy();
+        }
+    });
+
+    double seconds = TestHarness::TimePerCall(body);
+    done.store(true);
+    other.join();
+    return seconds;
+}
+
+int main() {
+    IOTelemetry telemetry;
+    CycleValues values;
+    CycleValues otherValues;
+
+    Report("RecordInputCycle", TestHarness::TimePerCall([&] { telemetry.RecordInputCycle(false); }));
+    Report("RecordLoopbackCycle", TestHarness::TimePerCall([&] { telemetry.RecordLoopbackCycle(false); }));
+    Report("SetDriftRatio", TestHarness::TimePerCall([&] { telemetry.SetDriftRatio(1.0001); }));
+    Report("RecordOutputCycle", TestHarness::TimePerCall([&] { RecordOutputCycle(telemetry, values); }));
+    Report("whole output cycle, with its timing",
+           TestHarness::TimePerCall([&] { RecordWholeOutputCycle(telemetry, values); }));
+
+    // The input side's counters are on cache lines of their own, so it shouldn't slow the output
+    // side down. A second output shares the output side's counters. With only one core the threads
+    // would just take turns, which says nothing about either.
+    if (std::thread::hardware_concurrency() < 2) {
+        printf("only one core, so not timing with other threads recording\n");
+        return 0;
+    }
+
+    Report("whole output cycle, input recording",
+           TimeAlongside([&] { RecordWholeOutputCycle(telemetry, values); },
+                         [&] { telemetry.RecordInputCycle(false); }));
+    Report("whole output cycle, another output",
+           TimeAlongside([&] { RecordWholeOutputCycle(telemetry, values); },
+                         [&] { RecordOutputCycle(telemetry, otherValues); }));
+
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include "AdaptiveResampler.h"
+#include "AudioRingBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "TestHarness.h"
+
+// Measures the proxy's end-to-end latency and checks it against what kAudioDevicePropertyLatency
+// reports. Clicks are stored in the ring buffer at known sample times of the proxy device, then
+// played out through the same steps outputDeviceIOProc takes: the read position it resyncs to, the
+// drift controller, and the resampler fed from the ring buffer's read spans. The latency of a click
+// is how long after the proxy's clock passes its sample time the output device presents it,
+// counting the output device's buffer, safety offset and latency the way the HAL does.
+
+struct Setup {
+    Float64 proxyRate;
+    Float64 outputRate;
+    UInt32 bufferFrames;
+    UInt32 safetyOffset;
+    UInt32 deviceLatency;
+    UInt32 cushionFrames;
+};
+
+static const UInt32 kChannels = 2;
+static const UInt32 kRingFrames = 88200;
+// Where the proxy's sample time is when the output device starts, so that everything's positive
+static const Float64 kStartFrame = 100000;
+static const Float64 kSeconds = 20;
+// The clicks start once the drift controller has been running for a while, and are far enough
+// apart that their filter responses don't overlap
+static const Float64 kFirstClickSeconds = 2;
+static const UInt32 kClickSpacing = 9973;
+// How many frames either side of a click's peak it takes its filter response to drop off
+static const UInt32 kPeakWidth = 4;
+
+// What calculateLatencyNoLock reports for the setup
+static UInt32 ReportedLatency(const Setup &setup, const AdaptiveResampler &resampler) {
+    Float64 outputDeviceFrames = 2.0 * (setup.bufferFrames + setup.safetyOffset) + setup.deviceLatency;
+    return UInt32(ceil(outputDeviceFrames * resampler.NominalRatio())) + resampler.Latency() + setup.cushionFrames;
+}
+
+static bool IsClick(SInt64 frame) {
+    return frame >= kStartFrame + kFirstClickSeconds * 48000 && frame % kClickSpacing == 0;
+}
+
+// Returns the measured latency of every click, in the proxy's frames
+static std::vector<Float64> MeasureLatencies(const Setup &setup, UInt32 &outReportedLatency) {
+    const Float64 nominalRatio = setup.proxyRate / setup.outputRate;
+    AudioRingBuffer ring(kChannels * sizeof(Float32), kRingFrames, AudioRingBuffer::AllocationMode::mirrored);
+    AdaptiveResampler resampler(kChannels, setup.bufferFrames, nominalRatio * 1.01);
+    DriftController controller;
+    resampler.SetNominalRatio(nominalRatio);
+    outReportedLatency = ReportedLatency(setup, resampler);
+
+    std::vector<Float32> block(512 * kChannels);
+    std::vector<Float32> output(setup.bufferFrames * kChannels);
+    std::vector<Float32> heard;
+    std::vector<SInt64> clicks;
+    SInt64 storedFrame = SInt64(kStartFrame) - kRingFrames / 2;
+    Float64 readFrame = 0;
+    UInt64 cycles = UInt64(kSeconds * setup.outputRate / setup.bufferFrames);
+
+    for (UInt64 cycle = 0; cycle < cycles; cycle++) {
+        Float64 inputNowFrame = kStartFrame + cycle * setup.bufferFrames * nominalRatio;
+
+        // The HAL has the proxy's clients write their output a little ahead of its clock
+        while (storedFrame < inputNowFrame + 1024) {
+            for (UInt32 frame = 0; frame < 512; frame++) {
+                bool click = IsClick(storedFrame + frame);
+                block[frame * kChannels] = block[frame * kChannels + 1] = click ? 1.0f : 0.0f;
+
+                if (click) {
+                    clicks.push_back(storedFrame + frame);
+                }
+            }
+
+            ring.Store((const Byte *)block.data(), 512, storedFrame);
+            storedFrame += 512;
+        }
+
+        if (cycle == 0) {
+            readFrame = floor(inputNowFrame - (setup.bufferFrames + setup.safetyOffset) * nominalRatio -
+                              resampler.Latency() - setup.cushionFrames);
+            resampler.Reset();
+            controller.Reset(inputNowFrame - readFrame - resampler.Latency());
+        }
+
+        Float64 ratio = nominalRatio * controller.Update(inputNowFrame - readFrame,
+                                                         UInt32(setup.bufferFrames * nominalRatio));
+        UInt32 inputFrames = resampler.InputFramesNeeded(setup.bufferFrames, ratio);
+        AudioRingBuffer::ReadSpans spans;
+
+        ring.BeginRead(SInt64(readFrame), inputFrames, spans);
+        resampler.PushSilence(spans.leadingZeroFrames);
+
+        for (int span = 0; span < 2 && spans.frames[span] > 0; span++) {
+            resampler.PushInput((const Float32 *)spans.data[span], spans.frames[span]);
+        }
+
+        resampler.PushSilence(spans.trailingZeroFrames);
+        ring.EndRead(spans);
+        readFrame += inputFrames;
+
+        resampler.Process(output.data(), setup.bufferFrames, ratio);
+
+        for (UInt32 frame = 0; frame < setup.bufferFrames; frame++) {
+            heard.push_back(output[frame * kChannels]);
+        }
+    }
+
+    // Each click comes out as a filter response peaking where it was, give or take a fraction of a
+    // frame, which a parabola through the peak and its neighbours finds. Downsampling spreads it
+    // out and brings the peak down, to as little as a third when the click falls between frames.
+    std::vector<Float64> latencies;
+    size_t click = 0;
+
+    for (size_t frame = kPeakWidth; frame + kPeakWidth < heard.size() && click < clicks.size(); frame++) {
+        if (heard[frame] < 0.15f || *std::max_element(&heard[frame - kPeakWidth], &heard[frame + kPeakWidth + 1]) !=
+                                        heard[frame]) {
+            continue;
+        }
+
+        Float64 before = heard[frame - 1];
+        Float64 peak = heard[frame];
+        Float64 after = heard[frame + 1];
+        Float64 offset = 0.5 * (before - after) / (before - 2 * peak + after);
+
+        // The output device presents each cycle a buffer and safety offset after the IO proc is
+        // called for it, and its own latency after that
+        Float64 presentedFrame = frame + offset + setup.bufferFrames + setup.safetyOffset + setup.deviceLatency;
+        Float64 presentedProxyFrame = kStartFrame + presentedFrame * nominalRatio;
+        latencies.push_back(presentedProxyFrame - clicks[click]);
+        click++;
+    }
+
+    return latencies;
+}
+
+static void TestLatency(const Setup &setup) {
+    UInt32 reported = 0;
+    std::vector<Float64> latencies = MeasureLatencies(setup, reported);
+    Float64 minLatency = INFINITY;
+    Float64 maxLatency = -INFINITY;
+
+    for (Float64 latency : latencies) {
+        minLatency = std::min(minLatency, latency);
+        maxLatency = std::max(maxLatency, latency);
+    }
+
+    printf("%6.0f -> %6.0f Hz  buffer %4u  safety %3u  latency %3u  cushion %4u:  reported %5u  "
+           "measured %7.1f to %7.1f\n",
+           setup.proxyRate,
+           setup.outputRate,
+           setup.bufferFrames,
+           setup.safetyOffset,
+           setup.deviceLatency,
+           setup.cushionFrames,
+           reported,
+           minLatency,
+           maxLatency);
+
+    // The reported latency is rounded up to a whole frame, so it should never be short. The drift
+    // controller nudges the output around by a fraction of a frame, and finding the peaks of the
+    // clicks is only good to about one of the output device's frames, which can be several of ours.
+    const Float64 outputFrame = std::max(setup.proxyRate / setup.outputRate, 1.0);
+    CHECK(latencies.size() > 50);
+    CHECK(minLatency > reported - 1.0 - 2.0 * outputFrame);
+    CHECK(maxLatency < reported + 0.5);
+}
+
+int main() {
+    // Each of the latency modes' cushions, at a few sample rate pairs and output device settings
+    const Setup setups[] = {
+        {48000, 48000, 512, 0, 0, 0},
+        {48000, 48000, 512, 24, 40, 512},
+        {48000, 48000, 128, 16, 32, 2048},
+        {44100, 48000, 512, 24, 40, 512},
+        {48000, 44100, 256, 8, 12, 512},
+        {48000, 96000, 1024, 32, 64, 0},
+        {96000, 44100, 512, 24, 40, 2048},
+    };
+
+    for (const Setup &setup : setups) {
+        TestLatency(setup);
+    }
+
+    return TestResult();
+}
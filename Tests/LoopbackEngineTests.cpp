@@ -0,0 +1,217 @@
+#include "LoopbackEngine.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "TestHarness.h"
+
+// The engine holds its whole history inline, which is too much for the stack
+static LoopbackEngine gEngine;
+
+static const uint32_t kChannels = 2;
+static const uint32_t kIOBufferFrames = 512;
+
+static float SampleValue(uint64_t sampleTime, uint32_t channel) {
+    return float(sampleTime % 1000003) * (channel == 0 ? 1.0f : -1.0f);
+}
+
+// Fills frames of the output IO buffer the way the HAL does, at their sample times' ring positions
+static void WriteCycle(std::vector<float> &ioBuffer, uint64_t sampleTime, uint32_t frames) {
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        uint32_t offset = uint32_t((sampleTime + frame) % kIOBufferFrames);
+
+        for (uint32_t channel = 0; channel < kChannels; channel++) {
+            ioBuffer[offset * kChannels + channel] = SampleValue(sampleTime + frame, channel);
+        }
+    }
+
+    gEngine.WriteOutput(ioBuffer.data(), kIOBufferFrames, sampleTime, frames);
+}
+
+// Reads a cycle of the input and returns how many of its frames weren't what was written for them
+// times gain, or silence where silent says so
+static uint32_t ReadCycleMismatches(uint64_t sampleTime, uint32_t frames, float gain, bool (*silent)(uint64_t)) {
+    std::vector<float> ioBuffer(kIOBufferFrames * kChannels, 12345.0f);
+    gEngine.ReadInput(ioBuffer.data(), kIOBufferFrames, sampleTime, frames);
+    uint32_t mismatches = 0;
+
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        uint32_t offset = uint32_t((sampleTime + frame) % kIOBufferFrames);
+
+        for (uint32_t channel = 0; channel < kChannels; channel++) {
+            float expected = silent(sampleTime + frame) ? 0.0f : SampleValue(sampleTime + frame, channel) * gain;
+
+            if (ioBuffer[offset * kChannels + channel] != expected) {
+                mismatches++;
+                break;
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+static const uint64_t kStartTime = 100000;
+static const uint32_t kLatency = 1024;
+
+static bool BeforeFirstWrite(uint64_t sampleTime) {
+    return sampleTime < kStartTime + kLatency;
+}
+
+static bool NeverSilent(uint64_t) {
+    return false;
+}
+
+static void TestLoopback() {
+    gEngine.SetGain(1.0f);
+    gEngine.Reset(kChannels);
+    std::vector<float> ioBuffer(kIOBufferFrames * kChannels);
+
+    // The output is written kLatency frames ahead of where the input is read, in cycles that don't
+    // divide the IO buffer evenly so they wrap around its end at different points
+    for (uint32_t cycle = 0; cycle < 200; cycle++) {
+        uint64_t readTime = kStartTime + cycle * 96;
+        WriteCycle(ioBuffer, readTime + kLatency, 96);
+        CHECK_EQUAL(ReadCycleMismatches(readTime, 96, 1.0f, BeforeFirstWrite), 0u);
+    }
+}
+
+static void TestGaps() {
+    gEngine.SetGain(1.0f);
+    gEngine.Reset(kChannels);
+    std::vector<float> ioBuffer(kIOBufferFrames * kChannels);
+
+    WriteCycle(ioBuffer, kStartTime, 128);
+    WriteCycle(ioBuffer, kStartTime + 256, 128);
+    CHECK_EQUAL(ReadCycleMismatches(kStartTime, 128, 1.0f, NeverSilent), 0u);
+    CHECK_EQUAL(ReadCycleMismatches(kStartTime + 256, 128, 1.0f, NeverSilent), 0u);
+
+    // The frames the output skipped are silence, and so is anything not written yet
+    CHECK_EQUAL(ReadCycleMismatches(kStartTime + 128, 128, 1.0f, [](uint64_t) { return true; }), 0u);
+    CHECK_EQUAL(ReadCycleMismatches(kStartTime + 384, 128, 1.0f, [](uint64_t) { return true; }), 0u);
+
+    // Once more than the history has been written, the oldest frames are gone
+    for (uint64_t time = kStartTime + 384; time < kStartTime + 384 + LoopbackEngine::kHistoryFrames; time += 256) {
+        WriteCycle(ioBuffer, time, 256);
+    }
+
+    CHECK_EQUAL(ReadCycleMismatches(kStartTime, 128, 1.0f, [](uint64_t) { return true; }), 0u);
+    CHECK_EQUAL(ReadCycleMismatches(kStartTime + 384 + 256, 128, 1.0f, NeverSilent), 0u);
+
+    // Writing from before the history, like after the HAL restarts its clock, starts it over
+    WriteCycle(ioBuffer, 5000, 128);
+    CHECK_EQUAL(ReadCycleMismatches(5000, 128, 1.0f, NeverSilent), 0u);
+    CHECK_EQUAL(ReadCycleMismatches(kStartTime + 384 + 256, 128, 1.0f, [](uint64_t) { return true; }), 0u);
+}
+
+static void TestGain() {
+    gEngine.SetGain(1.0f);
+    gEngine.Reset(kChannels);
+    std::vector<float> ioBuffer(kIOBufferFrames * kChannels);
+
+    for (uint64_t time = kStartTime; time < kStartTime + 1024; time += 128) {
+        WriteCycle(ioBuffer, time, 128);
+    }
+
+    CHECK_EQUAL(ReadCycleMismatches(kStartTime, 128, 1.0f, NeverSilent), 0u);
+
+    // A new gain is ramped to over the next cycle, with the same arithmetic as the engine
+    gEngine.SetGain(0.5f);
+    std::vector<float> input(kIOBufferFrames * kChannels);
+    gEngine.ReadInput(input.data(), kIOBufferFrames, kStartTime + 128, 128);
+    float step = (0.5f - 1.0f) / 128;
+    uint32_t mismatches = 0;
+
+    for (uint32_t frame = 0; frame < 128; frame++) {
+        uint64_t time = kStartTime + 128 + frame;
+        float gain = 1.0f + frame * step;
+        uint32_t offset = uint32_t(time % kIOBufferFrames);
+        mismatches += (input[offset * kChannels] != SampleValue(time, 0) * gain);
+    }
+
+    CHECK_EQUAL(mismatches, 0u);
+
+    // And after that it holds
+    CHECK_EQUAL(ReadCycleMismatches(kStartTime + 256, 128, 0.5f, NeverSilent), 0u);
+
+    // Muting is a gain of 0
+    gEngine.SetGain(0.0f);
+    gEngine.ReadInput(input.data(), kIOBufferFrames, kStartTime + 384, 128);
+    CHECK_EQUAL(ReadCycleMismatches(kStartTime + 512, 128, 0.0f, NeverSilent), 0u);
+
+    CHECK(LoopbackEngine::GainForDecibels(0.0f) == 1.0f);
+    CHECK(LoopbackEngine::GainForDecibels(-20.0f) > 0.0999f && LoopbackEngine::GainForDecibels(-20.0f) < 0.1001f);
+}
+
+static void TestScaleSamples() {
+    std::vector<float> in(70);
+    std::vector<float> out(70);
+
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = float(i) * 0.37f - 11.0f;
+    }
+
+    // Every count and an unaligned start, against a plain multiply
+    for (uint32_t count = 0; count < 64; count++) {
+        std::fill(out.begin(), out.end(), 99.0f);
+        ScaleSamples(in.data() + 1, out.data() + 1, count, 0.7f);
+        uint32_t mismatches = 0;
+
+        for (uint32_t i = 0; i < count; i++) {
+            float expected = in[1 + i] * 0.7f;
+            mismatches += (memcmp(&out[1 + i], &expected, sizeof(float)) != 0);
+        }
+
+        CHECK_EQUAL(mismatches, 0u);
+        CHECK(out[0] == 99.0f && out[1 + count] == 99.0f);
+    }
+}
+
+static void TestZeroTimestampClock() {
+    ZeroTimestampClock clock;
+    uint64_t sampleTime = 0;
+    uint64_t hostTime = 0;
+
+    // 2.5 host ticks per frame, so a period of 512 frames is 1280 ticks
+    clock.Start(1000, 2.5, 512);
+    CHECK_EQUAL(clock.NextHostTime(), 2280ull);
+    CHECK(!clock.Update(2279, sampleTime, hostTime));
+    CHECK(clock.Update(2280, sampleTime, hostTime));
+    CHECK_EQUAL(sampleTime, 512ull);
+    CHECK_EQUAL(hostTime, 2280ull);
+    CHECK(!clock.Update(2281, sampleTime, hostTime));
+    CHECK_EQUAL(clock.NextHostTime(), 3560ull);
+
+    // A late timer skips to the latest time stamp that's due
+    CHECK(clock.Update(1000 + 1280 * 4 + 5, sampleTime, hostTime));
+    CHECK_EQUAL(sampleTime, 2048ull);
+    CHECK_EQUAL(hostTime, 1000ull + 1280 * 4);
+    CHECK_EQUAL(clock.NextHostTime(), 1000ull + 1280 * 5);
+
+    // Time stamps are worked out from the anchor every time, so a rate that isn't a whole number of
+    // ticks per frame doesn't drift
+    clock.Start(0, 41.666666666666664, 512);
+
+    for (uint64_t period = 1; period <= 100000; period++) {
+        clock.Update(clock.NextHostTime(), sampleTime, hostTime);
+    }
+
+    CHECK_EQUAL(sampleTime, 512ull * 100000);
+    CHECK_EQUAL(hostTime, uint64_t(double(512ull * 100000) * 41.666666666666664));
+
+    // Starting again goes back to the new anchor
+    clock.Start(50, 1.0, 256);
+    CHECK(clock.Update(306, sampleTime, hostTime));
+    CHECK_EQUAL(sampleTime, 256ull);
+    CHECK_EQUAL(hostTime, 306ull);
+}
+
+int main() {
+    TestLoopback();
+    TestGaps();
+    TestGain();
+    TestScaleSamples();
+    TestZeroTimestampClock();
+    return TestResult();
+}
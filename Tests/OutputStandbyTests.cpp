@@ -0,0 +1,126 @@
+#include "OutputStandby.h"
+
+#include <vector>
+
+#include "TestHarness.h"
+
+// Plays sounds through a simulated output device the way ProxyAudioDevice's standby handles them:
+// after each sound the device goes into standby, a sound that comes while it's in standby resumes
+// it straight away, and once standby runs out it's stopped, so the next sound has to start it
+// again. For a few patterns of sounds, this counts those cold starts and how long the device sat
+// in standby, and checks where the standby period ends up.
+
+struct Outcome {
+    UInt32 coldStarts;
+    UInt32 warmStarts;
+    Float64 standbySeconds;
+    // The standby period after the last sound
+    Float64 finalPeriod;
+};
+
+// Each sound is gaps[i] seconds after the one before, and too short to matter
+static Outcome Play(const std::vector<Float64> &gaps) {
+    Outcome outcome = {1, 0, 0, OutputStandby::kMinSeconds};
+    Float64 &period = outcome.finalPeriod;
+
+    for (Float64 gap : gaps) {
+        if (gap < period) {
+            outcome.warmStarts++;
+            outcome.standbySeconds += gap;
+        } else {
+            outcome.coldStarts++;
+            outcome.standbySeconds += period;
+            period = OutputStandby::NextStandbySeconds(period, gap - period);
+        }
+    }
+
+    return outcome;
+}
+
+static std::vector<Float64> Repeat(Float64 gap, UInt32 count) {
+    return std::vector<Float64>(count, gap);
+}
+
+static Outcome Report(const char *name, const std::vector<Float64> &gaps) {
+    Outcome outcome = Play(gaps);
+    Float64 total = 0;
+
+    for (Float64 gap : gaps) {
+        total += gap;
+    }
+
+    printf("%-36s  %3u cold starts, %3u warm, in standby %4.1f%% of the time, standby now %3.0f s\n",
+           name,
+           outcome.coldStarts,
+           outcome.warmStarts,
+           100 * outcome.standbySeconds / total,
+           outcome.finalPeriod);
+    return outcome;
+}
+
+static void TestPatterns() {
+    // Sounds closer together than the shortest standby never stop the device
+    Outcome frequent = Report("every 20 s", Repeat(20, 100));
+    CHECK_EQUAL(frequent.coldStarts, 1u);
+    CHECK_EQUAL(frequent.finalPeriod, OutputStandby::kMinSeconds);
+
+    // A little further apart, the first gap stops the device, and the doubled standby keeps it
+    // running from then on
+    Outcome close = Report("every 45 s", Repeat(45, 100));
+    CHECK_EQUAL(close.coldStarts, 2u);
+    CHECK_EQUAL(close.finalPeriod, 2 * OutputStandby::kMinSeconds);
+
+    // Sounds far apart aren't worth keeping the device running for, so it stays at the minimum
+    Outcome sparse = Report("every 10 minutes", Repeat(600, 20));
+    CHECK_EQUAL(sparse.coldStarts, 21u);
+    CHECK_EQUAL(sparse.finalPeriod, OutputStandby::kMinSeconds);
+    CHECK(sparse.standbySeconds <= 20 * OutputStandby::kMinSeconds);
+
+    // Gaps that keep growing just faster than the period double it each time, up to the maximum
+    Outcome growing = Report("gaps of 50, 110, 230, 470, 900, 300 s", {50, 110, 230, 470, 900, 300});
+    CHECK_EQUAL(growing.finalPeriod, OutputStandby::kMaxSeconds);
+    CHECK_EQUAL(growing.coldStarts, 6u);
+    CHECK_EQUAL(growing.warmStarts, 1u);
+
+    // And once the sounds stop coming that often, it comes back down
+    std::vector<Float64> thenQuiet = {50, 110, 230, 470};
+    thenQuiet.insert(thenQuiet.end(), 4, 3600);
+    Outcome quiet = Report("the same, then an hour apart", thenQuiet);
+    CHECK_EQUAL(quiet.finalPeriod, OutputStandby::kMinSeconds);
+}
+
+static void TestNextStandbySeconds() {
+    const Float64 min = OutputStandby::kMinSeconds;
+    const Float64 max = OutputStandby::kMaxSeconds;
+
+    CHECK_EQUAL(OutputStandby::NextStandbySeconds(min, 10), 2 * min);
+    CHECK_EQUAL(OutputStandby::NextStandbySeconds(min, min), min);
+    CHECK_EQUAL(OutputStandby::NextStandbySeconds(4 * min, 10), 8 * min);
+    CHECK_EQUAL(OutputStandby::NextStandbySeconds(4 * min, 4 * min), 2 * min);
+    CHECK_EQUAL(OutputStandby::NextStandbySeconds(max, 0), max);
+    CHECK_EQUAL(OutputStandby::NextStandbySeconds(min, 3600), min);
+}
+
+static void TestPreRoll() {
+    const SInt64 preRoll = OutputStandby::kPreRollFrames;
+
+    // As far back as the pre-roll goes, when the ring buffer has it and none of it has been played
+    CHECK_EQUAL(OutputStandby::PreRollFrame(100000, 0, 0), 100000 - preRoll);
+
+    // No further back than the ring buffer still holds
+    CHECK_EQUAL(OutputStandby::PreRollFrame(100000, 99000, 0), 99000);
+
+    // Or than what this device has already played
+    CHECK_EQUAL(OutputStandby::PreRollFrame(100000, 0, 98000), 98000);
+
+    // And never forward from where it would have started
+    CHECK_EQUAL(OutputStandby::PreRollFrame(100000, 0, 120000), 100000);
+    CHECK_EQUAL(OutputStandby::PreRollFrame(100000, 110000, 0), 100000);
+}
+
+int main() {
+    TestPatterns();
+    TestNextStandbySeconds();
+    TestPreRoll();
+    return TestResult();
+}
@@ -0,0 +1,329 @@
+#include "ProxyAudioDevice.h"
+#include "PropertyTable.h"
+
+#include <vector>
+
+#include "TestHarness.h"
+
+// Checks every entry of the proxy's property tables against the property methods, through the
+// driver interface the HAL calls: the object has the property in the scopes the entry says (apart
+// from the controls, which are kept hidden by having no properties at all), it's settable if the
+// entry says so, GetPropertyDataSize gives the entry's size, GetPropertyData has a case for it that
+// writes exactly that many bytes, and SetPropertyData has a case for each settable one, which takes
+// back the value just read. Properties with a variable size are checked against what
+// GetPropertyDataSize says instead. The configuration properties are then checked for what they
+// accept and turn away.
+//
+// The driver is initialized with a host that keeps its storage in memory, so nothing the test sets
+// is saved, but it does look for an output device like it would in coreaudiod.
+
+static CFMutableDictionaryRef gStorage;
+
+static OSStatus HostPropertiesChanged(AudioServerPlugInHostRef,
+                                      AudioObjectID,
+                                      UInt32,
+                                      const AudioObjectPropertyAddress *) {
+    return 0;
+}
+
+static OSStatus HostCopyFromStorage(AudioServerPlugInHostRef, CFStringRef inKey, CFPropertyListRef *outData) {
+    CFPropertyListRef data = CFDictionaryGetValue(gStorage, inKey);
+    *outData = data ? CFRetain(data) : NULL;
+    return 0;
+}
+
+static OSStatus HostWriteToStorage(AudioServerPlugInHostRef, CFStringRef inKey, CFPropertyListRef inData) {
+    CFDictionarySetValue(gStorage, inKey, inData);
+    return 0;
+}
+
+static OSStatus HostDeleteFromStorage(AudioServerPlugInHostRef, CFStringRef inKey) {
+    CFDictionaryRemoveValue(gStorage, inKey);
+    return 0;
+}
+
+// Configuration changes are never performed, which leaves the device's state as it is
+static OSStatus HostRequestDeviceConfigurationChange(AudioServerPlugInHostRef, AudioObjectID, UInt64, void *) {
+    return 0;
+}
+
+static const AudioServerPlugInHostInterface gHost = {HostPropertiesChanged,
+                                                     HostCopyFromStorage,
+                                                     HostWriteToStorage,
+                                                     HostDeleteFromStorage,
+                                                     HostRequestDeviceConfigurationChange};
+
+static AudioServerPlugInDriverRef gDriver;
+
+// Room for any property's data, aligned for any of its types
+static std::vector<UInt64> DataBuffer(UInt32 size) {
+    return std::vector<UInt64>(size / sizeof(UInt64) + 1, 0);
+}
+
+// HasControlProperty hides the controls from the HAL by saying they have no properties
+static bool IsHiddenControl(AudioObjectID objectID) {
+    AudioObjectPropertyAddress address = {
+        kAudioObjectPropertyBaseClass, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster};
+    AudioClassID baseClass = 0;
+    UInt32 size = sizeof(baseClass);
+    (*gDriver)->GetPropertyData(gDriver, objectID, 0, &address, 0, NULL, size, &size, &baseClass);
+    return baseClass == kAudioControlClassID || baseClass == kAudioLevelControlClassID ||
+           baseClass == kAudioBooleanControlClassID || baseClass == kAudioSelectorControlClassID;
+}
+
+static void CheckProperty(AudioObjectID objectID, const PropertyInfo &property) {
+    AudioObjectPropertyAddress address = {
+        property.selector, kAudioObjectPropertyScopeOutput, kAudioObjectPropertyElementMaster};
+    AudioObjectPropertyAddress globalAddress = {
+        property.selector, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster};
+
+    // The translation properties take a UID in the qualifier; nothing else looks at it
+    CFStringRef qualifier = CFSTR("");
+    const UInt32 qualifierSize = sizeof(CFStringRef);
+    Boolean settable = !property.settable;
+    UInt32 size = 0;
+    UInt32 writtenSize = 0;
+
+    if (IsHiddenControl(objectID)) {
+        CHECK(!(*gDriver)->HasProperty(gDriver, objectID, 0, &address));
+        CHECK(!(*gDriver)->HasProperty(gDriver, objectID, 0, &globalAddress));
+    } else {
+        CHECK((*gDriver)->HasProperty(gDriver, objectID, 0, &address));
+        CHECK((*gDriver)->HasProperty(gDriver, objectID, 0, &globalAddress) == !property.scoped);
+    }
+
+    CHECK_EQUAL((*gDriver)->IsPropertySettable(gDriver, objectID, 0, &address, &settable), 0);
+    CHECK(settable == property.settable);
+    CHECK_EQUAL(
+        (*gDriver)->GetPropertyDataSize(gDriver, objectID, 0, &address, qualifierSize, &qualifier, &size), 0);
+
+    if (property.dataSize != PropertyInfo::kVariableSize) {
+        CHECK_EQUAL(size, property.dataSize);
+    }
+
+    // The conversion properties convert what's in the buffer in place, so it starts out as zeros
+    std::vector<UInt64> data = DataBuffer(size);
+    OSStatus status = (*gDriver)->GetPropertyData(
+        gDriver, objectID, 0, &address, qualifierSize, &qualifier, size, &writtenSize, data.data());
+
+    if (status != 0 || writtenSize != size) {
+        fprintf(stderr,
+                "object %u property '%c%c%c%c': get returned %d and wrote %u bytes of %u\n",
+                objectID,
+                char(property.selector >> 24),
+                char(property.selector >> 16),
+                char(property.selector >> 8),
+                char(property.selector),
+                int(status),
+                writtenSize,
+                size);
+    }
+
+    CHECK_EQUAL(status, 0);
+    CHECK_EQUAL(writtenSize, size);
+
+    // Setting a property to the value it has is a round trip through its case in SetPropertyData
+    status = (*gDriver)->SetPropertyData(gDriver, objectID, 0, &address, 0, NULL, writtenSize, data.data());
+
+    if (property.settable) {
+        CHECK_EQUAL(status, 0);
+    } else {
+        CHECK(status != 0);
+    }
+
+    // The CF objects some of the properties return are left to leak; this doesn't run for long
+}
+
+static void CheckObject(AudioObjectID objectID) {
+    UInt32 count = 0;
+    const PropertyInfo *properties = ProxyAudioDevice::propertyList(objectID, count);
+    CHECK(properties != NULL && count > 0);
+
+    for (UInt32 index = 0; index < count; index++) {
+        CheckProperty(objectID, properties[index]);
+    }
+
+    // And what isn't in the table isn't a property of the object
+    AudioObjectPropertyAddress address = {'nope', kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster};
+    UInt32 size = 0;
+    CHECK(!(*gDriver)->HasProperty(gDriver, objectID, 0, &address));
+    CHECK((*gDriver)->GetPropertyDataSize(gDriver, objectID, 0, &address, 0, NULL, &size) != 0);
+}
+
+// The objects the given object says it owns
+static std::vector<AudioObjectID> OwnedObjects(AudioObjectID objectID) {
+    AudioObjectPropertyAddress address = {
+        kAudioObjectPropertyOwnedObjects, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster};
+    UInt32 size = 0;
+    (*gDriver)->GetPropertyDataSize(gDriver, objectID, 0, &address, 0, NULL, &size);
+    std::vector<AudioObjectID> objects(size / sizeof(AudioObjectID));
+    (*gDriver)->GetPropertyData(gDriver, objectID, 0, &address, 0, NULL, size, &size, objects.data());
+    objects.resize(size / sizeof(AudioObjectID));
+    return objects;
+}
+
+// The translation properties find the box and the device by their UIDs, and turn away a qualifier
+// that isn't a CFStringRef
+static void CheckTranslateUID(AudioObjectPropertySelector selector, CFStringRef uid, AudioObjectID expected) {
+    AudioObjectPropertyAddress address = {selector, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster};
+    AudioObjectID objectID = kAudioObjectUnknown;
+    UInt32 size = 0;
+    auto translate = [&](UInt32 qualifierSize, const void *qualifier) {
+        objectID = kAudioObjectUnknown;
+        return (*gDriver)->GetPropertyData(
+            gDriver, kObjectID_PlugIn, 0, &address, qualifierSize, qualifier, sizeof(objectID), &size, &objectID);
+    };
+
+    CHECK_EQUAL(translate(sizeof(uid), &uid), 0);
+    CHECK_EQUAL(size, sizeof(AudioObjectID));
+    CHECK_EQUAL(objectID, expected);
+
+    CFStringRef unknown = CFSTR("not one of ours");
+    CHECK_EQUAL(translate(sizeof(unknown), &unknown), 0);
+    CHECK_EQUAL(objectID, kAudioObjectUnknown);
+
+    UInt16 shortQualifier = 0;
+    CHECK_EQUAL(translate(sizeof(shortQualifier), &shortQualifier), kAudioHardwareBadPropertySizeError);
+}
+
+static CFPropertyListRef CopyDeviceProperty(AudioObjectPropertySelector selector) {
+    AudioObjectPropertyAddress address = {selector, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster};
+    CFPropertyListRef value = NULL;
+    UInt32 size = sizeof(value);
+    CHECK_EQUAL((*gDriver)->GetPropertyData(gDriver, kObjectID_Device, 0, &address, 0, NULL, size, &size, &value), 0);
+    return value;
+}
+
+static OSStatus SetDeviceProperty(AudioObjectPropertySelector selector, CFPropertyListRef value) {
+    AudioObjectPropertyAddress address = {selector, kAudioObjectPropertyScopeGlobal, kAudioObjectPropertyElementMaster};
+    return (*gDriver)->SetPropertyData(gDriver, kObjectID_Device, 0, &address, 0, NULL, sizeof(value), &value);
+}
+
+static CFNumberRef CreateNumber(SInt32 number) {
+    return CFNumberCreate(NULL, kCFNumberSInt32Type, &number);
+}
+
+static CFDictionaryRef CreateConfiguration(std::vector<CFStringRef> keys, std::vector<CFTypeRef> values) {
+    return CFDictionaryCreate(NULL,
+                              (const void **)keys.data(),
+                              (const void **)values.data(),
+                              keys.size(),
+                              &kCFTypeDictionaryKeyCallBacks,
+                              &kCFTypeDictionaryValueCallBacks);
+}
+
+// The number for key in kProxyAudioDevicePropertyConfiguration's dictionary, or -1 if it isn't one
+static SInt32 ConfigurationNumber(CFStringRef key) {
+    CFDictionaryRef configuration = (CFDictionaryRef)CopyDeviceProperty(kProxyAudioDevicePropertyConfiguration);
+    CFTypeRef value = configuration ? CFDictionaryGetValue(configuration, key) : NULL;
+    SInt32 number = -1;
+
+    if (value && CFGetTypeID(value) == CFNumberGetTypeID()) {
+        CFNumberGetValue(CFNumberRef(value), kCFNumberSInt32Type, &number);
+    }
+
+    if (configuration) {
+        CFRelease(configuration);
+    }
+
+    return number;
+}
+
+// The configuration properties: each setting's own property and the whole dictionary show the
+// same values, a bad value is turned away, and a dictionary with anything bad in it changes nothing
+static void CheckConfiguration() {
+    CFStringRef bufferSizeKey = CFSTR("outputDeviceBufferFrameSize");
+    CFStringRef silenceKey = CFSTR("silenceStandbySeconds");
+    CFStringRef activeConditionKey = CFSTR("outputDeviceActiveCondition");
+
+    CFDictionaryRef configuration = (CFDictionaryRef)CopyDeviceProperty(kProxyAudioDevicePropertyConfiguration);
+    CHECK(configuration != NULL && CFGetTypeID(configuration) == CFDictionaryGetTypeID());
+    CHECK(configuration != NULL && CFDictionaryGetCount(configuration) == 8);
+
+    if (configuration) {
+        CFRelease(configuration);
+    }
+
+    CFNumberRef number256 = CreateNumber(256);
+    CFNumberRef number1024 = CreateNumber(1024);
+    CFNumberRef number2048 = CreateNumber(2048);
+    CFNumberRef number2 = CreateNumber(2);
+    CFNumberRef number60 = CreateNumber(60);
+    CFNumberRef number4000 = CreateNumber(4000);
+
+    CHECK_EQUAL(SetDeviceProperty(kProxyAudioDevicePropertyOutputDeviceBufferFrameSize, number256), 0);
+    CHECK_EQUAL(ConfigurationNumber(bufferSizeKey), 256);
+    CFNumberRef bufferSize = (CFNumberRef)CopyDeviceProperty(kProxyAudioDevicePropertyOutputDeviceBufferFrameSize);
+    CHECK(bufferSize != NULL && CFEqual(bufferSize, number256));
+
+    if (bufferSize) {
+        CFRelease(bufferSize);
+    }
+
+    // Too small, or not a number at all
+    CHECK_EQUAL(SetDeviceProperty(kProxyAudioDevicePropertyOutputDeviceBufferFrameSize, number2),
+                kAudioHardwareIllegalOperationError);
+    CHECK_EQUAL(SetDeviceProperty(kProxyAudioDevicePropertyOutputDeviceBufferFrameSize, CFSTR("256")),
+                kAudioHardwareIllegalOperationError);
+    CHECK_EQUAL(ConfigurationNumber(bufferSizeKey), 256);
+
+    // Only the settings in the dictionary change
+    SInt32 activeCondition = ConfigurationNumber(activeConditionKey);
+    CFDictionaryRef change = CreateConfiguration({bufferSizeKey, silenceKey}, {number1024, number60});
+    CHECK_EQUAL(SetDeviceProperty(kProxyAudioDevicePropertyConfiguration, change), 0);
+    CHECK_EQUAL(ConfigurationNumber(bufferSizeKey), 1024);
+    CHECK_EQUAL(ConfigurationNumber(silenceKey), 60);
+    CHECK_EQUAL(ConfigurationNumber(activeConditionKey), activeCondition);
+    CHECK(CFDictionaryGetValue(gStorage, silenceKey) != NULL);
+    CFRelease(change);
+
+    // An unknown key or a bad value anywhere in it means none of it is applied
+    CFDictionaryRef unknownKey = CreateConfiguration({bufferSizeKey, CFSTR("noSuchSetting")}, {number2048, number60});
+    CHECK_EQUAL(SetDeviceProperty(kProxyAudioDevicePropertyConfiguration, unknownKey),
+                kAudioHardwareIllegalOperationError);
+    CFDictionaryRef badValue = CreateConfiguration({bufferSizeKey, silenceKey}, {number2048, number4000});
+    CHECK_EQUAL(SetDeviceProperty(kProxyAudioDevicePropertyConfiguration, badValue),
+                kAudioHardwareIllegalOperationError);
+    CHECK_EQUAL(SetDeviceProperty(kProxyAudioDevicePropertyConfiguration, number2048),
+                kAudioHardwareIllegalOperationError);
+    CHECK_EQUAL(ConfigurationNumber(bufferSizeKey), 1024);
+    CHECK_EQUAL(ConfigurationNumber(silenceKey), 60);
+    CFRelease(unknownKey);
+    CFRelease(badValue);
+
+    for (CFNumberRef number : {number256, number1024, number2048, number2, number60, number4000}) {
+        CFRelease(number);
+    }
+}
+
+int main() {
+    gStorage = CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+
+    // The device is only published while the box is acquired
+    CFDictionarySetValue(gStorage, CFSTR("box acquired"), kCFBooleanTrue);
+    gDriver = (AudioServerPlugInDriverRef)ProxyAudio_Create(NULL, kAudioServerPlugInTypeUUID);
+    AudioServerPlugInHostRef host = &gHost;
+    CHECK(gDriver != NULL);
+    CHECK_EQUAL((*gDriver)->Initialize(gDriver, host), 0);
+
+    // Every object there is, found the way the HAL finds them
+    std::vector<AudioObjectID> objects = {kObjectID_PlugIn};
+
+    for (size_t index = 0; index < objects.size(); index++) {
+        for (AudioObjectID owned : OwnedObjects(objects[index])) {
+            objects.push_back(owned);
+        }
+    }
+
+    CHECK(objects.size() > 4);
+
+    for (AudioObjectID objectID : objects) {
+        CheckObject(objectID);
+    }
+
+    CheckTranslateUID(kAudioPlugInPropertyTranslateUIDToBox, CFSTR(kBox_UID), kObjectID_Box);
+    CheckTranslateUID(kAudioPlugInPropertyTranslateUIDToDevice, CFSTR(kDevice_UID), kObjectID_Device);
+    CheckConfiguration();
+
+    return TestResult();
+}
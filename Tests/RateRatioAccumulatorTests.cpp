@@ -0,0 +1,153 @@
+#include "RateRatioAccumulator.h"
+#include "SeqLockedValue.h"
+
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+#include "TestHarness.h"
+
+// The output IO proc adds a rate scalar every cycle while GetZeroTimeStamp collects their average,
+// and StartIO publishes the time line anchor GetZeroTimeStamp reads. These run the two sides on
+// threads of their own, as hard as they'll go.
+
+// The sum is kept to 32 fractional bits, and each sample is rounded to that
+static const Float64 kQuantum = 1.0 / 4294967296.0;
+
+static void TestAverage() {
+    RateRatioAccumulator accumulator;
+    CHECK(accumulator.CollectAverage() == 1.0);
+
+    for (int i = 0; i < 1000; i++) {
+        accumulator.AddSample(i % 2 ? 1.0001 : 0.9999);
+    }
+
+    CHECK(fabs(accumulator.CollectAverage() - 1.0) <= kQuantum);
+    CHECK(accumulator.CollectAverage() == 1.0);
+
+    // Nonsense scalars are ignored
+    accumulator.AddSample(0.0);
+    accumulator.AddSample(-1.0);
+    accumulator.AddSample(4.0);
+    accumulator.AddSample(NAN);
+    CHECK(accumulator.CollectAverage() == 1.0);
+
+    // Nothing overflows when nobody collects for a long time, samples past the limit are dropped
+    for (UInt32 i = 0; i < RateRatioAccumulator::kMaxSamples * 3; i++) {
+        accumulator.AddSample(3.9);
+    }
+
+    CHECK(fabs(accumulator.CollectAverage() - 3.9) <= kQuantum);
+
+    accumulator.AddSample(1.5);
+    accumulator.Reset();
+    CHECK(accumulator.CollectAverage() == 1.0);
+}
+
+static void TestConcurrentAverage() {
+    // The IO proc's scalars alternate between two values; since the count and the sum are taken
+    // together, every average collected has to lie between them
+    const Float64 low = 0.99995;
+    const Float64 high = 1.00013;
+    const UInt32 kSamples = 4000000;
+    const UInt32 kMinCollections = 1000;
+    RateRatioAccumulator accumulator;
+    std::atomic<bool> done(false);
+    UInt32 outOfRange = 0;
+    std::atomic<UInt32> collections(0);
+
+    std::thread collector([&] {
+        while (!done.load()) {
+            Float64 average = accumulator.CollectAverage();
+
+            if (average != 1.0) {
+                collections++;
+                outOfRange += (average < low - kQuantum || average > high + kQuantum);
+            }
+        }
+    });
+
+    // Until the collector has had a fair go at it as well
+    for (UInt32 i = 0; i < kSamples || collections.load() < kMinCollections; i++) {
+        accumulator.AddSample(i % 2 ? high : low);
+    }
+
+    done.store(true);
+    collector.join();
+    CHECK_EQUAL(outOfRange, 0u);
+
+    // And with a steady rate, the average is that rate every time, however the samples were split
+    // between collections. This is what keeps the zero time stamps from drifting away from the
+    // output device's clock.
+    const Float64 rate = 1.0000375;
+    accumulator.Reset();
+    done.store(false);
+    outOfRange = 0;
+    collections = 0;
+
+    std::thread steadyCollector([&] {
+        while (!done.load()) {
+            Float64 average = accumulator.CollectAverage();
+
+            if (average != 1.0) {
+                collections++;
+                outOfRange += (fabs(average - rate) > kQuantum);
+            }
+        }
+    });
+
+    for (UInt32 i = 0; i < kSamples || collections.load() < kMinCollections; i++) {
+        accumulator.AddSample(rate);
+    }
+
+    done.store(true);
+    steadyCollector.join();
+    CHECK_EQUAL(outOfRange, 0u);
+}
+
+struct Anchor {
+    UInt64 hostTime;
+    Float64 hostTicksPerFrame;
+    UInt32 generation;
+};
+
+static void TestConcurrentAnchor() {
+    // Every anchor is derived from its generation, so a reader can tell one that mixes two of them
+    SeqLockedValue<Anchor> anchor(Anchor{0, 0.0, 0});
+    std::atomic<bool> done(false);
+    UInt64 torn = 0;
+    std::atomic<UInt64> reads(0);
+    UInt32 lastGeneration = 0;
+    UInt32 backwards = 0;
+
+    std::thread reader([&] {
+        while (!done.load()) {
+            Anchor value = anchor.Load();
+            reads++;
+            torn += (value.hostTime != UInt64(value.generation) * 1000003 ||
+                     value.hostTicksPerFrame != value.generation * 0.5);
+            backwards += (value.generation < lastGeneration);
+            lastGeneration = value.generation;
+        }
+    });
+
+    UInt32 generation = 0;
+
+    while (generation < 3000000 || reads.load() < 100000) {
+        generation++;
+        anchor.Store(Anchor{UInt64(generation) * 1000003, generation * 0.5, generation});
+    }
+
+    done.store(true);
+    reader.join();
+    CHECK_EQUAL(torn, 0u);
+    CHECK_EQUAL(backwards, 0u);
+    CHECK_EQUAL(anchor.Load().generation, generation);
+}
+
+int main() {
+    TestAverage();
+    TestConcurrentAverage();
+    TestConcurrentAnchor();
+    return TestResult();
+}
@@ -0,0 +1,223 @@
+#include "RealtimeLog.h"
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <sys/syslog.h>
+#include <thread>
+#include <vector>
+
+#include "TestHarness.h"
+
+// The IO threads log through RealtimeLog while the audio output queue drains it. These check what
+// the drained messages come out as, that a full log drops messages and says how many, and that
+// with several threads logging as hard as they can while another drains, every message comes out
+// whole, once, and in the order its thread logged it.
+
+struct Message {
+    int priority;
+    std::string text;
+};
+
+// What the last Drain handed on. Only the draining thread touches it until it's been joined.
+static std::vector<Message> gMessages;
+
+static void CollectMessage(int priority, const char *message) {
+    gMessages.push_back({priority, message});
+}
+
+static std::vector<Message> Drain(RealtimeLog &log) {
+    gMessages.clear();
+    log.Drain(CollectMessage);
+    return gMessages;
+}
+
+// Drains the one message just logged
+static std::string Drained(RealtimeLog &log) {
+    std::vector<Message> messages = Drain(log);
+    CHECK_EQUAL(messages.size(), size_t(1));
+    return messages.empty() ? std::string() : messages[0].text;
+}
+
+enum class Mode { idle, running };
+
+static void TestFormat() {
+    RealtimeLog log;
+
+    // Every integer is widened to 64 bits, so the length modifiers don't matter
+    log.Log(LOG_NOTICE, "%d %d %u %hhd %ld %lld", SInt8(-5), SInt16(-300), UInt16(65535), 300, SInt32(-7), -8);
+    CHECK(Drained(log) == "-5 -300 65535 300 -7 -8");
+    log.Log(LOG_NOTICE, "%llu %u %d", UINT64_MAX, UInt32(4000000000u), INT64_MIN);
+    CHECK(Drained(log) == "18446744073709551615 4000000000 -9223372036854775808");
+    log.Log(LOG_NOTICE, "%x %08X %o %c %d", UInt32(0xdeadbeef), 0xabc, 8, 'A', Mode::running);
+    CHECK(Drained(log) == "deadbeef 00000ABC 10 A 1");
+
+    // Floating point values go through as doubles, and can be printed as integers and the other way
+    // round
+    log.Log(LOG_NOTICE, "%f %.2f %5.1f %d %g", 0.5f, 3.14159, -2.25, 2.75, 3);
+    CHECK(Drained(log) == "0.500000 3.14  -2.2 2 3");
+
+    // Strings are printed as they were passed, and anything else passed for one as (?)
+    static const char *const kNull = NULL;
+    log.Log(LOG_NOTICE, "%s|%-6s|%s|%s", "text", "left", kNull, 12);
+    CHECK(Drained(log) == "text|left  |(?)|(?)");
+
+    log.Log(LOG_NOTICE, "100%% of %d", 4);
+    CHECK(Drained(log) == "100% of 4");
+
+    // More conversions than arguments leaves the rest of the format as it is
+    log.Log(LOG_NOTICE, "%d and %5.1f and %s", 1);
+    CHECK(Drained(log) == "1 and %5.1f and %s");
+
+    // Each message keeps its own priority
+    log.Log(LOG_ERR, "error");
+    log.Log(LOG_DEBUG, "debug");
+    std::vector<Message> messages = Drain(log);
+    CHECK_EQUAL(messages.size(), size_t(2));
+    CHECK(messages.size() == 2 && messages[0].priority == LOG_ERR && messages[1].priority == LOG_DEBUG);
+}
+
+static void TestTruncation() {
+    RealtimeLog log;
+    static char longString[2000];
+    memset(longString, 'x', sizeof(longString) - 1);
+
+    // A message that doesn't fit is cut off at the end of Drain's buffer, whether it's the format
+    // or an argument that's too long, and wherever in the message that comes
+    log.Log(LOG_NOTICE, "start %s end", (const char *)longString);
+    std::string message = Drained(log);
+    CHECK_EQUAL(message.size(), size_t(511));
+    CHECK(message.compare(0, 6, "start ") == 0 && message.find_first_not_of('x', 6) == std::string::npos);
+
+    log.Log(LOG_NOTICE, "%s%d", (const char *)(longString + sizeof(longString) - 1 - 510), 123456);
+    message = Drained(log);
+    CHECK_EQUAL(message.size(), size_t(511));
+    CHECK(message.compare(509, 2, "x1") == 0);
+
+    log.Log(LOG_NOTICE, "%s%f", (const char *)(longString + sizeof(longString) - 1 - 511), 1.5);
+    CHECK_EQUAL(Drained(log).size(), size_t(511));
+
+    // The messages after it are unaffected
+    log.Log(LOG_NOTICE, "short %d", 1);
+    CHECK(Drained(log) == "short 1");
+}
+
+static void TestDroppedCount() {
+    RealtimeLog log;
+
+    // Nothing's been dropped, so nothing is reported
+    CHECK_EQUAL(Drain(log).size(), size_t(0));
+
+    for (UInt32 index = 0; index < RealtimeLog::kCapacity + 37; index++) {
+        log.Log(LOG_NOTICE, "message %u", index);
+    }
+
+    // The messages that fitted come out in order, followed by how many didn't
+    std::vector<Message> messages = Drain(log);
+    CHECK_EQUAL(messages.size(), size_t(RealtimeLog::kCapacity + 1));
+
+    for (UInt32 index = 0; index < RealtimeLog::kCapacity && index < messages.size(); index++) {
+        CHECK(messages[index].text == "message " + std::to_string(index));
+    }
+
+    CHECK(messages.back().priority == LOG_WARNING);
+    CHECK(messages.back().text == "ProxyAudio: real-time log was full, dropped 37 messages");
+
+    // Draining makes room again, and the count starts over
+    for (UInt32 index = 0; index < 3; index++) {
+        log.Log(LOG_NOTICE, "again %u", index);
+    }
+
+    messages = Drain(log);
+    CHECK_EQUAL(messages.size(), size_t(3));
+    CHECK(messages.size() == 3 && messages[2].text == "again 2");
+}
+
+static UInt64 Checksum(UInt32 writer, UInt64 index) {
+    return index * 2654435761u + writer;
+}
+
+// Each writer logs its messages numbered in order, with a checksum of the numbers in each, while
+// the drain runs as often as it can. Any message that comes out has to be whole, and each writer's
+// messages have to come out in order with none twice. Together with the drops the log reports,
+// that accounts for every message.
+static void TestConcurrentWriters() {
+    const UInt32 kWriters = 4;
+    const UInt32 kMessagesPerWriter = 200000;
+    RealtimeLog log;
+    std::atomic<UInt32> writersDone(0);
+    UInt64 torn = 0;
+    UInt64 outOfOrder = 0;
+    UInt64 received = 0;
+    UInt64 dropped = 0;
+    std::vector<SInt64> lastIndex(kWriters, -1);
+
+    // The output has to be a plain function, so the messages go through gMessages
+    std::thread drainer([&] {
+        for (bool finished = false; !finished;) {
+            finished = (writersDone.load() == kWriters);
+            gMessages.clear();
+            log.Drain(CollectMessage);
+
+            for (const Message &message : gMessages) {
+                unsigned long long count = 0;
+                unsigned writer = 0;
+                unsigned long long index = 0;
+                unsigned long long checksum = 0;
+
+                if (message.priority == LOG_WARNING &&
+                    sscanf(message.text.c_str(), "ProxyAudio: real-time log was full, dropped %llu messages", &count)
+                        == 1) {
+                    dropped += count;
+                } else if (sscanf(message.text.c_str(),
+                                  "writer %u message %llu checksum %llu",
+                                  &writer,
+                                  &index,
+                                  &checksum) != 3 ||
+                           writer >= kWriters || checksum != Checksum(writer, index)) {
+                    torn++;
+                } else {
+                    received++;
+                    outOfOrder += (SInt64(index) <= lastIndex[writer]);
+                    lastIndex[writer] = index;
+                }
+            }
+        }
+    });
+
+    std::vector<std::thread> writers;
+
+    for (UInt32 writer = 0; writer < kWriters; writer++) {
+        writers.emplace_back([&, writer] {
+            for (UInt64 index = 0; index < kMessagesPerWriter; index++) {
+                log.Log(LOG_NOTICE, "writer %u message %llu checksum %llu", writer, index, Checksum(writer, index));
+
+                // Now and then, so that the drain gets a go even with only one core
+                if (index % 64 == 0) {
+                    std::this_thread::yield();
+                }
+            }
+
+            writersDone++;
+        });
+    }
+
+    for (std::thread &writer : writers) {
+        writer.join();
+    }
+
+    drainer.join();
+    printf("%llu messages drained, %llu dropped\n", (unsigned long long)received, (unsigned long long)dropped);
+    CHECK_EQUAL(torn, 0u);
+    CHECK_EQUAL(outOfOrder, 0u);
+    CHECK_EQUAL(received + dropped, UInt64(kWriters) * kMessagesPerWriter);
+    CHECK(received >= RealtimeLog::kCapacity);
+}
+
+int main() {
+    TestFormat();
+    TestTruncation();
+    TestDroppedCount();
+    TestConcurrentWriters();
+    return TestResult();
+}
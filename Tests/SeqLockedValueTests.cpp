@@ -0,0 +1,152 @@
+#include "SeqLockedValue.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "TestHarness.h"
+
+// The control path publishes the IO thread's control state through a SeqLockedValue, with
+// stateMutex held, while the output IO procs read it every cycle. These store values as hard as
+// they'll go while several threads read them, and check that no reader ever sees a value that's
+// partly one store and partly another, or goes back to an older one.
+
+// Laid out like the proxy's ControlState, big enough that a store takes a while. Every field is
+// derived from the generation, so a reader can tell a torn value.
+struct State {
+    Float64 sampleRate;
+    UInt32 channelCount;
+    Float64 hostTicksPerFrame;
+    Float32 gains[32];
+    UInt32 generation;
+};
+
+static State MakeState(UInt32 generation) {
+    State state;
+    state.sampleRate = 44100.0 + generation;
+    state.channelCount = generation * 7;
+    state.hostTicksPerFrame = generation * 0.25;
+
+    for (UInt32 channel = 0; channel < 32; channel++) {
+        state.gains[channel] = Float32(generation % 4096 + channel);
+    }
+
+    state.generation = generation;
+    return state;
+}
+
+static bool IsWhole(const State &state) {
+    State expected = MakeState(state.generation);
+
+    for (UInt32 channel = 0; channel < 32; channel++) {
+        if (state.gains[channel] != expected.gains[channel]) {
+            return false;
+        }
+    }
+
+    return state.sampleRate == expected.sampleRate && state.channelCount == expected.channelCount &&
+           state.hostTicksPerFrame == expected.hostTicksPerFrame;
+}
+
+// Sizes that aren't a whole number of the words it's stored in
+struct ThreeBytes {
+    UInt8 bytes[3];
+};
+
+struct TwelveBytes {
+    UInt32 a;
+    Float32 b;
+    SInt32 c;
+};
+
+static void TestStoreAndLoad() {
+    SeqLockedValue<State> state(MakeState(1));
+    CHECK_EQUAL(state.Load().generation, 1u);
+    CHECK(IsWhole(state.Load()));
+
+    // Stores alternate between the slots, and the latest one is always what's read
+    for (UInt32 generation = 2; generation < 10; generation++) {
+        state.Store(MakeState(generation));
+        CHECK_EQUAL(state.Load().generation, generation);
+        CHECK(IsWhole(state.Load()));
+    }
+
+    SeqLockedValue<ThreeBytes> three(ThreeBytes{{1, 2, 3}});
+    CHECK(three.Load().bytes[0] == 1 && three.Load().bytes[1] == 2 && three.Load().bytes[2] == 3);
+    three.Store(ThreeBytes{{4, 5, 6}});
+    CHECK(three.Load().bytes[0] == 4 && three.Load().bytes[1] == 5 && three.Load().bytes[2] == 6);
+
+    SeqLockedValue<TwelveBytes> twelve;
+    CHECK(twelve.Load().a == 0 && twelve.Load().b == 0.0f && twelve.Load().c == 0);
+    twelve.Store(TwelveBytes{7, 0.5f, -9});
+    CHECK(twelve.Load().a == 7 && twelve.Load().b == 0.5f && twelve.Load().c == -9);
+}
+
+// writers threads take turns storing newer generations, serialized by a mutex the way stateMutex
+// serializes the control path, while kReaders threads read
+static void TestConcurrent(UInt32 writers) {
+    const UInt32 kReaders = 3;
+    const UInt32 kStores = 1000000;
+    const UInt64 kMinReads = 100000;
+    SeqLockedValue<State> state(MakeState(0));
+    std::mutex writeMutex;
+    UInt32 generation = 0;
+    std::atomic<bool> done(false);
+    std::atomic<UInt64> torn(0);
+    std::atomic<UInt64> backwards(0);
+    std::atomic<UInt64> reads(0);
+    std::vector<std::thread> threads;
+
+    for (UInt32 reader = 0; reader < kReaders; reader++) {
+        threads.emplace_back([&] {
+            UInt32 lastGeneration = 0;
+
+            while (!done.load()) {
+                State value = state.Load();
+                reads++;
+                torn += !IsWhole(value);
+                backwards += (value.generation < lastGeneration);
+                lastGeneration = value.generation;
+            }
+        });
+    }
+
+    std::vector<std::thread> writerThreads;
+
+    for (UInt32 writer = 0; writer < writers; writer++) {
+        writerThreads.emplace_back([&] {
+            for (UInt32 store = 0; store < kStores / writers || reads.load() < kMinReads; store++) {
+                std::lock_guard<std::mutex> lock(writeMutex);
+                state.Store(MakeState(++generation));
+            }
+        });
+    }
+
+    for (std::thread &writer : writerThreads) {
+        writer.join();
+    }
+
+    done.store(true);
+
+    for (std::thread &reader : threads) {
+        reader.join();
+    }
+
+    printf("%u writer(s), %u readers: %llu stores, %llu reads\n",
+           writers,
+           kReaders,
+           (unsigned long long)generation,
+           (unsigned long long)reads.load());
+    CHECK_EQUAL(torn.load(), 0u);
+    CHECK_EQUAL(backwards.load(), 0u);
+    CHECK_EQUAL(state.Load().generation, generation);
+    CHECK(IsWhole(state.Load()));
+}
+
+int main() {
+    TestStoreAndLoad();
+    TestConcurrent(1);
+    TestConcurrent(2);
+    return TestResult();
+}
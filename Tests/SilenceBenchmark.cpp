@@ -0,0 +1,136 @@
+#include "AdaptiveResampler.h"
+#include "AudioMixKernels.h"
+#include "AudioRingBuffer.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "TestHarness.h"
+
+// What an output cycle costs while the proxy device's clients are playing sound and while they're
+// only playing silence, with and without the silence path. Each call replays one cycle of the IO
+// procs with the real ring buffer, resampler and mix kernels: the input side checks the mix for
+// silence and stores it, a 512 frame cycle at a time, until the output side has what it needs, and
+// the output side reads it through the ring buffer's spans into the resampler, then resamples and
+// mixes it into the output device's buffer, which the HAL zeroes first. With the silence path, as
+// in WriteMix and outputDeviceIOProc, silent spans are pushed as silence and the resampler skips
+// whatever would only come out as silence. Without it, every cycle does all the work.
+//
+// The cost is also given as the share of one core it takes to keep up in real time. The benchmark
+// fails if the silence path doesn't make silent cycles cheaper.
+
+static const UInt32 kChannels = 2;
+static const UInt32 kInputCycleFrames = 512;
+static const UInt32 kOutputCycleFrames = 512;
+static const UInt32 kRingFrames = 88200;
+static const UInt32 kCushionFrames = 1024;
+
+class Cycle {
+  public:
+    Cycle(Float64 proxyRate, Float64 outputRate, bool audible, bool skipSilence)
+        : mRatio(proxyRate / outputRate * 1.0001),
+          mSkipSilence(skipSilence),
+          mRing(kChannels * sizeof(Float32), kRingFrames, AudioRingBuffer::AllocationMode::mirrored),
+          mResampler(kChannels, kOutputCycleFrames, mRatio),
+          mMix(kInputCycleFrames * kChannels, 0.0f),
+          mResampled(kOutputCycleFrames * kChannels),
+          mOutput(kOutputCycleFrames * kChannels) {
+        mResampler.SetNominalRatio(proxyRate / outputRate);
+
+        for (UInt32 frame = 0; audible && frame < kInputCycleFrames; frame++) {
+            mMix[frame * kChannels] = mMix[frame * kChannels + 1] = Float32(0.1 * sin(frame * 0.05));
+        }
+
+        for (UInt32 channel = 0; channel < kChannels; channel++) {
+            mGains[channel] = 0.5f;
+        }
+    }
+
+    void Run() {
+        UInt32 inputFrames = mResampler.InputFramesNeeded(kOutputCycleFrames, mRatio);
+
+        while (mStoredFrame < mReadFrame + inputFrames + kCushionFrames) {
+            bool silent = mSkipSilence && IsSilent(mMix.data(), kInputCycleFrames * kChannels);
+            mRing.Store((const Byte *)mMix.data(), kInputCycleFrames, mStoredFrame, silent);
+            mStoredFrame += kInputCycleFrames;
+        }
+
+        memset(mOutput.data(), 0, mOutput.size() * sizeof(Float32));
+
+        AudioRingBuffer::ReadSpans spans;
+        mRing.BeginRead(mReadFrame, inputFrames, spans);
+
+        if (mSkipSilence && mRing.SpansAreSilent(spans)) {
+            mResampler.PushSilence(inputFrames);
+        } else {
+            mResampler.PushSilence(spans.leadingZeroFrames);
+
+            for (int span = 0; span < 2 && spans.frames[span] > 0; span++) {
+                mResampler.PushInput((const Float32 *)spans.data[span], spans.frames[span]);
+            }
+
+            mResampler.PushSilence(spans.trailingZeroFrames);
+        }
+
+        mRing.EndRead(spans);
+        mReadFrame += inputFrames;
+
+        if (mSkipSilence && mResampler.IsSilent()) {
+            mResampler.Skip(kOutputCycleFrames, mRatio);
+        } else {
+            mResampler.Process(mResampled.data(), kOutputCycleFrames, mRatio);
+            MixInterleavedWithGain(
+                mResampled.data(), kChannels, mOutput.data(), kChannels, kOutputCycleFrames, mGains);
+        }
+    }
+
+  private:
+    Float64 mRatio;
+    bool mSkipSilence;
+    AudioRingBuffer mRing;
+    AdaptiveResampler mResampler;
+    std::vector<Float32> mMix;
+    std::vector<Float32> mResampled;
+    std::vector<Float32> mOutput;
+    Float32 mGains[kChannels];
+    SInt64 mStoredFrame = 0;
+    SInt64 mReadFrame = 0;
+};
+
+static double TimeCycle(Float64 proxyRate, Float64 outputRate, bool audible, bool skipSilence) {
+    Cycle cycle(proxyRate, outputRate, audible, skipSilence);
+    double seconds = TestHarness::TimePerCall([&] { cycle.Run(); });
+
+    printf("%6.0f -> %6.0f Hz  %-7s  %-20s %8.2f us per cycle  %6.3f%% of a core\n",
+           proxyRate,
+           outputRate,
+           audible ? "audible" : "silent",
+           skipSilence ? "with silence path" : "without",
+           seconds * 1e6,
+           seconds * outputRate / kOutputCycleFrames * 100);
+    return seconds;
+}
+
+int main() {
+    const Float64 rates[][2] = {
+        {44100, 48000},
+        {48000, 48000},
+        {48000, 44100},
+    };
+    bool slower = false;
+
+    for (const Float64 *rate : rates) {
+        TimeCycle(rate[0], rate[1], true, false);
+        TimeCycle(rate[0], rate[1], true, true);
+        double silentWithout = TimeCycle(rate[0], rate[1], false, false);
+        double silentWith = TimeCycle(rate[0], rate[1], false, true);
+
+        if (silentWith >= silentWithout) {
+            printf("SLOWER: the silence path doesn't make silent cycles any cheaper\n");
+            slower = true;
+        }
+    }
+
+    return slower ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+#ifndef __TestHarness_h__
+#define __TestHarness_h__
+
+#include <chrono>
+#include <cstdio>
+
+// Just enough for the tests in this directory, each of which is a plain executable. A failed check
+// is reported with its file and line and the test carries on; main returns TestResult(), which
+// exits with a failure status if any check failed.
+namespace TestHarness {
+inline int &Failures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline int Result(const char *name) {
+    if (Failures() != 0) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, Failures());
+        return 1;
+    }
+
+    printf("%s: passed\n", name);
+    return 0;
+}
+
+// Seconds per call of body, timed over enough calls to take about 100 ms
+template <typename Body>
+double TimePerCall(Body body) {
+    using Clock = std::chrono::steady_clock;
+    long calls = 1;
+
+    for (;;) {
+        Clock::time_point start = Clock::now();
+
+        for (long call = 0; call < calls; call++) {
+            body();
+        }
+
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        if (seconds >= 0.1) {
+            return seconds / calls;
+        }
+
+        calls *= 2;
+    }
+}
+} // namespace TestHarness
+
+#define CHECK(condition)                                                                                  \
+    do {                                                                                                  \
+        if (!(condition)) {                                                                               \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);                 \
+            TestHarness::Failures()++;                                                                    \
+        }                                                                                                 \
+    } while (0)
+
+#define CHECK_EQUAL(actual, expected)                                                                     \
+    do {                                                                                                  \
+        auto actualValue = (actual);                                                                      \
+        auto expectedValue = (expected);                                                                  \
+        if (!(actualValue == expectedValue)) {                                                            \
+            fprintf(stderr,                                                                               \
+                    "%s:%d: check failed: %s == %s (%lld != %lld)\n",                                     \
+                    __FILE__,                                                                             \
+                    __LINE__,                                                                             \
+                    #actual,                                                                              \
+                    #expected,                                                                            \
+                    (long long)actualValue,                                                               \
+                    (long long)expectedValue);                                                            \
+            TestHarness::Failures()++;                                                                    \
+        }                                                                                                 \
+    } while (0)
+
+#define TestResult() TestHarness::Result(__FILE__)
+
+#endif // __TestHarness_h__
@@ -0,0 +1,181 @@
+#include "UserActivitySchedule.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "TestHarness.h"
+
+// Drives monitorUserActivity's schedule with a simulated user and counts how often its timer fires
+// while the user is active, while they're idle, and how long it takes to notice them coming back
+// or going idle, against the fixed 500 ms timer the driver used to have. Each check reads the
+// user's idle time the way getUserIdleTimeInterval does, and the timer fires somewhere within its
+// leeway after it's due, as the system is allowed to.
+
+static const Float64 kBaselineInterval = 0.5;
+static const Float64 kBaselineLeeway = 0.02;
+
+// Someone who does something at each of the times in events, in order, and nothing in between
+struct User {
+    std::vector<Float64> events;
+
+    Float64 IdleTime(Float64 now) const {
+        auto next = std::upper_bound(events.begin(), events.end(), now);
+        return (next == events.begin()) ? now : now - *(next - 1);
+    }
+};
+
+struct Check {
+    Float64 time;
+    bool userActive;
+};
+
+// The checks over the first seconds seconds, the first one as the timer is set up
+static std::vector<Check> Simulate(const User &user, Float64 seconds, bool adaptive) {
+    std::vector<Check> checks;
+    UInt32 random = 1;
+
+    for (Float64 now = 0; now < seconds;) {
+        Float64 idleTime = user.IdleTime(now);
+        checks.push_back({now, idleTime < UserActivitySchedule::kUserIdleThreshold});
+
+        Float64 next = adaptive ? UserActivitySchedule::NextCheck(true, idleTime) : kBaselineInterval;
+        Float64 leeway = adaptive ? UserActivitySchedule::Leeway(next) : kBaselineLeeway;
+        random = random * 1664525 + 1013904223;
+        now += next + leeway * (random >> 8) / Float64(1 << 24);
+    }
+
+    return checks;
+}
+
+static Float64 ChecksPerMinute(const std::vector<Check> &checks, Float64 from, Float64 to) {
+    size_t count = std::count_if(
+        checks.begin(), checks.end(), [&](const Check &check) { return check.time >= from && check.time < to; });
+    return count / (to - from) * 60;
+}
+
+// How long after time the first check saw the user as active, or as idle
+static Float64 TimeToNotice(const std::vector<Check> &checks, Float64 time, bool userActive) {
+    for (const Check &check : checks) {
+        if (check.time >= time && check.userActive == userActive) {
+            return check.time - time;
+        }
+    }
+
+    return INFINITY;
+}
+
+static const char *ScheduleName(bool adaptive) {
+    return adaptive ? "adaptive" : "every 500 ms";
+}
+
+// Someone at the machine, doing something every few seconds for ten minutes
+static Float64 TestActive(bool adaptive) {
+    User user;
+
+    for (Float64 time = 0; time < 600; time += 3) {
+        user.events.push_back(time);
+    }
+
+    Float64 rate = ChecksPerMinute(Simulate(user, 600, adaptive), 0, 600);
+    printf("%-12s  active:  %6.1f checks a minute\n", ScheduleName(adaptive), rate);
+    return rate;
+}
+
+// Nobody there for ten minutes, after they were
+static Float64 TestIdle(bool adaptive) {
+    User user;
+    user.events.push_back(0);
+    Float64 idleFrom = UserActivitySchedule::kUserIdleThreshold;
+
+    std::vector<Check> checks = Simulate(user, 660, adaptive);
+    Float64 rate = ChecksPerMinute(checks, idleFrom + 60, 660);
+    printf("%-12s  idle:    %6.1f checks a minute\n", ScheduleName(adaptive), rate);
+
+    CHECK(!checks.back().userActive);
+    return rate;
+}
+
+// Someone coming back after being away, or leaving after being there, at a spread of times in
+// between checks. Returns the longest it took to notice.
+static Float64 TestReturnAndLeave(bool adaptive, Float64 &outLongestToLeave) {
+    Float64 longestToReturn = 0;
+    Float64 totalToReturn = 0;
+    Float64 longestToLeave = 0;
+    const int trials = 200;
+
+    for (int trial = 0; trial < trials; trial++) {
+        Float64 returnTime = 100 + trial * 0.0373;
+        User user;
+        user.events = {0, returnTime};
+
+        for (Float64 time = returnTime; time < returnTime + 60; time += 7) {
+            user.events.push_back(time);
+        }
+
+        std::vector<Check> checks = Simulate(user, 300, adaptive);
+        Float64 toReturn = TimeToNotice(checks, returnTime, true);
+        Float64 leaveTime = user.events.back() + UserActivitySchedule::kUserIdleThreshold;
+        Float64 toLeave = TimeToNotice(checks, leaveTime, false);
+
+        longestToReturn = std::max(longestToReturn, toReturn);
+        totalToReturn += toReturn;
+        longestToLeave = std::max(longestToLeave, toLeave);
+    }
+
+    printf("%-12s  return:  %6.2f s to notice on average, %5.2f s at most; leaving noticed within %5.2f s\n",
+           ScheduleName(adaptive),
+           totalToReturn / trials,
+           longestToReturn,
+           longestToLeave);
+    outLongestToLeave = longestToLeave;
+    return longestToReturn;
+}
+
+static void TestSchedules() {
+    Float64 baselineActive = TestActive(false);
+    Float64 baselineIdle = TestIdle(false);
+    Float64 baselineToLeave = 0;
+    Float64 baselineToReturn = TestReturnAndLeave(false, baselineToLeave);
+
+    Float64 active = TestActive(true);
+    Float64 idle = TestIdle(true);
+    Float64 toLeave = 0;
+    Float64 toReturn = TestReturnAndLeave(true, toLeave);
+
+    CHECK(baselineActive > 115 && baselineIdle > 115);
+    CHECK(baselineToReturn <= kBaselineInterval + kBaselineLeeway);
+    CHECK(baselineToLeave <= kBaselineInterval + kBaselineLeeway);
+
+    // Once every threshold while active, and every idle check interval while idle
+    CHECK(active <= 60 / (UserActivitySchedule::kUserIdleThreshold - 3) + 0.1);
+    CHECK(idle <= 60 / UserActivitySchedule::kIdleCheckInterval);
+    CHECK(idle > 60 / (UserActivitySchedule::kIdleCheckInterval * 1.1) - 0.1);
+
+    // Coming back is noticed up to an idle check interval late, and leaving no later than the
+    // threshold's leeway, where the old timer noticed both within half a second
+    const Float64 idleCheckLeeway = UserActivitySchedule::Leeway(UserActivitySchedule::kIdleCheckInterval);
+    CHECK(toReturn <= UserActivitySchedule::kIdleCheckInterval + idleCheckLeeway);
+    CHECK(toReturn > UserActivitySchedule::kIdleCheckInterval * 0.9);
+    CHECK(toLeave <= UserActivitySchedule::Leeway(UserActivitySchedule::kUserIdleThreshold));
+}
+
+static void TestUserIgnored() {
+    CHECK_EQUAL(UserActivitySchedule::NextCheck(false, 0), UserActivitySchedule::kUserIgnoredCheckInterval);
+    CHECK_EQUAL(UserActivitySchedule::NextCheck(false, 100), UserActivitySchedule::kUserIgnoredCheckInterval);
+}
+
+static void TestNextCheckBy() {
+    // A sooner deadline brings the check forward, but never to less than the minimum interval
+    CHECK_EQUAL(UserActivitySchedule::NextCheckBy(30, 10), 10);
+    CHECK_EQUAL(UserActivitySchedule::NextCheckBy(5, 10), 5);
+    CHECK_EQUAL(UserActivitySchedule::NextCheckBy(5, -3), UserActivitySchedule::kMinCheckInterval);
+    CHECK_EQUAL(UserActivitySchedule::NextCheck(true, 29.9), UserActivitySchedule::kMinCheckInterval);
+}
+
+int main() {
+    TestSchedules();
+    TestUserIgnored();
+    TestNextCheckBy();
+    return TestResult();
+}